@@ -0,0 +1,211 @@
+// airframe.cxx - a lightweight airframe model for exercising the
+//                autopilot offline
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "airframe.hxx"
+
+
+#define SG_DEGREES_TO_RADIANS 0.0174532925199433
+#define SG_RADIANS_TO_DEGREES 57.2957795130823
+#define SG_KT_TO_FPS          1.68780986
+#define SG_GRAVITY_FPS2       32.174
+
+
+static inline double clamp( double val, double min, double max ) {
+    if ( val < min ) return min;
+    if ( val > max ) return max;
+    return val;
+}
+
+
+static void get_coef( SGPropertyNode *config, const char *name,
+                      double *value )
+{
+    SGPropertyNode *node = config->getChild( name );
+    if ( node != NULL ) {
+        *value = node->getDoubleValue();
+    }
+}
+
+
+SimpleAirframe::SimpleAirframe() :
+    trim_airspeed( 30.0 ),
+    trim_pitch( 2.0 ),
+    roll_damping( 6.0 ),
+    aileron_power( 600.0 ),
+    rudder_roll_power( 250.0 ),
+    pitch_damping( 5.0 ),
+    pitch_stiffness( 20.0 ),
+    elevator_power( 500.0 ),
+    thrust_power( 8.0 ),
+    trim_throttle( 0.6 ),
+    drag( 0.15 ),
+    servo_tau( 0.05 ),
+    turb_roll( 0.0 ),
+    turb_pitch( 0.0 )
+{
+    reset( 0.0, trim_pitch, trim_airspeed, 500.0, 0.0, 1 );
+}
+
+
+void SimpleAirframe::configure( SGPropertyNode *config ) {
+    if ( config == NULL ) {
+        return;
+    }
+    get_coef( config, "trim-airspeed-kt", &trim_airspeed );
+    get_coef( config, "trim-pitch-deg", &trim_pitch );
+    get_coef( config, "roll-damping", &roll_damping );
+    get_coef( config, "aileron-power", &aileron_power );
+    get_coef( config, "rudder-roll-power", &rudder_roll_power );
+    get_coef( config, "pitch-damping", &pitch_damping );
+    get_coef( config, "pitch-stiffness", &pitch_stiffness );
+    get_coef( config, "elevator-power", &elevator_power );
+    get_coef( config, "thrust-power", &thrust_power );
+    get_coef( config, "trim-throttle", &trim_throttle );
+    get_coef( config, "drag", &drag );
+    get_coef( config, "servo-tau-sec", &servo_tau );
+}
+
+
+void SimpleAirframe::bind( SGPropertyNode *root ) {
+    aileron_node = root->getNode( "/controls/flight/aileron", true );
+    elevator_node = root->getNode( "/controls/flight/elevator", true );
+    rudder_node = root->getNode( "/controls/flight/rudder", true );
+    throttle_node = root->getNode( "/engines/engine[0]/throttle", true );
+
+    roll_node = root->getNode( "/orientation/roll-deg", true );
+    pitch_node = root->getNode( "/orientation/pitch-deg", true );
+    heading_node = root->getNode( "/orientation/heading-deg", true );
+    track_node = root->getNode( "/orientation/groundtrack-deg", true );
+    airspeed_node = root->getNode( "/velocities/airspeed-kt", true );
+    climb_node = root->getNode( "/velocities/vertical-speed-fps", true );
+    altitude_node = root->getNode( "/position/altitude-ft", true );
+    agl_node = root->getNode( "/position/altitude-agl-ft", true );
+
+    throttle_node->setDoubleValue( trim_throttle );
+}
+
+
+void SimpleAirframe::reset( double roll_deg, double pitch_deg,
+                            double airspeed_kt, double altitude_ft,
+                            double heading_deg, unsigned int seed )
+{
+    roll = roll_deg;
+    pitch = pitch_deg;
+    heading = heading_deg;
+    p = q = 0.0;
+    airspeed = airspeed_kt;
+    altitude = altitude_ft;
+    climb = 0.0;
+    aileron = elevator = rudder = 0.0;
+    throttle = trim_throttle;
+    gust_roll = gust_pitch = 0.0;
+    rand_state = seed;
+}
+
+
+void SimpleAirframe::set_turbulence( double roll_rms, double pitch_rms ) {
+    turb_roll = roll_rms;
+    turb_pitch = pitch_rms;
+}
+
+
+// standard normal deviate (Box-Muller), rand_r() keeps the stream
+// private to this instance
+double SimpleAirframe::gaussian() {
+    double u1 = (rand_r( &rand_state ) + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand_r( &rand_state ) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt( -2.0 * log( u1 ) ) * cos( 2.0 * M_PI * u2 );
+}
+
+
+void SimpleAirframe::update( double dt ) {
+    if ( dt <= 0.0 ) {
+        return;
+    }
+
+    // servos
+    double lag = clamp( dt / servo_tau, 0.0, 1.0 );
+    aileron += (clamp( aileron_node->getDoubleValue(), -1.0, 1.0 ) - aileron)
+        * lag;
+    elevator += (clamp( elevator_node->getDoubleValue(), -1.0, 1.0 )
+                 - elevator) * lag;
+    rudder += (clamp( rudder_node->getDoubleValue(), -1.0, 1.0 ) - rudder)
+        * lag;
+    throttle += (clamp( throttle_node->getDoubleValue(), 0.0, 1.0 )
+                 - throttle) * lag;
+
+    // turbulence as first order Gauss-Markov processes (0.5 sec)
+    double a = exp( -dt / 0.5 );
+    double b = sqrt( 1.0 - a * a );
+    if ( turb_roll > 0.0 ) {
+        gust_roll = a * gust_roll + b * turb_roll * gaussian();
+    }
+    if ( turb_pitch > 0.0 ) {
+        gust_pitch = a * gust_pitch + b * turb_pitch * gaussian();
+    }
+
+    // control power and stability scale with dynamic pressure
+    double qbar = (airspeed / trim_airspeed) * (airspeed / trim_airspeed);
+
+    double p_dot = -roll_damping * p
+        + qbar * (aileron_power * aileron + rudder_roll_power * rudder)
+        + gust_roll;
+    double q_dot = -pitch_damping * q
+        - qbar * pitch_stiffness * (pitch - trim_pitch)
+        - qbar * elevator_power * elevator
+        + gust_pitch;
+
+    p += p_dot * dt;
+    q += q_dot * dt;
+    roll = clamp( roll + p * dt, -180.0, 180.0 );
+    pitch = clamp( pitch + q * dt, -90.0, 90.0 );
+
+    // point mass path, flight path angle taken as pitch above trim
+    double gamma = (pitch - trim_pitch) * SG_DEGREES_TO_RADIANS;
+    double v_dot = thrust_power * (throttle - trim_throttle)
+        - drag * (airspeed - trim_airspeed)
+        - SG_GRAVITY_FPS2 / SG_KT_TO_FPS * sin( gamma );
+    airspeed += v_dot * dt;
+    if ( airspeed < 1.0 ) {
+        airspeed = 1.0;
+    }
+
+    double v_fps = airspeed * SG_KT_TO_FPS;
+    climb = v_fps * sin( gamma );
+    altitude += climb * dt;
+
+    // coordinated turn
+    double bank = clamp( roll, -85.0, 85.0 ) * SG_DEGREES_TO_RADIANS;
+    heading += SG_GRAVITY_FPS2 * tan( bank ) / v_fps
+        * SG_RADIANS_TO_DEGREES * dt;
+    heading = fmod( heading, 360.0 );
+    if ( heading < 0.0 ) {
+        heading += 360.0;
+    }
+
+    roll_node->setDoubleValue( roll );
+    pitch_node->setDoubleValue( pitch );
+    heading_node->setDoubleValue( heading );
+    track_node->setDoubleValue( heading );
+    airspeed_node->setDoubleValue( airspeed );
+    climb_node->setDoubleValue( climb );
+    altitude_node->setDoubleValue( altitude );
+    agl_node->setDoubleValue( altitude );
+}
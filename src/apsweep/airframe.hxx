@@ -0,0 +1,112 @@
+// airframe.hxx - a lightweight airframe model for exercising the
+//                autopilot offline
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#ifndef _AIRFRAME_HXX
+#define _AIRFRAME_HXX 1
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <props/props.hxx>
+
+
+/**
+ * Point mass airframe with second order roll and pitch dynamics.
+ *
+ * Reads /controls/flight/{aileron,elevator,rudder} and
+ * /engines/engine[0]/throttle and publishes the /orientation,
+ * /velocities and /position values the autopilot configurations use.
+ * Controls follow the FlightGear sign conventions (positive elevator
+ * pitches the nose down); a negative power coefficient models a
+ * reversed servo.  Control power scales with dynamic pressure.
+ *
+ * All nodes are resolved against the root passed to bind() so each
+ * instance can own a private property tree.
+ */
+
+class SimpleAirframe {
+
+public:
+
+    SimpleAirframe();
+    ~SimpleAirframe() {}
+
+    // override the default coefficients from an <airframe> node
+    void configure( SGPropertyNode *config );
+
+    // resolve input and output nodes under root
+    void bind( SGPropertyNode *root );
+
+    // set the initial state and turbulence random seed
+    void reset( double roll_deg, double pitch_deg, double airspeed_kt,
+                double altitude_ft, double heading_deg, unsigned int seed );
+
+    // set the rms turbulence induced angular acceleration (deg/s^2)
+    void set_turbulence( double roll, double pitch );
+
+    void update( double dt );
+
+private:
+
+    double gaussian();
+
+    // coefficients
+    double trim_airspeed;       // kt
+    double trim_pitch;          // deg, level flight at trim speed
+    double roll_damping;        // 1/s
+    double aileron_power;       // deg/s^2 per unit aileron
+    double rudder_roll_power;   // deg/s^2 per unit rudder
+    double pitch_damping;       // 1/s
+    double pitch_stiffness;     // 1/s^2
+    double elevator_power;      // deg/s^2 per unit elevator
+    double thrust_power;        // kt/s per unit throttle above trim
+    double trim_throttle;
+    double drag;                // 1/s
+    double servo_tau;           // s, first order servo lag
+
+    // state
+    double roll, pitch, heading;        // deg
+    double p, q;                        // deg/s
+    double airspeed;                    // kt
+    double altitude;                    // ft
+    double climb;                       // fps
+    double aileron, elevator, rudder, throttle;
+    double gust_roll, gust_pitch;       // filtered turbulence
+    double turb_roll, turb_pitch;       // rms turbulence
+    unsigned int rand_state;
+
+    // inputs
+    SGPropertyNode_ptr aileron_node;
+    SGPropertyNode_ptr elevator_node;
+    SGPropertyNode_ptr rudder_node;
+    SGPropertyNode_ptr throttle_node;
+
+    // outputs
+    SGPropertyNode_ptr roll_node;
+    SGPropertyNode_ptr pitch_node;
+    SGPropertyNode_ptr heading_node;
+    SGPropertyNode_ptr track_node;
+    SGPropertyNode_ptr airspeed_node;
+    SGPropertyNode_ptr climb_node;
+    SGPropertyNode_ptr altitude_node;
+    SGPropertyNode_ptr agl_node;
+};
+
+
+#endif // _AIRFRAME_HXX
@@ -0,0 +1,373 @@
+// apsweep.cxx - Monte Carlo gain sweep of the XML autopilot against a
+//               simple airframe model
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <control/xmlauto.hxx>
+#include <props/props.hxx>
+#include <props/props_io.hxx>
+#include <util/exception.hxx>
+#include <util/sg_atomic.hxx>
+#include <util/sg_path.hxx>
+
+#include "airframe.hxx"
+
+using std::string;
+using std::vector;
+
+
+// The autopilot components resolve their nodes through the global
+// property root (props) while they are built.  Each run owns a private
+// tree, so construction swaps the global root under this lock; once
+// built, a run only touches its own nodes and needs no locking.
+static pthread_mutex_t props_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+struct gain_def {
+    string name;
+    string path;                // relative to the autopilot config
+    double min;
+    double max;
+};
+
+struct metric_def {
+    string name;
+    string input;
+    string reference;           // property, or empty to use value
+    double value;
+};
+
+struct sweep_config {
+    SGPropertyNode_ptr autopilot;       // autopilot configuration
+    SGPropertyNode_ptr init;            // initial property values
+    SGPropertyNode_ptr airframe;        // model coefficients
+    vector <gain_def> gains;
+    vector <metric_def> metrics;
+    int runs;
+    unsigned int seed;
+    double duration;
+    double rate;
+    double initial_roll;
+    double initial_pitch;
+    double airspeed;
+    double turb_roll;
+    double turb_pitch;
+};
+
+static sweep_config cfg;
+
+// results, one row per run: gains followed by rms, max, final per metric
+static vector <double> results;
+static int columns;
+static SGAtomic<int> next_run( 0 );
+
+
+static double get_wall_time() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static double uniform( unsigned int *state ) {
+    return rand_r( state ) / (RAND_MAX + 1.0);
+}
+
+
+static double get_double( SGPropertyNode *node, const char *name,
+                          double def )
+{
+    SGPropertyNode *child = node->getChild( name );
+    return child != NULL ? child->getDoubleValue() : def;
+}
+
+
+static void usage( char *prog ) {
+    printf("Usage: %s [ --threads <n> ] <sweep.xml>\n", prog);
+    printf("\n");
+    printf("Runs the autopilot named in the sweep file against a simple\n");
+    printf("airframe model for each randomly drawn gain set and writes\n");
+    printf("one CSV row of tracking metrics per run to stdout.\n");
+    exit(0);
+}
+
+
+static bool load_config( const char *file ) {
+    SGPropertyNode_ptr root = new SGPropertyNode;
+    SGPath path( file );
+
+    try {
+        readProperties( path.str(), root );
+    } catch (const sg_exception& exc) {
+        fprintf(stderr, "Failed to load sweep configuration: %s\n", file);
+        return false;
+    }
+
+    SGPropertyNode *ap_path = root->getChild( "autopilot" );
+    if ( ap_path == NULL ) {
+        fprintf(stderr, "No <autopilot> specified in %s\n", file);
+        return false;
+    }
+    SGPath ap_file( path.dir() );
+    ap_file.append( ap_path->getStringValue() );
+    cfg.autopilot = new SGPropertyNode;
+    try {
+        readProperties( ap_file.str(), cfg.autopilot );
+    } catch (const sg_exception& exc) {
+        fprintf(stderr, "Failed to load autopilot configuration: %s\n",
+                ap_file.c_str());
+        return false;
+    }
+
+    cfg.init = root->getChild( "init" );
+    if ( cfg.init == NULL ) {
+        cfg.init = new SGPropertyNode;
+    }
+    cfg.airframe = root->getChild( "airframe" );
+
+    cfg.runs = (int)get_double( root, "runs", 100 );
+    cfg.seed = (unsigned int)get_double( root, "seed", 1 );
+    cfg.duration = get_double( root, "duration-sec", 30.0 );
+    cfg.rate = get_double( root, "rate-hz", 25.0 );
+
+    SGPropertyNode *dist = root->getChild( "disturbance" );
+    if ( dist == NULL ) {
+        dist = root->getNode( "disturbance", true );
+    }
+    cfg.initial_roll = get_double( dist, "initial-roll-deg", 0.0 );
+    cfg.initial_pitch = get_double( dist, "initial-pitch-deg", 0.0 );
+    cfg.airspeed = get_double( dist, "airspeed-kt", 30.0 );
+    cfg.turb_roll = get_double( dist, "turbulence-roll", 0.0 );
+    cfg.turb_pitch = get_double( dist, "turbulence-pitch", 0.0 );
+
+    int i;
+    for ( i = 0; i < root->nChildren(); ++i ) {
+        SGPropertyNode *child = root->getChild(i);
+        string cname = child->getName();
+        if ( cname == "gain" ) {
+            gain_def g;
+            g.path = child->getStringValue( "path" );
+            g.name = child->getStringValue( "name", g.path.c_str() );
+            g.min = get_double( child, "min", 0.0 );
+            g.max = get_double( child, "max", 0.0 );
+            if ( g.path.empty() ) {
+                fprintf(stderr, "<gain> needs a <path>\n");
+                return false;
+            }
+            cfg.gains.push_back( g );
+        } else if ( cname == "metric" ) {
+            metric_def m;
+            m.name = child->getStringValue( "name", "metric" );
+            m.input = child->getStringValue( "input" );
+            m.reference = child->getStringValue( "reference" );
+            m.value = get_double( child, "value", 0.0 );
+            if ( m.input.empty() ) {
+                fprintf(stderr, "<metric> needs an <input>\n");
+                return false;
+            }
+            cfg.metrics.push_back( m );
+        }
+    }
+
+    if ( cfg.runs < 1 || cfg.rate <= 0.0 || cfg.duration <= 0.0 ) {
+        fprintf(stderr, "Nothing to do\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Fly one run.  The worker's own copies of the shared configuration
+ * are passed in so the shared trees are never read concurrently.
+ */
+
+static void fly( int run, SGPropertyNode *ap_template,
+                 SGPropertyNode *init_template )
+{
+    double *row = &results[run * columns];
+    unsigned int rng = cfg.seed * 2654435761u + run;
+
+    SGPropertyNode_ptr root = new SGPropertyNode;
+    copyProperties( init_template, root );
+
+    SGPropertyNode *ap_config = root->getNode( "/autopilot/new-config", true );
+    copyProperties( ap_template, ap_config );
+
+    unsigned int i;
+    for ( i = 0; i < cfg.gains.size(); ++i ) {
+        const gain_def &g = cfg.gains[i];
+        double value = g.min + uniform( &rng ) * (g.max - g.min);
+        ap_config->getNode( g.path.c_str(), true )->setDoubleValue( value );
+        row[i] = value;
+    }
+
+    FGXMLAutopilot *ap = new FGXMLAutopilot;
+    pthread_mutex_lock( &props_lock );
+    props = root;
+    ap->bind();
+    ap->build();
+    props = NULL;
+    pthread_mutex_unlock( &props_lock );
+
+    SimpleAirframe model;
+    model.configure( cfg.airframe );
+    model.bind( root );
+    model.reset( (2.0 * uniform( &rng ) - 1.0) * cfg.initial_roll,
+                 (2.0 * uniform( &rng ) - 1.0) * cfg.initial_pitch,
+                 cfg.airspeed, 500.0, 360.0 * uniform( &rng ), rng );
+    model.set_turbulence( cfg.turb_roll, cfg.turb_pitch );
+
+    unsigned int nm = cfg.metrics.size();
+    vector <SGPropertyNode *> inputs( nm );
+    vector <SGPropertyNode *> refs( nm, (SGPropertyNode *)NULL );
+    vector <double> sum_sq( nm, 0.0 );
+    vector <double> max_err( nm, 0.0 );
+    vector <double> final_sum( nm, 0.0 );
+    for ( i = 0; i < nm; ++i ) {
+        inputs[i] = root->getNode( cfg.metrics[i].input.c_str(), true );
+        if ( !cfg.metrics[i].reference.empty() ) {
+            refs[i] = root->getNode( cfg.metrics[i].reference.c_str(), true );
+        }
+    }
+
+    double dt = 1.0 / cfg.rate;
+    int steps = (int)(cfg.duration * cfg.rate + 0.5);
+    int final_start = steps - steps / 10;  // last 10% of the run
+    int n;
+    for ( n = 0; n < steps; ++n ) {
+        model.update( dt );
+        ap->update( dt );
+
+        for ( i = 0; i < nm; ++i ) {
+            double ref = refs[i] != NULL ? refs[i]->getDoubleValue()
+                : cfg.metrics[i].value;
+            double err = fabs( inputs[i]->getDoubleValue() - ref );
+            sum_sq[i] += err * err;
+            if ( err > max_err[i] ) {
+                max_err[i] = err;
+            }
+            if ( n >= final_start ) {
+                final_sum[i] += err;
+            }
+        }
+    }
+
+    double *m = row + cfg.gains.size();
+    for ( i = 0; i < nm; ++i ) {
+        m[3 * i] = sqrt( sum_sq[i] / steps );
+        m[3 * i + 1] = max_err[i];
+        m[3 * i + 2] = final_sum[i] / (steps - final_start);
+    }
+
+    delete ap;
+}
+
+
+static void *worker( void * ) {
+    // private copies of the shared configuration, reading a value
+    // may format into the node's internal buffer
+    pthread_mutex_lock( &props_lock );
+    SGPropertyNode_ptr ap_template = new SGPropertyNode;
+    SGPropertyNode_ptr init_template = new SGPropertyNode;
+    copyProperties( cfg.autopilot, ap_template );
+    copyProperties( cfg.init, init_template );
+    pthread_mutex_unlock( &props_lock );
+
+    int run;
+    while ( (run = next_run.fetch_add( 1 )) < cfg.runs ) {
+        fly( run, ap_template, init_template );
+    }
+
+    return NULL;
+}
+
+
+int main( int argc, char **argv ) {
+    int threads = sysconf( _SC_NPROCESSORS_ONLN );
+    const char *file = NULL;
+
+    int i;
+    for ( i = 1; i < argc; ++i ) {
+        if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc ) {
+            threads = atoi( argv[++i] );
+        } else if ( strcmp( argv[i], "--help" ) == 0 ) {
+            usage( argv[0] );
+        } else {
+            file = argv[i];
+        }
+    }
+    if ( file == NULL ) {
+        usage( argv[0] );
+    }
+    if ( threads < 1 ) {
+        threads = 1;
+    }
+
+    if ( ! load_config( file ) ) {
+        exit(-1);
+    }
+
+    columns = cfg.gains.size() + 3 * cfg.metrics.size();
+    results.resize( cfg.runs * columns, 0.0 );
+
+    double start = get_wall_time();
+
+    vector <pthread_t> pool( threads );
+    for ( i = 0; i < threads; ++i ) {
+        pthread_create( &pool[i], NULL, worker, NULL );
+    }
+    for ( i = 0; i < threads; ++i ) {
+        pthread_join( pool[i], NULL );
+    }
+
+    double elapsed = get_wall_time() - start;
+
+    // CSV report
+    unsigned int j;
+    printf("run");
+    for ( j = 0; j < cfg.gains.size(); ++j ) {
+        printf(",%s", cfg.gains[j].name.c_str());
+    }
+    for ( j = 0; j < cfg.metrics.size(); ++j ) {
+        const char *name = cfg.metrics[j].name.c_str();
+        printf(",%s_rms,%s_max,%s_final", name, name, name);
+    }
+    printf("\n");
+    for ( i = 0; i < cfg.runs; ++i ) {
+        printf("%d", i);
+        for ( j = 0; j < (unsigned int)columns; ++j ) {
+            printf(",%.6g", results[i * columns + j]);
+        }
+        printf("\n");
+    }
+
+    fprintf(stderr, "%d runs on %d threads in %.2f sec (%.0f runs/min)\n",
+            cfg.runs, threads, elapsed, cfg.runs * 60.0 / elapsed);
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "include/props_schema.h"
+#include "control/route_mgr.hxx"
+#include "navigation/mnav.h"
+#include "props/props.hxx"
+#include "util/sg_atomic.hxx"
+#include "util/timing.h"
+
+#include "blackbox.h"
+#include "flightlog.h"
+#include "logging.h"
+
+using std::string;
+using std::vector;
+
+
+// The main loop is the only writer of the ring.  Each frame is
+// marked unfinished (seq 0) while it is filled in, so the snapshot,
+// which copies the ring while the main loop goes on recording, can
+// tell the frames it copied whole from the ones it caught half
+// written or overwritten.
+
+#define HEADER_BYTES 4096
+
+static const flightlog_field_def frame_fields[] = {
+    LOG_FIELD( blackbox_frame, seq, LOG_UINT32, "" ),
+    LOG_FIELD( blackbox_frame, flags, LOG_UINT32, "" ),
+    LOG_FIELD( blackbox_frame, time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( blackbox_frame, imu.time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( blackbox_frame, imu.p, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( blackbox_frame, imu.q, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( blackbox_frame, imu.r, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( blackbox_frame, imu.ax, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( blackbox_frame, imu.ay, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( blackbox_frame, imu.az, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( blackbox_frame, imu.hx, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( blackbox_frame, imu.hy, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( blackbox_frame, imu.hz, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( blackbox_frame, imu.Ps, LOG_DOUBLE, "m" ),
+    LOG_FIELD( blackbox_frame, imu.Pt, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, imu.phi, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( blackbox_frame, imu.the, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( blackbox_frame, imu.psi, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( blackbox_frame, imu.err_type, LOG_UINT64, "" ),
+    LOG_FIELD( blackbox_frame, gps.time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( blackbox_frame, gps.lat, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, gps.lon, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, gps.alt, LOG_DOUBLE, "m" ),
+    LOG_FIELD( blackbox_frame, gps.ve, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, gps.vn, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, gps.vd, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, gps.ITOW, LOG_DOUBLE, "s" ),
+    LOG_FIELD( blackbox_frame, gps.err_type, LOG_UINT64, "" ),
+    LOG_FIELD( blackbox_frame, nav.time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( blackbox_frame, nav.lat, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, nav.lon, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, nav.alt, LOG_DOUBLE, "m" ),
+    LOG_FIELD( blackbox_frame, nav.ve, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, nav.vn, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, nav.vd, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( blackbox_frame, nav.err_type, LOG_UINT64, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 0, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 1, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 2, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 3, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 4, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 5, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 6, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_in.chn, 7, LOG_UINT16, "" ),
+    LOG_FIELD( blackbox_frame, servo_in.status, LOG_UINT64, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 0, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 1, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 2, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 3, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 4, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 5, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 6, LOG_UINT16, "" ),
+    LOG_ELEMENT( blackbox_frame, servo_out.chn, 7, LOG_UINT16, "" ),
+    LOG_FIELD( blackbox_frame, target_roll_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, target_heading_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, target_pitch_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( blackbox_frame, target_climb_fps, LOG_DOUBLE, "ft/s" ),
+    LOG_FIELD( blackbox_frame, target_altitude_ft, LOG_DOUBLE, "ft" ),
+    LOG_FIELD( blackbox_frame, heading_error_deg, LOG_DOUBLE, "deg" )
+};
+
+static int fd = -1;
+static uint8_t *map = NULL;
+static size_t map_bytes = 0;
+static blackbox_header *header = NULL;
+static blackbox_frame *ring = NULL;
+static uint32_t slots = 0;
+
+static SGPath box_file;
+static double post_sec = 10.0;  // snapshot this long after the request
+static double sync_sec = 1.0;
+static int max_snapshots = 20;  // bbNNNNN directories kept
+
+static SGAtomic<bool> snapshot_request( false );
+static double snapshot_time = 0.0;
+static char snapshot_reason[48];
+
+// A snapshot saved by the black box thread is noted in the event log
+// by the main loop, the only thread that may queue events: saved_num
+// is the snapshot number, or -1 once the main loop has taken it.
+static SGAtomic<int> saved_num( -1 );
+static char saved_reason[48];
+
+static pthread_t sync_thread;
+static SGAtomic<bool> sync_running( false );
+
+static SGTypedProperty<double> ap_roll;
+static SGTypedProperty<double> ap_hdg;
+static SGTypedProperty<double> ap_pitch;
+static SGTypedProperty<double> ap_climb;
+static SGTypedProperty<double> ap_altitude;
+static SGTypedProperty<double> ap_hdg_error;
+
+
+// the numbers of the bbNNNNN directories in the log directory, sorted
+static vector<int> snapshot_dirs() {
+    vector<int> nums;
+    DIR *d = opendir( log_path.c_str() );
+    if ( d == NULL ) {
+        return nums;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        int num;
+        if ( sscanf( entry->d_name, "bb%d", &num ) == 1 ) {
+            nums.push_back( num );
+        }
+    }
+    closedir( d );
+    sort( nums.begin(), nums.end() );
+    return nums;
+}
+
+
+// remove a snapshot directory and the files in it
+static void remove_dir( const char *dir ) {
+    DIR *d = opendir( dir );
+    if ( d != NULL ) {
+        struct dirent *entry;
+        while ( (entry = readdir( d )) != NULL ) {
+            if ( entry->d_name[0] != '.' ) {
+                string file = string( dir ) + "/" + entry->d_name;
+                unlink( file.c_str() );
+            }
+        }
+        closedir( d );
+    }
+    rmdir( dir );
+}
+
+
+// Save the frames of a ring (a copy, or the mapping of the last run),
+// oldest first, as a flight log in a new snapshot directory.  Only
+// the frames numbered first to last are wanted, and only those found
+// whole.  Returns the snapshot number, or -1.
+static int snapshot_write( const uint8_t *frames, uint32_t count,
+                           uint32_t first, uint32_t last,
+                           const char *reason )
+{
+    vector<int> nums = snapshot_dirs();
+    int num = nums.empty() ? 0 : nums.back() + 1;
+    char dir[256];
+    snprintf( dir, 256, "%s/bb%05d", log_path.c_str(), num );
+    if ( mkdir( dir, 0755 ) != 0 ) {
+        printf("Cannot create %s\n", dir);
+        return -1;
+    }
+
+    FlightLogWriter log;
+    string file = string( dir ) + "/flight-0000.log";
+    if ( log.add_stream( "blackbox", sizeof(struct blackbox_frame),
+                         frame_fields,
+                         sizeof(frame_fields) / sizeof(frame_fields[0]) ) < 0
+         || !log.open( file.c_str() ) )
+    {
+        printf("Cannot create %s\n", file.c_str());
+        return -1;
+    }
+
+    int saved = 0;
+    for ( uint32_t seq = first; seq != last + 1; seq++ ) {
+        const blackbox_frame *f = (const blackbox_frame *)
+            (frames + ((seq - 1) % count) * sizeof(struct blackbox_frame));
+        if ( f->seq == seq ) {
+            log.write( 0, f );
+            saved++;
+        }
+    }
+    bool result = log.close();
+
+    printf("Black box: %d frames saved in %s (%s)\n", saved, dir, reason);
+    if ( !result ) {
+        return -1;
+    }
+
+    // keep the newest max_snapshots
+    nums.push_back( num );
+    for ( int i = 0; i < (int)nums.size() - max_snapshots; i++ ) {
+        snprintf( dir, 256, "%s/bb%05d", log_path.c_str(), nums[i] );
+        remove_dir( dir );
+    }
+
+    return num;
+}
+
+
+// snapshot the ring while the main loop keeps recording
+static void snapshot_take( const char *reason ) {
+    size_t bytes = slots * sizeof(struct blackbox_frame);
+    uint8_t *copy = (uint8_t *)malloc( bytes );
+    if ( copy == NULL ) {
+        return;
+    }
+
+    uint32_t last = sg_load( &header->frames, SG_ACQUIRE );
+    memcpy( copy, ring, bytes );
+    sg_fence( SG_ACQUIRE );     // frames before the count after
+    uint32_t now = sg_load( &header->frames, SG_RELAXED );
+
+    // frames after last are newer than the snapshot; the oldest
+    // frames may have been reused while they were copied
+    uint32_t first = 1;
+    if ( now + 1 > slots ) {
+        first = now + 2 - slots;
+    }
+    if ( last >= first ) {
+        int num = snapshot_write( copy, slots, first, last, reason );
+        if ( num >= 0 && saved_num.load() < 0 ) {
+            snprintf( saved_reason, sizeof(saved_reason), "%s", reason );
+            saved_num.store( num );
+        }
+    }
+
+    free( copy );
+}
+
+
+// the black box thread: sync the mapping once a second and take the
+// snapshots asked for
+static void *blackbox_sync( void * ) {
+    double last_sync = 0.0;
+    while ( sync_running ) {
+        double now = get_Time();
+        // the request is loaded before its time and reason
+        if ( snapshot_request && now >= snapshot_time ) {
+            snapshot_take( snapshot_reason );
+            snapshot_request = false;
+        }
+        if ( now >= last_sync + sync_sec ) {
+            msync( map, map_bytes, MS_SYNC );
+            last_sync = now;
+        }
+        usleep( 100000 );
+    }
+
+    msync( map, map_bytes, MS_SYNC );
+    return NULL;
+}
+
+
+// save the frames left in the black box file by the last run
+static void blackbox_recover() {
+    int old = open( box_file.c_str(), O_RDONLY );
+    if ( old < 0 ) {
+        return;
+    }
+
+    struct stat st;
+    blackbox_header h;
+    if ( fstat( old, &st ) == 0
+         && read( old, &h, sizeof(h) ) == (ssize_t)sizeof(h)
+         && memcmp( h.magic, "UGBB", 4 ) == 0
+         && h.version == BLACKBOX_VERSION
+         && h.frame_size == sizeof(struct blackbox_frame)
+         && h.slots > 0 && h.frames > 0
+         && (off_t)(HEADER_BYTES + (off_t)h.slots * h.frame_size)
+            <= st.st_size )
+    {
+        size_t bytes = (size_t)h.slots * h.frame_size;
+        void *m = mmap( NULL, HEADER_BYTES + bytes, PROT_READ, MAP_SHARED,
+                        old, 0 );
+        if ( m != MAP_FAILED ) {
+            uint32_t first = h.frames >= h.slots ? h.frames - h.slots + 1 : 1;
+            snapshot_write( (const uint8_t *)m + HEADER_BYTES, h.slots,
+                            first, h.frames, "last run" );
+            munmap( m, HEADER_BYTES + bytes );
+        }
+    }
+
+    close( old );
+}
+
+
+bool blackbox_init() {
+    SGPropertyNode *config = fgGetNode("/config/blackbox", true);
+    if ( !config->getBoolValue("enable", true) ) {
+        return false;
+    }
+    if ( log_path.str().empty() ) {
+        printf("Black box: no log path, disabled\n");
+        return false;
+    }
+    double seconds = config->getDoubleValue("seconds", 120.0);
+    post_sec = config->getDoubleValue("post-sec", 10.0);
+    sync_sec = config->getDoubleValue("sync-sec", 1.0);
+    max_snapshots = config->getIntValue("snapshots", 20);
+
+    ap_roll.bind( AUTOPILOT_INTERNAL_TARGET_ROLL_DEG );
+    ap_hdg.bind( AUTOPILOT_SETTINGS_TRUE_HEADING_DEG );
+    ap_pitch.bind( AUTOPILOT_SETTINGS_TARGET_PITCH_DEG );
+    ap_climb.bind( AUTOPILOT_INTERNAL_TARGET_CLIMB_RATE_FPS );
+    ap_altitude.bind( AUTOPILOT_SETTINGS_TARGET_ALTITUDE_FT );
+    ap_hdg_error.bind( AUTOPILOT_INTERNAL_TRUE_HEADING_ERROR_DEG );
+
+    box_file = log_path;
+    box_file.append( "blackbox.bin" );
+    blackbox_recover();
+
+    slots = (uint32_t)(seconds * BLACKBOX_HZ);
+    if ( slots < BLACKBOX_HZ ) {
+        slots = BLACKBOX_HZ;
+    }
+    map_bytes = HEADER_BYTES + (size_t)slots * sizeof(struct blackbox_frame);
+
+    fd = open( box_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 || ftruncate( fd, map_bytes ) != 0 ) {
+        printf("Cannot create %s\n", box_file.c_str());
+        blackbox_close();
+        return false;
+    }
+    void *m = mmap( NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0 );
+    if ( m == MAP_FAILED ) {
+        printf("Cannot map %s\n", box_file.c_str());
+        blackbox_close();
+        return false;
+    }
+    map = (uint8_t *)m;
+
+    // allocate and touch every page now, and keep them in memory, so
+    // recording never waits on a page fault that reads the disk
+    memset( map, 0, map_bytes );
+    mlock( map, map_bytes );
+
+    header = (blackbox_header *)map;
+    ring = (blackbox_frame *)(map + HEADER_BYTES);
+    memcpy( header->magic, "UGBB", 4 );
+    header->version = BLACKBOX_VERSION;
+    header->frame_size = sizeof(struct blackbox_frame);
+    header->slots = slots;
+    header->frames = 0;
+    msync( map, map_bytes, MS_SYNC );
+
+    sync_running = true;
+    if ( pthread_create( &sync_thread, NULL, blackbox_sync, NULL ) != 0 ) {
+        printf("Cannot start the black box thread\n");
+        sync_running = false;
+        blackbox_close();
+        return false;
+    }
+
+    printf("Black box: last %.0f seconds in %s\n", seconds,
+           box_file.c_str());
+    return true;
+}
+
+
+void blackbox_update( double current_time ) {
+    if ( ring == NULL ) {
+        return;
+    }
+
+    int num = saved_num.load();
+    if ( num >= 0 ) {
+        log_event( EVENT_NOTE, EVENT_INFO, num, "black box bb%05d: %s",
+                   num, saved_reason );
+        saved_num.store( -1 );
+    }
+
+    uint32_t seq = header->frames + 1;
+    blackbox_frame *f = &ring[(seq - 1) % slots];
+    sg_store( &f->seq, (uint32_t)0, SG_RELAXED );
+    sg_fence( SG_RELEASE );     // marked unfinished before it changes
+
+    f->flags = 0;
+    if ( autopilot_active ) {
+        f->flags |= BLACKBOX_AUTOPILOT;
+    }
+    if ( route_mgr.get_route_mode() == FGRouteMgr::GoHome ) {
+        f->flags |= BLACKBOX_GO_HOME;
+    }
+    f->time = current_time;
+    f->imu = imupacket;
+    f->gps = gpspacket;
+    f->nav = navpacket;
+    f->servo_in = servo_in;
+    f->servo_out = servo_out;
+    f->target_roll_deg = ap_roll.get();
+    f->target_heading_deg = ap_hdg.get();
+    f->target_pitch_deg = ap_pitch.get();
+    f->target_climb_fps = ap_climb.get();
+    f->target_altitude_ft = ap_altitude.get();
+    f->heading_error_deg = ap_hdg_error.get();
+
+    sg_store( &f->seq, seq, SG_RELEASE );  // the frame before its number
+    sg_store( &header->frames, seq, SG_RELEASE );
+}
+
+
+void blackbox_snapshot( const char *reason ) {
+    if ( !sync_running || snapshot_request ) {
+        return;
+    }
+
+    snprintf( snapshot_reason, sizeof(snapshot_reason), "%s", reason );
+    snapshot_time = get_Time() + post_sec;
+    snapshot_request.store( true, SG_RELEASE );  // after its reason
+}
+
+
+void blackbox_close() {
+    if ( sync_running ) {
+        sync_running = false;
+        pthread_join( sync_thread, NULL );
+    }
+
+    if ( map != NULL ) {
+        munmap( map, map_bytes );
+        map = NULL;
+        header = NULL;
+        ring = NULL;
+    }
+    if ( fd >= 0 ) {
+        close( fd );
+        fd = -1;
+    }
+}
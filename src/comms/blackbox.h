@@ -0,0 +1,83 @@
+// blackbox.h - the black box recorder
+//
+// The black box holds the last seconds (120 by default) of every
+// main loop frame: the imu, gps, nav and servo packets, the autopilot
+// targets and the modes, at the full 50 hz, whether or not data
+// logging is enabled.  The frames are stored straight into a ring in
+// a shared mapping of blackbox.bin in the log directory, so
+// recording one costs a few hundred bytes of copying and no system
+// call, and what was recorded survives a crash of the program.  A
+// thread of its own syncs the mapping to the disk about once a
+// second.
+//
+// A snapshot saves the ring, in order, as a flight log (see
+// flightlog.h) of one stream, "blackbox", in a new bbNNNNN directory
+// of the log directory, which the decoder reads like a flight.  A
+// snapshot is taken a few seconds after a mode change, a console link
+// loss or an autopilot disengage (see log_event()), so it covers the
+// time both before and after it, and at startup, of the ring left by
+// the last run.
+//
+// File layout: a 4096 byte header page, struct blackbox_header, then
+// the ring of struct blackbox_frame.
+
+
+#ifndef _UGEAR_BLACKBOX_H
+#define _UGEAR_BLACKBOX_H
+
+
+#include <stdint.h>
+
+#include "globaldefs.h"
+
+
+#define BLACKBOX_VERSION 1
+#define BLACKBOX_HZ 50          // main loop frames per second
+
+struct blackbox_header {
+    char magic[4];              // "UGBB"
+    uint16_t version;
+    uint16_t frame_size;
+    uint32_t slots;             // frames in the ring
+    uint32_t frames;            // frames recorded
+};
+
+// flags
+#define BLACKBOX_AUTOPILOT 1    // autopilot engaged
+#define BLACKBOX_GO_HOME 2      // route manager in GoHome mode
+
+struct blackbox_frame {
+    uint32_t seq;               // frame number from 1; 0 while written
+    uint32_t flags;
+    double time;
+    struct imu imu;
+    struct gps gps;
+    struct nav nav;
+    struct servo servo_in;
+    struct servo servo_out;
+    double target_roll_deg;
+    double target_heading_deg;
+    double target_pitch_deg;
+    double target_climb_fps;
+    double target_altitude_ft;
+    double heading_error_deg;
+};
+
+
+// map the black box (reading /config/blackbox), after saving the
+// frames of the last run.  Returns false if it is disabled or cannot
+// be set up.
+bool blackbox_init();
+
+// record this frame; called once per main loop frame
+void blackbox_update( double current_time );
+
+// ask for a snapshot (reason is a short note for the console and the
+// event log).  A request while one is waiting is merged with it.
+void blackbox_snapshot( const char *reason );
+
+// sync and unmap
+void blackbox_close();
+
+
+#endif // _UGEAR_BLACKBOX_H
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <map>
 #include <string>
 
 #include "checksum.h"
@@ -11,10 +12,14 @@
 
 #include <control/route_mgr.hxx>
 #include <health/health.h>
+#include <props/props.hxx>
+#include <props/props_binary.hxx>
 #include <util/strutils.hxx>
 
 #include "console_link.h"
+#include "logging.h"
 
+using std::map;
 using std::string;
 
 // global variables
@@ -243,6 +248,74 @@ void console_link_health( struct health *healthpacket ) {
 }
 
 
+static void console_link_packet( uint8_t id, uint8_t *payload, uint8_t size ) {
+    uint8_t buf[3];
+    uint8_t cksum0, cksum1;
+
+    // start of message sync bytes
+    buf[0] = START_OF_MSG0; buf[1] = START_OF_MSG1; buf[2] = 0;
+    console_write( buf, 2 );
+
+    // packet id and size (1 byte each)
+    buf[0] = id; buf[1] = size; buf[2] = 0;
+    console_write( buf, 2 );
+
+    // packet data
+    console_write( payload, size );
+
+    // check sum (2 bytes)
+    ugear_cksum( id, size, payload, size, &cksum0, &cksum1 );
+    buf[0] = cksum0; buf[1] = cksum1; buf[2] = 0;
+    console_write( buf, 2 );
+}
+
+
+// send a property subtree to the ground station in the binary
+// property format (props_binary.hxx), split into PROPS_PACKETs of
+// [part number][part count][message bytes].  With delta set only the
+// changes since the last send of the same path go out; the ground
+// station asks for one only when it holds that previous copy.
+static void console_link_props( const string &path, bool delta ) {
+    static map<string, SGPropertyNode_ptr> sent;
+
+    SGPropertyNode *node = fgGetNode( path.c_str() );
+    if ( node == NULL ) {
+        return;
+    }
+
+    SGPropertyNode_ptr &reference = sent[path];
+    if ( !delta || reference == NULL ) {
+        reference = new SGPropertyNode;
+        delta = false;
+    }
+
+    string message;
+    writeBinaryProperties( message, node, delta ? (SGPropertyNode *)reference : NULL );
+    int parts = (message.size() + MAX_PROPS_PART - 1) / MAX_PROPS_PART;
+    if ( parts > 255 ) {
+        printf("Property subtree %s too large to send (%d bytes)\n",
+               path.c_str(), (int)message.size());
+        return;
+    }
+
+    uint8_t buf[MAX_PROPS_PART + 2];
+    for ( int i = 0; i < parts; i++ ) {
+        int offset = i * MAX_PROPS_PART;
+        int size = message.size() - offset;
+        if ( size > MAX_PROPS_PART ) {
+            size = MAX_PROPS_PART;
+        }
+        buf[0] = i;
+        buf[1] = parts;
+        memcpy( buf + 2, message.data() + offset, size );
+        console_link_packet( PROPS_PACKET, buf, size + 2 );
+    }
+
+    // keep the receiver's view for the next delta
+    readBinaryProperties( message.data(), message.size(), reference );
+}
+
+
 static void console_link_execute_command( const string command ) {
     vector <string> token = split( command, "," );
 
@@ -278,10 +351,15 @@ static void console_link_execute_command( const string command ) {
         // specify an autopilot target
         if ( token[1] == "alt" ) {
             double alt = atof( token[2].c_str() );
-            SGPropertyNode_ptr target_altitude_ft
-                = fgGetNode( "/autopilot/settings/target-altitude-ft", true );
-            target_altitude_ft->setDoubleValue( alt );
+            static SGPropertyPath target_altitude_ft
+                = "/autopilot/settings/target-altitude-ft";
+            fgGetNode( target_altitude_ft, true )->setDoubleValue( alt );
         }
+    } else if ( token[0] == "get" && token.size() >= 2 ) {
+        // send a property subtree, optionally as a delta against the
+        // previous send
+        bool delta = ( token.size() == 3 && token[2] == "delta" );
+        console_link_props( token[1], delta );
     } else if ( token[0] == "wp" && token.size() == 5 ) {
         // specify new waypoint coordinates for a waypoint
         int index = atoi( token[1].c_str() );
@@ -380,9 +458,7 @@ bool console_link_command() {
          || nmea_sum.c_str()[1] != cmd_sum[1])
     {
         // checksum failure
-        // debug = fopen("/tmp/debug.txt", "a");
-        // fprintf(debug, "check sum failure\n");
-        // fclose(debug);
+        log_event( EVENT_CHECKSUM, EVENT_WARNING, 0, "%s", cmd.c_str() );
         return false;
     }
 
@@ -393,10 +469,6 @@ bool console_link_command() {
         return false;
     }
 
-    FILE *debug = fopen("/mnt/mmc/debug.txt", "a");
-    fprintf(debug, "command: %s\n", cmd.c_str());
-    fclose(debug);
-
     // extract command sequence number
     string num = cmd.substr(0, pos);
     int sequence = atoi( num.c_str() );
@@ -404,10 +476,10 @@ bool console_link_command() {
     // remainder
     cmd = cmd.substr(pos + 1);
 
-    // execute command
-    // debug = fopen("/tmp/debug.txt", "a");
-    // fprintf(debug, "Sequence: %d  Execute: '%s'\n", sequence, cmd.c_str());
-    // fclose(debug);
+    // execute command (heart beats are only of interest when
+    // debugging the link)
+    log_event( EVENT_COMMAND, cmd == "hb" ? EVENT_DEBUG : EVENT_INFO,
+               sequence, "%s", cmd.c_str() );
     console_link_execute_command( cmd );
 
     // register that we've received this message correctly
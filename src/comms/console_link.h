@@ -10,9 +10,13 @@ enum ugPacketType {
     IMU_PACKET = 1,
     NAV_PACKET = 2,
     SERVO_PACKET = 3,
-    HEALTH_PACKET = 4
+    HEALTH_PACKET = 4,
+    PROPS_PACKET = 5
 };
 
+// message bytes per PROPS_PACKET
+#define MAX_PROPS_PART 200
+
 extern bool console_link_on;
 #define MAX_CONSOLE_DEV 64
 extern char console_dev[MAX_CONSOLE_DEV];
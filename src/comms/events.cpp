@@ -0,0 +1,66 @@
+// events.cpp - reading the flight event log
+//
+// See events.h for the file layout.
+
+
+#include <stdio.h>
+
+#include "events.h"
+#include "flightlog.h"
+
+
+static uint16_t swap16( uint16_t x ) {
+    return (x >> 8) | (x << 8);
+}
+
+
+bool events_read( const char *file, vector<event_record> *events ) {
+    events->clear();
+
+    FILE *f = fopen( file, "rb" );
+    if ( f == NULL ) {
+        return false;
+    }
+
+    uint8_t header[8];
+    uint16_t version, size;
+    if ( fread( header, 8, 1, f ) != 1 || memcmp( header, "UGEV", 4 ) != 0 ) {
+        fclose( f );
+        return false;
+    }
+    memcpy( &version, header + 4, 2 );
+    memcpy( &size, header + 6, 2 );
+    bool swap = false;
+    if ( swap16( version ) == EVENTS_VERSION ) {
+        swap = true;
+        version = swap16( version );
+        size = swap16( size );
+    }
+    if ( version != EVENTS_VERSION || size != sizeof(struct event_record) ) {
+        fclose( f );
+        return false;
+    }
+
+    // (a crash can leave a partly written record at the end)
+    struct event_record e;
+    while ( fread( &e, sizeof(e), 1, f ) == 1 ) {
+        if ( swap ) {
+            uint64_t bits;
+            memcpy( &bits, &e.time, 8 );
+            bits = __builtin_bswap64( bits );
+            memcpy( &e.time, &bits, 8 );
+            e.flags = swap16( e.flags );
+            e.arg = (int32_t)__builtin_bswap32( (uint32_t)e.arg );
+        }
+        if ( ((e.flags & EVENT_DOUBLE_WORDS_SWAPPED) != 0)
+             != (LOG_DOUBLE_WORDS_SWAPPED != 0) )
+        {
+            log_swap_double_words( (uint8_t *)&e.time );
+        }
+        e.text[sizeof(e.text) - 1] = 0;
+        events->push_back( e );
+    }
+
+    fclose( f );
+    return true;
+}
@@ -0,0 +1,98 @@
+// events.h - the flight event log
+//
+// Things that happen now and then (a mode change, a command from the
+// ground station, a new home location, a bad checksum) are logged as
+// fixed size event records rather than as lines of text appended to
+// a file.  log_event() (see logging.h) only copies the record into a
+// ring; the log writer thread appends it to events.log in the
+// flight's log directory.  Without a flight log (logging off) the
+// event is printed to the console instead.  The dump tool (events)
+// prints the file as text.
+//
+// File layout:
+//
+//   header   "UGEV" u16 version  u16 record size
+//   records  struct event_record, in the writer's byte order (the
+//            version tells the reader which that was); the flags say
+//            whether time is in the ARM FPA double layout
+
+
+#ifndef _UGEAR_EVENTS_H
+#define _UGEAR_EVENTS_H
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+using std::vector;
+
+
+#define EVENTS_VERSION 1
+
+// event_record.flags: time has its 32-bit halves swapped (ARM FPA)
+#define EVENT_DOUBLE_WORDS_SWAPPED 0x0001
+
+enum event_type {
+    EVENT_NOTE = 0,             // free text
+    EVENT_MODE,                 // route mode change, arg = the new mode
+    EVENT_COMMAND,              // ground station command, arg = sequence
+    EVENT_HOME,                 // home location update
+    EVENT_CHECKSUM,             // command with a bad checksum
+    EVENT_LINK,                 // console link lost
+    EVENT_AUTOPILOT,            // arg = 1 engaged, 0 manual override
+    NUM_EVENT_TYPES
+};
+
+enum event_severity {
+    EVENT_DEBUG = 0,
+    EVENT_INFO,
+    EVENT_WARNING,
+    EVENT_ALERT,
+    NUM_EVENT_SEVERITIES
+};
+
+// 64 bytes, no padding
+struct event_record {
+    double time;
+    uint8_t type;               // event_type
+    uint8_t severity;           // event_severity
+    uint16_t flags;             // EVENT_DOUBLE_WORDS_SWAPPED
+    int32_t arg;
+    char text[48];              // nul terminated
+};
+
+
+inline const char *event_type_name( int type ) {
+    static const char *names[NUM_EVENT_TYPES] = {
+        "note", "mode", "command", "home", "checksum", "link", "autopilot"
+    };
+    return type >= 0 && type < NUM_EVENT_TYPES ? names[type] : "?";
+}
+
+inline const char *event_severity_name( int severity ) {
+    static const char *names[NUM_EVENT_SEVERITIES] = {
+        "debug", "info", "warning", "alert"
+    };
+    return severity >= 0 && severity < NUM_EVENT_SEVERITIES
+        ? names[severity] : "?";
+}
+
+// the severity with the given name, or -1
+inline int event_severity_value( const char *name ) {
+    for ( int i = 0; i < NUM_EVENT_SEVERITIES; i++ ) {
+        if ( strcmp( name, event_severity_name( i ) ) == 0 ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+// read the records of an event log, in this machine's byte order.
+// Returns false if the file cannot be read or is not an event log.
+bool events_read( const char *file, vector<event_record> *events );
+
+
+#endif // _UGEAR_EVENTS_H
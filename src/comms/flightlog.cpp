@@ -0,0 +1,1459 @@
+// flightlog.cpp - a self-describing, block compressed flight log file
+//
+// See flightlog.h for the file layout.
+
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "events.h"
+#include "flightlog.h"
+
+
+#define HEADER_FIXED 11         // magic, version, flags, header size
+#define BLOCK_HEADER 38
+#define INDEX_ENTRY 30
+#define TRAILER 12
+
+#define FLAG_BIG_ENDIAN 0x01
+#define FLAG_DOUBLE_WORDS 0x02  // LOG_DOUBLE_WORDS_SWAPPED
+#define STREAM_DELTA 0x01
+
+#define SUMMARY_VERSION 1
+
+
+static bool host_big_endian() {
+    uint16_t one = 1;
+    return *(uint8_t *)&one == 0;
+}
+
+
+static int type_size( int type ) {
+    switch ( type ) {
+    case LOG_DOUBLE: case LOG_INT64: case LOG_UINT64: return 8;
+    case LOG_FLOAT: case LOG_INT32: case LOG_UINT32: return 4;
+    case LOG_INT16: case LOG_UINT16: return 2;
+    case LOG_INT8: case LOG_UINT8: return 1;
+    }
+    return 0;
+}
+
+
+// little endian encoding of the container's own fields
+
+static void put_u8( vector<uint8_t> &buf, uint8_t v ) {
+    buf.push_back( v );
+}
+
+static void put_u16( vector<uint8_t> &buf, uint16_t v ) {
+    buf.push_back( v & 0xff );
+    buf.push_back( v >> 8 );
+}
+
+static void put_u32( vector<uint8_t> &buf, uint32_t v ) {
+    for ( int i = 0; i < 4; i++ ) {
+        buf.push_back( (v >> (8 * i)) & 0xff );
+    }
+}
+
+static void put_u64( vector<uint8_t> &buf, uint64_t v ) {
+    for ( int i = 0; i < 8; i++ ) {
+        buf.push_back( (v >> (8 * i)) & 0xff );
+    }
+}
+
+// the IEEE bits of a double, and back
+static uint64_t double_bits( double v ) {
+    uint64_t bits;
+    memcpy( &bits, &v, 8 );
+    if ( LOG_DOUBLE_WORDS_SWAPPED ) {
+        bits = (bits << 32) | (bits >> 32);
+    }
+    return bits;
+}
+
+static double bits_double( uint64_t bits ) {
+    if ( LOG_DOUBLE_WORDS_SWAPPED ) {
+        bits = (bits << 32) | (bits >> 32);
+    }
+    double v;
+    memcpy( &v, &bits, 8 );
+    return v;
+}
+
+static void put_f64( vector<uint8_t> &buf, double v ) {
+    put_u64( buf, double_bits( v ) );
+}
+
+static void put_str( vector<uint8_t> &buf, const string &s ) {
+    uint8_t len = s.length() > 255 ? 255 : s.length();
+    buf.push_back( len );
+    buf.insert( buf.end(), s.begin(), s.begin() + len );
+}
+
+static void put_magic( vector<uint8_t> &buf, const char *magic ) {
+    buf.insert( buf.end(), magic, magic + 4 );
+}
+
+
+// reads the same encoding back, failing (rather than running off the
+// end) on short data
+class decoder {
+
+public:
+
+    decoder( const uint8_t *data, size_t size )
+        : p( data ), end( data + size ), ok( true ) {}
+
+    bool good() const { return ok; }
+    const uint8_t *where() const { return p; }
+
+    bool magic( const char *m ) {
+        if ( !need( 4 ) || memcmp( p, m, 4 ) != 0 ) {
+            ok = false;
+            return false;
+        }
+        p += 4;
+        return true;
+    }
+
+    uint64_t uint( int bytes ) {
+        if ( !need( bytes ) ) {
+            return 0;
+        }
+        uint64_t v = 0;
+        for ( int i = 0; i < bytes; i++ ) {
+            v |= (uint64_t)p[i] << (8 * i);
+        }
+        p += bytes;
+        return v;
+    }
+
+    double f64() {
+        return bits_double( uint( 8 ) );
+    }
+
+    string str() {
+        int len = uint( 1 );
+        if ( !need( len ) ) {
+            return "";
+        }
+        string s( (const char *)p, len );
+        p += len;
+        return s;
+    }
+
+private:
+
+    bool need( size_t bytes ) {
+        if ( !ok || (size_t)(end - p) < bytes ) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok;
+};
+
+
+// the index and trailer that end a log
+static void put_index( vector<uint8_t> &buf,
+                       const vector<flightlog_block> &index,
+                       uint64_t index_offset )
+{
+    size_t start = buf.size();
+    put_magic( buf, "UGIX" );
+    put_u32( buf, index.size() );
+    for ( unsigned int i = 0; i < index.size(); i++ ) {
+        put_u16( buf, index[i].stream );
+        put_u32( buf, index[i].records );
+        put_f64( buf, index[i].first_time );
+        put_f64( buf, index[i].last_time );
+        put_u64( buf, index[i].offset );
+    }
+    put_u32( buf, crc32( 0, &buf[start], buf.size() - start ) );
+    put_u64( buf, index_offset );
+    put_magic( buf, "UGND" );
+}
+
+
+static bool read_at( int fd, off_t offset, void *buf, size_t size ) {
+    uint8_t *p = (uint8_t *)buf;
+    while ( size > 0 ) {
+        ssize_t n = pread( fd, p, size, offset );
+        if ( n <= 0 ) {
+            return false;
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static bool integer_type( int type ) {
+    return type != LOG_DOUBLE && type != LOG_FLOAT;
+}
+
+
+// an integer field as raw bits, and back
+static uint64_t load_bits( const uint8_t *p, int size, bool swap ) {
+    uint64_t v = 0;
+    for ( int i = 0; i < size; i++ ) {
+        int shift = host_big_endian() != swap ? size - 1 - i : i;
+        v |= (uint64_t)p[i] << (8 * shift);
+    }
+    return v;
+}
+
+static void store_bits( uint8_t *p, int size, bool swap, uint64_t v ) {
+    for ( int i = 0; i < size; i++ ) {
+        int shift = host_big_endian() != swap ? size - 1 - i : i;
+        p[i] = (v >> (8 * shift)) & 0xff;
+    }
+}
+
+
+// replace each integer field of records 1..count-1 with its change
+// from the record before (or undo that).  The arithmetic wraps at the
+// field width, so any values round trip.
+static void delta_encode( const flightlog_stream &s, uint8_t *records,
+                          uint32_t count, bool swap )
+{
+    for ( unsigned int f = 0; f < s.fields.size(); f++ ) {
+        const flightlog_field &field = s.fields[f];
+        if ( !integer_type( field.type ) ) {
+            continue;
+        }
+        int size = type_size( field.type );
+        uint8_t *p = records + (count - 1) * s.record_size + field.offset;
+        for ( uint32_t i = count - 1; i > 0; i--, p -= s.record_size ) {
+            uint64_t v = load_bits( p, size, swap )
+                - load_bits( p - s.record_size, size, swap );
+            store_bits( p, size, swap, v );
+        }
+    }
+}
+
+static void delta_decode( const flightlog_stream &s, uint8_t *records,
+                          uint32_t count, bool swap )
+{
+    for ( unsigned int f = 0; f < s.fields.size(); f++ ) {
+        const flightlog_field &field = s.fields[f];
+        if ( !integer_type( field.type ) ) {
+            continue;
+        }
+        int size = type_size( field.type );
+        uint8_t *p = records + s.record_size + field.offset;
+        for ( uint32_t i = 1; i < count; i++, p += s.record_size ) {
+            uint64_t v = load_bits( p, size, swap )
+                + load_bits( p - s.record_size, size, swap );
+            store_bits( p, size, swap, v );
+        }
+    }
+}
+
+
+double flightlog_field::value( const uint8_t *record, bool swap ) const {
+    uint8_t b[8];
+    int size = type_size( type );
+    memcpy( b, record + offset, size );
+    if ( swap ) {
+        for ( int i = 0; i < size / 2; i++ ) {
+            uint8_t tmp = b[i];
+            b[i] = b[size - 1 - i];
+            b[size - 1 - i] = tmp;
+        }
+    }
+
+    double v = 0.0;
+    switch ( type ) {
+    case LOG_DOUBLE: { double x; memcpy( &x, b, 8 ); v = x; break; }
+    case LOG_FLOAT: { float x; memcpy( &x, b, 4 ); v = x; break; }
+    case LOG_INT8: v = (int8_t)b[0]; break;
+    case LOG_UINT8: v = b[0]; break;
+    case LOG_INT16: { int16_t x; memcpy( &x, b, 2 ); v = x; break; }
+    case LOG_UINT16: { uint16_t x; memcpy( &x, b, 2 ); v = x; break; }
+    case LOG_INT32: { int32_t x; memcpy( &x, b, 4 ); v = x; break; }
+    case LOG_UINT32: { uint32_t x; memcpy( &x, b, 4 ); v = x; break; }
+    case LOG_INT64: { int64_t x; memcpy( &x, b, 8 ); v = x; break; }
+    case LOG_UINT64: { uint64_t x; memcpy( &x, b, 8 ); v = x; break; }
+    }
+    return scale == 1.0 ? v : v * scale;
+}
+
+
+int flightlog_field::format( char *buf, int size, const uint8_t *record,
+                             bool swap ) const
+{
+    double v = value( record, swap );
+    if ( scale != 1.0 ) {
+        // a count; print the value to about the count's resolution
+        return snprintf( buf, size, "%.9g", v );
+    }
+    switch ( type ) {
+    case LOG_DOUBLE:
+        return snprintf( buf, size, "%.17g", v );
+    case LOG_FLOAT:
+        return snprintf( buf, size, "%.9g", v );
+    case LOG_INT64: case LOG_UINT64: {
+        uint64_t raw;
+        memcpy( &raw, record + offset, 8 );
+        if ( swap ) {
+            raw = __builtin_bswap64( raw );
+        }
+        if ( type == LOG_INT64 ) {
+            return snprintf( buf, size, "%lld", (long long)raw );
+        }
+        return snprintf( buf, size, "%llu", (unsigned long long)raw );
+    }
+    default:
+        return snprintf( buf, size, "%.0f", v );
+    }
+}
+
+
+int flightlog_stream::find_field( const char *name ) const {
+    for ( unsigned int i = 0; i < fields.size(); i++ ) {
+        if ( fields[i].name == name ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+//
+// FlightLogWriter
+//
+
+FlightLogWriter::FlightLogWriter() :
+    fd( -1 ),
+    offset( 0 )
+{
+}
+
+
+FlightLogWriter::~FlightLogWriter() {
+    if ( fd >= 0 ) {
+        close();
+    }
+}
+
+
+int FlightLogWriter::add_stream( const char *name, int record_size,
+                                 const flightlog_field_def *fields,
+                                 int count, const char *time_field,
+                                 bool delta )
+{
+    if ( fd >= 0 || record_size <= 0 || record_size > BLOCK_BYTES ) {
+        printf("flight log: cannot add stream %s\n", name);
+        return -1;
+    }
+
+    flightlog_stream s;
+    s.name = name;
+    s.record_size = record_size;
+    s.time_field = -1;
+    s.delta = delta;
+    for ( int i = 0; i < count; i++ ) {
+        flightlog_field f;
+        f.name = fields[i].name;
+        f.type = fields[i].type;
+        f.offset = fields[i].offset;
+        f.units = fields[i].units;
+        f.scale = fields[i].scale != 0.0 ? fields[i].scale : 1.0;
+        if ( type_size( f.type ) == 0
+             || f.offset + type_size( f.type ) > record_size )
+        {
+            printf("flight log: bad field %s.%s\n", name, fields[i].name);
+            return -1;
+        }
+        if ( f.name == time_field ) {
+            s.time_field = i;
+        }
+        s.fields.push_back( f );
+    }
+    if ( s.time_field < 0 ) {
+        printf("flight log: stream %s has no %s field\n", name,
+               time_field);
+        return -1;
+    }
+
+    streams.push_back( s );
+    buffers.push_back( pending() );
+    buffers.back().raw.reserve( BLOCK_BYTES );
+
+    return streams.size() - 1;
+}
+
+
+bool FlightLogWriter::write_bytes( const void *data, size_t size ) {
+    const uint8_t *p = (const uint8_t *)data;
+    while ( size > 0 ) {
+        ssize_t n = ::write( fd, p, size );
+        if ( n <= 0 ) {
+            printf("flight log: error writing %s\n", name.c_str());
+            return false;
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+bool FlightLogWriter::open( const char *file ) {
+    if ( fd >= 0 ) {
+        return false;
+    }
+
+    fd = ::open( file, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 ) {
+        printf("flight log: cannot create %s\n", file);
+        return false;
+    }
+    name = file;
+    offset = 0;
+    index.clear();
+
+    vector<uint8_t> header;
+    put_magic( header, "UGLG" );
+    put_u16( header, FLIGHTLOG_VERSION );
+    put_u8( header, (host_big_endian() ? FLAG_BIG_ENDIAN : 0)
+            | (LOG_DOUBLE_WORDS_SWAPPED ? FLAG_DOUBLE_WORDS : 0) );
+    put_u32( header, 0 );       // size, filled in below
+    put_u16( header, streams.size() );
+    for ( unsigned int i = 0; i < streams.size(); i++ ) {
+        const flightlog_stream &s = streams[i];
+        put_str( header, s.name );
+        put_u8( header, s.delta ? STREAM_DELTA : 0 );
+        put_u16( header, s.record_size );
+        put_u16( header, s.time_field );
+        put_u16( header, s.fields.size() );
+        for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+            const flightlog_field &f = s.fields[j];
+            put_str( header, f.name );
+            put_u8( header, f.type );
+            put_u16( header, f.offset );
+            put_str( header, f.units );
+            put_f64( header, f.scale );
+        }
+    }
+    uint32_t size = header.size() + 4;
+    for ( int i = 0; i < 4; i++ ) {
+        header[7 + i] = (size >> (8 * i)) & 0xff;
+    }
+    put_u32( header, crc32( 0, &header[0], header.size() ) );
+
+    return write_bytes( &header[0], header.size() );
+}
+
+
+bool FlightLogWriter::write( int stream, const void *record ) {
+    if ( fd < 0 || stream < 0 || stream >= (int)streams.size() ) {
+        return false;
+    }
+
+    const flightlog_stream &s = streams[stream];
+    pending &p = buffers[stream];
+    if ( p.raw.size() + s.record_size > BLOCK_BYTES ) {
+        if ( !flush( stream ) ) {
+            return false;
+        }
+    }
+
+    const uint8_t *r = (const uint8_t *)record;
+    double t = s.time( r );
+    if ( p.records == 0 ) {
+        p.first_time = t;
+    }
+    p.last_time = t;
+    p.records++;
+    p.raw.insert( p.raw.end(), r, r + s.record_size );
+
+    return true;
+}
+
+
+bool FlightLogWriter::flush( int stream ) {
+    if ( fd < 0 || stream < 0 || stream >= (int)streams.size() ) {
+        return false;
+    }
+
+    pending &p = buffers[stream];
+    if ( p.records == 0 ) {
+        return true;
+    }
+
+    if ( streams[stream].delta ) {
+        delta_encode( streams[stream], &p.raw[0], p.records, false );
+    }
+
+    uLongf packed_size = compressBound( p.raw.size() );
+    packed.resize( packed_size );
+    if ( compress( &packed[0], &packed_size, &p.raw[0], p.raw.size() )
+         != Z_OK )
+    {
+        // drop the block, as a failed write does; the records are
+        // delta encoded now and cannot simply be written again
+        printf("flight log: cannot compress a %s block\n",
+               streams[stream].name.c_str());
+        p.raw.clear();
+        p.records = 0;
+        return false;
+    }
+
+    flightlog_block b;
+    b.stream = stream;
+    b.records = p.records;
+    b.first_time = p.first_time;
+    b.last_time = p.last_time;
+    b.offset = offset;
+
+    vector<uint8_t> header;
+    put_magic( header, "UGBK" );
+    put_u16( header, stream );
+    put_u32( header, p.records );
+    put_u32( header, p.raw.size() );
+    put_u32( header, packed_size );
+    put_f64( header, p.first_time );
+    put_f64( header, p.last_time );
+    put_u32( header, crc32( 0, &packed[0], packed_size ) );
+
+    p.raw.clear();
+    p.records = 0;
+
+    if ( !write_bytes( &header[0], header.size() )
+         || !write_bytes( &packed[0], packed_size ) )
+    {
+        return false;
+    }
+    index.push_back( b );
+
+    return true;
+}
+
+
+bool FlightLogWriter::flush_all() {
+    bool result = true;
+    for ( unsigned int i = 0; i < streams.size(); i++ ) {
+        result = flush( i ) && result;
+    }
+    return result;
+}
+
+
+bool FlightLogWriter::close() {
+    if ( fd < 0 ) {
+        return false;
+    }
+
+    bool result = flush_all();
+
+    vector<uint8_t> buf;
+    put_index( buf, index, offset );
+    result = write_bytes( &buf[0], buf.size() ) && result;
+
+    if ( fsync( fd ) != 0 ) {
+        printf("flight log: error syncing %s\n", name.c_str());
+        result = false;
+    }
+    if ( ::close( fd ) != 0 ) {
+        printf("flight log: error closing %s\n", name.c_str());
+        result = false;
+    }
+    fd = -1;
+
+    return result;
+}
+
+
+//
+// FlightLogReader
+//
+
+FlightLogReader::FlightLogReader() :
+    fd( -1 ),
+    data_start( 0 ),
+    end( 0 ),
+    swap( false ),
+    swap_words( false ),
+    scanned( false )
+{
+}
+
+
+FlightLogReader::~FlightLogReader() {
+    close();
+}
+
+
+bool FlightLogReader::open( const char *file ) {
+    close();
+
+    fd = ::open( file, O_RDONLY );
+    if ( fd < 0 ) {
+        printf("Cannot open %s\n", file);
+        return false;
+    }
+    name = file;
+
+    if ( !read_header() ) {
+        printf("%s is not a flight log\n", file);
+        close();
+        return false;
+    }
+
+    scanned = false;
+    if ( !read_index() ) {
+        // not closed cleanly; find the blocks the hard way
+        scanned = true;
+        blocks.clear();
+        scan_blocks();
+    }
+
+    return true;
+}
+
+
+void FlightLogReader::close() {
+    if ( fd >= 0 ) {
+        ::close( fd );
+        fd = -1;
+    }
+    streams.clear();
+    blocks.clear();
+}
+
+
+int FlightLogReader::find_stream( const char *name ) const {
+    for ( unsigned int i = 0; i < streams.size(); i++ ) {
+        if ( streams[i].name == name ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+bool FlightLogReader::read_header() {
+    uint8_t fixed[HEADER_FIXED];
+    if ( !read_at( fd, 0, fixed, HEADER_FIXED ) ) {
+        return false;
+    }
+    decoder d( fixed, HEADER_FIXED );
+    d.magic( "UGLG" );
+    int version = d.uint( 2 );
+    int flags = d.uint( 1 );
+    uint32_t size = d.uint( 4 );
+    if ( !d.good() || version < 1 || version > FLIGHTLOG_VERSION
+         || size < HEADER_FIXED + 6
+         || size > 1024 * 1024 )
+    {
+        return false;
+    }
+
+    vector<uint8_t> header( size );
+    if ( !read_at( fd, 0, &header[0], size ) ) {
+        return false;
+    }
+    decoder crc( &header[size - 4], 4 );
+    if ( crc.uint( 4 ) != crc32( 0, &header[0], size - 4 ) ) {
+        return false;
+    }
+
+    swap = ((flags & FLAG_BIG_ENDIAN) != 0) != host_big_endian();
+    swap_words = ((flags & FLAG_DOUBLE_WORDS) != 0)
+        != (LOG_DOUBLE_WORDS_SWAPPED != 0);
+
+    decoder h( &header[HEADER_FIXED], size - HEADER_FIXED - 4 );
+    int count = h.uint( 2 );
+    for ( int i = 0; i < count && h.good(); i++ ) {
+        flightlog_stream s;
+        s.name = h.str();
+        s.delta = version >= 2 && (h.uint( 1 ) & STREAM_DELTA);
+        s.record_size = h.uint( 2 );
+        s.time_field = h.uint( 2 );
+        int fields = h.uint( 2 );
+        for ( int j = 0; j < fields && h.good(); j++ ) {
+            flightlog_field f;
+            f.name = h.str();
+            f.type = (flightlog_type)h.uint( 1 );
+            f.offset = h.uint( 2 );
+            f.units = h.str();
+            f.scale = version >= 2 ? h.f64() : 1.0;
+            if ( type_size( f.type ) == 0
+                 || f.offset + type_size( f.type ) > s.record_size )
+            {
+                return false;
+            }
+            s.fields.push_back( f );
+        }
+        if ( s.record_size == 0 || s.time_field >= (int)s.fields.size() ) {
+            return false;
+        }
+        streams.push_back( s );
+    }
+    if ( !h.good() ) {
+        return false;
+    }
+
+    data_start = size;
+    return true;
+}
+
+
+bool FlightLogReader::read_index() {
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || st.st_size < data_start + TRAILER ) {
+        return false;
+    }
+
+    uint8_t trailer[TRAILER];
+    if ( !read_at( fd, st.st_size - TRAILER, trailer, TRAILER ) ) {
+        return false;
+    }
+    decoder t( trailer, TRAILER );
+    uint64_t index_offset = t.uint( 8 );
+    if ( !t.magic( "UGND" ) || index_offset < (uint64_t)data_start
+         || index_offset + 12 > (uint64_t)(st.st_size - TRAILER) )
+    {
+        return false;
+    }
+
+    size_t size = st.st_size - TRAILER - index_offset;
+    vector<uint8_t> buf( size );
+    if ( !read_at( fd, index_offset, &buf[0], size ) ) {
+        return false;
+    }
+    decoder crc( &buf[size - 4], 4 );
+    if ( crc.uint( 4 ) != crc32( 0, &buf[0], size - 4 ) ) {
+        return false;
+    }
+
+    decoder d( &buf[0], size - 4 );
+    d.magic( "UGIX" );
+    uint32_t count = d.uint( 4 );
+    if ( !d.good() || (size - 12) != (size_t)count * INDEX_ENTRY ) {
+        return false;
+    }
+    for ( uint32_t i = 0; i < count; i++ ) {
+        flightlog_block b;
+        b.stream = d.uint( 2 );
+        b.records = d.uint( 4 );
+        b.first_time = d.f64();
+        b.last_time = d.f64();
+        b.offset = d.uint( 8 );
+        if ( b.stream >= (int)streams.size() ) {
+            return false;
+        }
+        blocks.push_back( b );
+    }
+
+    if ( !d.good() ) {
+        return false;
+    }
+
+    end = index_offset;
+    return true;
+}
+
+
+bool FlightLogReader::scan_blocks() {
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 ) {
+        return false;
+    }
+
+    // stop at the first block that is cut short or damaged; that is
+    // where the writer stopped
+    off_t pos = data_start;
+    end = pos;
+    vector<uint8_t> packed;
+    while ( pos + BLOCK_HEADER <= st.st_size ) {
+        uint8_t header[BLOCK_HEADER];
+        if ( !read_at( fd, pos, header, BLOCK_HEADER ) ) {
+            break;
+        }
+        decoder d( header, BLOCK_HEADER );
+        flightlog_block b;
+        d.magic( "UGBK" );
+        b.stream = d.uint( 2 );
+        b.records = d.uint( 4 );
+        d.uint( 4 );
+        uint32_t packed_size = d.uint( 4 );
+        b.first_time = d.f64();
+        b.last_time = d.f64();
+        uint32_t crc = d.uint( 4 );
+        b.offset = pos;
+        if ( !d.good() || b.stream >= (int)streams.size()
+             || pos + BLOCK_HEADER + packed_size > st.st_size )
+        {
+            break;
+        }
+
+        packed.resize( packed_size );
+        if ( packed_size > 0
+             && !read_at( fd, pos + BLOCK_HEADER, &packed[0], packed_size ) )
+        {
+            break;
+        }
+        if ( crc != crc32( 0, packed_size ? &packed[0] : NULL,
+                           packed_size ) )
+        {
+            break;
+        }
+
+        blocks.push_back( b );
+        pos += BLOCK_HEADER + packed_size;
+        end = pos;
+    }
+
+    return true;
+}
+
+
+bool FlightLogReader::read_block( int i, vector<uint8_t> *records ) const {
+    if ( i < 0 || i >= (int)blocks.size() ) {
+        return false;
+    }
+    const flightlog_block &b = blocks[i];
+    const flightlog_stream &s = streams[b.stream];
+
+    uint8_t header[BLOCK_HEADER];
+    if ( !read_at( fd, b.offset, header, BLOCK_HEADER ) ) {
+        return false;
+    }
+    decoder d( header, BLOCK_HEADER );
+    d.magic( "UGBK" );
+    int stream = d.uint( 2 );
+    uint32_t count = d.uint( 4 );
+    uLongf raw_size = d.uint( 4 );
+    uint32_t packed_size = d.uint( 4 );
+    d.f64();
+    d.f64();
+    uint32_t crc = d.uint( 4 );
+    if ( !d.good() || stream != b.stream || count != b.records
+         || raw_size != (uLongf)count * s.record_size || packed_size == 0 )
+    {
+        printf("%s: bad block at %llu\n", name.c_str(),
+               (unsigned long long)b.offset);
+        return false;
+    }
+
+    vector<uint8_t> packed( packed_size );
+    if ( !read_at( fd, b.offset + BLOCK_HEADER, &packed[0], packed_size )
+         || crc != crc32( 0, &packed[0], packed_size ) )
+    {
+        printf("%s: damaged block at %llu\n", name.c_str(),
+               (unsigned long long)b.offset);
+        return false;
+    }
+
+    records->resize( raw_size );
+    uLongf size = raw_size;
+    if ( raw_size > 0
+         && (uncompress( &(*records)[0], &size, &packed[0], packed_size )
+             != Z_OK || size != raw_size) )
+    {
+        printf("%s: cannot decompress block at %llu\n", name.c_str(),
+               (unsigned long long)b.offset);
+        return false;
+    }
+    if ( s.delta && count > 0 ) {
+        delta_decode( s, &(*records)[0], count, swap );
+    }
+    if ( swap_words ) {
+        for ( unsigned int f = 0; f < s.fields.size(); f++ ) {
+            if ( s.fields[f].type != LOG_DOUBLE ) {
+                continue;
+            }
+            uint8_t *p = &(*records)[0] + s.fields[f].offset;
+            for ( uint32_t r = 0; r < count; r++ ) {
+                log_swap_double_words( p );
+                p += s.record_size;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+bool flightlog_repair( const char *file, bool *repaired, int *blocks ) {
+    FlightLogReader reader;
+    if ( !reader.open( file ) ) {
+        return false;
+    }
+    if ( repaired != NULL ) {
+        *repaired = reader.recovered();
+    }
+    if ( blocks != NULL ) {
+        *blocks = reader.block_count();
+    }
+    if ( !reader.recovered() ) {
+        return true;
+    }
+
+    vector<flightlog_block> index;
+    for ( int i = 0; i < reader.block_count(); i++ ) {
+        index.push_back( reader.block( i ) );
+    }
+    off_t end = reader.data_end();
+    reader.close();
+
+    vector<uint8_t> buf;
+    put_index( buf, index, end );
+
+    int fd = ::open( file, O_WRONLY );
+    if ( fd < 0 || ftruncate( fd, end ) != 0
+         || pwrite( fd, &buf[0], buf.size(), end ) != (ssize_t)buf.size()
+         || fsync( fd ) != 0 )
+    {
+        printf("Cannot repair %s\n", file);
+        if ( fd >= 0 ) {
+            ::close( fd );
+        }
+        return false;
+    }
+    ::close( fd );
+
+    return true;
+}
+
+
+vector<string> flightlog_segments( const char *dir ) {
+    vector<string> files;
+
+    DIR *d = opendir( dir );
+    if ( d == NULL ) {
+        return files;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        int num;
+        char end;
+        if ( sscanf( entry->d_name, "flight-%d.lo%c", &num, &end ) == 2
+             && end == 'g' )
+        {
+            files.push_back( string( dir ) + "/" + entry->d_name );
+        }
+    }
+    closedir( d );
+
+    // the numbers are zero padded, so this is segment order
+    sort( files.begin(), files.end() );
+
+    return files;
+}
+
+
+string flightlog_out_name( const char *dir, vector<string> *taken ) {
+    string base( dir );
+    string::size_type slash = base.rfind( '/' );
+    if ( slash != string::npos ) {
+        base = base.substr( slash + 1 );
+    }
+
+    string name = base;
+    for ( int n = 2;
+          find( taken->begin(), taken->end(), name ) != taken->end(); n++ )
+    {
+        char buf[16];
+        snprintf( buf, sizeof(buf), "-%d", n );
+        name = base + buf;
+    }
+    taken->push_back( name );
+
+    return name;
+}
+
+
+//
+// FlightLogCursor
+//
+
+FlightLogCursor::FlightLogCursor( const FlightLogReader *r, int s ) :
+    reader( r ),
+    stream( s ),
+    current( -1 ),
+    pos( 0 ),
+    count( 0 )
+{
+    for ( int i = 0; i < reader->block_count(); i++ ) {
+        if ( reader->block( i ).stream == stream ) {
+            blocks.push_back( i );
+        }
+    }
+}
+
+
+bool FlightLogCursor::load( int i ) {
+    current = i;
+    pos = count = 0;
+    if ( i >= (int)blocks.size()
+         || !reader->read_block( blocks[i], &records ) )
+    {
+        return false;
+    }
+    count = reader->block( blocks[i] ).records;
+    return true;
+}
+
+
+bool FlightLogCursor::seek( double t ) {
+    // the first block that ends at or after t
+    int lo = 0;
+    int hi = blocks.size();
+    while ( lo < hi ) {
+        int mid = (lo + hi) / 2;
+        if ( reader->block( blocks[mid] ).last_time < t ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if ( !load( lo ) ) {
+        return false;
+    }
+
+    int size = reader->stream( stream ).record_size;
+    while ( pos < count && time( &records[pos * size] ) < t ) {
+        pos++;
+    }
+
+    return pos < count;
+}
+
+
+const uint8_t *FlightLogCursor::next() {
+    while ( pos >= count ) {
+        if ( !load( current + 1 ) ) {
+            return NULL;
+        }
+    }
+
+    int size = reader->stream( stream ).record_size;
+    return &records[pos++ * size];
+}
+
+
+//
+// flightlog_summary
+//
+
+int flightlog_summary::find_stream( const char *name ) const {
+    for ( unsigned int i = 0; i < streams.size(); i++ ) {
+        if ( streams[i].name == name ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+// the files a summary of dir covers, as they are now
+static vector<flightlog_summary::source> summary_sources( const char *dir ) {
+    vector<string> files = flightlog_segments( dir );
+    files.push_back( string( dir ) + "/events.log" );
+
+    vector<flightlog_summary::source> sources;
+    for ( unsigned int i = 0; i < files.size(); i++ ) {
+        struct stat st;
+        if ( stat( files[i].c_str(), &st ) != 0 ) {
+            continue;
+        }
+        flightlog_summary::source src;
+        src.name = files[i].substr( files[i].rfind( '/' ) + 1 );
+        src.size = st.st_size;
+        src.mtime = st.st_mtime;
+        sources.push_back( src );
+    }
+    return sources;
+}
+
+
+static bool same_sources( const vector<flightlog_summary::source> &a,
+                          const vector<flightlog_summary::source> &b )
+{
+    if ( a.size() != b.size() ) {
+        return false;
+    }
+    for ( unsigned int i = 0; i < a.size(); i++ ) {
+        if ( a[i].name != b[i].name || a[i].size != b[i].size
+             || a[i].mtime != b[i].mtime )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void put_range( vector<uint8_t> &buf, const flightlog_range &r ) {
+    put_f64( buf, r.min );
+    put_f64( buf, r.max );
+}
+
+
+static flightlog_range get_range( decoder &d ) {
+    flightlog_range r;
+    r.min = d.f64();
+    r.max = d.f64();
+    return r;
+}
+
+
+static void put_summary( vector<uint8_t> &buf, const flightlog_summary &sum )
+{
+    put_magic( buf, "UGSM" );
+    put_u16( buf, SUMMARY_VERSION );
+
+    put_u16( buf, sum.sources.size() );
+    for ( unsigned int i = 0; i < sum.sources.size(); i++ ) {
+        put_str( buf, sum.sources[i].name );
+        put_u64( buf, sum.sources[i].size );
+        put_u64( buf, sum.sources[i].mtime );
+    }
+
+    put_f64( buf, sum.first_time );
+    put_f64( buf, sum.last_time );
+    put_u8( buf, sum.has_position );
+    put_f64( buf, sum.lat_min );
+    put_f64( buf, sum.lat_max );
+    put_f64( buf, sum.lon_min );
+    put_f64( buf, sum.lon_max );
+
+    put_u32( buf, sum.events.size() );
+    for ( unsigned int i = 0; i < sum.events.size(); i++ ) {
+        put_f64( buf, sum.events[i].time );
+        put_u8( buf, sum.events[i].type );
+        put_u32( buf, sum.events[i].arg );
+        put_str( buf, sum.events[i].text );
+    }
+
+    put_u16( buf, sum.streams.size() );
+    for ( unsigned int i = 0; i < sum.streams.size(); i++ ) {
+        const flightlog_summary::stream &s = sum.streams[i];
+        put_str( buf, s.name );
+        put_u16( buf, s.fields.size() );
+        for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+            put_str( buf, s.fields[j] );
+            put_range( buf, s.ranges[j] );
+        }
+    }
+
+    put_u32( buf, sum.blocks.size() );
+    for ( unsigned int i = 0; i < sum.blocks.size(); i++ ) {
+        const flightlog_summary::block &b = sum.blocks[i];
+        put_u16( buf, b.segment );
+        put_u32( buf, b.index );
+        put_u16( buf, b.stream );
+        put_f64( buf, b.first_time );
+        put_f64( buf, b.last_time );
+        put_u16( buf, b.ranges.size() );
+        for ( unsigned int j = 0; j < b.ranges.size(); j++ ) {
+            put_range( buf, b.ranges[j] );
+        }
+    }
+
+    put_u32( buf, crc32( 0, &buf[0], buf.size() ) );
+}
+
+
+static bool get_summary( const vector<uint8_t> &buf, flightlog_summary *sum )
+{
+    if ( buf.size() < 10 ) {
+        return false;
+    }
+    decoder crc( &buf[buf.size() - 4], 4 );
+    if ( crc.uint( 4 ) != crc32( 0, &buf[0], buf.size() - 4 ) ) {
+        return false;
+    }
+
+    decoder d( &buf[0], buf.size() - 4 );
+    d.magic( "UGSM" );
+    if ( d.uint( 2 ) != SUMMARY_VERSION ) {
+        return false;
+    }
+
+    *sum = flightlog_summary();
+    int count = d.uint( 2 );
+    for ( int i = 0; i < count && d.good(); i++ ) {
+        flightlog_summary::source src;
+        src.name = d.str();
+        src.size = d.uint( 8 );
+        src.mtime = (int64_t)d.uint( 8 );
+        sum->sources.push_back( src );
+    }
+
+    sum->first_time = d.f64();
+    sum->last_time = d.f64();
+    sum->has_position = d.uint( 1 ) != 0;
+    sum->lat_min = d.f64();
+    sum->lat_max = d.f64();
+    sum->lon_min = d.f64();
+    sum->lon_max = d.f64();
+
+    uint32_t events = d.uint( 4 );
+    for ( uint32_t i = 0; i < events && d.good(); i++ ) {
+        flightlog_summary::event e;
+        e.time = d.f64();
+        e.type = d.uint( 1 );
+        e.arg = (int32_t)d.uint( 4 );
+        e.text = d.str();
+        sum->events.push_back( e );
+    }
+
+    count = d.uint( 2 );
+    for ( int i = 0; i < count && d.good(); i++ ) {
+        flightlog_summary::stream s;
+        s.name = d.str();
+        int fields = d.uint( 2 );
+        for ( int j = 0; j < fields && d.good(); j++ ) {
+            s.fields.push_back( d.str() );
+            s.ranges.push_back( get_range( d ) );
+        }
+        sum->streams.push_back( s );
+    }
+
+    uint32_t blocks = d.uint( 4 );
+    for ( uint32_t i = 0; i < blocks && d.good(); i++ ) {
+        flightlog_summary::block b;
+        b.segment = d.uint( 2 );
+        b.index = d.uint( 4 );
+        b.stream = d.uint( 2 );
+        b.first_time = d.f64();
+        b.last_time = d.f64();
+        int ranges = d.uint( 2 );
+        for ( int j = 0; j < ranges && d.good(); j++ ) {
+            b.ranges.push_back( get_range( d ) );
+        }
+        if ( b.stream >= (int)sum->streams.size()
+             || (!b.ranges.empty()
+                 && b.ranges.size() != sum->streams[b.stream].fields.size()) )
+        {
+            return false;
+        }
+        sum->blocks.push_back( b );
+    }
+
+    return d.good();
+}
+
+
+static void widen( flightlog_range &r, double v ) {
+    if ( v != v ) {
+        return;                 // NaN
+    }
+    if ( v < r.min ) {
+        r.min = v;
+    }
+    if ( v > r.max ) {
+        r.max = v;
+    }
+}
+
+
+static void widen( flightlog_range &r, const flightlog_range &by ) {
+    if ( by.min <= by.max ) {
+        widen( r, by.min );
+        widen( r, by.max );
+    }
+}
+
+
+// summarize the logs of dir from scratch
+static bool summary_build( const char *dir, flightlog_summary *sum ) {
+    *sum = flightlog_summary();
+    sum->sources = summary_sources( dir );
+    const flightlog_range none = { HUGE_VAL, -HUGE_VAL };
+    flightlog_range span = none;
+    flightlog_range lat_range = none;
+    flightlog_range lon_range = none;
+
+    vector<string> segments = flightlog_segments( dir );
+    if ( segments.empty() ) {
+        return false;
+    }
+
+    vector<uint8_t> records;
+    for ( unsigned int seg = 0; seg < segments.size(); seg++ ) {
+        FlightLogReader reader;
+        if ( !reader.open( segments[seg].c_str() ) ) {
+            continue;
+        }
+        bool swap = reader.swapped();
+
+        // the summary stream of each of the segment's streams, or -1
+        // if the fields differ from an earlier segment's
+        vector<int> map;
+        for ( int i = 0; i < reader.stream_count(); i++ ) {
+            const flightlog_stream &s = reader.stream( i );
+            int n = sum->find_stream( s.name.c_str() );
+            if ( n < 0 ) {
+                flightlog_summary::stream ss;
+                ss.name = s.name;
+                for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+                    ss.fields.push_back( s.fields[j].name );
+                    ss.ranges.push_back( none );
+                }
+                n = sum->streams.size();
+                sum->streams.push_back( ss );
+            } else {
+                for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+                    if ( j >= sum->streams[n].fields.size()
+                         || sum->streams[n].fields[j] != s.fields[j].name )
+                    {
+                        n = -1;
+                        break;
+                    }
+                }
+                if ( n >= 0 && sum->streams[n].fields.size()
+                     != s.fields.size() )
+                {
+                    n = -1;
+                }
+            }
+            map.push_back( n );
+        }
+
+        for ( int b = 0; b < reader.block_count(); b++ ) {
+            const flightlog_block &fb = reader.block( b );
+            int n = map[fb.stream];
+            if ( n < 0 ) {
+                continue;
+            }
+            const flightlog_stream &s = reader.stream( fb.stream );
+            flightlog_summary::block sb;
+            sb.segment = seg;
+            sb.index = b;
+            sb.stream = n;
+            sb.first_time = fb.first_time;
+            sb.last_time = fb.last_time;
+            widen( span, fb.first_time );
+            widen( span, fb.last_time );
+
+            // a damaged block keeps no ranges, so a search reads it
+            if ( reader.read_block( b, &records ) ) {
+                sb.ranges.assign( s.fields.size(), none );
+                int lat = s.name == "gps" ? s.find_field( "lat" ) : -1;
+                int lon = s.name == "gps" ? s.find_field( "lon" ) : -1;
+                for ( uint32_t r = 0; r < fb.records; r++ ) {
+                    const uint8_t *record = &records[r * s.record_size];
+                    for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+                        widen( sb.ranges[j],
+                               s.fields[j].value( record, swap ) );
+                    }
+                    if ( lat >= 0 && lon >= 0 ) {
+                        double y = s.fields[lat].value( record, swap );
+                        double x = s.fields[lon].value( record, swap );
+                        if ( x != 0.0 || y != 0.0 ) {
+                            // (0, 0) is what the gps reports without
+                            // a fix
+                            widen( lat_range, y );
+                            widen( lon_range, x );
+                        }
+                    }
+                }
+                for ( unsigned int j = 0; j < s.fields.size(); j++ ) {
+                    widen( sum->streams[n].ranges[j], sb.ranges[j] );
+                }
+            }
+            sum->blocks.push_back( sb );
+        }
+    }
+
+    sum->first_time = span.min;
+    sum->last_time = span.max;
+    sum->has_position = lat_range.min <= lat_range.max;
+    sum->lat_min = lat_range.min;
+    sum->lat_max = lat_range.max;
+    sum->lon_min = lon_range.min;
+    sum->lon_max = lon_range.max;
+
+    vector<event_record> events;
+    string file = string( dir ) + "/events.log";
+    events_read( file.c_str(), &events );
+    for ( unsigned int i = 0; i < events.size(); i++ ) {
+        int type = events[i].type;
+        if ( type == EVENT_MODE || type == EVENT_LINK
+             || type == EVENT_AUTOPILOT || type == EVENT_HOME )
+        {
+            flightlog_summary::event e;
+            e.time = events[i].time;
+            e.type = type;
+            e.arg = events[i].arg;
+            e.text = events[i].text;
+            sum->events.push_back( e );
+        }
+    }
+
+    return !sum->streams.empty();
+}
+
+
+bool flightlog_summary_update( const char *dir, flightlog_summary *summary,
+                               bool *rebuilt )
+{
+    string file = string( dir ) + "/summary.idx";
+    vector<flightlog_summary::source> sources = summary_sources( dir );
+    if ( rebuilt != NULL ) {
+        *rebuilt = false;
+    }
+
+    // the saved summary, if it still describes the logs
+    FILE *f = fopen( file.c_str(), "rb" );
+    if ( f != NULL ) {
+        vector<uint8_t> buf;
+        uint8_t chunk[65536];
+        size_t n;
+        while ( (n = fread( chunk, 1, sizeof(chunk), f )) > 0 ) {
+            buf.insert( buf.end(), chunk, chunk + n );
+        }
+        fclose( f );
+        if ( get_summary( buf, summary )
+             && same_sources( summary->sources, sources ) )
+        {
+            return true;
+        }
+    }
+
+    if ( !summary_build( dir, summary ) ) {
+        return false;
+    }
+    if ( rebuilt != NULL ) {
+        *rebuilt = true;
+    }
+
+    // written under a temporary name and renamed into place, so a
+    // reader never sees half a summary (a flight directory that
+    // cannot be written just gets no saved summary)
+    vector<uint8_t> buf;
+    put_summary( buf, *summary );
+    string tmp = file + ".tmp";
+    f = fopen( tmp.c_str(), "wb" );
+    if ( f != NULL ) {
+        bool ok = fwrite( &buf[0], 1, buf.size(), f ) == buf.size();
+        ok = fclose( f ) == 0 && ok;
+        if ( !ok || rename( tmp.c_str(), file.c_str() ) != 0 ) {
+            unlink( tmp.c_str() );
+        }
+    }
+
+    return true;
+}
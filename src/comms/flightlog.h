@@ -0,0 +1,400 @@
+// flightlog.h - a self-describing, block compressed flight log file
+//
+// A flight log holds one or more record streams (imu, gps, ...).  The
+// file starts with a schema that names each stream and each field in
+// its records (type, byte offset, units), so a reader needs no copy
+// of the structs that wrote it and is not fooled by a change in their
+// padding or field order.  Records are buffered per stream and
+// written as zlib compressed blocks of at most BLOCK_BYTES, each with
+// its record count and time range.  Closing the log appends an index
+// of the blocks, so a reader can go straight to the block holding a
+// given time instead of decompressing everything before it.  A log
+// that was never closed has no index; the reader rebuilds it from the
+// block headers, and flightlog_repair() can write the missing index.
+//
+// A long flight is normally split into segments (flight-0000.log,
+// flight-0001.log, ...), each a complete log with its own schema, so
+// losing the end of one segment costs nothing before it.
+//
+// All integers in the container are little endian.  Records are
+// stored as the writer laid them out in memory; the schema records
+// the byte order they were written in, and whether the writer kept
+// doubles in the old ARM FPA layout (high word first), which the
+// reader undoes as it reads each block.  A field may be a count with a
+// scale factor (value = count * scale), and a stream may be delta
+// encoded: in each block, every integer field of a record after the
+// first holds the change from the record before, which compresses far
+// better than the values themselves.
+//
+// File layout:
+//
+//   header   "UGLG" u16 version  u8 flags  u32 header size
+//            u16 streams
+//            per stream: str name  u8 stream flags  u16 record size
+//                        u16 time field  u16 fields
+//                        per field: str name  u8 type  u16 offset
+//                                   str units  f64 scale
+//            u32 crc of the header
+//   block    "UGBK" u16 stream  u32 records  u32 raw size
+//            u32 packed size  f64 first time  f64 last time
+//            u32 crc of the packed data, then the packed data
+//   ...
+//   index    "UGIX" u32 blocks
+//            per block: u16 stream  u32 records  f64 first time
+//                       f64 last time  u64 offset of the block
+//            u32 crc of the index
+//   trailer  u64 offset of the index  "UGND"
+//
+// (str is a u8 length followed by that many bytes.  Version 1 files
+// have no stream flags or scales.)
+//
+// The summary (see flightlog_summary) is kept in the same encoding:
+//
+//   "UGSM" u16 version
+//   u16 sources   per source: str name  u64 size  i64 mtime
+//   f64 first time  f64 last time
+//   u8 has position  f64 lat min, max  f64 lon min, max
+//   u32 events    per event: f64 time  u8 type  i32 arg  str text
+//   u16 streams   per stream: str name  u16 fields
+//                             per field: str name  f64 min  f64 max
+//   u32 blocks    per block: u16 segment  u32 index  u16 stream
+//                            f64 first time  f64 last time
+//                            u16 ranges  per range: f64 min  f64 max
+//   u32 crc of the summary
+
+
+#ifndef _UGEAR_FLIGHTLOG_H
+#define _UGEAR_FLIGHTLOG_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+#define FLIGHTLOG_VERSION 2
+
+// Old ARM FPA doubles (soft float, old ABI) keep their two 32 bit
+// words high word first even on a little endian machine.
+#if defined(__arm__) && !defined(__VFP_FP__) && !defined(__ARMEB__)
+#define LOG_DOUBLE_WORDS_SWAPPED 1
+#else
+#define LOG_DOUBLE_WORDS_SWAPPED 0
+#endif
+
+// swap the words of a double between the FPA and the IEEE layouts
+inline void log_swap_double_words( uint8_t *p ) {
+    for ( int i = 0; i < 4; i++ ) {
+        uint8_t tmp = p[i];
+        p[i] = p[i + 4];
+        p[i + 4] = tmp;
+    }
+}
+
+enum flightlog_type {
+    LOG_DOUBLE = 1,
+    LOG_FLOAT,
+    LOG_INT8,
+    LOG_UINT8,
+    LOG_INT16,
+    LOG_UINT16,
+    LOG_INT32,
+    LOG_UINT32,
+    LOG_INT64,
+    LOG_UINT64
+};
+
+
+// one field of a record
+struct flightlog_field {
+    string name;
+    flightlog_type type;
+    int offset;
+    string units;
+    double scale;
+
+    // the field's value in a record, converted to double and scaled
+    double value( const uint8_t *record, bool swap = false ) const;
+
+    // the value as text, exactly (64 bit integers are not rounded
+    // through a double), as snprintf() would
+    int format( char *buf, int size, const uint8_t *record,
+                bool swap = false ) const;
+};
+
+
+// describe the fields of a struct for FlightLogWriter::add_stream()
+// (a scale of 0 means 1)
+struct flightlog_field_def {
+    const char *name;
+    flightlog_type type;
+    int offset;
+    const char *units;
+    double scale;
+};
+
+#define LOG_FIELD( S, F, T, U ) { #F, T, offsetof(struct S, F), U, 0 }
+#define LOG_SCALED( S, F, T, U, K ) { #F, T, offsetof(struct S, F), U, K }
+#define LOG_ELEMENT( S, F, I, T, U ) \
+    { #F "[" #I "]", T, offsetof(struct S, F[I]), U, 0 }
+
+
+// one stream of records
+struct flightlog_stream {
+    string name;
+    int record_size;
+    int time_field;             // index of the field holding the time
+    bool delta;                 // integer fields are delta encoded
+    vector<flightlog_field> fields;
+
+    int find_field( const char *name ) const;
+    double time( const uint8_t *record, bool swap = false ) const {
+        return fields[time_field].value( record, swap );
+    }
+};
+
+
+// one compressed block, as listed in the index
+struct flightlog_block {
+    int stream;
+    uint32_t records;
+    double first_time;
+    double last_time;
+    uint64_t offset;            // of the block header
+};
+
+
+// Writes a flight log.  Not thread safe; logging.cpp calls it only
+// from its writer thread.
+class FlightLogWriter {
+
+public:
+
+    enum { BLOCK_BYTES = 65536 };
+
+    FlightLogWriter();
+    ~FlightLogWriter();
+
+    // declare the streams (before open()).  time_field names the
+    // field holding each record's time (in seconds, once scaled);
+    // delta turns on delta encoding.  Returns the stream number, or
+    // -1 if the description is bad.
+    int add_stream( const char *name, int record_size,
+                    const flightlog_field_def *fields, int count,
+                    const char *time_field = "time", bool delta = false );
+
+    // create the file and write the schema
+    bool open( const char *file );
+
+    // buffer one record; a full block is compressed and written
+    bool write( int stream, const void *record );
+
+    // write out the partly filled block of one stream, or of all
+    bool flush( int stream );
+    bool flush_all();
+
+    // flush everything, write the index, sync the file to the disk
+    // and close
+    bool close();
+
+    bool is_open() const { return fd >= 0; }
+    uint64_t bytes_written() const { return offset; }
+
+private:
+
+    struct pending {
+        vector<uint8_t> raw;
+        uint32_t records;
+        double first_time;
+        double last_time;
+    };
+
+    bool write_bytes( const void *data, size_t size );
+
+    int fd;
+    string name;
+    uint64_t offset;
+    vector<flightlog_stream> streams;
+    vector<pending> buffers;
+    vector<flightlog_block> index;
+    vector<uint8_t> packed;
+};
+
+
+// Reads a flight log.  After open() the schema and block list do not
+// change, and read_block() uses pread(), so several threads may read
+// blocks of one FlightLogReader at once.
+class FlightLogReader {
+
+public:
+
+    FlightLogReader();
+    ~FlightLogReader();
+
+    // read the schema and the index (or rebuild the index by scanning
+    // the blocks, if the log was not closed)
+    bool open( const char *file );
+    void close();
+
+    int stream_count() const { return streams.size(); }
+    const flightlog_stream &stream( int i ) const { return streams[i]; }
+    int find_stream( const char *name ) const;
+
+    int block_count() const { return blocks.size(); }
+    const flightlog_block &block( int i ) const { return blocks[i]; }
+
+    // decompress block i into records (stream(block(i).stream)
+    // record_size bytes each)
+    bool read_block( int i, vector<uint8_t> *records ) const;
+
+    // true if the records were written in the other byte order; pass
+    // it on to flightlog_field::value().  (Doubles written in the
+    // other word order are put right by read_block().)
+    bool swapped() const { return swap; }
+
+    // true if the index was rebuilt from the blocks
+    bool recovered() const { return scanned; }
+
+    // the end of the last good block
+    off_t data_end() const { return end; }
+
+private:
+
+    bool read_header();
+    bool read_index();
+    bool scan_blocks();
+
+    int fd;
+    string name;
+    off_t data_start;
+    off_t end;
+    bool swap;
+    bool swap_words;            // of doubles, see LOG_DOUBLE_WORDS_SWAPPED
+    bool scanned;
+    vector<flightlog_stream> streams;
+    vector<flightlog_block> blocks;
+};
+
+
+// If file was never closed, cut off any partly written block and add
+// the index; repaired tells whether that was needed and blocks how
+// many blocks the file holds.  Returns false if the file is not a
+// flight log or cannot be rewritten.
+bool flightlog_repair( const char *file, bool *repaired = NULL,
+                       int *blocks = NULL );
+
+// the segment files of the flight log in dir, in order
+vector<string> flightlog_segments( const char *dir );
+
+// the name for the output of the flight in dir: the last component
+// of dir, with -2, -3, ... added when an earlier flight of the same
+// run (say flt00000 of another archive) has already taken it.  The
+// name is added to taken.
+string flightlog_out_name( const char *dir, vector<string> *taken );
+
+
+// Walks the records of one stream of a FlightLogReader in order.
+class FlightLogCursor {
+
+public:
+
+    FlightLogCursor( const FlightLogReader *reader, int stream );
+
+    // position before the first record at or after time, using the
+    // index to skip the blocks that end before it
+    bool seek( double time );
+
+    // the next record, or NULL at the end of the stream (or on a
+    // damaged block)
+    const uint8_t *next();
+
+    double time( const uint8_t *record ) const {
+        return reader->stream( stream ).time( record, reader->swapped() );
+    }
+
+private:
+
+    bool load( int i );
+
+    const FlightLogReader *reader;
+    int stream;
+    vector<int> blocks;         // the stream's blocks, in time order
+    int current;                // loaded entry of blocks, -1 for none
+    vector<uint8_t> records;
+    uint32_t pos;               // next record in the loaded block
+    uint32_t count;
+};
+
+
+// The least and greatest value of a field (min > max if it had none).
+struct flightlog_range {
+    double min;
+    double max;
+};
+
+
+// A summary of one flight: its log segments and its event log (see
+// events.h).  It is kept in summary.idx in the flight directory, so a
+// search through many flights reads a few kilobytes of each one
+// instead of decoding it, and decodes only the blocks whose field
+// ranges could match.
+struct flightlog_summary {
+
+    // a file summarized, to tell when the summary is out of date
+    struct source {
+        string name;
+        uint64_t size;
+        int64_t mtime;
+    };
+
+    struct stream {
+        string name;
+        vector<string> fields;
+        vector<flightlog_range> ranges;         // over the flight
+    };
+
+    struct block {
+        int segment;
+        int index;                              // block in the segment
+        int stream;                             // in streams
+        double first_time;
+        double last_time;
+        vector<flightlog_range> ranges;         // empty if unread
+    };
+
+    struct event {
+        double time;
+        int type;
+        int arg;
+        string text;
+    };
+
+    vector<source> sources;
+    double first_time;
+    double last_time;
+    bool has_position;          // gps fixes seen
+    double lat_min, lat_max;
+    double lon_min, lon_max;
+    vector<event> events;       // mode, link, autopilot and home
+    vector<stream> streams;
+    vector<block> blocks;
+
+    int find_stream( const char *name ) const;
+};
+
+
+// Bring the summary of the flight in dir up to date: load
+// summary.idx, or if it is missing, damaged or older than the logs,
+// rebuild it (decoding every block once) and save it.  rebuilt tells
+// which.  Returns false if dir has no readable flight log.
+bool flightlog_summary_update( const char *dir, flightlog_summary *summary,
+                               bool *rebuilt = NULL );
+
+
+#endif // _UGEAR_FLIGHTLOG_H
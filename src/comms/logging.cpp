@@ -1,25 +1,288 @@
 #include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <zlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "navigation/ahrs.h"
+#include "navigation/mnav.h"
+#include "props/props.hxx"
+#include "props/props_binary.hxx"
+#include "props/props_io.hxx"
+#include "props/props_journal.hxx"
+#include "util/exception.hxx"
+#include "util/sg_atomic.hxx"
+#include "util/timing.h"
 
+#include "blackbox.h"
+#include "events.h"
+#include "flightlog.h"
 #include "logging.h"
 
 // global variables for data file logging
 
-static gzFile fimu = NULL;
-static gzFile fgps = NULL;
-static gzFile fnav = NULL;
-static gzFile fservo = NULL;
-static gzFile fhealth = NULL;
+// The main loop never touches the log file.  Each data stream has a
+// ring of fixed size record slots; log_*() copies the record into the
+// next free slot and a writer thread hands whatever the rings hold to
+// the flight log (see flightlog.h), which compresses it in blocks.
+// Each ring has one producer (the main loop) and one consumer (the
+// writer thread), so no locks are needed.
+
+enum log_policy {
+    LOG_DROP_NEWEST,            // full queue: drop the incoming record
+    LOG_DECIMATE                // over half full: keep every other record
+};
+
+struct log_stream {
+    const char *name;
+    int record_size;
+    const flightlog_field_def *fields;
+    int field_count;
+    uint32_t slots;             // power of two
+    log_policy policy;
+
+    bool delta;                 // delta encode the blocks
+    int id;                     // stream number in the flight log
+    uint8_t *ring;
+
+    // shared by the two threads, through sg_load() and sg_store()
+    uint32_t head;              // advanced by the main loop
+    uint32_t tail;              // advanced by the writer thread
+    bool flush_request;         // set by the main loop
+
+    uint32_t offered;           // records given to log_*(), main loop
+    uint32_t dropped;           // records not queued, main loop
+    uint32_t failed;            // records not written, writer thread
+};
+
+enum { IMU_LOG, GPS_LOG, NAV_LOG, SERVO_LOG, HEALTH_LOG, NUM_LOGS };
+
+// the schema written at the head of the flight log
+
+static const flightlog_field_def imu_fields[] = {
+    LOG_FIELD( imu, time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( imu, p, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( imu, q, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( imu, r, LOG_DOUBLE, "rad/s" ),
+    LOG_FIELD( imu, ax, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( imu, ay, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( imu, az, LOG_DOUBLE, "m/s^2" ),
+    LOG_FIELD( imu, hx, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( imu, hy, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( imu, hz, LOG_DOUBLE, "gauss" ),
+    LOG_FIELD( imu, Ps, LOG_DOUBLE, "m" ),
+    LOG_FIELD( imu, Pt, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( imu, phi, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( imu, the, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( imu, psi, LOG_DOUBLE, "rad" ),
+    LOG_FIELD( imu, err_type, LOG_UINT64, "" )
+};
+
+// The compact imu record: the sensor values as the MNAV counts them,
+// and the attitudes quantized to 16 bits, delta encoded in the log.
+// 36 bytes instead of 136, and the deltas compress several times
+// better than the doubles.
+struct imu_counts {
+    uint32_t time;              // 0.1 ms
+    int16_t p, q, r;
+    int16_t ax, ay, az;
+    int16_t hx, hy, hz;
+    int16_t Ps, Pt;
+    int16_t phi, the, psi;
+    uint8_t err_type;
+};
+
+#define TIME_SCALE 1.0e-4
+#define ANGLE_SCALE (M_PI / 32768.0)
+
+static const flightlog_field_def imu_count_fields[] = {
+    LOG_SCALED( imu_counts, time, LOG_UINT32, "s", TIME_SCALE ),
+    LOG_SCALED( imu_counts, p, LOG_INT16, "rad/s", MNAV_GYRO_SCALE ),
+    LOG_SCALED( imu_counts, q, LOG_INT16, "rad/s", MNAV_GYRO_SCALE ),
+    LOG_SCALED( imu_counts, r, LOG_INT16, "rad/s", MNAV_GYRO_SCALE ),
+    LOG_SCALED( imu_counts, ax, LOG_INT16, "m/s^2", MNAV_ACCEL_SCALE ),
+    LOG_SCALED( imu_counts, ay, LOG_INT16, "m/s^2", MNAV_ACCEL_SCALE ),
+    LOG_SCALED( imu_counts, az, LOG_INT16, "m/s^2", MNAV_ACCEL_SCALE ),
+    LOG_SCALED( imu_counts, hx, LOG_INT16, "gauss", MNAV_MAG_SCALE ),
+    LOG_SCALED( imu_counts, hy, LOG_INT16, "gauss", MNAV_MAG_SCALE ),
+    LOG_SCALED( imu_counts, hz, LOG_INT16, "gauss", MNAV_MAG_SCALE ),
+    LOG_SCALED( imu_counts, Ps, LOG_INT16, "m", MNAV_PS_SCALE ),
+    LOG_SCALED( imu_counts, Pt, LOG_INT16, "m/s", MNAV_PT_SCALE ),
+    LOG_SCALED( imu_counts, phi, LOG_INT16, "rad", ANGLE_SCALE ),
+    LOG_SCALED( imu_counts, the, LOG_INT16, "rad", ANGLE_SCALE ),
+    LOG_SCALED( imu_counts, psi, LOG_INT16, "rad", ANGLE_SCALE ),
+    LOG_FIELD( imu_counts, err_type, LOG_UINT8, "" )
+};
+
+static const flightlog_field_def gps_fields[] = {
+    LOG_FIELD( gps, time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( gps, lat, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( gps, lon, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( gps, alt, LOG_DOUBLE, "m" ),
+    LOG_FIELD( gps, ve, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( gps, vn, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( gps, vd, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( gps, ITOW, LOG_DOUBLE, "s" ),
+    LOG_FIELD( gps, err_type, LOG_UINT64, "" )
+};
+
+static const flightlog_field_def nav_fields[] = {
+    LOG_FIELD( nav, time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( nav, lat, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( nav, lon, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( nav, alt, LOG_DOUBLE, "m" ),
+    LOG_FIELD( nav, ve, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( nav, vn, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( nav, vd, LOG_DOUBLE, "m/s" ),
+    LOG_FIELD( nav, err_type, LOG_UINT64, "" )
+};
+
+static const flightlog_field_def servo_fields[] = {
+    LOG_FIELD( servo, time, LOG_DOUBLE, "s" ),
+    LOG_ELEMENT( servo, chn, 0, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 1, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 2, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 3, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 4, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 5, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 6, LOG_UINT16, "" ),
+    LOG_ELEMENT( servo, chn, 7, LOG_UINT16, "" ),
+    LOG_FIELD( servo, status, LOG_UINT64, "" )
+};
+
+static const flightlog_field_def health_fields[] = {
+    LOG_FIELD( health, time, LOG_DOUBLE, "s" ),
+    LOG_FIELD( health, target_roll_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( health, target_heading_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( health, target_pitch_deg, LOG_DOUBLE, "deg" ),
+    LOG_FIELD( health, target_climb_fps, LOG_DOUBLE, "ft/s" ),
+    LOG_FIELD( health, target_altitude_ft, LOG_DOUBLE, "ft" ),
+    LOG_FIELD( health, command_sequence, LOG_UINT64, "" ),
+    LOG_FIELD( health, target_waypoint, LOG_UINT64, "" ),
+    LOG_FIELD( health, loadavg, LOG_UINT64, "1/100" ),
+    LOG_FIELD( health, ahrs_hz, LOG_UINT64, "Hz" ),
+    LOG_FIELD( health, nav_hz, LOG_UINT64, "Hz" ),
+    LOG_FIELD( health, log_queue_depth, LOG_UINT64, "" ),
+    LOG_FIELD( health, log_write_usec, LOG_UINT64, "us" ),
+    LOG_FIELD( health, log_dropped, LOG_UINT64, "" )
+};
+
+#define FIELDS( f ) f, sizeof(f) / sizeof(f[0])
+
+// the rest of a log_stream until logging_init(): not delta encoded,
+// no flight log stream, no ring yet, empty and uncounted
+#define STREAM_IDLE false, -1, NULL, 0, 0, false, 0, 0, 0
+
+// about 10 seconds of each stream at its normal rate, enough to ride
+// out a slow MMC write
+static log_stream streams[NUM_LOGS] = {
+    { "imu", sizeof(struct imu), FIELDS(imu_fields), 512, LOG_DECIMATE,
+      STREAM_IDLE },
+    { "gps", sizeof(struct gps), FIELDS(gps_fields), 64, LOG_DROP_NEWEST,
+      STREAM_IDLE },
+    { "nav", sizeof(struct nav), FIELDS(nav_fields), 256, LOG_DECIMATE,
+      STREAM_IDLE },
+    { "servo", sizeof(struct servo), FIELDS(servo_fields), 512,
+      LOG_DECIMATE, STREAM_IDLE },
+    { "health", sizeof(struct health), FIELDS(health_fields), 64,
+      LOG_DROP_NEWEST, STREAM_IDLE }
+};
+
+// The event ring is drained to events.log (see events.h) rather than
+// to the flight log, so an event reaches the disk as soon as the
+// writer sees it instead of waiting for a block to fill.
+static log_stream event_stream =
+    { "events", sizeof(struct event_record), NULL, 0, 64, LOG_DROP_NEWEST,
+      STREAM_IDLE };
+static int event_fd = -1;
+static int event_level = EVENT_INFO;    // events below this are ignored
+
+// Channels are streams defined in the config (/config/data/channel):
+// a set of properties sampled at a chosen rate.  Between samples a
+// channel can keep the mean, or the minimum and maximum, of each
+// property over the frames since the last sample.
+
+enum channel_policy {
+    CHANNEL_SAMPLE,             // the value at the sample time
+    CHANNEL_MEAN,               // the mean over the interval
+    CHANNEL_MINMAX              // the minimum and maximum
+};
+
+struct log_channel {
+    string name;
+    channel_policy policy;
+    double interval;            // seconds between records
+    double next_time;
+
+    vector<SGPropertyNode_ptr> nodes;
+    vector<double> sum;
+    vector<double> min;
+    vector<double> max;
+    int frames;                 // since the last record
+
+    vector<string> field_names;
+    vector<flightlog_field_def> fields;
+    vector<double> record;      // time, then the values
+    log_stream stream;
+};
+
+static vector<log_channel *> channels;
+
+// the fixed streams and the channels
+static vector<log_stream *> all_streams;
+
+static FlightLogWriter *flight_log = NULL;
+
+// The log is written in segments of about segment_bytes.  A segment
+// is synced to the disk when it is closed, so a power loss costs at
+// most the open segment, and flightlog_repair() saves the part of
+// that which reached the disk.  Whole flights, then black box
+// snapshots, oldest first, are deleted to keep the log directory
+// (black box included) under budget_bytes.
+static int flight_num = 0;
+static int segment_num = 0;
+static uint64_t segment_bytes = 1024 * 1024;
+static uint64_t budget_bytes = 0;       // no limit
+
+// log the imu as struct imu_counts
+static bool log_imu_counts = false;
+
+static pthread_t writer_thread;
+static SGAtomic<bool> writer_running( false );
+static SGAtomic<uint32_t> write_usec_max( 0 ); // slowest write since reported
+
+static void *log_writer( void * );
 
 bool log_to_file = false;       // log to file is enabled/disabled
 SGPath log_path;                // base log path
 bool display_on = false;        // dump summary to display periodically
 
+SGPath flight_dir;              // this flight's log directory
+
+// journal of every property write, see journal_init()
+static SGPropertyJournal *journal = NULL;
+
+// property subtrees saved by checkpoint_update()
+static vector<string> checkpoint_nodes;
+static double checkpoint_interval = 10.0;
+static double checkpoint_time = 0.0;
+static SGPath checkpoint_file;
+
+// the latest checkpoint, encoded by the main loop and saved by the
+// writer thread; the main loop leaves it alone while it is pending
+static string checkpoint_buffer;
+static SGAtomic<bool> checkpoint_pending( false );
+
 
 // scan the base path for fltNNNN directories.  Return the biggest
 // flight number
@@ -53,11 +316,369 @@ int max_flight_num() {
 }
 
 
+// set up the channels listed in the config
+static void channels_init( SGPropertyNode *config ) {
+    vector<SGPropertyNode_ptr> defs = config->getChildren("channel");
+    for ( unsigned int i = 0; i < defs.size(); i++ ) {
+        SGPropertyNode *def = defs[i];
+        log_channel *c = new log_channel;
+        c->name = def->getStringValue("name", "channel");
+        bool taken = false;
+        for ( int j = 0; j < NUM_LOGS; j++ ) {
+            taken = taken || c->name == streams[j].name;
+        }
+        for ( unsigned int j = 0; j < channels.size(); j++ ) {
+            taken = taken || c->name == channels[j]->name;
+        }
+        if ( taken ) {
+            printf("Channel %s: the name is taken\n", c->name.c_str());
+            delete c;
+            continue;
+        }
+
+        string policy = def->getStringValue("policy", "sample");
+        if ( policy == "mean" ) {
+            c->policy = CHANNEL_MEAN;
+        } else if ( policy == "min-max" ) {
+            c->policy = CHANNEL_MINMAX;
+        } else {
+            if ( policy != "sample" ) {
+                printf("Channel %s: unknown policy %s, sampling\n",
+                       c->name.c_str(), policy.c_str());
+            }
+            c->policy = CHANNEL_SAMPLE;
+        }
+
+        double rate = def->getDoubleValue("rate-hz", 1.0);
+        c->interval = rate > 0.0 ? 1.0 / rate : 0.0;
+        c->next_time = 0.0;
+
+        c->field_names.push_back( "time" );
+        vector<SGPropertyNode_ptr> props = def->getChildren("property");
+        for ( unsigned int j = 0; j < props.size(); j++ ) {
+            string path = props[j]->getStringValue();
+            c->nodes.push_back( fgGetNode( path.c_str(), true ) );
+            if ( c->policy == CHANNEL_MINMAX ) {
+                c->field_names.push_back( path + ".min" );
+                c->field_names.push_back( path + ".max" );
+            } else {
+                c->field_names.push_back( path );
+            }
+        }
+        if ( c->nodes.empty() ) {
+            printf("Channel %s has no properties\n", c->name.c_str());
+            delete c;
+            continue;
+        }
+
+        int n = c->nodes.size();
+        c->sum.resize( n );
+        c->min.resize( n );
+        c->max.resize( n );
+        c->frames = 0;
+        c->record.resize( c->field_names.size() );
+        for ( unsigned int j = 0; j < c->field_names.size(); j++ ) {
+            flightlog_field_def f = { c->field_names[j].c_str(), LOG_DOUBLE,
+                                      (int)(j * sizeof(double)),
+                                      j == 0 ? "s" : "", 0.0 };
+            c->fields.push_back( f );
+        }
+
+        // room for about 10 seconds of records
+        uint32_t slots = 16;
+        while ( slots < 1024 && slots < rate * 10.0 ) {
+            slots *= 2;
+        }
+
+        log_stream *s = &c->stream;
+        s->name = c->name.c_str();
+        s->record_size = c->record.size() * sizeof(double);
+        s->fields = &c->fields[0];
+        s->field_count = c->fields.size();
+        s->slots = slots;
+        s->policy = LOG_DROP_NEWEST;
+        s->delta = false;
+        s->id = -1;
+        s->ring = NULL;
+        s->head = s->tail = 0;
+        s->flush_request = false;
+        s->offered = s->dropped = s->failed = 0;
+
+        channels.push_back( c );
+        printf("Channel %s: %d properties at %.1f hz\n", c->name.c_str(),
+               n, rate);
+    }
+}
+
+
+// repair the segments of a flight log that was cut off by a crash or
+// power loss
+static void logging_recover( int num ) {
+    char dir[256];
+    snprintf( dir, 256, "%s/flt%05d", log_path.c_str(), num );
+
+    vector<string> segments = flightlog_segments( dir );
+    for ( unsigned int i = 0; i < segments.size(); i++ ) {
+        bool repaired = false;
+        int blocks = 0;
+        if ( !flightlog_repair( segments[i].c_str(), &repaired, &blocks ) ) {
+            printf("Cannot recover %s\n", segments[i].c_str());
+        } else if ( repaired ) {
+            printf("Recovered %d blocks of %s\n", blocks,
+                   segments[i].c_str());
+        }
+    }
+}
+
+
+// bytes in the regular files of dir, and their names (sorted)
+static uint64_t dir_bytes( const string &dir, vector<string> *files ) {
+    uint64_t bytes = 0;
+
+    DIR *d = opendir( dir.c_str() );
+    if ( d == NULL ) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        string file = dir + "/" + entry->d_name;
+        struct stat st;
+        if ( stat( file.c_str(), &st ) == 0 && S_ISREG(st.st_mode) ) {
+            bytes += st.st_size;
+            if ( files != NULL ) {
+                files->push_back( file );
+            }
+        }
+    }
+    closedir( d );
+
+    if ( files != NULL ) {
+        sort( files->begin(), files->end() );
+    }
+    return bytes;
+}
+
+
+// delete a flight or black box snapshot directory and its files
+static void remove_log_dir( const char *dir ) {
+    vector<string> files;
+    dir_bytes( dir, &files );
+    for ( unsigned int j = 0; j < files.size(); j++ ) {
+        unlink( files[j].c_str() );
+    }
+    rmdir( dir );
+    printf("Log budget: deleted %s\n", dir);
+}
+
+
+// delete the oldest flights, then the oldest black box snapshots,
+// until the log directory fits the byte budget.  The black box file
+// counts against the budget but is never deleted.  If this flight
+// alone is over budget, its oldest closed segments go too.
+static void logging_evict() {
+    if ( budget_bytes == 0 ) {
+        return;
+    }
+
+    vector<int> flights;
+    vector<int> snapshots;
+    DIR *d = opendir( log_path.c_str() );
+    if ( d == NULL ) {
+        return;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        int num;
+        if ( sscanf( entry->d_name, "flt%d", &num ) == 1 ) {
+            flights.push_back( num );
+        } else if ( sscanf( entry->d_name, "bb%d", &num ) == 1 ) {
+            snapshots.push_back( num );
+        }
+    }
+    closedir( d );
+    sort( flights.begin(), flights.end() );
+    sort( snapshots.begin(), snapshots.end() );
+
+    uint64_t total = 0;
+    vector<uint64_t> sizes;
+    for ( unsigned int i = 0; i < flights.size(); i++ ) {
+        char dir[256];
+        snprintf( dir, 256, "%s/flt%05d", log_path.c_str(), flights[i] );
+        sizes.push_back( dir_bytes( dir, NULL ) );
+        total += sizes.back();
+    }
+    vector<uint64_t> snapshot_sizes;
+    for ( unsigned int i = 0; i < snapshots.size(); i++ ) {
+        char dir[256];
+        snprintf( dir, 256, "%s/bb%05d", log_path.c_str(), snapshots[i] );
+        snapshot_sizes.push_back( dir_bytes( dir, NULL ) );
+        total += snapshot_sizes.back();
+    }
+    SGPath box_file = log_path;
+    box_file.append( "blackbox.bin" );
+    struct stat box_st;
+    if ( stat( box_file.c_str(), &box_st ) == 0 ) {
+        total += box_st.st_size;
+    }
+
+    for ( unsigned int i = 0; i < flights.size() && total > budget_bytes;
+          i++ )
+    {
+        if ( flights[i] == flight_num ) {
+            continue;
+        }
+        char dir[256];
+        snprintf( dir, 256, "%s/flt%05d", log_path.c_str(), flights[i] );
+        remove_log_dir( dir );
+        total -= sizes[i];
+    }
+
+    // the newest snapshot may still be being written
+    for ( int i = 0; i < (int)snapshots.size() - 1 && total > budget_bytes;
+          i++ )
+    {
+        char dir[256];
+        snprintf( dir, 256, "%s/bb%05d", log_path.c_str(), snapshots[i] );
+        remove_log_dir( dir );
+        total -= snapshot_sizes[i];
+    }
+
+    if ( total > budget_bytes ) {
+        vector<string> segments = flightlog_segments( flight_dir.c_str() );
+        for ( int i = 0; i < (int)segments.size() - 1 && total > budget_bytes;
+              i++ )
+        {
+            struct stat st;
+            if ( stat( segments[i].c_str(), &st ) == 0
+                 && unlink( segments[i].c_str() ) == 0 )
+            {
+                total -= st.st_size;
+                printf("Log budget: deleted %s\n", segments[i].c_str());
+            }
+        }
+    }
+}
+
+
+// create this flight's event log
+static bool events_open() {
+    SGPath file = flight_dir;
+    file.append( "events.log" );
+    event_fd = open( file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( event_fd < 0 ) {
+        printf("Cannot open %s\n", file.c_str());
+        return false;
+    }
+
+    uint8_t header[8];
+    uint16_t version = EVENTS_VERSION;
+    uint16_t size = sizeof(struct event_record);
+    memcpy( header, "UGEV", 4 );
+    memcpy( header + 4, &version, 2 );
+    memcpy( header + 6, &size, 2 );
+    if ( write( event_fd, header, 8 ) != 8 ) {
+        printf("Cannot write %s\n", file.c_str());
+        close( event_fd );
+        event_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+
+// start the next segment of this flight's log
+static bool segment_open() {
+    char name[32];
+    snprintf( name, 32, "flight-%04d.log", segment_num );
+    SGPath file = flight_dir;
+    file.append( name );
+    if ( !flight_log->open( file.c_str() ) ) {
+        printf("Cannont open %s\n", file.c_str());
+        return false;
+    }
+
+    // make the new file's directory entry durable too
+    int fd = open( flight_dir.c_str(), O_RDONLY );
+    if ( fd >= 0 ) {
+        fsync( fd );
+        close( fd );
+    }
+
+    return true;
+}
+
+
+// close the current segment (syncing it) and open the next
+static bool segment_next() {
+    bool result = flight_log->close();
+    segment_num++;
+    result = segment_open() && result;
+    logging_evict();
+
+    return result;
+}
+
+
+// empty a stream's queue and zero its counts
+static void stream_reset( log_stream *s ) {
+    if ( s->ring == NULL ) {
+        // touch the slots now rather than fault them in during flight
+        s->ring = (uint8_t *)calloc( s->slots, s->record_size );
+    }
+    s->head = s->tail = 0;
+    s->flush_request = false;
+    s->offered = s->dropped = s->failed = 0;
+}
+
+
+static void stream_report( log_stream *s ) {
+    if ( s->dropped > 0 ) {
+        printf("%s log: %u of %u records dropped\n", s->name,
+               s->dropped, s->offered);
+    }
+    if ( s->failed > 0 ) {
+        printf("%s log: %u records could not be written\n", s->name,
+               s->failed);
+    }
+}
+
+
 bool logging_init() {
     // find the biggest flight number logged so far
     int max = max_flight_num();
     printf("Max log dir is flt%05d\n", max);
 
+    // the last flight may have ended with the power
+    if ( max >= 0 ) {
+        logging_recover( max );
+    }
+
+    SGPropertyNode *config = fgGetNode("/config/data", true);
+    segment_bytes = (uint64_t)config->getIntValue("segment-kb", 1024) * 1024;
+    budget_bytes = (uint64_t)config->getIntValue("budget-mb", 0)
+        * 1024 * 1024;
+
+    // (the ring size is fixed once allocated)
+    if ( config->getBoolValue("imu-counts")
+         && streams[IMU_LOG].ring == NULL )
+    {
+        log_stream *s = &streams[IMU_LOG];
+        s->record_size = sizeof(struct imu_counts);
+        s->fields = imu_count_fields;
+        s->field_count = sizeof(imu_count_fields)
+            / sizeof(imu_count_fields[0]);
+        s->delta = true;
+        log_imu_counts = true;
+    }
+
+    const char *level = config->getStringValue("event-level", "info");
+    event_level = event_severity_value( level );
+    if ( event_level < 0 ) {
+        printf("Unknown event level %s, using info\n", level);
+        event_level = EVENT_INFO;
+    }
+
 
     // make the new logging directory
     char new_dir[256];
@@ -67,110 +688,564 @@ bool logging_init() {
     if ( result != 0 ) {
         printf("Error: creating %s\n", new_dir);
     }
+    flight_dir = new_dir;
+    flight_num = max + 1;
+    segment_num = 0;
 
-    // open all the logging files
+    // make room for this flight
+    logging_evict();
 
-    SGPath file;
+    // open the flight log
 
-    file = new_dir; file.append( "imu.dat.gz" );
-    if ( (fimu = gzopen( file.c_str(), "w+b" )) == NULL ) {
-        printf("Cannont open %s\n", file.c_str());
+    all_streams.clear();
+    for ( int i = 0; i < NUM_LOGS; i++ ) {
+        all_streams.push_back( &streams[i] );
+    }
+    channels_init( config );
+    for ( unsigned int i = 0; i < channels.size(); i++ ) {
+        all_streams.push_back( &channels[i]->stream );
+    }
+
+    delete flight_log;
+    flight_log = new FlightLogWriter;
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        log_stream *s = all_streams[i];
+        s->id = flight_log->add_stream( s->name, s->record_size,
+                                        s->fields, s->field_count, "time",
+                                        s->delta );
+        if ( s->id < 0 ) {
+            return false;
+        }
+    }
+
+    if ( !segment_open() || !events_open() ) {
         return false;
     }
 
-    file = new_dir; file.append( "gps.dat.gz" );
-    if ( (fgps = gzopen( file.c_str(), "w+b" )) == NULL ) {
-        printf("Cannont open %s\n", file.c_str());
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        stream_reset( all_streams[i] );
+    }
+    stream_reset( &event_stream );
+
+    writer_running = true;
+    if ( pthread_create( &writer_thread, NULL, log_writer, NULL ) != 0 ) {
+        printf("Cannot start the log writer thread\n");
+        writer_running = false;
         return false;
     }
 
-    file = new_dir; file.append( "nav.dat.gz" );
-    if ( (fnav = gzopen( file.c_str(), "w+b" )) == NULL ) {
-        printf("Cannont open %s\n", file.c_str());
+    return true;
+}
+
+
+bool logging_close() {
+    // let the writer drain the queues, then close the log
+
+    if ( writer_running ) {
+        writer_running = false;
+        pthread_join( writer_thread, NULL );
+    }
+
+    if ( flight_log != NULL ) {
+        flight_log->close();
+        delete flight_log;
+        flight_log = NULL;
+    }
+
+    if ( event_fd >= 0 ) {
+        fsync( event_fd );
+        close( event_fd );
+        event_fd = -1;
+    }
+
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        stream_report( all_streams[i] );
+    }
+    stream_report( &event_stream );
+
+    all_streams.clear();
+    for ( unsigned int i = 0; i < channels.size(); i++ ) {
+        free( channels[i]->stream.ring );
+        delete channels[i];
+    }
+    channels.clear();
+
+    if ( journal != NULL ) {
+        journal->close();
+        printf("Property journal: %lu writes recorded, %lu dropped\n",
+               journal->getRecorded(), journal->getDropped());
+    }
+
+    return true;
+}
+
+
+// start journaling every property write to props.jnl.gz in the
+// flight's log directory (logging_init() must have succeeded).  The
+// main thread only copies each write into a ring; a separate thread
+// compresses it.  Rebuild the tree at any frame with the replay tool.
+bool journal_init() {
+    if ( journal == NULL ) {
+        int ring_size = fgGetNode("/config/data/journal-records", true)
+            ->getIntValue();
+        journal = ring_size > 0 ? new SGPropertyJournal( ring_size )
+                                : new SGPropertyJournal;
+    }
+
+    SGPath file = flight_dir;
+    file.append( "props.jnl.gz" );
+    try {
+        journal->open( file.str(), props );
+    } catch ( const sg_exception &exc ) {
+        printf("Cannot open %s\n", file.c_str());
         return false;
     }
 
-    file = new_dir; file.append( "servo.dat.gz" );
-    if ( (fservo = gzopen( file.c_str(),"w+b" )) == NULL ) {
-        printf("Cannont open %s\n", file.c_str());
+    return true;
+}
+
+
+// mark the start of a main loop frame in the property journal
+void journal_frame( double current_time ) {
+    if ( journal != NULL ) {
+        journal->frame( current_time );
+    }
+}
+
+
+// queue one record, or count it as dropped if the stream's policy
+// says so.  Runs in the main loop; costs one memcpy.
+static void log_push( log_stream *s, const void *record ) {
+    if ( s->ring == NULL || !writer_running ) {
+        return;
+    }
+
+    uint32_t used = s->head - sg_load( &s->tail, SG_ACQUIRE );
+    s->offered++;
+    if ( used >= s->slots
+         || (s->policy == LOG_DECIMATE && used >= s->slots / 2
+             && (s->offered & 1)) )
+    {
+        s->dropped++;
+        return;
+    }
+
+    uint32_t slot = s->head & (s->slots - 1);
+    memcpy( s->ring + slot * s->record_size, record, s->record_size );
+    sg_store( &s->head, s->head + 1, SG_RELEASE );  // record before head
+}
+
+
+// keep the slowest write since logging_write_usec() was last called
+static void note_write_time( double start ) {
+    uint32_t usec = (uint32_t)((get_Time() - start) * 1000000.0);
+    uint32_t max = write_usec_max.load();
+    while ( usec > max && !write_usec_max.compare_exchange( max, usec ) )
+        ;
+}
+
+
+// write out everything queued on one stream and do any flush the
+// main loop asked for.  Returns false if there was nothing to do.
+static bool log_drain( log_stream *s ) {
+    uint32_t head = sg_load( &s->head, SG_ACQUIRE );
+    uint32_t tail = s->tail;
+    // take the request, so one made while this flush runs is kept
+    bool flush = sg_exchange( &s->flush_request, false );
+    if ( head == tail && !flush ) {
         return false;
     }
 
-    file = new_dir; file.append( "health.dat.gz" );
-    if ( (fhealth = gzopen( file.c_str(), "w+b" )) == NULL ) {
-        printf("Cannont open %s\n", file.c_str());
+    double start = get_Time();
+    while ( tail != head ) {
+        uint32_t slot = tail & (s->slots - 1);
+        flight_log->write( s->id, s->ring + slot * s->record_size );
+        tail++;
+    }
+    if ( flush ) {
+        flight_log->flush( s->id );
+    }
+    note_write_time( start );
+
+    sg_store( &s->tail, tail, SG_RELEASE );  // slots read before reuse
+    return true;
+}
+
+
+// append the queued events to events.log and sync it, so the events
+// before a crash survive it.  Returns false if there were none.
+static bool event_drain() {
+    log_stream *s = &event_stream;
+    uint32_t head = sg_load( &s->head, SG_ACQUIRE );
+    uint32_t tail = s->tail;
+    if ( head == tail ) {
         return false;
     }
 
+    double start = get_Time();
+    while ( tail != head ) {
+        // the records up to the end of the ring in one write
+        uint32_t slot = tail & (s->slots - 1);
+        uint32_t count = head - tail;
+        if ( count > s->slots - slot ) {
+            count = s->slots - slot;
+        }
+        size_t bytes = count * s->record_size;
+        if ( write( event_fd, s->ring + slot * s->record_size, bytes )
+             != (ssize_t)bytes )
+        {
+            s->failed += count;
+        }
+        tail += count;
+    }
+    fdatasync( event_fd );
+    note_write_time( start );
+
+    sg_store( &s->tail, tail, SG_RELEASE );  // slots read before reuse
     return true;
 }
 
 
-bool logging_close() {
-    // close files
+// save checkpoint_buffer under a temporary name and rename it into
+// place, so a reset mid-write leaves the previous checkpoint intact
+static void checkpoint_write() {
+    string tmp = checkpoint_file.str() + ".tmp";
+    FILE *fp = fopen( tmp.c_str(), "wb" );
+    if ( fp == NULL ) {
+        printf("Cannot write %s\n", tmp.c_str());
+        return;
+    }
+    bool ok = fwrite( checkpoint_buffer.data(), 1, checkpoint_buffer.size(),
+                      fp ) == checkpoint_buffer.size();
+    if ( fclose( fp ) != 0 || !ok ) {
+        printf("Cannot write %s\n", tmp.c_str());
+        return;
+    }
+    if ( rename( tmp.c_str(), checkpoint_file.c_str() ) != 0 ) {
+        printf("Cannot rename %s\n", tmp.c_str());
+    }
+}
 
-    gzclose(fimu);
-    gzclose(fgps);
-    gzclose(fnav);
-    gzclose(fservo);
-    gzclose(fhealth);
 
+// save the checkpoint the main loop handed over, if any.  Returns
+// false if there was none.
+static bool checkpoint_drain() {
+    if ( !checkpoint_pending.load( SG_ACQUIRE ) ) {
+        return false;
+    }
+
+    double start = get_Time();
+    checkpoint_write();
+    note_write_time( start );
+
+    checkpoint_pending.store( false, SG_RELEASE );
     return true;
 }
 
 
+// the log writer thread: drain the queues until logging_close()
+static void *log_writer( void * ) {
+    while ( writer_running ) {
+        bool busy = event_drain();
+        busy = checkpoint_drain() || busy;
+        for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+            busy = log_drain( all_streams[i] ) || busy;
+        }
+        if ( flight_log->is_open()
+             && flight_log->bytes_written() >= segment_bytes )
+        {
+            double start = get_Time();
+            segment_next();
+            note_write_time( start );
+        }
+        if ( !busy ) {
+            usleep( 20000 );
+        }
+    }
+
+    event_drain();
+    checkpoint_drain();
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        log_drain( all_streams[i] );
+    }
+
+    return NULL;
+}
+
+
 void log_gps( struct gps *gpspacket ) {
-    gzwrite( fgps, gpspacket, sizeof(struct gps) );
+    log_push( &streams[GPS_LOG], gpspacket );
+}
+
+
+// a value as a 16 bit count of scale
+static int16_t count16( double value, double scale ) {
+    double count = value / scale;
+    if ( count > 32767.0 ) {
+        return 32767;
+    } else if ( count < -32768.0 ) {
+        return -32768;
+    }
+    return (int16_t)lrint( count );
 }
 
 
 void log_imu( struct imu *imupacket ) {
-    gzwrite( fimu, imupacket, sizeof(struct imu) );
+    if ( !log_imu_counts ) {
+        log_push( &streams[IMU_LOG], imupacket );
+        return;
+    }
+
+    struct imu_counts c;
+    memset( &c, 0, sizeof(c) );  // no stray bytes in the padding
+    c.time = (uint32_t)lrint( imupacket->time / TIME_SCALE );
+    c.p = count16( imupacket->p, MNAV_GYRO_SCALE );
+    c.q = count16( imupacket->q, MNAV_GYRO_SCALE );
+    c.r = count16( imupacket->r, MNAV_GYRO_SCALE );
+    c.ax = count16( imupacket->ax, MNAV_ACCEL_SCALE );
+    c.ay = count16( imupacket->ay, MNAV_ACCEL_SCALE );
+    c.az = count16( imupacket->az, MNAV_ACCEL_SCALE );
+    c.hx = count16( imupacket->hx, MNAV_MAG_SCALE );
+    c.hy = count16( imupacket->hy, MNAV_MAG_SCALE );
+    c.hz = count16( imupacket->hz, MNAV_MAG_SCALE );
+    c.Ps = count16( imupacket->Ps, MNAV_PS_SCALE );
+    c.Pt = count16( imupacket->Pt, MNAV_PT_SCALE );
+    c.phi = count16( imupacket->phi, ANGLE_SCALE );
+    c.the = count16( imupacket->the, ANGLE_SCALE );
+    c.psi = count16( imupacket->psi, ANGLE_SCALE );
+    c.err_type = imupacket->err_type;
+    log_push( &streams[IMU_LOG], &c );
 }
 
 
 void log_nav( struct nav *navpacket ) {
-    gzwrite( fnav, navpacket, sizeof(struct nav) );
+    log_push( &streams[NAV_LOG], navpacket );
 }
 
 
 void log_servo( struct servo *servopacket ) {
-    gzwrite( fservo, servopacket, sizeof(struct servo) );
+    log_push( &streams[SERVO_LOG], servopacket );
 }
 
 
 void log_health( struct health *healthpacket ) {
-    gzwrite( fhealth, healthpacket, sizeof(struct health) );
+    log_push( &streams[HEALTH_LOG], healthpacket );
 }
 
 
+// the flushes are done by the writer thread, these only ask for one
 void flush_gps() {
-    // printf("flush gps\n");
-    gzflush( fgps, Z_SYNC_FLUSH );
+    sg_store( &streams[GPS_LOG].flush_request, true );
 }
 
 
 void flush_imu() {
-    // printf("flush imu\n");
-    gzflush( fimu, Z_SYNC_FLUSH );
+    sg_store( &streams[IMU_LOG].flush_request, true );
 }
 
 
 void flush_nav() {
-    // printf("flush nav\n");
-    gzflush( fnav, Z_SYNC_FLUSH );
+    sg_store( &streams[NAV_LOG].flush_request, true );
 }
 
 
 void flush_servo() {
-    // printf("flush servo\n");
-    gzflush( fservo, Z_SYNC_FLUSH );
+    sg_store( &streams[SERVO_LOG].flush_request, true );
 }
 
 
 void flush_health() {
-    // printf("flush health\n");
-    gzflush( fhealth, Z_SYNC_FLUSH );
+    sg_store( &streams[HEALTH_LOG].flush_request, true );
+}
+
+
+// sample the channels; called every frame
+void log_channels( double current_time ) {
+    for ( unsigned int i = 0; i < channels.size(); i++ ) {
+        log_channel *c = channels[i];
+        int n = c->nodes.size();
+
+        if ( c->policy != CHANNEL_SAMPLE ) {
+            for ( int j = 0; j < n; j++ ) {
+                double v = c->nodes[j]->getDoubleValue();
+                if ( c->frames == 0 ) {
+                    c->sum[j] = c->min[j] = c->max[j] = v;
+                } else {
+                    c->sum[j] += v;
+                    if ( v < c->min[j] ) c->min[j] = v;
+                    if ( v > c->max[j] ) c->max[j] = v;
+                }
+            }
+            c->frames++;
+        }
+
+        if ( current_time < c->next_time ) {
+            continue;
+        }
+        c->next_time += c->interval;
+        if ( c->next_time < current_time ) {
+            // fell behind (or just started); don't try to catch up
+            c->next_time = current_time + c->interval;
+        }
+
+        c->record[0] = current_time;
+        for ( int j = 0; j < n; j++ ) {
+            switch ( c->policy ) {
+            case CHANNEL_SAMPLE:
+                c->record[1 + j] = c->nodes[j]->getDoubleValue();
+                break;
+            case CHANNEL_MEAN:
+                c->record[1 + j] = c->sum[j] / c->frames;
+                break;
+            case CHANNEL_MINMAX:
+                c->record[1 + 2 * j] = c->min[j];
+                c->record[2 + 2 * j] = c->max[j];
+                break;
+            }
+        }
+        c->frames = 0;
+
+        log_push( &c->stream, &c->record[0] );
+    }
+}
+
+
+void flush_channels() {
+    for ( unsigned int i = 0; i < channels.size(); i++ ) {
+        sg_store( &channels[i]->stream.flush_request, true );
+    }
+}
+
+
+// log an event (see events.h); ignored if its severity is below the
+// configured /config/data/event-level.  Costs a snprintf() and a copy
+// into the event ring.  When the flight log is not open (logging is
+// off or failed to start) the event is printed to the console
+// instead, so it is not lost.  Mode changes, link loss and autopilot
+// disengages also save the black box.
+void log_event( int type, int severity, int arg, const char *format, ... )
+{
+    if ( type == EVENT_MODE || type == EVENT_LINK
+         || (type == EVENT_AUTOPILOT && arg == 0) )
+    {
+        blackbox_snapshot( event_type_name( type ) );
+    }
+
+    if ( severity < event_level ) {
+        return;
+    }
+
+    struct event_record e;
+    memset( &e, 0, sizeof(e) );
+    e.time = get_Time();
+    e.type = type;
+    e.severity = severity;
+    e.flags = LOG_DOUBLE_WORDS_SWAPPED ? EVENT_DOUBLE_WORDS_SWAPPED : 0;
+    e.arg = arg;
+    if ( format != NULL ) {
+        va_list ap;
+        va_start( ap, format );
+        vsnprintf( e.text, sizeof(e.text), format, ap );
+        va_end( ap );
+    }
+
+    if ( event_stream.ring == NULL || !writer_running ) {
+        printf("event: %10.3f %-7s %-8s %6d %s\n", e.time,
+               event_severity_name( e.severity ), event_type_name( e.type ),
+               e.arg, e.text);
+        return;
+    }
+
+    log_push( &event_stream, &e );
+}
+
+
+// records waiting in the log queues
+int logging_queue_depth() {
+    int depth = event_stream.head - sg_load( &event_stream.tail );
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        depth += all_streams[i]->head - sg_load( &all_streams[i]->tail );
+    }
+    return depth;
+}
+
+
+// slowest log write or flush since the last call, in microseconds
+int logging_write_usec() {
+    return write_usec_max.exchange( 0 );
+}
+
+
+// records dropped because a queue was full
+int logging_dropped() {
+    int dropped = event_stream.dropped;
+    for ( unsigned int i = 0; i < all_streams.size(); i++ ) {
+        dropped += all_streams[i]->dropped;
+    }
+    return dropped;
+}
+
+
+// read the /config/checkpoint settings and restore the subtrees
+// saved by a previous run, if there is a checkpoint file.  Returns
+// false if checkpoints are disabled.
+bool checkpoint_init() {
+    SGPropertyNode *config = fgGetNode("/config/checkpoint", true);
+    if ( !config->getBoolValue("enable") ) {
+        return false;
+    }
+    checkpoint_interval = config->getDoubleValue("interval-sec", 10.0);
+
+    vector<SGPropertyNode_ptr> nodes = config->getChildren("node");
+    for ( unsigned int i = 0; i < nodes.size(); i++ ) {
+        checkpoint_nodes.push_back( nodes[i]->getStringValue() );
+    }
+
+    checkpoint_file = log_path;
+    checkpoint_file.append( "checkpoint.bin" );
+    try {
+        readBinaryProperties( checkpoint_file.str(), props );
+        printf("Restored checkpoint from %s\n", checkpoint_file.c_str());
+    } catch ( const sg_exception &exc ) {
+        printf("No checkpoint restored from %s\n", checkpoint_file.c_str());
+    }
+
+    return true;
+}
+
+
+// save the checkpointed subtrees in binary form once per interval.
+// The main loop only encodes them; the log writer thread writes the
+// file (see checkpoint_write()).  Without the writer (logging off)
+// the file is written here.
+void checkpoint_update( double current_time ) {
+    if ( checkpoint_nodes.empty()
+         || current_time < checkpoint_time + checkpoint_interval )
+    {
+        return;
+    }
+    if ( checkpoint_pending.load( SG_ACQUIRE ) ) {
+        // the writer is still saving the last one, try next frame
+        return;
+    }
+    checkpoint_time = current_time;
+
+    SGPropertyNode_ptr state = new SGPropertyNode;
+    for ( unsigned int i = 0; i < checkpoint_nodes.size(); i++ ) {
+        const char *path = checkpoint_nodes[i].c_str();
+        SGPropertyNode *node = fgGetNode( path );
+        if ( node != NULL ) {
+            copyProperties( node, state->getNode( path, true ) );
+        }
+    }
+
+    checkpoint_buffer.clear();
+    writeBinaryProperties( checkpoint_buffer, state );
+    if ( writer_running ) {
+        checkpoint_pending.store( true, SG_RELEASE );
+    } else {
+        checkpoint_write();
+    }
 }
 
 
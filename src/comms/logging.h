@@ -3,6 +3,7 @@
 
 
 #include "globaldefs.h"
+#include "events.h"
 
 #include "util/sg_path.hxx"
 
@@ -10,6 +11,7 @@
 
 extern bool log_to_file;
 extern SGPath log_path;
+extern SGPath flight_dir;
 extern bool display_on;
 
 // global functions
@@ -29,6 +31,22 @@ void flush_nav( );
 void flush_servo( );
 void flush_health( );
 
+void log_channels( double current_time );
+void flush_channels( );
+
+void log_event( int type, int severity, int arg, const char *format, ... )
+    __attribute__ ((format (printf, 4, 5)));
+
+int logging_queue_depth();
+int logging_write_usec();
+int logging_dropped();
+
+bool journal_init();
+void journal_frame( double current_time );
+
+bool checkpoint_init();
+void checkpoint_update( double current_time );
+
 void display_message( struct imu *data, struct gps *gdata,
                       struct nav *ndata, struct servo *sdata,
                       struct health *hdata );
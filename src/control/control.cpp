@@ -16,11 +16,14 @@
 #include "comms/logging.h"
 #include "comms/uplink.h"
 #include "include/globaldefs.h"
+#include "include/props_schema.h"
 #include "navigation/mnav.h"
 #include "props/props.hxx"
+#include "util/latency.h"
 #include "util/timing.h"
 
 #include "util.h"
+#include "mixer.h"
 #include "xmlauto.hxx"
 
 #include "control.h"
@@ -47,12 +50,7 @@ struct servo servo_out;
 //static struct nav      navval;
 //enum   	      modedefs {pitch_mode,roll_mode,heading_mode,altitude_mode,speed_mode,waypoint_mode};
 
-static SGPropertyNode *aileron_out_node = NULL;
-static SGPropertyNode *elevator_out_node = NULL;
-static SGPropertyNode *throttle_out_node = NULL;
-static SGPropertyNode *rudder_out_node = NULL;
-static SGPropertyNode *ap_target = NULL;
-static SGPropertyNode *elevon_mix = NULL;
+static SGTypedProperty<double> ap_target;
 
 
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -65,19 +63,14 @@ static FGXMLAutopilot ap;
 
 void control_init() {
     // initialize the autopilot class and build the structures from the
-    // configuration file values
+    // configuration file values (init() calls build())
     ap.init();
-    ap.build();
 
-    // initialize the flight control output property nodes
-    aileron_out_node = fgGetNode("/controls/flight/aileron", true);
-    elevator_out_node = fgGetNode("/controls/flight/elevator", true);
-    throttle_out_node = fgGetNode("/engines/engine[0]/throttle", true);
-    rudder_out_node = fgGetNode("/controls/flight/rudder", true);
+    // load the servo mixer, it reads the flight control output
+    // property nodes
+    mixer_init();
 
-    ap_target = fgGetNode("/autopilot/settings/target-roll-deg", true);
-
-    elevon_mix = fgGetNode("/config/autopilot/elevon-mixing", true);
+    ap_target.bind( AUTOPILOT_SETTINGS_TARGET_ROLL_DEG );
 }
 
 
@@ -85,6 +78,9 @@ void control_reset() {
   // initialization:
   if ( display_on ) { printf("Initializing autopilot\n"); }
 
+  // slew servo outputs from where the pilot left them
+  mixer_reset( &servo_in );
+
   //servopos = servo_in;	// save the last servo positions
   //imuval   = imupacket;		// save the last attitude
   //gpsval   = gpspacket;		// save the last gps
@@ -110,65 +106,25 @@ void control_update(short flight_mode)
     // double max_value = 35.0;
     // double tgt_value = (max_value - min_value) *
     //   ((double)servo_in.chn[5] / 65535.0) + min_value;
-    // ap_target->setFloatValue( tgt_value );
+    // ap_target.set( tgt_value );
 
     // update the autopilot stages
     ap.update( 0.04 );	// dt = 1/25
 
-    /* printf("%.2f %.2f\n", aileron_out_node->getFloatValue(),
-              elevator_out_node->getFloatValue()); */
-    static SGPropertyNode *vert_speed_fps
-        = fgGetNode("/velocities/vertical-speed-fps", true);
-    static SGPropertyNode *true_alt
-        = fgGetNode("/position/altitude-ft", true);
-    /* printf("%.1f %.2f %.2f\n",
-           true_alt->getFloatValue(),
-           vert_speed_fps->getFloatValue(),
-           elevator_out_node->getFloatValue()); */
-
-    // initialize the servo command array to central values so we don't
-    // inherit junk
-    for ( int i = 0; i < 8; ++i ) {
-        servo_out.chn[i] = 32768;
-    }
-
-    if ( elevon_mix->getBoolValue() ) {
-        // elevon mixing mode
-
-        //aileron
-        servo_out.chn[0] = 32768
-            + (int16_t)(aileron_out_node->getFloatValue() * 32768)
-            + (int16_t)(elevator_out_node->getFloatValue() * 32768);
-
-        //elevator
-        servo_out.chn[1] = 32768
-            + (int16_t)(aileron_out_node->getFloatValue() * 32768)
-            - (int16_t)(elevator_out_node->getFloatValue() * 32768);
-    } else {
-        // conventional airframe mode
-
-        //aileron
-        servo_out.chn[0] = 32768
-            + (int16_t)(aileron_out_node->getFloatValue() * 32768);
-
-        //elevator
-        servo_out.chn[1] = 32768
-            + (int16_t)(elevator_out_node->getFloatValue() * 32768);
-    }
-
-    //throttle
-    servo_out.chn[2] = 32768
-        + (uint16_t)(throttle_out_node->getFloatValue() * 32768);
-
-    // rudder
-    servo_out.chn[3] = 32768
-        + (int16_t)(rudder_out_node->getFloatValue() * 32768);
+    // mix the control outputs into servo commands
+    mixer_update( 0.04, &servo_out );
 
     // time stamp the packet for logging
     servo_out.time = get_Time();
+    servo_latency.mark( LAT_CONTROL );
 
-    // send commanded servo positions to the MNAV
-    send_short_servo_cmd();
+    // send commanded servo positions to the MNAV, the short packet
+    // only carries the first four channels
+    if ( mixer_needs_full_packet() ) {
+        send_servo_cmd();
+    } else {
+        send_short_servo_cmd();
+    }
 }
 
 
@@ -0,0 +1,724 @@
+// expression.cxx - compile autopilot formulas into a compact bytecode
+//                  program for a small stack machine
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression.hxx"
+
+
+// maximum number of instructions, jump targets must fit in 16 bits
+#define MAX_CODE_SIZE 65535
+
+
+// number of stack operands consumed by each opcode (the result is
+// always pushed back as a single value)
+static const int op_arity[] = {
+    0, 0,                       // CONST LOAD
+    1, 1,                       // NEG NOT
+    2, 2, 2, 2, 2, 2,           // ADD SUB MUL DIV MOD POW
+    2, 2, 2, 2, 2, 2, 2, 2,     // LT LE GT GE EQ NE AND OR
+    1, 1, 1, 1, 1, 1, 2,        // SIN COS TAN ASIN ACOS ATAN ATAN2
+    1, 1, 1, 1, 1, 1,           // SQRT EXP LOG ABS FLOOR CEIL
+    2, 2, 3, 3,                 // MIN MAX CLAMP WRAP
+    1,                          // TABLE
+    1, 0                        // JZ JMP
+};
+
+
+struct function_def {
+    const char *name;
+    int op;
+    int nargs;
+};
+
+
+////////////////////////////////////////////////////////////////////////
+// Recursive descent compiler.  Errors are thrown as strings (the same
+// convention as the property path parser) and turned into an error
+// message by FGExpression::compile().
+////////////////////////////////////////////////////////////////////////
+
+class FGExpressionParser {
+
+public:
+
+    FGExpressionParser( FGExpression *program, const string &source );
+
+    void parse();
+
+private:
+
+    enum token_type { T_END, T_NUMBER, T_IDENT, T_OP };
+
+    void next();
+    bool is_op( const char *op ) const;
+    void expect( const char *op );
+    void fail( const string &message ) const;
+
+    void parse_expr();
+    void parse_or();
+    void parse_and();
+    void parse_compare();
+    void parse_sum();
+    void parse_product();
+    void parse_unary();
+    void parse_power();
+    void parse_primary();
+    void parse_call( const string &name );
+    void parse_table();
+    double parse_constant();
+
+    int add_constant( double value );
+    void emit( int op, int arg = 0 );
+    int emit_jump( int op );
+    void patch_jump( int pos );
+
+    FGExpression *prog;
+    const string &src;
+    size_t pos;                 // read position in src
+    size_t tok_start;           // start of the current token
+
+    token_type tok;
+    string tok_text;
+    double tok_value;
+
+    static const function_def functions[];
+
+    int depth;                  // current stack depth
+    int max_depth;              // deepest stack seen
+    unsigned int barrier;       // no constant folding before a jump target
+};
+
+
+const function_def FGExpressionParser::functions[] = {
+    { "sin",   FGExpression::OP_SIN,   1 },
+    { "cos",   FGExpression::OP_COS,   1 },
+    { "tan",   FGExpression::OP_TAN,   1 },
+    { "asin",  FGExpression::OP_ASIN,  1 },
+    { "acos",  FGExpression::OP_ACOS,  1 },
+    { "atan",  FGExpression::OP_ATAN,  1 },
+    { "atan2", FGExpression::OP_ATAN2, 2 },
+    { "sqrt",  FGExpression::OP_SQRT,  1 },
+    { "exp",   FGExpression::OP_EXP,   1 },
+    { "log",   FGExpression::OP_LOG,   1 },
+    { "pow",   FGExpression::OP_POW,   2 },
+    { "abs",   FGExpression::OP_ABS,   1 },
+    { "floor", FGExpression::OP_FLOOR, 1 },
+    { "ceil",  FGExpression::OP_CEIL,  1 },
+    { "min",   FGExpression::OP_MIN,   2 },
+    { "max",   FGExpression::OP_MAX,   2 },
+    { "clamp", FGExpression::OP_CLAMP, 3 },
+    { "wrap",  FGExpression::OP_WRAP,  3 },
+    { NULL, 0, 0 }
+};
+
+
+FGExpressionParser::FGExpressionParser( FGExpression *program,
+                                        const string &source ) :
+    prog( program ),
+    src( source ),
+    pos( 0 ),
+    tok_start( 0 ),
+    tok( T_END ),
+    tok_value( 0.0 ),
+    depth( 0 ),
+    max_depth( 0 ),
+    barrier( 0 )
+{
+}
+
+
+void FGExpressionParser::fail( const string &message ) const {
+    char buf[32];
+    snprintf( buf, 32, " (at column %d)", (int)tok_start + 1 );
+    throw message + buf;
+}
+
+
+void FGExpressionParser::next() {
+    while ( pos < src.length() && isspace(src[pos]) ) {
+        pos++;
+    }
+    tok_start = pos;
+    tok_text = "";
+
+    if ( pos >= src.length() ) {
+        tok = T_END;
+        return;
+    }
+
+    const char *start = src.c_str() + pos;
+    char c = *start;
+    if ( isdigit(c) || (c == '.' && isdigit(start[1])) ) {
+        char *end;
+        tok_value = strtod( start, &end );
+        pos += end - start;
+        tok = T_NUMBER;
+    } else if ( isalpha(c) || c == '_' ) {
+        while ( pos < src.length()
+                && (isalnum(src[pos]) || src[pos] == '_') )
+        {
+            tok_text += src[pos++];
+        }
+        tok = T_IDENT;
+    } else {
+        static const char *two_char[] = {
+            "<=", ">=", "==", "!=", "&&", "||", NULL
+        };
+        for ( int i = 0; two_char[i] != NULL; ++i ) {
+            if ( strncmp( start, two_char[i], 2 ) == 0 ) {
+                tok_text = two_char[i];
+                pos += 2;
+                tok = T_OP;
+                return;
+            }
+        }
+        if ( strchr( "+-*/%^()<>!?:,", c ) == NULL ) {
+            fail( string("unexpected character '") + c + "'" );
+        }
+        tok_text = c;
+        pos++;
+        tok = T_OP;
+    }
+}
+
+
+bool FGExpressionParser::is_op( const char *op ) const {
+    return tok == T_OP && tok_text == op;
+}
+
+
+void FGExpressionParser::expect( const char *op ) {
+    if ( !is_op( op ) ) {
+        fail( string("expected '") + op + "'" );
+    }
+    next();
+}
+
+
+int FGExpressionParser::add_constant( double value ) {
+    vector <double> &c = prog->constants;
+    for ( unsigned int i = 0; i < c.size(); ++i ) {
+        if ( c[i] == value ) {
+            return i;
+        }
+    }
+    c.push_back( value );
+    return c.size() - 1;
+}
+
+
+// Append an instruction.  If every operand of a pure operation is a
+// constant emitted since the last jump target, evaluate it now and
+// replace the operands with the result.
+void FGExpressionParser::emit( int op, int arg ) {
+    vector <FGExpression::instruction> &code = prog->code;
+    int n = op_arity[op];
+
+    if ( op != FGExpression::OP_JZ && op != FGExpression::OP_JMP
+         && n > 0 && code.size() >= barrier + n )
+    {
+        double args[3];
+        bool constant = true;
+        for ( int i = 0; i < n; ++i ) {
+            const FGExpression::instruction &in = code[code.size() - n + i];
+            if ( in.op != FGExpression::OP_CONST ) {
+                constant = false;
+                break;
+            }
+            args[i] = prog->constants[in.arg];
+        }
+        if ( constant ) {
+            double result;
+            if ( op == FGExpression::OP_TABLE ) {
+                result = prog->lookup( arg, args[0] );
+            } else {
+                result = FGExpression::apply( op, args );
+            }
+            code.resize( code.size() - n );
+            depth -= n;
+            op = FGExpression::OP_CONST;
+            arg = add_constant( result );
+            n = 0;
+        }
+    }
+
+    if ( code.size() >= MAX_CODE_SIZE ) {
+        fail( "expression too long" );
+    }
+
+    FGExpression::instruction in;
+    in.op = op;
+    in.arg = arg;
+    code.push_back( in );
+
+    depth -= n;
+    if ( op != FGExpression::OP_JZ && op != FGExpression::OP_JMP ) {
+        depth++;
+    }
+    if ( depth > max_depth ) {
+        max_depth = depth;
+    }
+}
+
+
+int FGExpressionParser::emit_jump( int op ) {
+    emit( op, 0 );
+    return prog->code.size() - 1;
+}
+
+
+void FGExpressionParser::patch_jump( int jump ) {
+    prog->code[jump].arg = prog->code.size();
+    barrier = prog->code.size();
+}
+
+
+void FGExpressionParser::parse() {
+    next();
+    parse_expr();
+    if ( tok != T_END ) {
+        fail( "unexpected '" + tok_text + "'" );
+    }
+    prog->stack.resize( max_depth > 0 ? max_depth : 1 );
+}
+
+
+void FGExpressionParser::parse_expr() {
+    parse_or();
+    if ( is_op( "?" ) ) {
+        next();
+        int jz = emit_jump( FGExpression::OP_JZ );
+        int d = depth;
+        parse_expr();
+        int jmp = emit_jump( FGExpression::OP_JMP );
+        depth = d;
+        patch_jump( jz );
+        expect( ":" );
+        parse_expr();
+        patch_jump( jmp );
+    }
+}
+
+
+void FGExpressionParser::parse_or() {
+    parse_and();
+    while ( is_op( "||" ) ) {
+        next();
+        parse_and();
+        emit( FGExpression::OP_OR );
+    }
+}
+
+
+void FGExpressionParser::parse_and() {
+    parse_compare();
+    while ( is_op( "&&" ) ) {
+        next();
+        parse_compare();
+        emit( FGExpression::OP_AND );
+    }
+}
+
+
+void FGExpressionParser::parse_compare() {
+    parse_sum();
+
+    int op;
+    if ( is_op( "<" ) ) {
+        op = FGExpression::OP_LT;
+    } else if ( is_op( "<=" ) ) {
+        op = FGExpression::OP_LE;
+    } else if ( is_op( ">" ) ) {
+        op = FGExpression::OP_GT;
+    } else if ( is_op( ">=" ) ) {
+        op = FGExpression::OP_GE;
+    } else if ( is_op( "==" ) ) {
+        op = FGExpression::OP_EQ;
+    } else if ( is_op( "!=" ) ) {
+        op = FGExpression::OP_NE;
+    } else {
+        return;
+    }
+    next();
+    parse_sum();
+    emit( op );
+}
+
+
+void FGExpressionParser::parse_sum() {
+    parse_product();
+    while ( is_op( "+" ) || is_op( "-" ) ) {
+        int op = is_op( "+" ) ? FGExpression::OP_ADD : FGExpression::OP_SUB;
+        next();
+        parse_product();
+        emit( op );
+    }
+}
+
+
+void FGExpressionParser::parse_product() {
+    parse_unary();
+    while ( is_op( "*" ) || is_op( "/" ) || is_op( "%" ) ) {
+        int op = FGExpression::OP_MUL;
+        if ( is_op( "/" ) ) {
+            op = FGExpression::OP_DIV;
+        } else if ( is_op( "%" ) ) {
+            op = FGExpression::OP_MOD;
+        }
+        next();
+        parse_unary();
+        emit( op );
+    }
+}
+
+
+void FGExpressionParser::parse_unary() {
+    if ( is_op( "-" ) ) {
+        next();
+        parse_unary();
+        emit( FGExpression::OP_NEG );
+    } else if ( is_op( "!" ) ) {
+        next();
+        parse_unary();
+        emit( FGExpression::OP_NOT );
+    } else {
+        parse_power();
+    }
+}
+
+
+void FGExpressionParser::parse_power() {
+    parse_primary();
+    if ( is_op( "^" ) ) {
+        next();
+        parse_unary();
+        emit( FGExpression::OP_POW );
+    }
+}
+
+
+void FGExpressionParser::parse_primary() {
+    if ( tok == T_NUMBER ) {
+        emit( FGExpression::OP_CONST, add_constant( tok_value ) );
+        next();
+    } else if ( tok == T_IDENT ) {
+        string name = tok_text;
+        next();
+        if ( is_op( "(" ) ) {
+            parse_call( name );
+        } else if ( name == "pi" ) {
+            emit( FGExpression::OP_CONST, add_constant( M_PI ) );
+        } else {
+            const vector <string> &names = prog->names;
+            unsigned int i;
+            for ( i = 0; i < names.size(); ++i ) {
+                if ( names[i] == name ) {
+                    break;
+                }
+            }
+            if ( i == names.size() ) {
+                fail( "unknown variable '" + name + "'" );
+            }
+            emit( FGExpression::OP_LOAD, i );
+        }
+    } else if ( is_op( "(" ) ) {
+        next();
+        parse_expr();
+        expect( ")" );
+    } else if ( tok == T_END ) {
+        fail( "unexpected end of expression" );
+    } else {
+        fail( "unexpected '" + tok_text + "'" );
+    }
+}
+
+
+void FGExpressionParser::parse_call( const string &name ) {
+    if ( name == "table" ) {
+        parse_table();
+        return;
+    }
+
+    int i;
+    for ( i = 0; functions[i].name != NULL; ++i ) {
+        if ( name == functions[i].name ) {
+            break;
+        }
+    }
+    if ( functions[i].name == NULL ) {
+        fail( "unknown function '" + name + "'" );
+    }
+
+    expect( "(" );
+    for ( int n = 0; n < functions[i].nargs; ++n ) {
+        if ( n > 0 ) {
+            expect( "," );
+        }
+        parse_expr();
+    }
+    expect( ")" );
+
+    emit( functions[i].op );
+}
+
+
+// parse an expression that must fold down to a single constant
+double FGExpressionParser::parse_constant() {
+    vector <FGExpression::instruction> &code = prog->code;
+    unsigned int start = code.size();
+    parse_expr();
+    if ( code.size() != start + 1
+         || code.back().op != FGExpression::OP_CONST )
+    {
+        fail( "table breakpoints must be constant" );
+    }
+    double value = prog->constants[code.back().arg];
+    code.pop_back();
+    depth--;
+    return value;
+}
+
+
+void FGExpressionParser::parse_table() {
+    expect( "(" );
+    parse_expr();
+
+    vector <double> &tables = prog->tables;
+    int table = tables.size();
+    tables.push_back( 0.0 );
+
+    int count = 0;
+    while ( is_op( "," ) ) {
+        next();
+        double x = parse_constant();
+        expect( "," );
+        double y = parse_constant();
+        if ( count > 0 && x <= tables[tables.size() - 2] ) {
+            fail( "table breakpoints must be increasing" );
+        }
+        tables.push_back( x );
+        tables.push_back( y );
+        count++;
+    }
+    expect( ")" );
+
+    if ( count == 0 ) {
+        fail( "table needs at least one breakpoint" );
+    }
+    if ( table > 65535 ) {
+        fail( "too many tables" );
+    }
+    tables[table] = count;
+
+    emit( FGExpression::OP_TABLE, table );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Compiled program and interpreter.
+////////////////////////////////////////////////////////////////////////
+
+FGExpression::FGExpression() {
+}
+
+
+int FGExpression::add_variable( const string &name ) {
+    for ( unsigned int i = 0; i < names.size(); ++i ) {
+        if ( names[i] == name ) {
+            return i;
+        }
+    }
+    names.push_back( name );
+    vars.push_back( 0.0 );
+    return names.size() - 1;
+}
+
+
+bool FGExpression::compile( const string &source ) {
+    code.clear();
+    constants.clear();
+    tables.clear();
+    error = "";
+
+    FGExpressionParser parser( this, source );
+    try {
+        parser.parse();
+    } catch ( const string &message ) {
+        code.clear();
+        error = message;
+        return false;
+    }
+
+    return true;
+}
+
+
+double FGExpression::lookup( int table, double x ) const {
+    int n = (int)tables[table];
+    const double *p = &tables[table + 1];
+
+    if ( x <= p[0] ) {
+        return p[1];
+    }
+    if ( x >= p[2 * (n - 1)] ) {
+        return p[2 * (n - 1) + 1];
+    }
+
+    // binary search for the bracketing segment
+    int lo = 0;
+    int hi = n - 1;
+    while ( hi - lo > 1 ) {
+        int mid = (lo + hi) / 2;
+        if ( x < p[2 * mid] ) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+
+    double x0 = p[2 * lo];
+    double y0 = p[2 * lo + 1];
+    double x1 = p[2 * hi];
+    double y1 = p[2 * hi + 1];
+    return y0 + (x - x0) * (y1 - y0) / (x1 - x0);
+}
+
+
+double FGExpression::apply( int op, const double *a ) {
+    switch ( op ) {
+    case OP_NEG:   return -a[0];
+    case OP_NOT:   return a[0] == 0.0 ? 1.0 : 0.0;
+    case OP_ADD:   return a[0] + a[1];
+    case OP_SUB:   return a[0] - a[1];
+    case OP_MUL:   return a[0] * a[1];
+    case OP_DIV:   return a[0] / a[1];
+    case OP_MOD:   return fmod( a[0], a[1] );
+    case OP_POW:   return pow( a[0], a[1] );
+    case OP_LT:    return a[0] < a[1] ? 1.0 : 0.0;
+    case OP_LE:    return a[0] <= a[1] ? 1.0 : 0.0;
+    case OP_GT:    return a[0] > a[1] ? 1.0 : 0.0;
+    case OP_GE:    return a[0] >= a[1] ? 1.0 : 0.0;
+    case OP_EQ:    return a[0] == a[1] ? 1.0 : 0.0;
+    case OP_NE:    return a[0] != a[1] ? 1.0 : 0.0;
+    case OP_AND:   return (a[0] != 0.0 && a[1] != 0.0) ? 1.0 : 0.0;
+    case OP_OR:    return (a[0] != 0.0 || a[1] != 0.0) ? 1.0 : 0.0;
+    case OP_SIN:   return sin( a[0] );
+    case OP_COS:   return cos( a[0] );
+    case OP_TAN:   return tan( a[0] );
+    case OP_ASIN:  return asin( a[0] );
+    case OP_ACOS:  return acos( a[0] );
+    case OP_ATAN:  return atan( a[0] );
+    case OP_ATAN2: return atan2( a[0], a[1] );
+    case OP_SQRT:  return sqrt( a[0] );
+    case OP_EXP:   return exp( a[0] );
+    case OP_LOG:   return log( a[0] );
+    case OP_ABS:   return fabs( a[0] );
+    case OP_FLOOR: return floor( a[0] );
+    case OP_CEIL:  return ceil( a[0] );
+    case OP_MIN:   return a[0] < a[1] ? a[0] : a[1];
+    case OP_MAX:   return a[0] > a[1] ? a[0] : a[1];
+    case OP_CLAMP:
+        if ( a[0] < a[1] ) return a[1];
+        if ( a[0] > a[2] ) return a[2];
+        return a[0];
+    case OP_WRAP: {
+        // normalize to lie in [lo, hi)
+        double step = a[2] - a[1];
+        if ( step <= 0.0 ) {
+            return a[0];
+        }
+        double val = fmod( a[0] - a[1], step );
+        if ( val < 0.0 ) {
+            val += step;
+        }
+        return val + a[1];
+    }
+    default:
+        return 0.0;
+    }
+}
+
+
+double FGExpression::evaluate() {
+    if ( code.empty() ) {
+        return 0.0;
+    }
+
+    const instruction *base = &code[0];
+    const instruction *pc = base;
+    const instruction *end = base + code.size();
+    const double *k = constants.empty() ? 0 : &constants[0];
+    const double *v = vars.empty() ? 0 : &vars[0];
+    double *sp = &stack[0] - 1;
+
+    while ( pc < end ) {
+        switch ( pc->op ) {
+        case OP_CONST:
+            *++sp = k[pc->arg];
+            break;
+        case OP_LOAD:
+            *++sp = v[pc->arg];
+            break;
+        case OP_NEG:
+            sp[0] = -sp[0];
+            break;
+        case OP_ADD:
+            sp[-1] += sp[0];
+            --sp;
+            break;
+        case OP_SUB:
+            sp[-1] -= sp[0];
+            --sp;
+            break;
+        case OP_MUL:
+            sp[-1] *= sp[0];
+            --sp;
+            break;
+        case OP_DIV:
+            sp[-1] /= sp[0];
+            --sp;
+            break;
+        case OP_TABLE:
+            sp[0] = lookup( pc->arg, sp[0] );
+            break;
+        case OP_JZ:
+            if ( *sp-- == 0.0 ) {
+                pc = base + pc->arg;
+                continue;
+            }
+            break;
+        case OP_JMP:
+            pc = base + pc->arg;
+            continue;
+        default: {
+            int n = op_arity[pc->op];
+            sp -= n - 1;
+            sp[0] = apply( pc->op, sp );
+            break;
+        }
+        }
+        ++pc;
+    }
+
+    return *sp;
+}
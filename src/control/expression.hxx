@@ -0,0 +1,120 @@
+// expression.hxx - compile autopilot formulas into a compact bytecode
+//                  program for a small stack machine
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#ifndef _EXPRESSION_HXX
+#define _EXPRESSION_HXX 1
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+/**
+ * A formula compiled once into bytecode and evaluated every frame.
+ *
+ * Grammar (lowest to highest precedence):
+ *
+ *   expr    := or [ '?' expr ':' expr ]
+ *   or      := and { '||' and }
+ *   and     := compare { '&&' compare }
+ *   compare := sum [ ( '<' | '<=' | '>' | '>=' | '==' | '!=' ) sum ]
+ *   sum     := product { ( '+' | '-' ) product }
+ *   product := unary { ( '*' | '/' | '%' ) unary }
+ *   unary   := ( '-' | '!' ) unary | power
+ *   power   := primary [ '^' unary ]
+ *   primary := number | variable | 'pi' | function '(' args ')' | '(' expr ')'
+ *
+ * Functions: sin cos tan asin acos atan atan2 sqrt exp log pow abs
+ * floor ceil min max clamp(x,lo,hi) wrap(x,lo,hi) and
+ * table(x, x0,y0, x1,y1, ...) which linearly interpolates between
+ * constant breakpoints and holds the end values outside of them.
+ * Trig functions work in radians.
+ *
+ * Variables are declared with add_variable() before compile() and
+ * are written into the slot array returned by get_variables() before
+ * each evaluate().  Sub-expressions that only involve constants are
+ * folded at compile time.
+ */
+
+class FGExpression {
+
+public:
+
+    FGExpression();
+    ~FGExpression() {}
+
+    // declare a named input, returns its slot number
+    int add_variable( const string &name );
+
+    // compile the formula, returns false and sets the error message
+    // if the source is not valid
+    bool compile( const string &source );
+
+    inline const string& get_error() const { return error; }
+    inline bool is_valid() const { return code.size() > 0; }
+    inline double *get_variables() {
+        return vars.empty() ? 0 : &vars[0];
+    }
+
+    // run the program against the current variable slots
+    double evaluate();
+
+private:
+
+    friend class FGExpressionParser;
+
+    enum opcode {
+        OP_CONST, OP_LOAD,
+        OP_NEG, OP_NOT,
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+        OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_AND, OP_OR,
+        OP_SIN, OP_COS, OP_TAN, OP_ASIN, OP_ACOS, OP_ATAN, OP_ATAN2,
+        OP_SQRT, OP_EXP, OP_LOG, OP_ABS, OP_FLOOR, OP_CEIL,
+        OP_MIN, OP_MAX, OP_CLAMP, OP_WRAP,
+        OP_TABLE,
+        OP_JZ, OP_JMP
+    };
+
+    struct instruction {
+        uint16_t op;
+        uint16_t arg;
+    };
+
+    // evaluate a single pure operation on the top n stack entries
+    static double apply( int op, const double *args );
+    double lookup( int table, double x ) const;
+
+    vector <instruction> code;
+    vector <double> constants;
+    vector <double> tables;     // packed: count, x0, y0, x1, y1, ...
+    vector <string> names;
+    vector <double> vars;
+    vector <double> stack;
+    string error;
+};
+
+
+#endif // _EXPRESSION_HXX
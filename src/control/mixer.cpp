@@ -0,0 +1,227 @@
+/******************************************************************************
+ * FILE: mixer.cpp
+ * DESCRIPTION:
+ *   Map autopilot control outputs onto the servo channels.  The mix is
+ *   loaded once into a fixed point matrix so each update is a single
+ *   integer matrix-vector product followed by trim, limits and slew.
+ *
+ *   <mixer>
+ *     <input>/controls/flight/aileron</input>
+ *     <input>/controls/flight/elevator</input>
+ *     <channel>
+ *       <gain>1.0 1.0</gain>        (one per input)
+ *       <trim>0.0</trim>            (all values normalized to +/-1)
+ *       <min>-1.0</min>
+ *       <max>1.0</max>
+ *       <rate-per-sec>4.0</rate-per-sec>
+ *     </channel>
+ *     ...
+ *   </mixer>
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "props/props.hxx"
+
+#include "mixer.h"
+
+
+// Inputs are scaled to Q15 (1.0 = 32768) and gains to Q14, so each
+// product is Q29 and the sum is shifted back down to servo counts.
+#define INPUT_SHIFT 15
+#define GAIN_SHIFT  14
+#define SERVO_MID   32768
+#define SERVO_MAX   65535
+#define MAX_GAIN    8.0
+
+static SGPropertyNode *input_node[MIXER_MAX_INPUTS];
+static int num_inputs = 0;
+
+static int32_t gain[MIXER_CHANNELS][MIXER_MAX_INPUTS];  // Q14
+static int32_t trim[MIXER_CHANNELS];                     // servo counts
+static int32_t min_out[MIXER_CHANNELS];
+static int32_t max_out[MIXER_CHANNELS];
+static double rate[MIXER_CHANNELS];                      // counts/sec, 0 = off
+static int32_t last_out[MIXER_CHANNELS];
+static bool live[MIXER_CHANNELS];
+static bool seeded = false;
+
+
+static int32_t to_counts( double val ) {
+    double c = SERVO_MID + val * SERVO_MID;
+    if ( c < 0.0 ) return 0;
+    if ( c > SERVO_MAX ) return SERVO_MAX;
+    return (int32_t)c;
+}
+
+
+static int32_t to_gain( double val ) {
+    if ( val > MAX_GAIN ) val = MAX_GAIN;
+    if ( val < -MAX_GAIN ) val = -MAX_GAIN;
+    return (int32_t)(val * (1 << GAIN_SHIFT) + (val < 0 ? -0.5 : 0.5));
+}
+
+
+static int add_input( const char *path ) {
+    if ( num_inputs >= MIXER_MAX_INPUTS ) {
+        printf("[mixer] too many inputs, ignoring %s\n", path);
+        return -1;
+    }
+    input_node[num_inputs] = fgGetNode( path, true );
+    return num_inputs++;
+}
+
+
+static void clear_mix() {
+    memset( gain, 0, sizeof(gain) );
+    num_inputs = 0;
+    for ( int ch = 0; ch < MIXER_CHANNELS; ++ch ) {
+        trim[ch] = 0;
+        min_out[ch] = 0;
+        max_out[ch] = SERVO_MAX;
+        rate[ch] = 0.0;
+        live[ch] = false;
+    }
+}
+
+
+// the original hard coded four channel mix
+static void default_mix() {
+    int ail = add_input( "/controls/flight/aileron" );
+    int ele = add_input( "/controls/flight/elevator" );
+    int thr = add_input( "/engines/engine[0]/throttle" );
+    int rud = add_input( "/controls/flight/rudder" );
+
+    if ( fgGetNode("/config/autopilot/elevon-mixing", true)->getBoolValue() ) {
+        gain[0][ail] = to_gain( 1.0 );
+        gain[0][ele] = to_gain( 1.0 );
+        gain[1][ail] = to_gain( 1.0 );
+        gain[1][ele] = to_gain( -1.0 );
+    } else {
+        gain[0][ail] = to_gain( 1.0 );
+        gain[1][ele] = to_gain( 1.0 );
+    }
+    gain[2][thr] = to_gain( 1.0 );
+    gain[3][rud] = to_gain( 1.0 );
+
+    for ( int ch = 0; ch < 4; ++ch ) {
+        live[ch] = true;
+    }
+}
+
+
+void mixer_init() {
+    clear_mix();
+
+    SGPropertyNode *config = fgGetNode("/config/mixer");
+    if ( config == NULL ) {
+        default_mix();
+        return;
+    }
+
+    int i;
+    for ( i = 0; i < config->nChildren(); ++i ) {
+        SGPropertyNode *child = config->getChild(i);
+        if ( strcmp( child->getName(), "input" ) == 0 ) {
+            add_input( child->getStringValue() );
+        }
+    }
+
+    int ch = 0;
+    for ( i = 0; i < config->nChildren(); ++i ) {
+        SGPropertyNode *child = config->getChild(i);
+        if ( strcmp( child->getName(), "channel" ) != 0 ) {
+            continue;
+        }
+        if ( ch >= MIXER_CHANNELS ) {
+            printf("[mixer] only %d channels supported\n", MIXER_CHANNELS);
+            break;
+        }
+
+        // whitespace separated gains, one per input
+        const char *str = child->getStringValue( "gain", "" );
+        char *end;
+        int in = 0;
+        double val = strtod( str, &end );
+        while ( end != str && in < num_inputs ) {
+            gain[ch][in++] = to_gain( val );
+            str = end;
+            val = strtod( str, &end );
+        }
+
+        trim[ch] = to_counts( child->getDoubleValue( "trim", 0.0 ) )
+            - SERVO_MID;
+        min_out[ch] = to_counts( child->getDoubleValue( "min", -1.0 ) );
+        max_out[ch] = to_counts( child->getDoubleValue( "max", 1.0 ) );
+        rate[ch] = child->getDoubleValue( "rate-per-sec", 0.0 ) * SERVO_MID;
+
+        live[ch] = true;
+        ch++;
+    }
+
+    printf("[mixer] %d inputs, %d channels\n", num_inputs, ch);
+}
+
+
+void mixer_reset( const struct servo *seed ) {
+    for ( int ch = 0; ch < MIXER_CHANNELS; ++ch ) {
+        last_out[ch] = seed->chn[ch];
+    }
+    seeded = true;
+}
+
+
+void mixer_update( double dt, struct servo *out ) {
+    int32_t in[MIXER_MAX_INPUTS];
+    int i, ch;
+
+    for ( i = 0; i < num_inputs; ++i ) {
+        float val = input_node[i]->getFloatValue();
+        if ( val > 1.0 ) val = 1.0;
+        if ( val < -1.0 ) val = -1.0;
+        in[i] = (int32_t)(val * (1 << INPUT_SHIFT));
+    }
+
+    for ( ch = 0; ch < MIXER_CHANNELS; ++ch ) {
+        if ( !live[ch] ) {
+            out->chn[ch] = SERVO_MID;
+            continue;
+        }
+
+        // matrix row times input vector
+        int64_t sum = 0;
+        const int32_t *g = gain[ch];
+        for ( i = 0; i < num_inputs; ++i ) {
+            sum += (int64_t)g[i] * in[i];
+        }
+        int32_t val = SERVO_MID + trim[ch]
+            + (int32_t)(sum >> (INPUT_SHIFT + GAIN_SHIFT - 15));
+
+        if ( val < min_out[ch] ) val = min_out[ch];
+        if ( val > max_out[ch] ) val = max_out[ch];
+
+        if ( rate[ch] > 0.0 && seeded ) {
+            int32_t step = (int32_t)(rate[ch] * dt);
+            if ( step < 1 ) step = 1;
+            if ( val > last_out[ch] + step ) val = last_out[ch] + step;
+            if ( val < last_out[ch] - step ) val = last_out[ch] - step;
+        }
+
+        last_out[ch] = val;
+        out->chn[ch] = (uint16_t)val;
+    }
+    seeded = true;
+}
+
+
+bool mixer_needs_full_packet() {
+    for ( int ch = 4; ch < MIXER_CHANNELS; ++ch ) {
+        if ( live[ch] ) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,34 @@
+//
+// FILE: mixer.h
+// DESCRIPTION: map autopilot control outputs onto the 8 servo channels
+//              through a fixed point mixing matrix
+//
+
+#ifndef _UGEAR_MIXER_H
+#define _UGEAR_MIXER_H
+
+
+#include "globaldefs.h"
+
+
+#define MIXER_MAX_INPUTS 8
+#define MIXER_CHANNELS   8
+
+
+// Load the mixer from /config/mixer.  Without one, the classic four
+// channel mix is set up (aileron, elevator, throttle, rudder, or
+// elevons when /config/autopilot/elevon-mixing is set).
+void mixer_init();
+
+// seed the slew rate limiters with the given servo positions
+void mixer_reset( const struct servo *seed );
+
+// evaluate the mix into out->chn[]
+void mixer_update( double dt, struct servo *out );
+
+// true if any channel past the first four is in use, i.e. the full
+// 8 channel servo packet must be sent
+bool mixer_needs_full_packet();
+
+
+#endif // _UGEAR_MIXER_H
@@ -26,6 +26,7 @@
 #include <math.h>
 
 #include <include/globaldefs.h>
+#include <include/props_schema.h>
 #include <props/props_io.hxx>
 #include <util/exception.hxx>
 #include <util/sg_path.hxx>
@@ -43,12 +44,6 @@ FGRouteMgr route_mgr;           // global route manager object
 FGRouteMgr::FGRouteMgr() :
     route( new SGRoute ),
     config_props( NULL ),
-    lon( NULL ),
-    lat( NULL ),
-    alt( NULL ),
-    true_hdg_deg( NULL ),
-    target_altitude_ft( NULL ),
-    target_agl_ft( NULL ),
     home_set( false ),
     altitude_set( false ),
     agl_set( false ),
@@ -95,15 +90,13 @@ void FGRouteMgr::init() {
         printf("No autopilot configuration specified in master.xml file!");
     }
 
-    lon = fgGetNode( "/position/longitude-deg", true );
-    lat = fgGetNode( "/position/latitude-deg", true );
-    alt = fgGetNode( "/position/altitude-ft", true );
+    lon.bind( POSITION_LONGITUDE_DEG );
+    lat.bind( POSITION_LATITUDE_DEG );
+    alt.bind( POSITION_ALTITUDE_FT );
 
-    true_hdg_deg = fgGetNode( "/autopilot/settings/true-heading-deg", true );
-    target_altitude_ft
-        = fgGetNode( "/autopilot/settings/target-altitude-ft", true );
-    target_agl_ft
-        = fgGetNode( "/autopilot/settings/target-agl-ft", true );
+    true_hdg_deg.bind( AUTOPILOT_SETTINGS_TRUE_HEADING_DEG );
+    target_altitude_ft.bind( AUTOPILOT_SETTINGS_TARGET_ALTITUDE_FT );
+    target_agl_ft.bind( AUTOPILOT_SETTINGS_TARGET_AGL_FT );
 }
 
 
@@ -111,20 +104,20 @@ void FGRouteMgr::update() {
     double wp_course, wp_distance;
 
     if ( mode == GoHome && home_set ) {
-        home.CourseAndDistance( lon->getDoubleValue(), lat->getDoubleValue(),
-                                alt->getDoubleValue(),
+        home.CourseAndDistance( lon.get(), lat.get(),
+                                alt.get(),
                                 &wp_course, &wp_distance );
 
-        true_hdg_deg->setDoubleValue( wp_course );
+        true_hdg_deg.set( wp_course );
         double target_alt_m = home.get_target_alt_m();
         double target_agl_m = home.get_target_agl_m();
 
         if ( !altitude_set && target_alt_m > -9990 ) {
-            target_altitude_ft->setDoubleValue( target_alt_m * SG_METER_TO_FEET );
+            target_altitude_ft.set( target_alt_m * SG_METER_TO_FEET );
             altitude_set = true;
         }
         if ( !agl_set && target_agl_m > -9990 ) {
-            target_agl_ft->setDoubleValue( target_agl_m * SG_METER_TO_FEET );
+            target_agl_ft.set( target_agl_m * SG_METER_TO_FEET );
             agl_set = true;
         }
 
@@ -132,19 +125,19 @@ void FGRouteMgr::update() {
     } else if ( mode == FollowRoute && route->size() > 0 ) {
         // track current waypoint of route
         SGWayPoint wp = route->get_current();
-        wp.CourseAndDistance( lon->getDoubleValue(), lat->getDoubleValue(),
-                              alt->getDoubleValue(), &wp_course, &wp_distance );
+        wp.CourseAndDistance( lon.get(), lat.get(),
+                              alt.get(), &wp_course, &wp_distance );
 
-        true_hdg_deg->setDoubleValue( wp_course );
+        true_hdg_deg.set( wp_course );
         double target_alt_m = wp.get_target_alt_m();
         double target_agl_m = wp.get_target_agl_m();
 
         if ( !altitude_set && target_alt_m > -9990 ) {
-            target_altitude_ft->setDoubleValue( target_alt_m * SG_METER_TO_FEET );
+            target_altitude_ft.set( target_alt_m * SG_METER_TO_FEET );
             altitude_set = true;
         }
         if ( !agl_set && target_agl_m > -9990 ) {
-            target_agl_ft->setDoubleValue( target_agl_m * SG_METER_TO_FEET );
+            target_agl_ft.set( target_agl_m * SG_METER_TO_FEET );
             agl_set = true;
         }
 
@@ -281,6 +274,9 @@ bool FGRouteMgr::update_home( const SGWayPoint &wp, bool force_update ) {
             // good location
             home = wp;
             home_set = true;
+            log_event( EVENT_HOME, EVENT_INFO, 0, "%.6f %.6f %.0f",
+                       home.get_target_lon(), home.get_target_lat(),
+                       home.get_target_alt_m() );
             if ( display_on ) {
                 printf( "HOME updated: %.6f %.6f\n",
                         home.get_target_lon(), home.get_target_lat() );
@@ -294,3 +290,21 @@ bool FGRouteMgr::update_home( const SGWayPoint &wp, bool force_update ) {
 
     return false;
 }
+
+
+// log only actual changes: set_route_mode() is called for every
+// command received
+void FGRouteMgr::set_route_mode() {
+    if ( mode != FollowRoute ) {
+        log_event( EVENT_MODE, EVENT_INFO, FollowRoute, "FollowRoute" );
+    }
+    mode = FollowRoute;
+}
+
+
+void FGRouteMgr::set_home_mode() {
+    if ( mode != GoHome ) {
+        log_event( EVENT_MODE, EVENT_WARNING, GoHome, "GoHome" );
+    }
+    mode = GoHome;
+}
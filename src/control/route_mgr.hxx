@@ -35,6 +35,7 @@ using std::string;
 using std::vector;
 
 #include "props/props.hxx"
+#include "props/props_typed.hxx"
 #include "route.hxx"
 
 
@@ -61,14 +62,14 @@ private:
     SGPropertyNode_ptr config_props;
 
     // automatic inputs
-    SGPropertyNode_ptr lon;
-    SGPropertyNode_ptr lat;
-    SGPropertyNode_ptr alt;
+    SGTypedProperty<double> lon;
+    SGTypedProperty<double> lat;
+    SGTypedProperty<double> alt;
 
     // automatic outputs
-    SGPropertyNode_ptr true_hdg_deg;
-    SGPropertyNode_ptr target_altitude_ft;
-    SGPropertyNode_ptr target_agl_ft;
+    SGTypedProperty<double> true_hdg_deg;
+    SGTypedProperty<double> target_altitude_ft;
+    SGTypedProperty<double> target_agl_ft;
 
     bool home_set;
     bool altitude_set;
@@ -105,19 +106,8 @@ public:
 
     bool update_home( const SGWayPoint &wp, bool force_update );
 
-    inline void set_route_mode() {
-        mode = FollowRoute;
-        FILE *debug = fopen("/mnt/mmc/debug.txt", "a");
-        fprintf(debug, "mode: FollowRoute\n");
-        fclose(debug);
-    }
-
-    inline void set_home_mode() {
-        mode = GoHome;
-        FILE *debug = fopen("/mnt/mmc/debug.txt", "a");
-        fprintf(debug, "mode: GoHome\n");
-        fclose(debug);
-    }
+    void set_route_mode();
+    void set_home_mode();
 
     inline fgRouteMode get_route_mode() {
         return mode;
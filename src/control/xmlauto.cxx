@@ -21,6 +21,7 @@
 // $Id: xmlauto.cxx,v 1.8 2008/05/09 00:34:28 curt Exp $
 
 #include <math.h>
+#include <stdlib.h>
 
 #include <props/props_io.hxx>
 #include <util/exception.hxx>
@@ -43,6 +44,9 @@ FGPIDController::FGPIDController( SGPropertyNode *node ):
     gamma( 0.0 ),
     Ti( 0.0 ),
     Td( 0.0 ),
+    Kp_prop( NULL ),
+    Ti_prop( NULL ),
+    Td_prop( NULL ),
     u_min( 0.0 ),
     u_max( 0.0 ),
     ep_n_1( 0.0 ),
@@ -127,7 +131,12 @@ FGPIDController::FGPIDController( SGPropertyNode *node ):
             
             prop = child->getChild( "Kp" );
             if ( prop != NULL ) {
-                Kp = prop->getDoubleValue();
+                SGPropertyNode *sched = prop->getChild( "prop" );
+                if ( sched != NULL ) {
+                    Kp_prop = fgGetNode( sched->getStringValue(), true );
+                } else {
+                    Kp = prop->getDoubleValue();
+                }
             }
 
             prop = child->getChild( "beta" );
@@ -147,12 +156,22 @@ FGPIDController::FGPIDController( SGPropertyNode *node ):
 
             prop = child->getChild( "Ti" );
             if ( prop != NULL ) {
-                Ti = prop->getDoubleValue();
+                SGPropertyNode *sched = prop->getChild( "prop" );
+                if ( sched != NULL ) {
+                    Ti_prop = fgGetNode( sched->getStringValue(), true );
+                } else {
+                    Ti = prop->getDoubleValue();
+                }
             }
 
             prop = child->getChild( "Td" );
             if ( prop != NULL ) {
-                Td = prop->getDoubleValue();
+                SGPropertyNode *sched = prop->getChild( "prop" );
+                if ( sched != NULL ) {
+                    Td_prop = fgGetNode( sched->getStringValue(), true );
+                } else {
+                    Td = prop->getDoubleValue();
+                }
             }
 
             prop = child->getChild( "u_min" );
@@ -259,6 +278,17 @@ void FGPIDController::update( double dt ) {
     // enabled = false;
     // }
 
+    // pick up scheduled gains
+    if ( Kp_prop != NULL ) {
+        Kp = Kp_prop->getDoubleValue();
+    }
+    if ( Ti_prop != NULL ) {
+        Ti = Ti_prop->getDoubleValue();
+    }
+    if ( Td_prop != NULL ) {
+        Td = Td_prop->getDoubleValue();
+    }
+
     if ( enabled && Ts > 0.0) {
         if ( debug ) printf("Updating %s Ts = %.2f", name.c_str(), Ts );
 
@@ -733,16 +763,306 @@ void FGDigitalFilter::update(double dt)
 }
 
 
-FGXMLAutopilot::FGXMLAutopilot() {
+FGExpressionComponent::FGExpressionComponent( SGPropertyNode *node ):
+    dt_slot( 0 ),
+    debug( false )
+{
+    string formula;
+
+    // dt is always available to the formula
+    dt_slot = expr.add_variable( "dt" );
+
+    int i;
+    for ( i = 0; i < node->nChildren(); ++i ) {
+        SGPropertyNode *child = node->getChild(i);
+        string cname = child->getName();
+        string cval = child->getStringValue();
+        if ( cname == "name" ) {
+            name = cval;
+        } else if ( cname == "debug" ) {
+            debug = child->getBoolValue();
+        } else if ( cname == "enable" ) {
+            SGPropertyNode *prop = child->getChild( "prop" );
+            if ( prop != NULL ) {
+                enable_prop = fgGetNode( prop->getStringValue(), true );
+            }
+            SGPropertyNode *val = child->getChild( "value" );
+            if ( val != NULL ) {
+                enable_value = val->getStringValue();
+            }
+        } else if ( cname == "input" ) {
+            SGPropertyNode *var = child->getChild( "var" );
+            SGPropertyNode *prop = child->getChild( "prop" );
+            if ( var != NULL && prop != NULL ) {
+                input_list.push_back( fgGetNode( prop->getStringValue(),
+                                                 true ) );
+                input_slot.push_back( expr.add_variable( var->getStringValue() ) );
+            } else {
+                printf("Expression input needs a <var> and a <prop>, " );
+                printf("Section = %s\n", name.c_str() );
+            }
+        } else if ( cname == "formula" ) {
+            formula = cval;
+        } else if ( cname == "output" ) {
+            SGPropertyNode *tmp = fgGetNode( child->getStringValue(), true );
+            output_list.push_back( tmp );
+        } else {
+            printf("Error in autopilot config logic, " );
+            if ( name.length() ) {
+                printf("Section = %s\n", name.c_str() );
+            }
+        }
+    }
+
+    if ( ! expr.compile( formula ) ) {
+        printf("Error in expression '%s': %s\n", name.c_str(),
+               expr.get_error().c_str() );
+    }
+}
+
+void FGExpressionComponent::update( double dt )
+{
+    if ( enable_prop != NULL
+         && enable_prop->getStringValue() != enable_value )
+    {
+        enabled = false;
+        return;
+    }
+
+    // a formula that failed to compile leaves the outputs alone
+    enabled = expr.is_valid();
+    if ( !enabled ) {
+        return;
+    }
+
+    double *vars = expr.get_variables();
+    vars[dt_slot] = dt;
+
+    unsigned int i;
+    for ( i = 0; i < input_list.size(); ++i ) {
+        vars[input_slot[i]] = input_list[i]->getDoubleValue();
+    }
+
+    double output = expr.evaluate();
+
+    for ( i = 0; i < output_list.size(); ++i ) {
+        output_list[i]->setDoubleValue( output );
+    }
+
+    if ( debug ) {
+        printf("%s: output = %.3f\n", name.c_str(), output);
+    }
+}
+
+
+// parse a whitespace separated list of numbers
+static void parse_numbers( const char *str, vector <double> &values ) {
+    char *end;
+    double value = strtod( str, &end );
+    while ( end != str ) {
+        values.push_back( value );
+        str = end;
+        value = strtod( str, &end );
+    }
+}
+
+
+FGTableComponent::FGTableComponent( SGPropertyNode *node ):
+    debug( false )
+{
+    int i;
+    for ( i = 0; i < node->nChildren(); ++i ) {
+        SGPropertyNode *child = node->getChild(i);
+        string cname = child->getName();
+        string cval = child->getStringValue();
+        if ( cname == "name" ) {
+            name = cval;
+        } else if ( cname == "debug" ) {
+            debug = child->getBoolValue();
+        } else if ( cname == "axis" ) {
+            axis a;
+            SGPropertyNode *prop = child->getChild( "prop" );
+            if ( prop != NULL ) {
+                a.prop = fgGetNode( prop->getStringValue(), true );
+            }
+            prop = child->getChild( "breakpoints" );
+            if ( prop != NULL ) {
+                parse_numbers( prop->getStringValue(), a.breakpoints );
+            }
+            a.uniform = false;
+            a.inv_step = 0.0;
+            a.last = 0;
+            a.stride = 1;
+            axes.push_back( a );
+        } else if ( cname == "data" ) {
+            parse_numbers( child->getStringValue(), data );
+        } else if ( cname == "output" ) {
+            SGPropertyNode *tmp = fgGetNode( child->getStringValue(), true );
+            output_list.push_back( tmp );
+        } else {
+            printf("Error in autopilot config logic, " );
+            if ( name.length() ) {
+                printf("Section = %s\n", name.c_str() );
+            }
+        }
+    }
+
+    if ( axes.size() < 1 || axes.size() > MAX_TABLE_AXES ) {
+        printf("Table %s needs 1 to %d axes\n", name.c_str(), MAX_TABLE_AXES);
+        data.clear();
+        return;
+    }
+
+    // compute strides (last axis varies fastest) and check spacing
+    unsigned int size = 1;
+    int k;
+    for ( k = axes.size() - 1; k >= 0; --k ) {
+        axis &a = axes[k];
+        unsigned int n = a.breakpoints.size();
+        if ( a.prop == NULL || n < 2 ) {
+            printf("Table %s axis %d needs a <prop> and at least two"
+                   " breakpoints\n", name.c_str(), k);
+            data.clear();
+            return;
+        }
+
+        double step = (a.breakpoints[n - 1] - a.breakpoints[0]) / (n - 1);
+        a.uniform = true;
+        unsigned int j;
+        for ( j = 1; j < n; ++j ) {
+            if ( a.breakpoints[j] <= a.breakpoints[j - 1] ) {
+                printf("Table %s axis %d breakpoints must be increasing\n",
+                       name.c_str(), k);
+                data.clear();
+                return;
+            }
+            double expected = a.breakpoints[0] + j * step;
+            if ( fabs( a.breakpoints[j] - expected ) > 1e-9 * fabs( step ) ) {
+                a.uniform = false;
+            }
+        }
+        a.inv_step = 1.0 / step;
+
+        a.stride = size;
+        size *= n;
+    }
+
+    if ( data.size() != size ) {
+        printf("Table %s has %d data values, expected %d\n", name.c_str(),
+               (int)data.size(), size);
+        data.clear();
+    }
+}
+
+
+// Find the lower bracket index and the interpolation fraction of x
+// along one axis, clamping to the end points.
+void FGTableComponent::bracket( axis &a, double x, unsigned int *index,
+                                double *frac )
+{
+    const vector <double> &b = a.breakpoints;
+    unsigned int last = b.size() - 2;
+
+    if ( x <= b[0] ) {
+        *index = 0;
+        *frac = 0.0;
+        return;
+    }
+    if ( x >= b[last + 1] ) {
+        *index = last;
+        *frac = 1.0;
+        return;
+    }
+
+    unsigned int i;
+    if ( a.uniform ) {
+        i = (unsigned int)((x - b[0]) * a.inv_step);
+        if ( i > last ) {
+            i = last;
+        }
+        *index = i;
+        *frac = (x - b[i]) * a.inv_step;
+    } else {
+        // walk from the previous bracket
+        i = a.last;
+        while ( i > 0 && x < b[i] ) {
+            --i;
+        }
+        while ( i < last && x >= b[i + 1] ) {
+            ++i;
+        }
+        a.last = i;
+        *index = i;
+        *frac = (x - b[i]) / (b[i + 1] - b[i]);
+    }
+}
+
+
+void FGTableComponent::update( double /* dt */ )
+{
+    enabled = !data.empty();
+    if ( !enabled ) {
+        return;
+    }
+
+    unsigned int n = axes.size();
+    unsigned int index[MAX_TABLE_AXES];
+    double frac[MAX_TABLE_AXES];
+    unsigned int base = 0;
+    unsigned int k;
+    for ( k = 0; k < n; ++k ) {
+        bracket( axes[k], axes[k].prop->getDoubleValue(), &index[k], &frac[k] );
+        base += index[k] * axes[k].stride;
+    }
+
+    // weighted sum over the 2^n corners of the enclosing cell
+    double output = 0.0;
+    unsigned int corner;
+    for ( corner = 0; corner < (1u << n); ++corner ) {
+        double weight = 1.0;
+        unsigned int offset = base;
+        for ( k = 0; k < n; ++k ) {
+            if ( corner & (1u << k) ) {
+                weight *= frac[k];
+                offset += axes[k].stride;
+            } else {
+                weight *= 1.0 - frac[k];
+            }
+        }
+        if ( weight != 0.0 ) {
+            output += weight * data[offset];
+        }
+    }
+
+    unsigned int i;
+    for ( i = 0; i < output_list.size(); ++i ) {
+        output_list[i]->setDoubleValue( output );
+    }
+
+    if ( debug ) {
+        printf("%s: output = %.4f\n", name.c_str(), output);
+    }
+}
+
+
+FGXMLAutopilot::FGXMLAutopilot() :
+    serviceable( true ),
+    average( 0.0 ),
+    v_last( 0.0 )
+{
 }
 
 
 FGXMLAutopilot::~FGXMLAutopilot() {
+    unsigned int i;
+    for ( i = 0; i < components.size(); ++i ) {
+        delete components[i];
+    }
 }
 
  
 void FGXMLAutopilot::init() {
-    config_props = fgGetNode( "/autopilot/new-config", true );
+    bind();
 
     SGPropertyNode *root_n = fgGetNode("/config/root-path");
     SGPropertyNode *path_n = fgGetNode("/config/autopilot/path");
@@ -773,13 +1093,32 @@ void FGXMLAutopilot::init() {
 
 
 void FGXMLAutopilot::reinit() {
+    unsigned int i;
+    for ( i = 0; i < components.size(); ++i ) {
+        delete components[i];
+    }
     components.clear();
     init();
-    build();
 }
 
 
+/*
+ * Resolve the nodes used by the autopilot itself against the current
+ * property tree.  init() does this before reading the configuration;
+ * a caller that fills in /autopilot/new-config on its own calls
+ * bind() and then build().
+ */
+
 void FGXMLAutopilot::bind() {
+    config_props = fgGetNode( "/autopilot/new-config", true );
+
+    vel.bind( VELOCITIES_AIRSPEED_KT );
+    lookahead5.bind( AUTOPILOT_INTERNAL_LOOKAHEAD_5_SEC_AIRSPEED_KT );
+    lookahead10.bind( AUTOPILOT_INTERNAL_LOOKAHEAD_10_SEC_AIRSPEED_KT );
+
+    target_true.bind( AUTOPILOT_SETTINGS_TRUE_HEADING_DEG );
+    true_hdg.bind( ORIENTATION_GROUNDTRACK_DEG );
+    true_error.bind( AUTOPILOT_INTERNAL_TRUE_HEADING_ERROR_DEG );
 }
 
 void FGXMLAutopilot::unbind() {
@@ -806,6 +1145,12 @@ bool FGXMLAutopilot::build() {
         } else if ( name == "filter" ) {
             FGXMLAutoComponent *c = new FGDigitalFilter( node );
             components.push_back( c );
+        } else if ( name == "expression" ) {
+            FGXMLAutoComponent *c = new FGExpressionComponent( node );
+            components.push_back( c );
+        } else if ( name == "table" ) {
+            FGXMLAutoComponent *c = new FGTableComponent( node );
+            components.push_back( c );
         } else {
 	  printf("Unknown top level section: %s\n", name.c_str() );
             return false;
@@ -828,19 +1173,10 @@ inline void SG_NORMALIZE_RANGE( T &val, const T min, const T max ) {
 /*
  * Update helper values
  */
-static void update_helper( double dt ) {
+void FGXMLAutopilot::update_helper( double dt ) {
     // Estimate speed in 5,10 seconds
-    static SGPropertyNode *vel = fgGetNode( "/velocities/airspeed-kt", true );
-    static SGPropertyNode *lookahead5
-        = fgGetNode( "/autopilot/internal/lookahead-5-sec-airspeed-kt", true );
-    static SGPropertyNode *lookahead10
-        = fgGetNode( "/autopilot/internal/lookahead-10-sec-airspeed-kt", true );
-
-    static double average = 0.0; // average/filtered prediction
-    static double v_last = 0.0;  // last velocity
-
     if ( dt > 0.0 ) {
-        double v = vel->getDoubleValue();
+        double v = vel.get();
         double a = (v - v_last) / dt;
 
         if ( dt < 1.0 ) {
@@ -849,29 +1185,22 @@ static void update_helper( double dt ) {
             average = a;
         }
 
-        lookahead5->setDoubleValue( v + average * 5.0 );
-        lookahead10->setDoubleValue( v + average * 10.0 );
+        lookahead5.set( v + average * 5.0 );
+        lookahead10.set( v + average * 10.0 );
         v_last = v;
     }
 
     // Calculate true heading error normalized to +/- 180.0
-    static SGPropertyNode *target_true
-        = fgGetNode( "/autopilot/settings/true-heading-deg", true );
-    static SGPropertyNode *true_hdg
-        = fgGetNode( "/orientation/groundtrack-deg", true );
-    static SGPropertyNode *true_error
-        = fgGetNode( "/autopilot/internal/true-heading-error-deg", true );
-
-    double diff = target_true->getDoubleValue() - true_hdg->getDoubleValue();
+    double diff = target_true.get() - true_hdg.get();
     if ( diff < -180.0 ) { diff += 360.0; }
     if ( diff > 180.0 ) { diff -= 360.0; }
-    true_error->setDoubleValue( diff );
+    true_error.set( diff );
 
     /* static int c = 0;
     c++;
     if ( c > 25 ) {
         printf("  tgt = %.1f  current = %.1f  error = %.1f\n",
-               target_true->getDoubleValue(), true_hdg->getDoubleValue(),
+               target_true.get(), true_hdg.get(),
                diff);
         c = 0;
         } */
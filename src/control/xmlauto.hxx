@@ -36,7 +36,10 @@ using std::string;
 using std::vector;
 using std::deque;
 
+#include <include/props_schema.h>
 #include <props/props.hxx>
+
+#include "expression.hxx"
 // #include </structure/subsystem_mgr.hxx>
 
 // #include <Main/fg_props.hxx>
@@ -53,7 +56,7 @@ protected:
     string name;
 
     SGPropertyNode_ptr enable_prop;
-    SGPropertyNode_ptr passive_mode;
+    SGTypedProperty<bool> passive_mode;
     string enable_value;
     bool honor_passive;
     bool enabled;
@@ -67,14 +70,15 @@ public:
 
     FGXMLAutoComponent() :
       enable_prop( NULL ),
-      passive_mode( fgGetNode("/autopilot/locks/passive-mode", true) ),
       enable_value( "" ),
       honor_passive( false ),
       enabled( false ),
       input_prop( NULL ),
       r_n_prop( NULL ),
       r_n_value( 0.0 )
-    { }
+    {
+        passive_mode.bind( AUTOPILOT_LOCKS_PASSIVE_MODE );
+    }
 
     virtual ~FGXMLAutoComponent() {}
 
@@ -117,6 +121,12 @@ private:
     double Ti;                  // Integrator time (sec)
     double Td;                  // Derivator time (sec)
 
+    // Optional scheduled gains, when set these override the
+    // constant Kp, Ti and Td values each update
+    SGPropertyNode_ptr Kp_prop;
+    SGPropertyNode_ptr Ti_prop;
+    SGPropertyNode_ptr Td_prop;
+
     double u_min;               // Minimum output clamp
     double u_max;               // Maximum output clamp
 
@@ -246,6 +256,106 @@ public:
     void update(double dt);
 };
 
+/**
+ * FGExpressionComponent - evaluate a formula over a set of input
+ * properties and write the result to the output properties.  The
+ * formula is compiled to bytecode once at load time.
+ *
+ * <expression>
+ *   <name>true heading error</name>
+ *   <input>
+ *     <var>target</var>
+ *     <prop>/autopilot/settings/true-heading-deg</prop>
+ *   </input>
+ *   <input>
+ *     <var>track</var>
+ *     <prop>/orientation/groundtrack-deg</prop>
+ *   </input>
+ *   <formula>wrap(target - track, -180, 180)</formula>
+ *   <output>/autopilot/internal/true-heading-error-deg</output>
+ * </expression>
+ *
+ * The frame time is available to the formula as "dt".
+ */
+
+class FGExpressionComponent : public FGXMLAutoComponent
+{
+private:
+    FGExpression expr;
+    vector <SGPropertyNode_ptr> input_list;
+    vector <int> input_slot;
+    int dt_slot;
+
+    bool debug;
+
+public:
+    FGExpressionComponent(SGPropertyNode *node);
+    ~FGExpressionComponent() {}
+
+    void update(double dt);
+};
+
+/**
+ * FGTableComponent - N-dimensional lookup table with multilinear
+ * interpolation, typically used for gain scheduling.  Data is listed
+ * with the last axis varying fastest.  Inputs outside of the
+ * breakpoints are clamped to the table edges.
+ *
+ * <table>
+ *   <name>roll gain schedule</name>
+ *   <axis>
+ *     <prop>/velocities/airspeed-kt</prop>
+ *     <breakpoints>20 30 40 50</breakpoints>
+ *   </axis>
+ *   <axis>
+ *     <prop>/controls/engines/engine/throttle</prop>
+ *     <breakpoints>0.0 0.5 1.0</breakpoints>
+ *   </axis>
+ *   <data>
+ *     0.030 0.028 0.025
+ *     0.024 0.022 0.020
+ *     0.018 0.017 0.015
+ *     0.014 0.013 0.012
+ *   </data>
+ *   <output>/autopilot/gains/roll-kp</output>
+ * </table>
+ *
+ * Evenly spaced breakpoints are indexed directly, otherwise the
+ * search starts from the previous bracket so slowly varying inputs
+ * cost a compare or two per axis.  A pid-controller picks up a
+ * scheduled gain with <Kp><prop>/autopilot/gains/roll-kp</prop></Kp>;
+ * list the table ahead of the controller so it runs first.
+ */
+
+#define MAX_TABLE_AXES 4
+
+class FGTableComponent : public FGXMLAutoComponent
+{
+private:
+    struct axis {
+        SGPropertyNode_ptr prop;
+        vector <double> breakpoints;
+        bool uniform;           // evenly spaced breakpoints
+        double inv_step;        // 1 / spacing when uniform
+        unsigned int last;      // cached lower bracket index
+        unsigned int stride;    // data offset of one step along this axis
+    };
+
+    vector <axis> axes;
+    vector <double> data;
+
+    bool debug;
+
+    static void bracket( axis &a, double x, unsigned int *index,
+                         double *frac );
+
+public:
+    FGTableComponent(SGPropertyNode *node);
+    ~FGTableComponent() {}
+
+    void update(double dt);
+};
+
 /**
  * Model an autopilot system.
  * 
@@ -273,9 +383,22 @@ protected:
 
 private:
 
+    void update_helper( double dt );
+
     bool serviceable;
     SGPropertyNode_ptr config_props;
     comp_list components;
+
+    // update_helper() nodes and state, kept per instance so several
+    // autopilots with their own property trees can run side by side
+    SGTypedProperty<double> vel;
+    SGTypedProperty<double> lookahead5;
+    SGTypedProperty<double> lookahead10;
+    SGTypedProperty<double> target_true;
+    SGTypedProperty<double> true_hdg;
+    SGTypedProperty<double> true_error;
+    double average;             // average/filtered prediction
+    double v_last;              // last velocity
 };
 
 
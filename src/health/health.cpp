@@ -4,8 +4,10 @@
 #include <stdio.h>
 
 #include "include/globaldefs.h"
+#include "include/props_schema.h"
 
 #include "comms/console_link.h"
+#include "comms/logging.h"
 #include "props/props.hxx"
 #include "util/timing.h"
 
@@ -16,30 +18,33 @@
 
 struct health healthpacket;
 
-static SGPropertyNode *ap_roll;
-static SGPropertyNode *ap_hdg;
-static SGPropertyNode *ap_pitch;
-static SGPropertyNode *ap_climb;
-static SGPropertyNode *ap_altitude;
-static SGPropertyNode *ground_ref;
-static SGPropertyNode *ap_agl;
+static SGTypedProperty<double> ap_roll;
+static SGTypedProperty<double> ap_hdg;
+static SGTypedProperty<double> ap_pitch;
+static SGTypedProperty<double> ap_climb;
+static SGTypedProperty<double> ap_altitude;
+static SGTypedProperty<float> ground_ref;
+static SGTypedProperty<double> ap_agl;
 
 
 bool health_init() {
     loadavg_init();
     //sgbatmon_init();
 
-    ap_roll = fgGetNode("/autopilot/internal/target-roll-deg", true);
-    ap_hdg = fgGetNode( "/autopilot/settings/true-heading-deg", true );
-    ap_pitch = fgGetNode( "/autopilot/settings/target-pitch-deg", true );
-    ap_climb = fgGetNode("/autopilot/internal/target-climb-rate-fps", true);
-    ap_altitude = fgGetNode( "/autopilot/settings/target-altitude-ft", true );
-    ground_ref = fgGetNode( "/position/ground-altitude-pressure-m", true );
-    ap_agl = fgGetNode( "/autopilot/settings/target-agl-ft", true );
+    ap_roll.bind( AUTOPILOT_INTERNAL_TARGET_ROLL_DEG );
+    ap_hdg.bind( AUTOPILOT_SETTINGS_TRUE_HEADING_DEG );
+    ap_pitch.bind( AUTOPILOT_SETTINGS_TARGET_PITCH_DEG );
+    ap_climb.bind( AUTOPILOT_INTERNAL_TARGET_CLIMB_RATE_FPS );
+    ap_altitude.bind( AUTOPILOT_SETTINGS_TARGET_ALTITUDE_FT );
+    ground_ref.bind( POSITION_GROUND_ALTITUDE_PRESSURE_M );
+    ap_agl.bind( AUTOPILOT_SETTINGS_TARGET_AGL_FT );
 
     // set initial values
     healthpacket.command_sequence = 0;
     healthpacket.target_waypoint = 0;
+    healthpacket.log_queue_depth = 0;
+    healthpacket.log_write_usec = 0;
+    healthpacket.log_dropped = 0;
 
     return true;
 }
@@ -48,14 +53,18 @@ bool health_init() {
 bool health_update() {
     healthpacket.time = get_Time();
 
-    healthpacket.target_roll_deg = ap_roll->getDoubleValue();
-    healthpacket.target_heading_deg = ap_hdg->getDoubleValue();
-    healthpacket.target_pitch_deg = ap_pitch->getDoubleValue();
-    healthpacket.target_climb_fps = ap_climb->getDoubleValue();
-    /* healthpacket.target_altitude_ft = ap_altitude->getDoubleValue(); */
+    healthpacket.target_roll_deg = ap_roll.get();
+    healthpacket.target_heading_deg = ap_hdg.get();
+    healthpacket.target_pitch_deg = ap_pitch.get();
+    healthpacket.target_climb_fps = ap_climb.get();
+    /* healthpacket.target_altitude_ft = ap_altitude.get(); */
     healthpacket.target_altitude_ft
-        = ground_ref->getDoubleValue() * SG_METER_TO_FEET
-          + ap_agl->getDoubleValue();
+        = ground_ref.get() * SG_METER_TO_FEET
+          + ap_agl.get();
+
+    healthpacket.log_queue_depth = logging_queue_depth();
+    healthpacket.log_write_usec = logging_write_usec();
+    healthpacket.log_dropped = logging_dropped();
 
     loadavg_update();
     //sgbatmon_update();
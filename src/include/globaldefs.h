@@ -61,6 +61,9 @@ struct health {
     uint64_t loadavg;           /* system "1 minute" load average */
     uint64_t ahrs_hz;           /* actual ahrs loop hz */
     uint64_t nav_hz;            /* actual nav loop hz */
+    uint64_t log_queue_depth;   /* records waiting to be logged */
+    uint64_t log_write_usec;    /* slowest log write since last packet */
+    uint64_t log_dropped;       /* records dropped by the logger */
 };
 
 extern struct imu imupacket;
@@ -0,0 +1,28 @@
+//
+// Typed keys for the properties listed in props_schema.def
+//
+// Each PROPERTY( key, path, type ) line becomes a compile time
+// constant SGPropertyKey<type> named key.  Bind a typed handle to it
+// once at init time and use the handle from then on:
+//
+//     static SGTypedProperty<double> ap_roll;
+//     ap_roll.bind( AUTOPILOT_INTERNAL_TARGET_ROLL_DEG );
+//     ...
+//     double roll = ap_roll.get();
+//
+// To add a property, add a line to props_schema.def.
+//
+
+#ifndef _UGEAR_PROPS_SCHEMA_H
+#define _UGEAR_PROPS_SCHEMA_H
+
+
+#include <props/props_typed.hxx>
+
+#define PROPERTY( key, path, type ) \
+    static const SGPropertyKey<type> key = { path };
+#include "props_schema.def"
+#undef PROPERTY
+
+
+#endif // _UGEAR_PROPS_SCHEMA_H
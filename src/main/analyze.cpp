@@ -0,0 +1,767 @@
+// analyze.cpp - flight statistics across an archive of flight logs
+//
+// analyze [--threads n] [--csv file] <archive or flight dir> [...]
+//
+//     For each flight, compute:
+//
+//       autopilot tracking error, per controller: the health record's
+//       roll, pitch, heading, climb and altitude targets against the
+//       attitude and nav solution at the same time (only while the
+//       autopilot is engaged, if the event log says when that was)
+//
+//       gps against nav: the north, east and down position and the
+//       velocity differences at each gps fix
+//
+//       loop health: the imu time step, and the ahrs and nav rates,
+//       load average and log writer figures of the health records
+//
+//       battery: any channel field with "volt" in its name
+//
+//     and print one row per flight and figure: count, mean, standard
+//     deviation, minimum, 50th, 95th and 99th percentiles, maximum and
+//     the trend (least squares slope per minute).  With --csv, write
+//     the same table to a file.
+//
+//     Every figure is computed in one pass in constant memory: mean
+//     and variance by Welford's method, percentiles by the P-square
+//     estimator (Jain and Chlamtac), so a flight costs one decode of
+//     each stream it uses.  The flights are analyzed by a pool of
+//     threads.
+
+#include <ctype.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "comms/events.h"
+#include "comms/flightlog.h"
+#include "include/globaldefs.h"
+
+using std::string;
+using std::vector;
+
+
+#define FT_PER_M 3.28083989501312
+#define EARTH_RADIUS_M 6378137.0
+
+
+void usage( char *prog ) {
+    printf("Usage: %s [ --options ] <archive or flight dir> [ ... ]\n",
+           prog);
+    printf("\n");
+    printf("  --threads <n>    : analyze n flights at once (default 4)\n");
+    printf("  --csv <file>     : also write the table as CSV\n");
+
+    exit(0);
+}
+
+
+// One quantile of a stream of values, estimated in constant memory
+// by the P-square algorithm: five markers whose heights follow the
+// minimum, the p/2, p and (1+p)/2 quantiles and the maximum, adjusted
+// by piecewise parabolic interpolation as values arrive.
+class p2_quantile {
+
+public:
+
+    p2_quantile( double quantile ) : p( quantile ), count( 0 ) {}
+
+    void add( double x );
+    double value() const;
+
+private:
+
+    double p;
+    int count;
+    double q[5];                // marker heights
+    double n[5];                // marker positions
+    double np[5];               // desired positions
+    double dn[5];               // their increments
+};
+
+
+void p2_quantile::add( double x ) {
+    if ( count < 5 ) {
+        q[count++] = x;
+        if ( count == 5 ) {
+            std::sort( q, q + 5 );
+            for ( int i = 0; i < 5; i++ ) {
+                n[i] = i;
+            }
+            np[0] = 0.0;
+            np[1] = 2.0 * p;
+            np[2] = 4.0 * p;
+            np[3] = 2.0 + 2.0 * p;
+            np[4] = 4.0;
+            dn[0] = 0.0;
+            dn[1] = p / 2.0;
+            dn[2] = p;
+            dn[3] = (1.0 + p) / 2.0;
+            dn[4] = 1.0;
+        }
+        return;
+    }
+    count++;
+
+    // the cell x falls in, stretching the ends to take it
+    int k;
+    if ( x < q[0] ) {
+        q[0] = x;
+        k = 0;
+    } else if ( x >= q[4] ) {
+        q[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while ( k < 3 && x >= q[k + 1] ) {
+            k++;
+        }
+    }
+    for ( int i = k + 1; i < 5; i++ ) {
+        n[i] += 1.0;
+    }
+    for ( int i = 0; i < 5; i++ ) {
+        np[i] += dn[i];
+    }
+
+    // move the middle markers that are off their desired position
+    for ( int i = 1; i < 4; i++ ) {
+        double d = np[i] - n[i];
+        if ( (d >= 1.0 && n[i + 1] - n[i] > 1.0)
+             || (d <= -1.0 && n[i - 1] - n[i] < -1.0) )
+        {
+            d = d > 0.0 ? 1.0 : -1.0;
+            double qp = q[i] + d / (n[i + 1] - n[i - 1])
+                * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i])
+                   / (n[i + 1] - n[i])
+                   + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1])
+                   / (n[i] - n[i - 1]));
+            if ( q[i - 1] < qp && qp < q[i + 1] ) {
+                q[i] = qp;
+            } else {
+                int j = i + (int)d;
+                q[i] += d * (q[j] - q[i]) / (n[j] - n[i]);
+            }
+            n[i] += d;
+        }
+    }
+}
+
+
+double p2_quantile::value() const {
+    if ( count >= 5 ) {
+        return q[2];
+    }
+    if ( count == 0 ) {
+        return 0.0;
+    }
+    // few values: the exact quantile, from an insertion sort of the
+    // at most four of them (std::sort over v[5] trips -Warray-bounds)
+    double v[5];
+    int size = 0;
+    for ( int i = 0; i < count && i < 5; i++ ) {
+        int j = size++;
+        while ( j > 0 && v[j - 1] > q[i] ) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = q[i];
+    }
+    return v[(int)(p * (size - 1) + 0.5)];
+}
+
+
+// The running statistics of one figure: Welford's mean and variance,
+// the extremes, three percentiles, and the least squares slope
+// against time from the running covariance.
+class metric {
+
+public:
+
+    metric() : n( 0 ), mean( 0.0 ), m2( 0.0 ), min( 0.0 ), max( 0.0 ),
+               mean_t( 0.0 ), m2_t( 0.0 ), c_tx( 0.0 ),
+               p50( 0.50 ), p95( 0.95 ), p99( 0.99 ) {}
+
+    void add( double t, double x );
+
+    unsigned long count() const { return n; }
+    double average() const { return mean; }
+    double stddev() const { return n > 1 ? sqrt( m2 / (n - 1) ) : 0.0; }
+    double low() const { return min; }
+    double high() const { return max; }
+    double median() const { return p50.value(); }
+    double pct95() const { return p95.value(); }
+    double pct99() const { return p99.value(); }
+
+    // change per minute
+    double trend() const { return m2_t > 0.0 ? 60.0 * c_tx / m2_t : 0.0; }
+
+private:
+
+    unsigned long n;
+    double mean;
+    double m2;
+    double min;
+    double max;
+    double mean_t;
+    double m2_t;
+    double c_tx;
+    p2_quantile p50;
+    p2_quantile p95;
+    p2_quantile p99;
+};
+
+
+void metric::add( double t, double x ) {
+    if ( x != x ) {
+        return;                 // NaN
+    }
+    n++;
+    if ( n == 1 ) {
+        min = max = x;
+    } else {
+        if ( x < min ) min = x;
+        if ( x > max ) max = x;
+    }
+
+    double dx = x - mean;
+    mean += dx / n;
+    m2 += dx * (x - mean);
+
+    double dt = t - mean_t;
+    mean_t += dt / n;
+    m2_t += dt * (t - mean_t);
+    c_tx += dt * (x - mean);
+
+    p50.add( x );
+    p95.add( x );
+    p99.add( x );
+}
+
+
+// The records of one stream of a flight, in time order, across its
+// segments.  The schema is taken to be the same in every segment.
+class stream_walker {
+
+public:
+
+    stream_walker( const vector<string> &segments, const char *name );
+    ~stream_walker();
+
+    // the stream is in the flight
+    bool found() const { return have_schema; }
+
+    // a field's index, or -1
+    int field( const char *name ) const {
+        return have_schema ? schema.find_field( name ) : -1;
+    }
+
+    // step to the next record; false at the end
+    bool next();
+
+    // step to the last record at or before t; false if there is none
+    bool seek_before( double t );
+
+    double time() const { return schema.time( &record[0], swap ); }
+    double value( int f ) const {
+        return f < 0 ? NAN : schema.fields[f].value( &record[0], swap );
+    }
+
+    // if set, the time step from each record to the next, in
+    // milliseconds, is added to it
+    metric *steps;
+
+private:
+
+    bool fetch( vector<uint8_t> &into );
+
+    vector<string> segments;
+    string name;
+    unsigned int segment;
+    FlightLogReader *reader;
+    FlightLogCursor *cursor;
+    flightlog_stream schema;
+    bool have_schema;
+    bool swap;
+
+    vector<uint8_t> record;
+    bool have;
+    vector<uint8_t> ahead;      // the record after, read to look ahead
+    bool have_ahead;
+    double last_time;
+    bool have_last;
+};
+
+
+stream_walker::stream_walker( const vector<string> &segs, const char *n ) :
+    steps( NULL ),
+    segments( segs ),
+    name( n ),
+    segment( 0 ),
+    reader( NULL ),
+    cursor( NULL ),
+    have_schema( false ),
+    swap( false ),
+    have( false ),
+    have_ahead( false ),
+    have_last( false )
+{
+    for ( unsigned int i = 0; i < segments.size(); i++ ) {
+        FlightLogReader r;
+        int sn;
+        if ( r.open( segments[i].c_str() )
+             && (sn = r.find_stream( n )) >= 0 )
+        {
+            schema = r.stream( sn );
+            have_schema = true;
+            break;
+        }
+    }
+}
+
+
+stream_walker::~stream_walker() {
+    delete cursor;
+    delete reader;
+}
+
+
+// the next record of the stream, from the next segment if need be
+bool stream_walker::fetch( vector<uint8_t> &into ) {
+    if ( !have_schema ) {
+        return false;
+    }
+
+    while ( true ) {
+        if ( cursor != NULL ) {
+            const uint8_t *r = cursor->next();
+            if ( r != NULL ) {
+                into.assign( r, r + schema.record_size );
+                if ( steps != NULL ) {
+                    double t = schema.time( r, swap );
+                    if ( have_last ) {
+                        steps->add( t, (t - last_time) * 1000.0 );
+                    }
+                    last_time = t;
+                    have_last = true;
+                }
+                return true;
+            }
+        }
+
+        delete cursor;
+        cursor = NULL;
+        delete reader;
+        reader = NULL;
+        if ( segment >= segments.size() ) {
+            return false;
+        }
+
+        reader = new FlightLogReader;
+        if ( reader->open( segments[segment++].c_str() ) ) {
+            int sn = reader->find_stream( name.c_str() );
+            if ( sn >= 0 && reader->stream( sn ).record_size
+                            == schema.record_size )
+            {
+                swap = reader->swapped();
+                cursor = new FlightLogCursor( reader, sn );
+            }
+        }
+    }
+}
+
+
+bool stream_walker::next() {
+    if ( have_ahead ) {
+        record.swap( ahead );
+        have_ahead = false;
+        have = true;
+    } else {
+        have = fetch( record );
+    }
+    return have;
+}
+
+
+bool stream_walker::seek_before( double t ) {
+    while ( true ) {
+        if ( !have_ahead ) {
+            have_ahead = fetch( ahead );
+            if ( !have_ahead ) {
+                break;
+            }
+        }
+        if ( schema.time( &ahead[0], swap ) > t ) {
+            break;
+        }
+        record.swap( ahead );
+        have_ahead = false;
+        have = true;
+    }
+    return have && time() <= t;
+}
+
+
+// one flight, and its figures
+struct job {
+    job() : ok( false ) {}
+
+    string flight;
+    bool ok;
+    vector<string> names;
+    // (a deque, so the references figure() returns stay valid)
+    std::deque<metric> metrics;
+};
+
+static vector<job> jobs;
+static unsigned int next_job = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// the figure of a job with the given name, added if it is new
+static metric &figure( job &j, const string &name ) {
+    for ( unsigned int i = 0; i < j.names.size(); i++ ) {
+        if ( j.names[i] == name ) {
+            return j.metrics[i];
+        }
+    }
+    j.names.push_back( name );
+    j.metrics.push_back( metric() );
+    return j.metrics.back();
+}
+
+
+static double wrap_180( double deg ) {
+    while ( deg > 180.0 ) deg -= 360.0;
+    while ( deg < -180.0 ) deg += 360.0;
+    return deg;
+}
+
+
+// tracking error of each controller, at the health records
+static void tracking( job &j, const vector<string> &segments ) {
+    stream_walker health( segments, "health" );
+    stream_walker imu( segments, "imu" );
+    stream_walker nav( segments, "nav" );
+    if ( !health.found() || !imu.found() ) {
+        return;
+    }
+    imu.steps = &figure( j, "imu step ms" );
+
+    int h_roll = health.field( "target_roll_deg" );
+    int h_pitch = health.field( "target_pitch_deg" );
+    int h_hdg = health.field( "target_heading_deg" );
+    int h_climb = health.field( "target_climb_fps" );
+    int h_alt = health.field( "target_altitude_ft" );
+    int h_ahrs = health.field( "ahrs_hz" );
+    int h_nav = health.field( "nav_hz" );
+    int h_load = health.field( "loadavg" );
+    int h_write = health.field( "log_write_usec" );
+    int h_dropped = health.field( "log_dropped" );
+    int i_phi = imu.field( "phi" );
+    int i_the = imu.field( "the" );
+    int i_psi = imu.field( "psi" );
+    int n_alt = nav.field( "alt" );
+    int n_vd = nav.field( "vd" );
+    int n_err = nav.field( "err_type" );
+
+    // when the autopilot was engaged, from the event log
+    vector<event_record> events;
+    events_read( (j.flight + "/events.log").c_str(), &events );
+    vector<event_record> engage;
+    for ( unsigned int i = 0; i < events.size(); i++ ) {
+        if ( events[i].type == EVENT_AUTOPILOT ) {
+            engage.push_back( events[i] );
+        }
+    }
+    // (with no autopilot events, take it to be engaged throughout)
+    bool engaged = engage.empty() || engage[0].arg == 0;
+    unsigned int next_engage = 0;
+
+    metric &roll = figure( j, "roll error deg" );
+    metric &pitch = figure( j, "pitch error deg" );
+    metric &heading = figure( j, "heading error deg" );
+    metric &climb = figure( j, "climb error fps" );
+    metric &alt = figure( j, "altitude error ft" );
+
+    while ( health.next() ) {
+        double t = health.time();
+        figure( j, "ahrs hz" ).add( t, health.value( h_ahrs ) );
+        figure( j, "nav hz" ).add( t, health.value( h_nav ) );
+        figure( j, "load avg" ).add( t, health.value( h_load ) / 100.0 );
+        figure( j, "log write us" ).add( t, health.value( h_write ) );
+        figure( j, "log dropped" ).add( t, health.value( h_dropped ) );
+
+        while ( next_engage < engage.size()
+                && engage[next_engage].time <= t )
+        {
+            engaged = engage[next_engage++].arg != 0;
+        }
+        if ( !engaged || !imu.seek_before( t ) ) {
+            continue;
+        }
+
+        roll.add( t, health.value( h_roll )
+                  - imu.value( i_phi ) * SG_RADIANS_TO_DEGREES );
+        pitch.add( t, health.value( h_pitch )
+                   - imu.value( i_the ) * SG_RADIANS_TO_DEGREES );
+        heading.add( t, wrap_180( health.value( h_hdg )
+                                  - imu.value( i_psi )
+                                  * SG_RADIANS_TO_DEGREES ) );
+
+        if ( nav.found() && nav.seek_before( t )
+             && nav.value( n_err ) == no_error )
+        {
+            climb.add( t, health.value( h_climb )
+                       + nav.value( n_vd ) * FT_PER_M );
+            alt.add( t, health.value( h_alt )
+                     - nav.value( n_alt ) * FT_PER_M );
+        }
+    }
+
+    // the rest of the imu, for its time steps
+    imu.seek_before( HUGE_VAL );
+}
+
+
+// gps fixes against the nav solution at the same time
+static void innovation( job &j, const vector<string> &segments ) {
+    stream_walker gps( segments, "gps" );
+    stream_walker nav( segments, "nav" );
+    if ( !gps.found() || !nav.found() ) {
+        return;
+    }
+
+    const char *names[] = { "lat", "lon", "alt", "vn", "ve", "vd",
+                            "err_type" };
+    int g[7], n[7];
+    for ( int i = 0; i < 7; i++ ) {
+        g[i] = gps.field( names[i] );
+        n[i] = nav.field( names[i] );
+    }
+
+    metric &north = figure( j, "gps-nav north m" );
+    metric &east = figure( j, "gps-nav east m" );
+    metric &down = figure( j, "gps-nav down m" );
+    metric &vn = figure( j, "gps-nav vn m/s" );
+    metric &ve = figure( j, "gps-nav ve m/s" );
+    metric &vd = figure( j, "gps-nav vd m/s" );
+
+    while ( gps.next() ) {
+        double t = gps.time();
+        if ( gps.value( g[6] ) != no_error || !nav.seek_before( t )
+             || nav.value( n[6] ) != no_error )
+        {
+            continue;
+        }
+        double lat = gps.value( g[0] ) * SG_DEGREES_TO_RADIANS;
+        north.add( t, (gps.value( g[0] ) - nav.value( n[0] ))
+                   * SG_DEGREES_TO_RADIANS * EARTH_RADIUS_M );
+        east.add( t, (gps.value( g[1] ) - nav.value( n[1] ))
+                  * SG_DEGREES_TO_RADIANS * EARTH_RADIUS_M * cos( lat ) );
+        down.add( t, nav.value( n[2] ) - gps.value( g[2] ) );
+        vn.add( t, gps.value( g[3] ) - nav.value( n[3] ) );
+        ve.add( t, gps.value( g[4] ) - nav.value( n[4] ) );
+        vd.add( t, gps.value( g[5] ) - nav.value( n[5] ) );
+    }
+}
+
+
+// the channel fields that look like a battery voltage
+static void battery( job &j, const vector<string> &segments ) {
+    FlightLogReader reader;
+    if ( !reader.open( segments[0].c_str() ) ) {
+        return;
+    }
+
+    for ( int sn = 0; sn < reader.stream_count(); sn++ ) {
+        const flightlog_stream &s = reader.stream( sn );
+        vector<int> fields;
+        for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+            string lower;
+            for ( unsigned int k = 0; k < s.fields[i].name.length(); k++ ) {
+                lower += tolower( s.fields[i].name[k] );
+            }
+            if ( lower.find( "volt" ) != string::npos ) {
+                fields.push_back( i );
+            }
+        }
+        if ( fields.empty() ) {
+            continue;
+        }
+
+        stream_walker w( segments, s.name.c_str() );
+        while ( w.next() ) {
+            for ( unsigned int i = 0; i < fields.size(); i++ ) {
+                figure( j, s.name + " " + s.fields[fields[i]].name )
+                    .add( w.time(), w.value( fields[i] ) );
+            }
+        }
+    }
+}
+
+
+static void *worker( void * ) {
+    while ( true ) {
+        pthread_mutex_lock( &job_lock );
+        unsigned int i = next_job++;
+        pthread_mutex_unlock( &job_lock );
+        if ( i >= jobs.size() ) {
+            break;
+        }
+
+        job &j = jobs[i];
+        vector<string> segments = flightlog_segments( j.flight.c_str() );
+        FlightLogReader first;
+        j.ok = !segments.empty() && first.open( segments[0].c_str() );
+        if ( j.ok ) {
+            tracking( j, segments );
+            innovation( j, segments );
+            battery( j, segments );
+        }
+    }
+
+    return NULL;
+}
+
+
+// the flights in path: path itself if it holds a flight log, else
+// its fltNNNNN subdirectories
+static void add_flights( string path ) {
+    while ( path.length() > 1 && path[path.length() - 1] == '/' ) {
+        path.erase( path.length() - 1 );
+    }
+
+    if ( !flightlog_segments( path.c_str() ).empty() ) {
+        job j;
+        j.flight = path;
+        jobs.push_back( j );
+        return;
+    }
+
+    vector<string> names;
+    DIR *d = opendir( path.c_str() );
+    if ( d == NULL ) {
+        printf("Cannot open %s\n", path.c_str());
+        return;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        int num;
+        if ( sscanf( entry->d_name, "flt%d", &num ) == 1 ) {
+            names.push_back( entry->d_name );
+        }
+    }
+    closedir( d );
+    sort( names.begin(), names.end() );
+
+    for ( unsigned int i = 0; i < names.size(); i++ ) {
+        string flight = path + "/" + names[i];
+        if ( !flightlog_segments( flight.c_str() ).empty() ) {
+            job j;
+            j.flight = flight;
+            jobs.push_back( j );
+        }
+    }
+}
+
+
+int main( int argc, char **argv )
+{
+    int threads = 4;
+    string csv_file;
+    vector<string> paths;
+
+    for ( int iarg = 1; iarg < argc; iarg++ ) {
+        if ( !strcmp(argv[iarg], "--threads") && iarg + 1 < argc ) {
+            ++iarg;
+            threads = atoi( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--csv") && iarg + 1 < argc ) {
+            ++iarg;
+            csv_file = argv[iarg];
+        } else if ( argv[iarg][0] == '-' ) {
+            usage( argv[0] );
+        } else {
+            paths.push_back( argv[iarg] );
+        }
+    }
+    if ( paths.empty() || threads < 1 ) {
+        usage( argv[0] );
+    }
+
+    for ( unsigned int i = 0; i < paths.size(); i++ ) {
+        add_flights( paths[i] );
+    }
+
+    vector<pthread_t> pool( threads );
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_create( &pool[i], NULL, worker, NULL );
+    }
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_join( pool[i], NULL );
+    }
+
+    FILE *csv = NULL;
+    if ( !csv_file.empty() ) {
+        csv = fopen( csv_file.c_str(), "w" );
+        if ( csv == NULL ) {
+            printf("Cannot create %s\n", csv_file.c_str());
+            return -1;
+        }
+        fprintf( csv, "flight,figure,count,mean,std,min,p50,p95,p99,max,"
+                 "trend_per_min\n" );
+    }
+
+    printf("%-24s %-22s %8s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+           "flight", "figure", "count", "mean", "std", "min", "p50", "p95",
+           "p99", "max", "trend/min");
+
+    int failures = 0;
+    for ( unsigned int i = 0; i < jobs.size(); i++ ) {
+        const job &j = jobs[i];
+        if ( !j.ok ) {
+            printf("%s: cannot read the flight log\n", j.flight.c_str());
+            failures++;
+            continue;
+        }
+        string::size_type slash = j.flight.rfind( '/' );
+        string name = slash == string::npos ? j.flight
+            : j.flight.substr( slash + 1 );
+        for ( unsigned int k = 0; k < j.metrics.size(); k++ ) {
+            const metric &m = j.metrics[k];
+            if ( m.count() == 0 ) {
+                continue;
+            }
+            printf("%-24s %-22s %8lu %10.4g %10.4g %10.4g %10.4g %10.4g "
+                   "%10.4g %10.4g %10.4g\n", name.c_str(),
+                   j.names[k].c_str(), m.count(), m.average(), m.stddev(),
+                   m.low(), m.median(), m.pct95(), m.pct99(), m.high(),
+                   m.trend());
+            if ( csv != NULL ) {
+                fprintf( csv, "%s,%s,%lu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,"
+                         "%.9g,%.9g\n", j.flight.c_str(), j.names[k].c_str(),
+                         m.count(), m.average(), m.stddev(), m.low(),
+                         m.median(), m.pct95(), m.pct99(), m.high(),
+                         m.trend() );
+            }
+        }
+    }
+
+    if ( csv != NULL && fclose( csv ) != 0 ) {
+        printf("Cannot write %s\n", csv_file.c_str());
+        failures++;
+    }
+
+    printf("%lu flights analyzed, %d failed\n", (unsigned long)jobs.size(),
+           failures);
+
+    return failures ? -1 : 0;
+}
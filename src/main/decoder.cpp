@@ -0,0 +1,391 @@
+// decoder.cpp - convert flight logs (see comms/flightlog.h) to text or
+// NumPy column files.
+//
+// decoder [--npy] [--threads n] [--out dir] fltNNNNN [fltNNNNN ...]
+//
+//     For each flight directory, write one file per stream,
+//     <stream>.csv, with a header line of field names; or with --npy,
+//     one directory per stream holding <field>.npy for each field,
+//     which numpy.load(file, mmap_mode='r') maps without reading.  The
+//     output goes in the flight directory, or under dir/fltNNNNN
+//     (dir/fltNNNNN-2 and so on for a second flight of the same name,
+//     from another archive).
+//
+//     Each stream of each flight is decoded by one thread of a pool,
+//     reading the log a block at a time, so memory use does not grow
+//     with the length of the flight and many flights can be converted
+//     in one run.
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "comms/flightlog.h"
+
+using std::string;
+using std::vector;
+
+
+static bool npy = false;
+
+
+void usage( char *prog ) {
+    printf("Usage: %s [ --options ] <flight dir> [ <flight dir> ... ]\n",
+           prog);
+    printf("\n");
+    printf("  --npy            : write NumPy column files instead of CSV\n");
+    printf("  --threads <n>    : decode n streams at once (default 4)\n");
+    printf("  --out <dir>      : write under dir/<flight> instead of in\n");
+    printf("                     the flight directory\n");
+
+    exit(0);
+}
+
+
+// one stream of one flight
+struct job {
+    string flight;              // flight directory
+    string out;                 // output directory
+    vector<string> segments;
+    string stream;
+};
+
+static vector<job> jobs;
+static unsigned int next_job = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failures = 0;
+
+
+// a file name from a field name: chn[0] -> chn0, and (for channels)
+// /velocities/airspeed-kt -> velocities.airspeed-kt
+static string file_name( const string &field ) {
+    string name;
+    for ( unsigned int i = 0; i < field.length(); i++ ) {
+        char c = field[i];
+        if ( isalnum( c ) || c == '_' || c == '-' || c == '.' ) {
+            name += c;
+        } else if ( c == '/' && !name.empty() ) {
+            name += '.';
+        }
+    }
+    return name;
+}
+
+
+static const char *npy_type( flightlog_type type ) {
+    uint16_t one = 1;
+    bool little = *(uint8_t *)&one == 1;
+
+    switch ( type ) {
+    case LOG_DOUBLE: return little ? "<f8" : ">f8";
+    case LOG_FLOAT: return little ? "<f4" : ">f4";
+    case LOG_INT8: return "|i1";
+    case LOG_UINT8: return "|u1";
+    case LOG_INT16: return little ? "<i2" : ">i2";
+    case LOG_UINT16: return little ? "<u2" : ">u2";
+    case LOG_INT32: return little ? "<i4" : ">i4";
+    case LOG_UINT32: return little ? "<u4" : ">u4";
+    case LOG_INT64: return little ? "<i8" : ">i8";
+    case LOG_UINT64: return little ? "<u8" : ">u8";
+    }
+    return "";
+}
+
+
+// write (or rewrite, once the length is known) the header of a
+// version 1.0 .npy file.  The header is always 128 bytes, so the data
+// can be written before the final count is.
+static bool npy_header( FILE *f, flightlog_type type, unsigned long rows ) {
+    char dict[128];
+    int len = snprintf( dict, sizeof(dict),
+                        "{'descr': '%s', 'fortran_order': False, "
+                        "'shape': (%lu,), }", npy_type( type ), rows );
+    char header[128];
+    memset( header, ' ', sizeof(header) );
+    memcpy( header, "\x93NUMPY\x01\x00", 8 );
+    header[8] = 128 - 10;
+    header[9] = 0;
+    memcpy( header + 10, dict, len );
+    header[127] = '\n';
+
+    return fseek( f, 0, SEEK_SET ) == 0
+        && fwrite( header, 1, sizeof(header), f ) == sizeof(header);
+}
+
+
+// copy a field to a column, in the byte order of this machine.
+// Counts are converted to doubles in their units.
+static void column_value( uint8_t *out, const flightlog_field &f,
+                          const uint8_t *record, bool swap, int size )
+{
+    if ( f.scale != 1.0 ) {
+        double v = f.value( record, swap );
+        memcpy( out, &v, sizeof(v) );
+        return;
+    }
+    for ( int i = 0; i < size; i++ ) {
+        out[i] = record[f.offset + (swap ? size - 1 - i : i)];
+    }
+}
+
+
+// the type of a field's column
+static flightlog_type column_type( const flightlog_field &f ) {
+    return f.scale != 1.0 ? LOG_DOUBLE : f.type;
+}
+
+
+static int type_bytes( flightlog_type type ) {
+    switch ( type ) {
+    case LOG_DOUBLE: case LOG_INT64: case LOG_UINT64: return 8;
+    case LOG_FLOAT: case LOG_INT32: case LOG_UINT32: return 4;
+    case LOG_INT16: case LOG_UINT16: return 2;
+    default: return 1;
+    }
+}
+
+
+static bool make_dir( const string &dir ) {
+    if ( mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+        printf("Cannot create %s\n", dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// decode one stream of one flight, segment by segment and block by
+// block
+static bool decode( const job &j ) {
+    vector<FILE *> files;
+    vector<flightlog_type> types;
+    vector<uint8_t> records;
+    vector<char> text;
+    vector<uint8_t> column;
+    unsigned long rows = 0;
+    bool result = true;
+
+    for ( unsigned int seg = 0; seg < j.segments.size() && result; seg++ ) {
+        FlightLogReader reader;
+        if ( !reader.open( j.segments[seg].c_str() ) ) {
+            result = false;
+            break;
+        }
+        int sn = reader.find_stream( j.stream.c_str() );
+        if ( sn < 0 ) {
+            continue;
+        }
+        const flightlog_stream &s = reader.stream( sn );
+        bool swap = reader.swapped();
+
+        // open the outputs from the first segment's schema
+        if ( files.empty() ) {
+            if ( npy ) {
+                string dir = j.out + "/" + j.stream;
+                result = make_dir( dir );
+                for ( unsigned int i = 0; i < s.fields.size() && result;
+                      i++ )
+                {
+                    string file = dir + "/" + file_name( s.fields[i].name )
+                        + ".npy";
+                    FILE *f = fopen( file.c_str(), "wb" );
+                    if ( f == NULL ) {
+                        printf("Cannot create %s\n", file.c_str());
+                        result = false;
+                        break;
+                    }
+                    files.push_back( f );
+                    types.push_back( column_type( s.fields[i] ) );
+                    npy_header( f, types.back(), 0 );
+                }
+            } else {
+                string file = j.out + "/" + j.stream + ".csv";
+                FILE *f = fopen( file.c_str(), "w" );
+                if ( f == NULL ) {
+                    printf("Cannot create %s\n", file.c_str());
+                    result = false;
+                    break;
+                }
+                for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+                    fprintf( f, "%s%s", i ? "," : "",
+                             s.fields[i].name.c_str() );
+                }
+                fprintf( f, "\n" );
+                files.push_back( f );
+            }
+        }
+        if ( !result ) {
+            break;
+        }
+        if ( files.size() != (npy ? s.fields.size() : 1) ) {
+            printf("%s: the %s fields change between segments\n",
+                   j.flight.c_str(), j.stream.c_str());
+            result = false;
+            break;
+        }
+
+        for ( int b = 0; b < reader.block_count(); b++ ) {
+            if ( reader.block( b ).stream != sn ) {
+                continue;
+            }
+            if ( !reader.read_block( b, &records ) ) {
+                result = false;
+                break;
+            }
+            uint32_t count = reader.block( b ).records;
+
+            if ( npy ) {
+                for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+                    const flightlog_field &f = s.fields[i];
+                    int size = type_bytes( column_type( f ) );
+                    column.resize( count * size );
+                    for ( uint32_t r = 0; r < count; r++ ) {
+                        column_value( &column[r * size], f,
+                                      &records[r * s.record_size], swap,
+                                      size );
+                    }
+                    fwrite( &column[0], size, count, files[i] );
+                }
+            } else {
+                // about 25 characters a field is plenty
+                text.resize( s.fields.size() * 32 + 1 );
+                for ( uint32_t r = 0; r < count; r++ ) {
+                    const uint8_t *record = &records[r * s.record_size];
+                    int len = 0;
+                    for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+                        if ( i > 0 ) {
+                            text[len++] = ',';
+                        }
+                        len += s.fields[i].format( &text[len], 31, record,
+                                                   swap );
+                    }
+                    text[len++] = '\n';
+                    fwrite( &text[0], 1, len, files[0] );
+                }
+            }
+            rows += count;
+        }
+    }
+
+    for ( unsigned int i = 0; i < files.size(); i++ ) {
+        if ( npy ) {
+            // now the length is known
+            result = npy_header( files[i], types[i], rows ) && result;
+        }
+        if ( fclose( files[i] ) != 0 ) {
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+
+static void *worker( void * ) {
+    while ( true ) {
+        pthread_mutex_lock( &job_lock );
+        unsigned int i = next_job++;
+        pthread_mutex_unlock( &job_lock );
+        if ( i >= jobs.size() ) {
+            break;
+        }
+
+        if ( !decode( jobs[i] ) ) {
+            printf("%s: cannot decode %s\n", jobs[i].flight.c_str(),
+                   jobs[i].stream.c_str());
+            pthread_mutex_lock( &job_lock );
+            failures++;
+            pthread_mutex_unlock( &job_lock );
+        }
+    }
+
+    return NULL;
+}
+
+
+int main( int argc, char **argv )
+{
+    int threads = 4;
+    string out_dir;
+    vector<string> flights;
+
+    for ( int iarg = 1; iarg < argc; iarg++ ) {
+        if ( !strcmp(argv[iarg], "--npy") ) {
+            npy = true;
+        } else if ( !strcmp(argv[iarg], "--threads") && iarg + 1 < argc ) {
+            ++iarg;
+            threads = atoi( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--out") && iarg + 1 < argc ) {
+            ++iarg;
+            out_dir = argv[iarg];
+        } else if ( argv[iarg][0] == '-' ) {
+            usage( argv[0] );
+        } else {
+            flights.push_back( argv[iarg] );
+        }
+    }
+    if ( flights.empty() || threads < 1 ) {
+        usage( argv[0] );
+    }
+    if ( !out_dir.empty() && !make_dir( out_dir ) ) {
+        return -1;
+    }
+
+    // one job per stream per flight; the first segment names the
+    // streams
+    vector<string> out_names;
+    for ( unsigned int i = 0; i < flights.size(); i++ ) {
+        string flight = flights[i];
+        while ( flight.length() > 1 && flight[flight.length() - 1] == '/' ) {
+            flight.erase( flight.length() - 1 );
+        }
+
+        vector<string> segments = flightlog_segments( flight.c_str() );
+        FlightLogReader reader;
+        if ( segments.empty() || !reader.open( segments[0].c_str() ) ) {
+            printf("%s: no flight log\n", flight.c_str());
+            failures++;
+            continue;
+        }
+
+        job j;
+        j.flight = flight;
+        j.out = flight;
+        if ( !out_dir.empty() ) {
+            j.out = out_dir + "/"
+                + flightlog_out_name( flight.c_str(), &out_names );
+            if ( !make_dir( j.out ) ) {
+                failures++;
+                continue;
+            }
+        }
+        j.segments = segments;
+        for ( int s = 0; s < reader.stream_count(); s++ ) {
+            j.stream = reader.stream( s ).name;
+            jobs.push_back( j );
+        }
+    }
+
+    vector<pthread_t> pool( threads );
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_create( &pool[i], NULL, worker, NULL );
+    }
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_join( pool[i], NULL );
+    }
+
+    printf("%lu streams of %lu flights decoded, %d failed\n",
+           (unsigned long)jobs.size(), (unsigned long)flights.size(),
+           failures);
+
+    return failures ? -1 : 0;
+}
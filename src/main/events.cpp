@@ -0,0 +1,102 @@
+// events.cpp - print flight event logs (see comms/events.h) as text.
+//
+// events [--level l] [--type t] fltNNNNN|events.log [...]
+//
+//     Print one line per event: time, severity, type, argument and
+//     text.  --level skips the events below severity l (debug, info,
+//     warning or alert); --type prints only events of type t (note,
+//     mode, command, home, checksum, link or autopilot).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "comms/events.h"
+
+using std::string;
+
+
+static int min_level = EVENT_DEBUG;
+static int only_type = -1;
+
+
+void usage( char *prog ) {
+    printf("Usage: %s [ --options ] <flight dir> | <events.log> ...\n",
+           prog);
+    printf("\n");
+    printf("  --level <l>      : skip events below severity l (debug,\n");
+    printf("                     info, warning or alert)\n");
+    printf("  --type <t>       : only print events of type t\n");
+
+    exit(0);
+}
+
+
+// print the events of one file; false if it is not an event log
+static bool dump( const char *file ) {
+    vector<event_record> events;
+    if ( !events_read( file, &events ) ) {
+        printf("%s: cannot read the event log\n", file);
+        return false;
+    }
+
+    for ( unsigned int i = 0; i < events.size(); i++ ) {
+        const event_record &e = events[i];
+        if ( e.severity < min_level
+             || (only_type >= 0 && e.type != only_type) )
+        {
+            continue;
+        }
+        printf("%10.3f %-7s %-8s %6d %s\n", e.time,
+               event_severity_name( e.severity ), event_type_name( e.type ),
+               e.arg, e.text);
+    }
+
+    return true;
+}
+
+
+int main( int argc, char **argv ) {
+    int iarg = 1;
+    while ( iarg < argc && strncmp( argv[iarg], "--", 2 ) == 0 ) {
+        if ( strcmp( argv[iarg], "--level" ) == 0 && iarg + 1 < argc ) {
+            min_level = event_severity_value( argv[++iarg] );
+            if ( min_level < 0 ) {
+                usage( argv[0] );
+            }
+        } else if ( strcmp( argv[iarg], "--type" ) == 0 && iarg + 1 < argc ) {
+            iarg++;
+            for ( int i = 0; i < NUM_EVENT_TYPES; i++ ) {
+                if ( strcmp( argv[iarg], event_type_name( i ) ) == 0 ) {
+                    only_type = i;
+                }
+            }
+            if ( only_type < 0 ) {
+                usage( argv[0] );
+            }
+        } else {
+            usage( argv[0] );
+        }
+        iarg++;
+    }
+    if ( iarg >= argc ) {
+        usage( argv[0] );
+    }
+
+    int failures = 0;
+    for ( ; iarg < argc; iarg++ ) {
+        string file = argv[iarg];
+        struct stat st;
+        if ( stat( file.c_str(), &st ) == 0 && S_ISDIR(st.st_mode) ) {
+            file += "/events.log";
+        }
+        if ( !dump( file.c_str() ) ) {
+            failures++;
+        }
+    }
+
+    return failures > 0 ? 1 : 0;
+}
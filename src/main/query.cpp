@@ -0,0 +1,606 @@
+// query.cpp - search an archive of flight logs
+//
+// query [--threads n] [--where cond] [--event type[=text]]
+//       [--window s] [--out dir] <archive or flight dir> [...]
+//
+//     Find the times in each flight where a condition holds and print
+//     them, merged into spans of the window (default 10 s) either
+//     side.  Conditions add up: a time matches if any does.
+//
+//     --where "imu.phi > 45deg"        a field of a stream (<, <=, >,
+//     --where "abs(imu.phi) > 45deg"   >=); deg converts to a field
+//                                      in rad
+//     --event mode=GoHome              an event of a type (mode,
+//                                      link, autopilot, home), and
+//                                      optionally with a text
+//
+//     With --out, write the records of every stream in each span to
+//     dir/<flight>-<n>/<stream>.csv; a flight name that two archives
+//     share becomes <flight>-2 (and so on) for the second.  With no
+//     condition, list the flights: time span, area and events.
+//
+//     An archive is a directory of fltNNNNN (and bbNNNNN) flights.
+//     Each flight has a summary (see flightlog_summary) that gives
+//     the range of every field in each block; it is built the first
+//     time a flight is searched, and again when its logs change.  A
+//     search reads the summaries and decodes only the blocks whose
+//     range could match.  The flights are searched by a pool of
+//     threads.
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "comms/events.h"
+#include "comms/flightlog.h"
+
+using std::string;
+using std::vector;
+
+
+void usage( char *prog ) {
+    printf("Usage: %s [ --options ] <archive or flight dir> [ ... ]\n",
+           prog);
+    printf("\n");
+    printf("  --threads <n>    : search n flights at once (default 4)\n");
+    printf("  --where <cond>   : match a field, as \"[abs(]stream.field[)]\n");
+    printf("                     <op> value[deg]\"; op is <, <=, > or >=\n");
+    printf("  --event <t[=x]>  : match events of type t (with text x)\n");
+    printf("  --window <s>     : seconds kept either side of a match\n");
+    printf("                     (default 10)\n");
+    printf("  --out <dir>      : write the matching spans of each flight\n");
+    printf("                     as CSV under dir\n");
+
+    exit(0);
+}
+
+
+struct condition {
+    string text;                // as given
+    string stream;
+    string field;
+    bool abs;
+    bool greater;               // > or >=, else < or <=
+    bool equal;                 // >= or <=
+    double value;
+    bool deg;                   // value given in degrees
+};
+
+struct event_match {
+    int type;
+    string text;                // empty for any
+};
+
+struct span {
+    double first;
+    double last;
+};
+
+// one flight, and what was found in it
+struct job {
+    job() : ok( false ), rebuilt( false ), blocks_read( 0 ), blocks( 0 ) {}
+
+    string flight;
+    string out_name;            // of its spans under out_dir
+    flightlog_summary summary;
+    bool ok;
+    bool rebuilt;
+    int blocks_read;
+    int blocks;
+    vector<span> spans;
+};
+
+static vector<condition> conditions;
+static vector<event_match> event_matches;
+static double window = 10.0;
+static string out_dir;
+
+static vector<job> jobs;
+static unsigned int next_job = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// parse "[abs(]stream.field[)] op value[deg]"
+static bool parse_condition( const char *arg, condition *c ) {
+    string s;
+    for ( const char *p = arg; *p; p++ ) {
+        if ( *p != ' ' ) {
+            s += *p;
+        }
+    }
+    c->text = arg;
+
+    string::size_type op = s.find_first_of( "<>" );
+    if ( op == string::npos || op == 0 ) {
+        return false;
+    }
+    c->greater = s[op] == '>';
+    c->equal = op + 1 < s.length() && s[op + 1] == '=';
+    string left = s.substr( 0, op );
+    string right = s.substr( op + (c->equal ? 2 : 1) );
+
+    c->abs = left.compare( 0, 4, "abs(" ) == 0
+        && left[left.length() - 1] == ')';
+    if ( c->abs ) {
+        left = left.substr( 4, left.length() - 5 );
+    }
+    string::size_type dot = left.find( '.' );
+    if ( dot == string::npos || dot == 0 || dot + 1 == left.length() ) {
+        return false;
+    }
+    c->stream = left.substr( 0, dot );
+    c->field = left.substr( dot + 1 );
+
+    char *end;
+    c->value = strtod( right.c_str(), &end );
+    if ( end == right.c_str() ) {
+        return false;
+    }
+    c->deg = strcmp( end, "deg" ) == 0;
+    return c->deg || *end == 0;
+}
+
+
+static bool parse_event( const char *arg, event_match *e ) {
+    string s = arg;
+    string::size_type eq = s.find( '=' );
+    string type = s.substr( 0, eq );
+    e->text = eq == string::npos ? "" : s.substr( eq + 1 );
+    for ( int i = 0; i < NUM_EVENT_TYPES; i++ ) {
+        if ( type == event_type_name( i ) ) {
+            e->type = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// could a value in r meet the condition (an unknown range could)
+static bool possible( const condition &c, double value,
+                      const flightlog_range &r )
+{
+    if ( r.min > r.max ) {
+        return true;
+    }
+    if ( c.greater ) {
+        if ( c.abs ) {
+            return r.max > value || -r.min > value
+                || (c.equal && (r.max == value || -r.min == value));
+        }
+        return r.max > value || (c.equal && r.max == value);
+    }
+    if ( c.abs ) {
+        // some |x| below value: the range meets (-value, value)
+        return (r.min < value || (c.equal && r.min == value))
+            && (r.max > -value || (c.equal && r.max == -value));
+    }
+    return r.min < value || (c.equal && r.min == value);
+}
+
+
+static bool meets( const condition &c, double value, double x ) {
+    if ( c.abs ) {
+        x = fabs( x );
+    }
+    if ( c.greater ) {
+        return x > value || (c.equal && x == value);
+    }
+    return x < value || (c.equal && x == value);
+}
+
+
+// add the span around time t, merging it with the last span if they
+// touch (times arrive in order within a stream)
+static void add_match( vector<span> &spans, double t ) {
+    span s = { t - window, t + window };
+    if ( !spans.empty() && s.first <= spans.back().last ) {
+        if ( s.last > spans.back().last ) {
+            spans.back().last = s.last;
+        }
+        return;
+    }
+    spans.push_back( s );
+}
+
+
+static bool span_less( const span &a, const span &b ) {
+    return a.first < b.first;
+}
+
+
+// merge spans found by different conditions
+static void merge_spans( vector<span> &spans ) {
+    sort( spans.begin(), spans.end(), span_less );
+    vector<span> merged;
+    for ( unsigned int i = 0; i < spans.size(); i++ ) {
+        if ( !merged.empty() && spans[i].first <= merged.back().last ) {
+            if ( spans[i].last > merged.back().last ) {
+                merged.back().last = spans[i].last;
+            }
+        } else {
+            merged.push_back( spans[i] );
+        }
+    }
+    spans.swap( merged );
+}
+
+
+// the matching times of one condition, reading only the blocks the
+// summary does not rule out
+static bool search( job &j, const vector<string> &segments,
+                    const condition &c )
+{
+    int sn = j.summary.find_stream( c.stream.c_str() );
+    if ( sn < 0 ) {
+        return true;
+    }
+    const flightlog_summary::stream &ss = j.summary.streams[sn];
+    int fn = -1;
+    for ( unsigned int i = 0; i < ss.fields.size(); i++ ) {
+        if ( ss.fields[i] == c.field ) {
+            fn = i;
+        }
+    }
+    if ( fn < 0 ) {
+        return true;
+    }
+
+    vector<span> found;
+    vector<uint8_t> records;
+    int open_segment = -1;
+    FlightLogReader reader;
+    const flightlog_stream *s = NULL;
+    const flightlog_field *f = NULL;
+    double value = c.value;
+    for ( unsigned int i = 0; i < j.summary.blocks.size(); i++ ) {
+        const flightlog_summary::block &b = j.summary.blocks[i];
+        if ( b.stream != sn ) {
+            continue;
+        }
+        j.blocks++;
+
+        // (opening a segment reads only its schema and index)
+        if ( b.segment != open_segment ) {
+            reader.close();
+            open_segment = b.segment;
+            if ( b.segment >= (int)segments.size()
+                 || !reader.open( segments[b.segment].c_str() ) )
+            {
+                return false;
+            }
+            int rn = reader.find_stream( c.stream.c_str() );
+            int rf = rn < 0 ? -1
+                : reader.stream( rn ).find_field( c.field.c_str() );
+            if ( rf < 0 ) {
+                return false;
+            }
+            s = &reader.stream( rn );
+            f = &s->fields[rf];
+            value = c.value;
+            if ( c.deg && f->units == "rad" ) {
+                value = c.value * M_PI / 180.0;
+            }
+        }
+
+        if ( !b.ranges.empty() && !possible( c, value, b.ranges[fn] ) ) {
+            continue;
+        }
+        if ( b.index >= reader.block_count()
+             || !reader.read_block( b.index, &records ) )
+        {
+            continue;           // damaged; nothing to find in it
+        }
+        j.blocks_read++;
+        bool swap = reader.swapped();
+        for ( uint32_t r = 0; r < reader.block( b.index ).records; r++ ) {
+            const uint8_t *record = &records[r * s->record_size];
+            if ( meets( c, value, f->value( record, swap ) ) ) {
+                add_match( found, s->time( record, swap ) );
+            }
+        }
+    }
+
+    j.spans.insert( j.spans.end(), found.begin(), found.end() );
+    return true;
+}
+
+
+static bool make_dir( const string &dir ) {
+    if ( mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+        printf("Cannot create %s\n", dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// write every stream's records in each span as CSV; the cursor
+// decodes only the blocks that overlap the span
+static bool extract( const job &j, const vector<string> &segments ) {
+    char buf[32];
+    vector<char> text;
+
+    for ( unsigned int n = 0; n < j.spans.size(); n++ ) {
+        const span &sp = j.spans[n];
+        snprintf( buf, sizeof(buf), "-%03d", n );
+        string dir = out_dir + "/" + j.out_name + buf;
+        if ( !make_dir( dir ) ) {
+            return false;
+        }
+
+        vector<FILE *> files( j.summary.streams.size(), (FILE *)NULL );
+        for ( unsigned int seg = 0; seg < segments.size(); seg++ ) {
+            FlightLogReader reader;
+            if ( !reader.open( segments[seg].c_str() ) ) {
+                continue;
+            }
+            bool swap = reader.swapped();
+            for ( int sn = 0; sn < reader.stream_count(); sn++ ) {
+                const flightlog_stream &s = reader.stream( sn );
+                int out = j.summary.find_stream( s.name.c_str() );
+                FlightLogCursor cursor( &reader, sn );
+                if ( out < 0 || !cursor.seek( sp.first ) ) {
+                    continue;
+                }
+                if ( files[out] == NULL ) {
+                    string file = dir + "/" + s.name + ".csv";
+                    files[out] = fopen( file.c_str(), "w" );
+                    if ( files[out] == NULL ) {
+                        printf("Cannot create %s\n", file.c_str());
+                        continue;
+                    }
+                    for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+                        fprintf( files[out], "%s%s", i ? "," : "",
+                                 s.fields[i].name.c_str() );
+                    }
+                    fprintf( files[out], "\n" );
+                }
+
+                text.resize( s.fields.size() * 32 + 1 );
+                const uint8_t *record;
+                while ( (record = cursor.next()) != NULL
+                        && cursor.time( record ) <= sp.last )
+                {
+                    int len = 0;
+                    for ( unsigned int i = 0; i < s.fields.size(); i++ ) {
+                        if ( i > 0 ) {
+                            text[len++] = ',';
+                        }
+                        len += s.fields[i].format( &text[len], 31, record,
+                                                   swap );
+                    }
+                    text[len++] = '\n';
+                    fwrite( &text[0], 1, len, files[out] );
+                }
+            }
+        }
+
+        for ( unsigned int i = 0; i < files.size(); i++ ) {
+            if ( files[i] != NULL ) {
+                fclose( files[i] );
+            }
+        }
+    }
+
+    return true;
+}
+
+
+static void run( job &j ) {
+    j.ok = flightlog_summary_update( j.flight.c_str(), &j.summary,
+                                     &j.rebuilt );
+    if ( !j.ok ) {
+        return;
+    }
+    vector<string> segments = flightlog_segments( j.flight.c_str() );
+
+    for ( unsigned int i = 0; i < conditions.size() && j.ok; i++ ) {
+        j.ok = search( j, segments, conditions[i] );
+    }
+    for ( unsigned int i = 0; i < event_matches.size(); i++ ) {
+        const event_match &m = event_matches[i];
+        for ( unsigned int k = 0; k < j.summary.events.size(); k++ ) {
+            const flightlog_summary::event &e = j.summary.events[k];
+            if ( e.type == m.type && (m.text.empty() || e.text == m.text) ) {
+                add_match( j.spans, e.time );
+            }
+        }
+    }
+    merge_spans( j.spans );
+
+    if ( j.ok && !out_dir.empty() ) {
+        j.ok = extract( j, segments );
+    }
+}
+
+
+static void *worker( void * ) {
+    while ( true ) {
+        pthread_mutex_lock( &job_lock );
+        unsigned int i = next_job++;
+        pthread_mutex_unlock( &job_lock );
+        if ( i >= jobs.size() ) {
+            break;
+        }
+        run( jobs[i] );
+    }
+
+    return NULL;
+}
+
+
+// the flights in path: path itself if it holds a flight log, else
+// its fltNNNNN and bbNNNNN subdirectories
+static void add_flights( string path ) {
+    while ( path.length() > 1 && path[path.length() - 1] == '/' ) {
+        path.erase( path.length() - 1 );
+    }
+
+    if ( !flightlog_segments( path.c_str() ).empty() ) {
+        job j;
+        j.flight = path;
+        jobs.push_back( j );
+        return;
+    }
+
+    vector<string> names;
+    DIR *d = opendir( path.c_str() );
+    if ( d == NULL ) {
+        printf("Cannot open %s\n", path.c_str());
+        return;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir( d )) != NULL ) {
+        int num;
+        if ( sscanf( entry->d_name, "flt%d", &num ) == 1
+             || sscanf( entry->d_name, "bb%d", &num ) == 1 )
+        {
+            names.push_back( entry->d_name );
+        }
+    }
+    closedir( d );
+    sort( names.begin(), names.end() );
+
+    for ( unsigned int i = 0; i < names.size(); i++ ) {
+        string flight = path + "/" + names[i];
+        if ( !flightlog_segments( flight.c_str() ).empty() ) {
+            job j;
+            j.flight = flight;
+            jobs.push_back( j );
+        }
+    }
+}
+
+
+int main( int argc, char **argv )
+{
+    int threads = 4;
+    vector<string> paths;
+
+    for ( int iarg = 1; iarg < argc; iarg++ ) {
+        if ( !strcmp(argv[iarg], "--threads") && iarg + 1 < argc ) {
+            ++iarg;
+            threads = atoi( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--where") && iarg + 1 < argc ) {
+            ++iarg;
+            condition c;
+            if ( !parse_condition( argv[iarg], &c ) ) {
+                printf("Cannot parse condition: %s\n", argv[iarg]);
+                usage( argv[0] );
+            }
+            conditions.push_back( c );
+        } else if ( !strcmp(argv[iarg], "--event") && iarg + 1 < argc ) {
+            ++iarg;
+            event_match e;
+            if ( !parse_event( argv[iarg], &e ) ) {
+                printf("Unknown event type: %s\n", argv[iarg]);
+                usage( argv[0] );
+            }
+            event_matches.push_back( e );
+        } else if ( !strcmp(argv[iarg], "--window") && iarg + 1 < argc ) {
+            ++iarg;
+            window = atof( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--out") && iarg + 1 < argc ) {
+            ++iarg;
+            out_dir = argv[iarg];
+        } else if ( argv[iarg][0] == '-' ) {
+            usage( argv[0] );
+        } else {
+            paths.push_back( argv[iarg] );
+        }
+    }
+    if ( paths.empty() || threads < 1 ) {
+        usage( argv[0] );
+    }
+    if ( !out_dir.empty() && !make_dir( out_dir ) ) {
+        return -1;
+    }
+
+    for ( unsigned int i = 0; i < paths.size(); i++ ) {
+        add_flights( paths[i] );
+    }
+    vector<string> out_names;
+    for ( unsigned int i = 0; i < jobs.size(); i++ ) {
+        jobs[i].out_name = flightlog_out_name( jobs[i].flight.c_str(),
+                                               &out_names );
+    }
+
+    vector<pthread_t> pool( threads );
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_create( &pool[i], NULL, worker, NULL );
+    }
+    for ( int i = 0; i < threads; i++ ) {
+        pthread_join( pool[i], NULL );
+    }
+
+    bool listing = conditions.empty() && event_matches.empty();
+    int failures = 0;
+    int rebuilt = 0;
+    int matched = 0;
+    int blocks = 0;
+    int blocks_read = 0;
+    for ( unsigned int i = 0; i < jobs.size(); i++ ) {
+        const job &j = jobs[i];
+        if ( !j.ok ) {
+            printf("%s: cannot read the flight log\n", j.flight.c_str());
+            failures++;
+            continue;
+        }
+        rebuilt += j.rebuilt;
+        blocks += j.blocks;
+        blocks_read += j.blocks_read;
+
+        const flightlog_summary &s = j.summary;
+        if ( listing ) {
+            printf("%s  %.1f - %.1f s", j.flight.c_str(), s.first_time,
+                   s.last_time);
+            if ( s.has_position ) {
+                printf("  lat %.5f %.5f  lon %.5f %.5f", s.lat_min,
+                       s.lat_max, s.lon_min, s.lon_max);
+            }
+            printf("\n");
+            for ( unsigned int k = 0; k < s.events.size(); k++ ) {
+                printf("    %10.3f %-9s %s\n", s.events[k].time,
+                       event_type_name( s.events[k].type ),
+                       s.events[k].text.c_str());
+            }
+            continue;
+        }
+
+        if ( !j.spans.empty() ) {
+            matched++;
+        }
+        for ( unsigned int k = 0; k < j.spans.size(); k++ ) {
+            printf("%s  %.2f - %.2f s", j.flight.c_str(),
+                   j.spans[k].first, j.spans[k].last);
+            if ( !out_dir.empty() ) {
+                printf("  -> %s/%s-%03d", out_dir.c_str(),
+                       j.out_name.c_str(), k);
+            }
+            printf("\n");
+        }
+    }
+
+    if ( listing ) {
+        printf("%lu flights (%d summaries rebuilt), %d failed\n",
+               (unsigned long)jobs.size(), rebuilt, failures);
+    } else {
+        printf("%d of %lu flights match (%d summaries rebuilt); "
+               "%d of %d blocks decoded, %d failed\n",
+               matched, (unsigned long)jobs.size(), rebuilt, blocks_read,
+               blocks, failures);
+    }
+
+    return failures ? -1 : 0;
+}
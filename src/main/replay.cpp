@@ -0,0 +1,124 @@
+// replay.cpp - rebuild the property tree from a flight's property
+// journal (props.jnl.gz, see props/props_journal.hxx).
+//
+// replay [--frame n] [--time sec] [--node path] journal
+//     print the tree (or the subtree at path) as it stood at the end
+//     of frame n or of the first frame at or after time sec; by
+//     default at the end of the journal.
+//
+// replay --track path [--track path ...] journal
+//     print one line per frame with the frame time and the listed
+//     values, for plotting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <props/props.hxx>
+#include <props/props_io.hxx>
+#include <props/props_journal.hxx>
+#include <util/exception.hxx>
+
+using std::cout;
+using std::string;
+using std::vector;
+
+
+void usage( char *prog ) {
+    printf("Usage: %s [ --options ] <journal file>\n", prog);
+    printf("\n");
+    printf("  --frame <n>      : show the tree at the end of frame n\n");
+    printf("  --time <sec>     : show the tree at the first frame at or after sec\n");
+    printf("  --node <path>    : show only the subtree at path\n");
+    printf("  --track <path>   : print the value of path every frame\n");
+    printf("                     (may be repeated)\n");
+
+    exit(0);
+}
+
+
+int main( int argc, char **argv )
+{
+    unsigned int last_frame = 0;
+    double last_time = -1.0;
+    string node_path = "/";
+    vector<string> tracks;
+    string file;
+
+    for ( int iarg = 1; iarg < argc; iarg++ ) {
+        if ( !strcmp(argv[iarg], "--frame") && iarg + 1 < argc ) {
+            ++iarg;
+            last_frame = atoi( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--time") && iarg + 1 < argc ) {
+            ++iarg;
+            last_time = atof( argv[iarg] );
+        } else if ( !strcmp(argv[iarg], "--node") && iarg + 1 < argc ) {
+            ++iarg;
+            node_path = argv[iarg];
+        } else if ( !strcmp(argv[iarg], "--track") && iarg + 1 < argc ) {
+            ++iarg;
+            tracks.push_back( argv[iarg] );
+        } else if ( argv[iarg][0] == '-' || !file.empty() ) {
+            usage( argv[0] );
+        } else {
+            file = argv[iarg];
+        }
+    }
+    if ( file.empty() ) {
+        usage( argv[0] );
+    }
+
+    SGPropertyNode_ptr tree = new SGPropertyNode;
+    SGPropertyJournalReader reader;
+
+    try {
+        reader.open( file );
+
+        if ( !tracks.empty() ) {
+            vector<SGPropertyNode *> nodes;
+            for ( unsigned int i = 0; i < tracks.size(); i++ ) {
+                nodes.push_back( tree->getNode( tracks[i].c_str(), true ) );
+            }
+            printf("time");
+            for ( unsigned int i = 0; i < tracks.size(); i++ ) {
+                printf(" %s", tracks[i].c_str());
+            }
+            printf("\n");
+            while ( reader.next( tree ) ) {
+                printf("%.3f", reader.getTime());
+                for ( unsigned int i = 0; i < nodes.size(); i++ ) {
+                    printf(" %s", nodes[i]->getStringValue());
+                }
+                printf("\n");
+            }
+        } else {
+            while ( reader.next( tree ) ) {
+                if ( last_frame > 0 && reader.getFrame() >= last_frame ) {
+                    break;
+                }
+                if ( last_time >= 0.0 && reader.getTime() >= last_time ) {
+                    break;
+                }
+            }
+
+            SGPropertyNode *node = tree->getNode( node_path.c_str() );
+            if ( node == NULL ) {
+                printf("No %s in the journal\n", node_path.c_str());
+                return -1;
+            }
+            writeProperties( cout, node, true );
+        }
+    } catch ( const sg_exception &exc ) {
+        printf("%s: %s\n", file.c_str(), exc.getFormattedMessage().c_str());
+        return -1;
+    }
+
+    fprintf(stderr, "frame %u at %.3f sec, %lu records lost in flight\n",
+            reader.getFrame(), reader.getTime(), reader.getLost());
+
+    return 0;
+}
@@ -27,6 +27,7 @@
 
 #include <string>
 
+#include "comms/blackbox.h"
 #include "comms/console_link.h"
 #include "comms/groundstation.h"
 #include "comms/logging.h"
@@ -41,6 +42,7 @@
 #include "props/props.hxx"
 #include "props/props_io.hxx"
 #include "util/exception.hxx"
+#include "util/latency.h"
 #include "util/myprof.h"
 #include "util/sg_path.hxx"
 #include "util/timing.h"
@@ -66,6 +68,7 @@ void usage()
     printf("--mnav <device>      : specify mnav communication device\n");
     printf("--console <dev>      : specify console device and enable link\n");
     printf("--display on/off     : dump periodic data to display\n");	
+    printf("--fast-control on/off: send servo commands right after the AHRS\n");
     printf("--wifi on/off        : enable or disable WiFi communication with GS \n");
     printf("--ip xxx.xxx.xxx.xxx : set GS i.p. address for WiFi comm\n");
     printf("--help               : display this help messages\n\n");
@@ -85,6 +88,7 @@ int main( int argc, char **argv )
     bool enable_control = false;   // autopilot control module enabled/disabled
     bool enable_nav     = false;   // nav filter enabled/disabled
     bool enable_route   = false;   // route module enabled/disabled
+    bool fast_control   = false;   // run the autopilot right after AHRS
     bool wifi           = false;   // wifi connection enabled/disabled
     bool initial_home   = false;   // initial home position determined
 
@@ -119,6 +123,8 @@ int main( int argc, char **argv )
     log_path.set( p->getStringValue() );
     p = fgGetNode("/config/data/enable", true);
     log_to_file = p->getBoolValue();
+    p = fgGetNode("/config/data/journal", true);
+    bool enable_journal = p->getBoolValue();
     printf("log path = %s enabled = %d\n", log_path.c_str(), log_to_file);
 
     p = fgGetNode("/config/mnav/device", true);
@@ -133,6 +139,9 @@ int main( int argc, char **argv )
     p = fgGetNode("/config/autopilot/enable", true);
     enable_control = p->getBoolValue();
 
+    p = fgGetNode("/config/autopilot/fast-control", true);
+    fast_control = p->getBoolValue();
+
     p = fgGetNode("/config/route/enable", true);
     enable_route = p->getBoolValue();
 
@@ -157,6 +166,10 @@ int main( int argc, char **argv )
             ++iarg;
             if ( !strcmp(argv[iarg], "on") ) display_on = true;
             if ( !strcmp(argv[iarg], "off") ) display_on = false;
+        } else if ( !strcmp(argv[iarg],"--fast-control") ) {
+            ++iarg;
+            if ( !strcmp(argv[iarg], "on") ) fast_control = true;
+            if ( !strcmp(argv[iarg], "off") ) fast_control = false;
         } else if ( !strcmp(argv[iarg], "--wifi") ) {
             ++iarg;
             if ( !strcmp(argv[iarg], "on") ) wifi = true;
@@ -183,6 +196,8 @@ int main( int argc, char **argv )
         if ( !result ) {
             printf("Warning: error opening one or more data files, logging disabled\n");
             log_to_file = false;
+        } else if ( enable_journal ) {
+            journal_init();
         }
     }
 
@@ -215,6 +230,13 @@ int main( int argc, char **argv )
         route_mgr.init();
     }
 
+    // restore any checkpointed state from the last run
+    checkpoint_init();
+
+    // start the black box recorder (saving what the last run left in
+    // it)
+    blackbox_init();
+
     //
     // Main loop.  The mnav_update() command blocks on MNAV sensor
     // data which is spit out at precisely 50hz.  So this loop will
@@ -240,6 +262,7 @@ int main( int argc, char **argv )
         // Notice: this loop runs at 50hz synced to the MNAV data input
 
         current_time = get_Time();
+        journal_frame( current_time );
 
         // upate timing counters
         if ( enable_nav ) {
@@ -257,9 +280,24 @@ int main( int argc, char **argv )
         // function will then call the ahrs_update() function as
         // appropriate to compute the attitude estimate.
 	mnav_prof.start();
-        mnav_update();
+        mnav_update( fast_control );
 	mnav_prof.stop();
 
+        if ( fast_control ) {
+            // Keep the sensor to servo path short: run the autopilot
+            // on the fresh attitude and write the servo command
+            // before any console or log I/O.  Nav and route results
+            // computed later in this frame are picked up on the next
+            // autopilot update.
+            if ( enable_control && ap_counter >= 2 ) {
+                ap_counter = 0;
+                control_prof.start();
+                control_update(0);
+                control_prof.stop();
+            }
+            mnav_output();
+        }
+
 	if ( enable_nav ) {
             // navigation (update at 10hz.)  compute a location estimate
             // based on gps and accelerometer data.
@@ -303,6 +341,8 @@ int main( int argc, char **argv )
                 // modem range.  Switch to fly home mode.  Ground
                 // station operator will need to send a resume route
                 // command to resume the route.
+                log_event( EVENT_LINK, EVENT_ALERT, 0, "no command for %.0f s",
+                           current_time - last_command_time );
                 route_mgr.set_home_mode();
             }
         }
@@ -317,7 +357,7 @@ int main( int argc, char **argv )
             }
         }
 
-	if ( enable_control ) {
+	if ( enable_control && !fast_control ) {
             // autopilot update at 25 hz
             if ( ap_counter >= 2 ) { 
                 ap_counter = 0;
@@ -341,6 +381,7 @@ int main( int argc, char **argv )
             } else {
                 log_servo( &servo_in );
             }
+            log_channels( current_time );
         }
 
         // health status (update at 1hz)
@@ -386,6 +427,7 @@ int main( int argc, char **argv )
 	    }
 	    if ( enable_control ) {
 	      control_prof.stats( "CTRL" );
+	      servo_latency.stats( "LAT " );
 	    }
 	    health_prof.stats ( "HLTH" );
         }
@@ -411,16 +453,27 @@ int main( int argc, char **argv )
                 case 4:
                     flush_health();
                     break;
-                default:
-                    flush_state = 0;
+                case 5:
+                    flush_channels();
+                    break;
                 }
-                flush_state++;
+                flush_state = (flush_state + 1) % 6;
             }
         }
 
+        // record the frame in the black box
+        blackbox_update( current_time );
+
+        // save the checkpointed subtrees every so often
+        checkpoint_update( current_time );
+
+        // hand this frame's property changes to any batched listeners
+        SGPropertyChangeListener::fireBatchedChanges();
+
     } // end main loop
 
     // close and exit
+    blackbox_close();
     ahrs_close();
     mnav_close();
     if ( enable_nav ) {
@@ -18,9 +18,11 @@
 #include "comms/logging.h"
 #include "comms/serial.h"
 #include "include/globaldefs.h"
+#include "include/props_schema.h"
 #include "navigation/ahrs.h"
 #include "navigation/nav.h"
 #include "props/props.hxx"
+#include "util/latency.h"
 #include "util/myprof.h"
 #include "util/timing.h"
 
@@ -67,20 +69,76 @@ struct imu imupacket;
 struct gps gpspacket;
 struct nav navpacket;
 
+// decoded this frame but not yet sent to the console link or logs
+static bool imu_output_pending = false;
+static bool gps_output_pending = false;
+
+// air data filter state, published to the property tree by tie()
+static float Ps_filt = 0.0;
+static float Pt_filt = 0.0;
+static float climb_filt = 0.0;
+static float ground_alt_press = 0.0;
+
 // imu property nodes
-static SGPropertyNode *theta_node = NULL;
-static SGPropertyNode *phi_node = NULL;
-static SGPropertyNode *psi_node = NULL;
-// static SGPropertyNode *Ps_node = NULL;
-// static SGPropertyNode *Pt_node = NULL;
-static SGPropertyNode *Ps_filt_node = NULL;
-static SGPropertyNode *Pt_filt_node = NULL;
-// static SGPropertyNode *comp_time_node = NULL;
-SGPropertyNode *pressure_error_m_node = NULL;
-SGPropertyNode *true_alt_ft_node = NULL;
-SGPropertyNode *agl_alt_ft_node = NULL;
-SGPropertyNode *vert_fps_node = NULL;
-SGPropertyNode *ground_alt_press_m_node = NULL;
+static SGTypedProperty<float> pressure_error_m;
+
+// derived values are computed from the live packet and filter state
+// when the property is read
+static double get_pitch_deg() { return imupacket.the * SG_RADIANS_TO_DEGREES; }
+static double get_roll_deg() { return imupacket.phi * SG_RADIANS_TO_DEGREES; }
+static double get_heading_deg() { return imupacket.psi * SG_RADIANS_TO_DEGREES; }
+
+static double get_true_alt_ft() {
+    // best guess at true altitude
+    return (Ps_filt + pressure_error_m.get())
+        * SG_METER_TO_FEET;
+}
+
+static double get_agl_alt_ft() {
+    return (Ps_filt - ground_alt_press) * SG_METER_TO_FEET;
+}
+
+static double get_vert_fps() { return climb_filt * SG_METER_TO_FEET; }
+
+// The imu and air data properties are tied once the first valid imu
+// packet has been filtered, so nobody reads the getters over an empty
+// packet.  Tied nodes don't notify their listeners when the value
+// behind them changes; mnav_update() fires them after every packet
+// (a no-op for the nodes nobody listens to).
+#define MAX_IMU_TIED 9
+static SGPropertyNode *imu_tied_nodes[MAX_IMU_TIED];
+static int imu_tied_count = 0;
+
+template <class T>
+static void tie_imu_node( const SGPropertyKey<T> &key,
+                          const SGRawValue<T> &rawValue )
+{
+    SGPropertyNode *node = fgGetNode( key.path, true );
+    node->tie( rawValue, false );
+    imu_tied_nodes[imu_tied_count++] = node;
+}
+
+static void tie_imu_nodes()
+{
+    tie_imu_node( ORIENTATION_PITCH_DEG,
+                  SGRawValueFunctions<double>(get_pitch_deg) );
+    tie_imu_node( ORIENTATION_ROLL_DEG,
+                  SGRawValueFunctions<double>(get_roll_deg) );
+    tie_imu_node( ORIENTATION_HEADING_DEG,
+                  SGRawValueFunctions<double>(get_heading_deg) );
+    tie_imu_node( POSITION_ALTITUDE_PRESSURE_M,
+                  SGRawValuePointer<float>(&Ps_filt) );
+    tie_imu_node( VELOCITIES_AIRSPEED_PITOT_MS,
+                  SGRawValuePointer<float>(&Pt_filt) );
+    tie_imu_node( POSITION_ALTITUDE_FT,
+                  SGRawValueFunctions<double>(get_true_alt_ft) );
+    tie_imu_node( POSITION_ALTITUDE_AGL_FT,
+                  SGRawValueFunctions<double>(get_agl_alt_ft) );
+    tie_imu_node( VELOCITIES_PRESSURE_VERTICAL_SPEED_FPS,
+                  SGRawValueFunctions<double>(get_vert_fps) );
+    tie_imu_node( POSITION_GROUND_ALTITUDE_PRESSURE_M,
+                  SGRawValuePointer<float>(&ground_alt_press) );
+}
 
 // gps property nodes
 // static SGPropertyNode *gps_lat_node = NULL;
@@ -151,21 +209,9 @@ void mnav_init()
     }
     nbytes = 0;  
 
-    // initialize imu property nodes
-    theta_node = fgGetNode("/orientation/pitch-deg", true);
-    phi_node = fgGetNode("/orientation/roll-deg", true);
-    psi_node = fgGetNode("/orientaiton/heading-deg", true);
-    // Ps_node = fgGetNode("/position/altitude-pressure-m", true);
-    // Pt_node = fgGetNode("/velocities/airspeed-ms", true);
-    Ps_filt_node = fgGetNode("/position/altitude-pressure-m", true);
-    Pt_filt_node = fgGetNode("/velocities/airspeed-pitot-ms", true);
-    // comp_time_node = fgGetNode("/time/computer-sec", true);
-    true_alt_ft_node = fgGetNode("/position/altitude-ft",true);
-    agl_alt_ft_node = fgGetNode("/position/altitude-agl-ft", true);
-    pressure_error_m_node = fgGetNode("/position/pressure-error-m", true);
-    vert_fps_node = fgGetNode("/velocities/pressure-vertical-speed-fps",true);
-    ground_alt_press_m_node
-        = fgGetNode("/position/ground-altitude-pressure-m", true);
+    // the imu and air data properties are tied by mnav_update() once
+    // there is a valid packet behind them
+    pressure_error_m.bind( POSITION_PRESSURE_ERROR_M );
 
     // initialize gps property nodes
     // gps_lat_node = fgGetNode("/position/latitude-gps-deg", true);
@@ -187,18 +233,19 @@ void mnav_init()
 // which the MNAV sends data dictates the timing and rate of the
 // entire ugear program.
 //
-void mnav_update()
+// If defer_output is true the console link and log writes for this
+// packet are left for a later call to mnav_output() so the caller can
+// get the servo command out first.
+//
+void mnav_update( bool defer_output )
 {
     int headerOK = 0;
     int nbytes = 0;
     uint8_t input_buffer[FULL_PACKET_SIZE]={0,};
 
-    static float Ps_filt = 0.0;
-    static float Pt_filt = 0.0;
-
     static float Ps_filt_last = 0.0;
     static double t_last = 0.0;
-    static float climb_filt = 0.0;
+    static bool ground_alt_init = false;
 
     bool imu_valid_data = false;
     bool gps_valid_data = false;
@@ -232,10 +279,12 @@ void mnav_update()
             nbytes += read(sPort2, input_buffer+nbytes,
                            SENSOR_PACKET_LENGTH-nbytes); 
         }
+        servo_latency.mark( LAT_SERIAL );
 
         // check checksum
         if ( checksum(input_buffer,SENSOR_PACKET_LENGTH) ) {
             decode_imupacket(&imupacket, input_buffer);
+            servo_latency.mark( LAT_DECODE );
             imu_valid_data = true;
         } else {
             if ( display_on ) {
@@ -251,12 +300,14 @@ void mnav_update()
             nbytes += read(sPort2, input_buffer+nbytes,
                            FULL_PACKET_SIZE-nbytes); 
         }
+        servo_latency.mark( LAT_SERIAL );
 
         // printf("G P S   D A T A   A V A I L A B L E\n");
 
         // check checksum
         if ( checksum(input_buffer,FULL_PACKET_SIZE) ) {
             decode_imupacket(&imupacket, input_buffer);
+            servo_latency.mark( LAT_DECODE );
             imu_valid_data = true;
 		     
             // check GPS data packet
@@ -288,14 +339,12 @@ void mnav_update()
         ahrs_prof.start();
         ahrs_update();
 	ahrs_prof.stop();
+        servo_latency.mark( LAT_AHRS );
 
 	// Do a simple first order low pass filter to reduce noise
 	Ps_filt = 0.93 * Ps_filt + 0.07 * imupacket.Ps;
 	Pt_filt = 0.9 * Pt_filt + 0.1 * imupacket.Pt;
 
-        // best guess at true altitude
-        float true_alt_m = Ps_filt + pressure_error_m_node->getFloatValue();
-
         // pressure sensor based rate of climb
         float climb = (Ps_filt - Ps_filt_last) / (imupacket.time - t_last);
         Ps_filt_last = Ps_filt;
@@ -306,44 +355,30 @@ void mnav_update()
         // assumes that system clock time starts counting at zero.
         // Watch out if we ever find a way to set the system clock to
         // real time.
-        static float ground_alt_press = imupacket.Ps;
+        if ( !ground_alt_init ) {
+            ground_alt_press = imupacket.Ps;
+            ground_alt_init = true;
+        }
         if ( imupacket.time < 30.0 ) {
             float dt = imupacket.time - t_last;
             float elapsed = imupacket.time - dt;
             ground_alt_press
                 = (elapsed * ground_alt_press + dt * imupacket.Ps)
                   / imupacket.time;
-            ground_alt_press_m_node->setFloatValue( ground_alt_press );
         }
 
         t_last = imupacket.time;
 
-        /* printf("%.2f %.2f\n", imupacket.phi * SG_RADIANS_TO_DEGREES,
-           imupacket.the * SG_RADIANS_TO_DEGREES); */
-
-	// publish values to property tree
-	theta_node->setFloatValue( imupacket.the * SG_RADIANS_TO_DEGREES );
-	phi_node->setFloatValue( imupacket.phi * SG_RADIANS_TO_DEGREES );
-	psi_node->setFloatValue( imupacket.psi * SG_RADIANS_TO_DEGREES );
-	// Ps_node->setFloatValue( imupacket.Ps );
-	// Pt_node->setFloatValue( imupacket.Pt );
-	Ps_filt_node->setFloatValue( Ps_filt );
-	Pt_filt_node->setFloatValue( Pt_filt );
-	// comp_time_node->setDoubleValue( imupacket.time );
-        true_alt_ft_node->setFloatValue( true_alt_m * SG_METER_TO_FEET );
-        agl_alt_ft_node->setFloatValue( (Ps_filt - ground_alt_press) * SG_METER_TO_FEET );
-        vert_fps_node->setFloatValue( climb_filt * SG_METER_TO_FEET );
-
-        // printf("Ps = %.1f nav = %.1f bld = %.1f vsi = %.2f\n",
-        //        Ps_filt, navpacket.alt, true_alt_m, climb_filt);
-
-        if ( console_link_on ) {
-            console_link_imu( &imupacket );
+        // attitude, pressure altitude and climb rate properties are
+        // tied to imupacket and the filter state above
+        if ( imu_tied_count == 0 ) {
+            tie_imu_nodes();
         }
-
-        if ( log_to_file ) {
-            log_imu( &imupacket );
+        for ( int i = 0; i < imu_tied_count; i++ ) {
+            imu_tied_nodes[i]->fireValueChanged();
         }
+
+        imu_output_pending = true;
     }
 
     if ( gps_valid_data ) {
@@ -355,13 +390,11 @@ void mnav_update()
 	// gps_vn_node->setDoubleValue( gpspacket.vn );
 	// gps_vd_node->setDoubleValue( gpspacket.vd );
 
-        if ( console_link_on ) {
-            console_link_gps( &gpspacket );
-        }
+        gps_output_pending = true;
+    }
 
-        if ( log_to_file ) {
-            log_gps( &gpspacket );
-        }
+    if ( !defer_output ) {
+        mnav_output();
     }
 
     //////////////////////////////////////////////////////////////
@@ -388,6 +421,9 @@ void mnav_update()
 
     if ( servo_in.chn[4] <= 12000 ) {
         // if the autopilot is enabled, or signal is lost
+        if ( !autopilot_active ) {
+            log_event( EVENT_AUTOPILOT, EVENT_INFO, 1, "engaged" );
+        }
         if ( !autopilot_active && display_on ) {
             printf("[CONTROL]: switching to autopilot\n");
 	    autopilot_reinit = true;
@@ -401,6 +437,10 @@ void mnav_update()
         // add delay on control trigger to minimize mode confusion
         // caused by the transmitter power off
         if ( autopilot_count < 0 ) {
+            if ( autopilot_active ) {
+                log_event( EVENT_AUTOPILOT, EVENT_WARNING, 0,
+                           "manual override" );
+            }
             if ( autopilot_active && display_on ) {
                 printf("[CONTROL]: switching to manual pass through\n");
             }
@@ -413,6 +453,34 @@ void mnav_update()
 }
 
 
+// send the most recently decoded imu and gps packets to the console
+// link and log files
+void mnav_output()
+{
+    if ( imu_output_pending ) {
+        if ( console_link_on ) {
+            console_link_imu( &imupacket );
+        }
+
+        if ( log_to_file ) {
+            log_imu( &imupacket );
+        }
+        imu_output_pending = false;
+    }
+
+    if ( gps_output_pending ) {
+        if ( console_link_on ) {
+            console_link_gps( &gpspacket );
+        }
+
+        if ( log_to_file ) {
+            log_gps( &gpspacket );
+        }
+        gps_output_pending = false;
+    }
+}
+
+
 void mnav_close()
 {
     //close the serial port
@@ -484,20 +552,20 @@ void decode_imupacket( struct imu *data, uint8_t* buffer )
     unsigned short tmpr = 0;
 
     /* acceleration in m/s^2 */
-    data->ax = (double)(((tmp = (signed char)buffer[ 3])<<8)|buffer[ 4])*5.98755e-04; tmp=0;
-    data->ay = (double)(((tmp = (signed char)buffer[ 5])<<8)|buffer[ 6])*5.98755e-04; tmp=0;
-    data->az = (double)(((tmp = (signed char)buffer[ 7])<<8)|buffer[ 8])*5.98755e-04; tmp=0;
+    data->ax = (double)(((tmp = (signed char)buffer[ 3])<<8)|buffer[ 4])*MNAV_ACCEL_SCALE; tmp=0;
+    data->ay = (double)(((tmp = (signed char)buffer[ 5])<<8)|buffer[ 6])*MNAV_ACCEL_SCALE; tmp=0;
+    data->az = (double)(((tmp = (signed char)buffer[ 7])<<8)|buffer[ 8])*MNAV_ACCEL_SCALE; tmp=0;
    
   
     /* angular rate in rad/s */
-    data->p  = (double)(((tmp = (signed char)buffer[ 9])<<8)|buffer[10])*1.06526e-04; tmp=0;
-    data->q  = (double)(((tmp = (signed char)buffer[11])<<8)|buffer[12])*1.06526e-04; tmp=0;
-    data->r  = (double)(((tmp = (signed char)buffer[13])<<8)|buffer[14])*1.06526e-04; tmp=0;
+    data->p  = (double)(((tmp = (signed char)buffer[ 9])<<8)|buffer[10])*MNAV_GYRO_SCALE; tmp=0;
+    data->q  = (double)(((tmp = (signed char)buffer[11])<<8)|buffer[12])*MNAV_GYRO_SCALE; tmp=0;
+    data->r  = (double)(((tmp = (signed char)buffer[13])<<8)|buffer[14])*MNAV_GYRO_SCALE; tmp=0;
    
     /* magnetic field in Gauss */
-    data->hx = (double)(((tmp = (signed char)buffer[15])<<8)|buffer[16])*6.10352e-05; tmp=0;
-    data->hy = (double)(((tmp = (signed char)buffer[17])<<8)|buffer[18])*6.10352e-05; tmp=0;
-    data->hz = (double)(((tmp = (signed char)buffer[19])<<8)|buffer[20])*6.10352e-05; tmp=0;
+    data->hx = (double)(((tmp = (signed char)buffer[15])<<8)|buffer[16])*MNAV_MAG_SCALE; tmp=0;
+    data->hy = (double)(((tmp = (signed char)buffer[17])<<8)|buffer[18])*MNAV_MAG_SCALE; tmp=0;
+    data->hz = (double)(((tmp = (signed char)buffer[19])<<8)|buffer[20])*MNAV_MAG_SCALE; tmp=0;
 
     /* temperature in Celcius */
     /*
@@ -507,8 +575,8 @@ void decode_imupacket( struct imu *data, uint8_t* buffer )
     */
    
     /* pressure in m and m/s */
-    data->Ps = (double)(((tmp = (signed char)buffer[27])<<8)|buffer[28])*3.05176e-01; tmp=0;
-    data->Pt = (double)(((tmp = (signed char)buffer[29])<<8)|buffer[30])*2.44141e-03; tmp=0;
+    data->Ps = (double)(((tmp = (signed char)buffer[27])<<8)|buffer[28])*MNAV_PS_SCALE; tmp=0;
+    data->Pt = (double)(((tmp = (signed char)buffer[29])<<8)|buffer[30])*MNAV_PT_SCALE; tmp=0;
 
     // servo packet
     switch (buffer[2]) {
@@ -578,6 +646,7 @@ void send_servo_cmd()
     // don't attempt any manner of retry if write fails (it shouldn't
     // ever fail) :-)
     write(sPort2, data, SERVO_PACKET_LENGTH);
+    servo_latency.mark( LAT_SERVO );
 
     // printf("%d %d\n", cnt_cmd[0], cnt_cmd[1]);
 
@@ -615,4 +684,5 @@ void send_short_servo_cmd()
 
     // don't attempt any manner of retry if write fails
     write(sPort2, data, SHORT_SERVO_PACKET_LENGTH);
+    servo_latency.mark( LAT_SERVO );
 }
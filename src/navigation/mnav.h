@@ -19,10 +19,18 @@ extern char *cnt_status;
 #define MAX_MNAV_DEV 64
 extern char mnav_dev[MAX_MNAV_DEV];
 
+// scale factors from MNAV 16 bit sensor counts to units
+#define MNAV_ACCEL_SCALE 5.98755e-04    // m/s^2
+#define MNAV_GYRO_SCALE 1.06526e-04     // rad/s
+#define MNAV_MAG_SCALE 6.10352e-05      // gauss
+#define MNAV_PS_SCALE 3.05176e-01       // m
+#define MNAV_PT_SCALE 2.44141e-03       // m/s
+
 
 // function prototypes
 void mnav_init();
-void mnav_update();
+void mnav_update( bool defer_output = false );
+void mnav_output();
 void mnav_close();
 
 void send_servo_cmd();
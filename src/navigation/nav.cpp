@@ -18,6 +18,7 @@
 #include "comms/console_link.h"
 #include "comms/logging.h"
 #include "include/globaldefs.h"
+#include "include/props_schema.h"
 #include "props/props.hxx"
 #include "util/matrix.h"
 #include "util/myprof.h"
@@ -53,14 +54,53 @@ MATRIX ntmp66,ntmp96,ntmp33;
 
 short  gps_init_count = 0;
 
-// nav (cooked gps/accelerometer) property nodes
-static SGPropertyNode *nav_lat_node = NULL;
-static SGPropertyNode *nav_lon_node = NULL;
-static SGPropertyNode *nav_alt_feet_node = NULL;
-static SGPropertyNode *nav_track_node = NULL;
-// static SGPropertyNode *nav_vel_node = NULL;
-static SGPropertyNode *nav_vert_speed_fps_node = NULL;
-static SGPropertyNode *pressure_error_m_node = NULL;
+// filtered gps minus pressure altitude, published by tie()
+static float Ps_filt_err = 0.0;
+
+// nav (cooked gps/accelerometer) properties are tied to navpacket,
+// these compute the derived ones when they are read
+static double get_nav_alt_ft() { return navpacket.alt * SG_METER_TO_FEET; }
+
+static double get_nav_track_deg() {
+    return 90 - atan2(navpacket.vn, navpacket.ve) * SG_RADIANS_TO_DEGREES;
+}
+
+static double get_nav_vert_speed_fps() {
+    return -navpacket.vd * SG_METER_TO_FEET;
+}
+
+// The nav properties are tied once the filter has produced its first
+// solution, so nobody reads navpacket before it holds one.  Tied
+// nodes don't notify their listeners; nav_update() fires them after
+// every solution (a no-op for the nodes nobody listens to).
+#define MAX_NAV_TIED 6
+static SGPropertyNode *nav_tied_nodes[MAX_NAV_TIED];
+static int nav_tied_count = 0;
+
+template <class T>
+static void tie_nav_node( const SGPropertyKey<T> &key,
+                          const SGRawValue<T> &rawValue )
+{
+    SGPropertyNode *node = fgGetNode( key.path, true );
+    node->tie( rawValue, false );
+    nav_tied_nodes[nav_tied_count++] = node;
+}
+
+static void tie_nav_nodes()
+{
+    tie_nav_node( POSITION_LATITUDE_DEG,
+                  SGRawValuePointer<double>(&navpacket.lat) );
+    tie_nav_node( POSITION_LONGITUDE_DEG,
+                  SGRawValuePointer<double>(&navpacket.lon) );
+    tie_nav_node( POSITION_ALTITUDE_NAV_FT,
+                  SGRawValueFunctions<double>(get_nav_alt_ft) );
+    tie_nav_node( ORIENTATION_GROUNDTRACK_DEG,
+                  SGRawValueFunctions<double>(get_nav_track_deg) );
+    tie_nav_node( VELOCITIES_VERTICAL_SPEED_FPS,
+                  SGRawValueFunctions<double>(get_nav_vert_speed_fps) );
+    tie_nav_node( POSITION_PRESSURE_ERROR_M,
+                  SGRawValuePointer<float>(&Ps_filt_err) );
+}
 
 
 void timer_intr( int sig )
@@ -110,15 +150,8 @@ void nav_init()
   
     navpacket.err_type = no_gps_update;
 
-    // initialize nav property nodes
-    nav_lat_node = fgGetNode("/position/latitude-deg", true);
-    nav_lon_node = fgGetNode("/position/longitude-deg", true);
-    nav_alt_feet_node = fgGetNode("/position/altitude-nav-ft", true);
-    nav_track_node = fgGetNode("/orientation/groundtrack-deg", true);
-    // nav_vel_node = fgGetNode("/velocities/groundspeed-ms", true);
-    nav_vert_speed_fps_node
-        = fgGetNode("/velocities/vertical-speed-fps",true);
-    pressure_error_m_node = fgGetNode("/position/pressure-error-m", true);
+    // the nav properties are tied by nav_update() once there is a
+    // solution behind them
 
     if ( display_on ) {
         printf("[nav] initialized.\n");
@@ -133,7 +166,6 @@ void nav_update()
     static int       gps_state = 0;
     static double    acq_start = 0; // time that gps first acquired
 
-    static float Ps_filt_err = 0.0;
     static float Ps_count  = 0.0;
     const float Ps_span = 2500.0;   // counts @ 10hz
 
@@ -202,17 +234,13 @@ void nav_update()
             + ((Ps_span - Ps_count) / Ps_span) * alt_err;
         // printf("cnt = %.0f err = %.2f\n", Ps_count, Ps_filt_err);
 
-        // publish values to property tree
-	nav_lat_node->setDoubleValue( navpacket.lat );
-	nav_lon_node->setDoubleValue( navpacket.lon );
-	nav_alt_feet_node->setDoubleValue( navpacket.alt * SG_METER_TO_FEET );
-	nav_track_node->setDoubleValue( 90 - atan2(navpacket.vn, navpacket.ve)
-	 				* SG_RADIANS_TO_DEGREES );
-	// nav_vel_node->setDoubleValue( sqrt( navpacket.vn * navpacket.vn
-	// 				    + navpacket.ve * navpacket.ve ) );
-        nav_vert_speed_fps_node
-            ->setDoubleValue( -navpacket.vd * SG_METER_TO_FEET );
-        pressure_error_m_node->setFloatValue( Ps_filt_err );
+        // the nav properties are tied to navpacket and Ps_filt_err
+        if ( nav_tied_count == 0 ) {
+            tie_nav_nodes();
+        }
+        for ( int i = 0; i < nav_tied_count; i++ ) {
+            nav_tied_nodes[i]->fireValueChanged();
+        }
 
         if ( console_link_on ) {
             console_link_nav( &navpacket );
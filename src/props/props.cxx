@@ -7,10 +7,15 @@
 // $Id: props.cxx,v 1.2 2007/03/08 20:54:08 curt Exp $
 
 #include "props.hxx"
+#include "props_journal.hxx"
 
 #include <algorithm>
+#include <cassert>
 #include <sstream>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if PROPS_STANDALONE
@@ -23,6 +28,7 @@ using std::cerr;
 using std::endl;
 using std::find;
 using std::sort;
+using std::unique;
 using std::vector;
 using std::stringstream;
 
@@ -250,18 +256,478 @@ compare_strings (const char * s1, const char * s2)
 }
 
 /**
- * Locate a child node by name and index.
+ * Nodes with more children than this get a (name, index) hash index.
  */
-static int
-find_child (const char * name, int index, const vector<SGPropertyNode_ptr>& nodes)
+#define CHILD_INDEX_THRESHOLD 8
+
+/**
+ * Numbers the trees, so a path cache can tell when a node it
+ * started from has come to belong to another one.
+ */
+static SGAtomic<unsigned int> tree_count(0);
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Concurrent readers.
+//
+// One thread owns and writes a tree; others may take snapshots of it
+// (see props_snapshot.hxx).  The writer never waits for a reader.
+// Each write, or each beginUpdate()/endUpdate() group, makes the
+// tree's write sequence odd while it runs and even again afterwards,
+// and a reader starts its copy over if the sequence moved underneath
+// it.  Changes to the shape of the tree, types, ties, aliases and
+// strings are writes like any other, so a reader may see them half
+// done: it checks the sequence again before it follows any pointer
+// it loaded (an alias, a tie, a string), and the writer never frees
+// what a reader might still be looking at.  Old strings, tie
+// objects, child blocks and removed nodes are retired instead, and
+// freed after every reader that could have seen them has left, which
+// the readers announce in one of two counters by epoch.
+//
+// All of this state is per tree, kept by the root, so trees written
+// on different threads (apsweep's workers) share nothing.
+////////////////////////////////////////////////////////////////////////
+
+struct SGPropertyNode::tree_state
+{
+  tree_state ();
+  ~tree_state ();
+
+  void write_begin ();
+  void write_end ();
+  void value_begin ();
+  void value_end ();
+  void retire (void * p, void (* release) (void *));
+  void reclaim ();
+
+  unsigned int id;
+				// Bumped whenever a node is removed
+				// from this tree.  Path caches hold
+				// plain pointers and are thrown away
+				// once it moves on.
+  SGAtomic<unsigned int> removals;
+
+				// Odd while a write is under way.
+  SGAtomic<unsigned int> sequence;
+  SGAtomic<int> update_depth;
+				// Bumped by every structural change,
+				// so a reader knows to relist.
+  SGAtomic<unsigned int> structure;
+
+				// Readers in, by the parity of the
+				// epoch they came in under.
+  SGAtomic<unsigned int> epoch;
+  SGAtomic<int> readers[2];
+
+  struct retired {
+    void * p;
+    void (* release) (void *);
+  };
+  vector<retired> retiring;	// since the epoch last moved on
+  vector<retired> waiting;	// from before that
+};
+
+SGPropertyNode::tree_state::tree_state ()
+  : id(tree_count.fetch_add(1) + 1),
+    removals(0),
+    sequence(0),
+    update_depth(0),
+    structure(0),
+    epoch(0)
 {
-  int nNodes = nodes.size();
-  for (int i = 0; i < nNodes; i++) {
-    SGPropertyNode * node = nodes[i];
-    if (compare_strings(node->getName(), name) && node->getIndex() == index)
-      return i;
+  readers[0] = 0;
+  readers[1] = 0;
+}
+
+SGPropertyNode::tree_state::~tree_state ()
+{
+				// The tree is going; no reader may
+				// be in it any more.
+  for (unsigned int i = 0; i < waiting.size(); i++)
+    waiting[i].release(waiting[i].p);
+  for (unsigned int i = 0; i < retiring.size(); i++)
+    retiring[i].release(retiring[i].p);
+}
+
+				// Only the writer's thread updates the
+				// sequence and depth, so plain loads and
+				// stores do; they are atomic for the
+				// readers' sake.
+inline void
+SGPropertyNode::tree_state::write_begin ()
+{
+  int depth = update_depth.load(SG_RELAXED);
+  update_depth.store(depth + 1, SG_RELAXED);
+  if (depth == 0) {
+    sequence.store(sequence.load(SG_RELAXED) + 1,
+		   SG_RELAXED);
+				// The odd sequence before the writes.
+    sg_fence(SG_RELEASE);
   }
-  return -1;
+}
+
+inline void
+SGPropertyNode::tree_state::write_end ()
+{
+  int depth = update_depth.load(SG_RELAXED) - 1;
+  update_depth.store(depth, SG_RELAXED);
+  if (depth == 0) {
+    sequence.store(sequence.load(SG_RELAXED) + 1,
+		   SG_RELEASE);
+    if (!retiring.empty() || !waiting.empty())
+      reclaim();
+  }
+}
+
+/**
+ * A single value write, which cannot nest, leaves the depth alone.
+ */
+inline void
+SGPropertyNode::tree_state::value_begin ()
+{
+  if (update_depth.load(SG_RELAXED) == 0) {
+    sequence.store(sequence.load(SG_RELAXED) + 1,
+		   SG_RELAXED);
+    sg_fence(SG_RELEASE);
+  }
+}
+
+inline void
+SGPropertyNode::tree_state::value_end ()
+{
+  if (update_depth.load(SG_RELAXED) == 0) {
+    sequence.store(sequence.load(SG_RELAXED) + 1,
+		   SG_RELEASE);
+    if (!retiring.empty() || !waiting.empty())
+      reclaim();
+  }
+}
+
+void
+SGPropertyNode::tree_state::retire (void * p, void (* release) (void *))
+{
+  retired r;
+  r.p = p;
+  r.release = release;
+  retiring.push_back(r);
+}
+
+/**
+ * Free what was retired before the current epoch once the readers
+ * that came in before it have all left, and start a new epoch for
+ * what was retired since.  Never waits: if old readers are still in,
+ * it is tried again after the next write.
+ */
+void
+SGPropertyNode::tree_state::reclaim ()
+{
+  unsigned int current = epoch.load();
+  if (readers[(current + 1) & 1].load() != 0)
+    return;
+
+  for (unsigned int i = 0; i < waiting.size(); i++)
+    waiting[i].release(waiting[i].p);
+  waiting.clear();
+  waiting.swap(retiring);
+  if (!waiting.empty())
+    epoch.store(current + 1);
+}
+
+template <class T>
+static void
+release_object (void * p)
+{
+  delete (T *)p;
+}
+
+static void
+release_string (void * p)
+{
+  delete [] (char *)p;
+}
+
+static void
+release_node (void * p)
+{
+  SGPropertyNode * node = (SGPropertyNode *)p;
+  if (!SGReferenced::put(node))
+    delete node;
+}
+
+
+/**
+ * Fields a reader may load in the middle of a write are stored and
+ * loaded whole; which value it got is for the sequence to judge.
+ */
+template <class T> struct field_type { typedef T type; };
+
+template <class T>
+static inline void
+store_field (T &field, typename field_type<T>::type value)
+{
+  sg_store(&field, value, SG_RELAXED);
+}
+
+template <class T>
+static inline T
+load_field (const T &field)
+{
+  return sg_load(&field, SG_RELAXED);
+}
+
+
+/**
+ * Pass a successful write to the open journal, if any.
+ */
+static inline void
+journal_write (const SGPropertyNode * node)
+{
+  if (SGPropertyJournal::active != 0)
+    SGPropertyJournal::active->record(node);
+}
+
+
+/**
+ * Have the open journal, if any, sample a newly tied node.
+ */
+static inline void
+journal_tie (const SGPropertyNode * node)
+{
+  if (SGPropertyJournal::active != 0)
+    SGPropertyJournal::active->track(node);
+}
+
+
+/**
+ * Bracket a writer's structural change.
+ */
+class SGPropertyNode::structure_guard
+{
+public:
+  structure_guard (const SGPropertyNode * node)
+    : _tree(node->get_tree())
+  {
+    _tree->write_begin();
+    _tree->structure.store(_tree->structure.load(SG_RELAXED)
+			   + 1, SG_RELAXED);
+  }
+  ~structure_guard () {
+    _tree->write_end();
+  }
+  tree_state * tree () const { return _tree; }
+private:
+  tree_state * _tree;
+};
+
+void
+SGPropertyNode::beginUpdate ()
+{
+  get_tree()->write_begin();
+}
+
+void
+SGPropertyNode::endUpdate ()
+{
+  get_tree()->write_end();
+}
+
+SGPropertyNode::tree_state *
+SGPropertyNode::read_lock (const SGPropertyNode * node, int &slot)
+{
+  tree_state * tree = node->get_tree();
+  while (true) {
+    unsigned int current = tree->epoch.load();
+    tree->readers[current & 1].fetch_add(1);
+				// Counted under the epoch it is now?
+    if (tree->epoch.load() == current) {
+      slot = current & 1;
+      return tree;
+    }
+    tree->readers[current & 1].fetch_sub(1);
+  }
+}
+
+void
+SGPropertyNode::read_unlock (tree_state * tree, int slot)
+{
+  tree->readers[slot].fetch_sub(1);
+}
+
+unsigned int
+SGPropertyNode::read_begin (const tree_state * tree)
+{
+  return tree->sequence.load(SG_ACQUIRE);
+}
+
+bool
+SGPropertyNode::read_retry (const tree_state * tree, unsigned int sequence)
+{
+				// The reads before the sequence.
+  sg_fence(SG_ACQUIRE);
+  return ((sequence & 1)
+	  || tree->sequence.load(SG_RELAXED) != sequence);
+}
+
+unsigned int
+SGPropertyNode::structure_generation (const tree_state * tree)
+{
+  return tree->structure.load(SG_RELAXED);
+}
+
+
+/**
+ * Load a pointer the writer may be changing on a reader thread, or
+ * 0 if a write has started since sequence, in which case it may not
+ * point at what the reader thinks it does.
+ */
+template <class T>
+static inline T *
+read_pointer (T * const * slot, const SGAtomic<unsigned int> &counter,
+	      unsigned int sequence)
+{
+  T * p = sg_load(slot, SG_ACQUIRE);
+  sg_fence(SG_ACQUIRE);
+  if (counter.load(SG_RELAXED) != sequence)
+    return 0;
+  return p;
+}
+
+const SGPropertyNode *
+SGPropertyNode::read_target (const tree_state * tree,
+			     unsigned int sequence) const
+{
+  const SGPropertyNode * node = this;
+  for (int hops = 0; hops < 64; hops++) {
+    if (sg_load(&node->_type, SG_ACQUIRE) != ALIAS)
+      return node;
+    node = read_pointer(&node->_value.alias, tree->sequence, sequence);
+    if (node == 0)
+      return 0;
+  }
+  return 0;
+}
+
+bool
+SGPropertyNode::read_type (const tree_state * tree, unsigned int sequence,
+			   Type &type) const
+{
+  const SGPropertyNode * node = read_target(tree, sequence);
+  if (node == 0)
+    return false;
+  type = sg_load(&node->_type, SG_ACQUIRE);
+  return true;
+}
+
+bool
+SGPropertyNode::read_value (const tree_state * tree, unsigned int sequence,
+			    Type type, value_copy &value, string &text) const
+{
+  const SGPropertyNode * node = read_target(tree, sequence);
+  if (node == 0 || sg_load(&node->_type, SG_ACQUIRE) != type)
+    return false;
+
+  value.double_val = 0.0;
+  text.clear();
+  if (!(load_field(node->_attr) & READ))
+    return true;
+
+  if (sg_load(&node->_tied, SG_ACQUIRE)) {
+    const SGAtomic<unsigned int> &counter = tree->sequence;
+    switch (type) {
+    case BOOL: {
+      SGRawValue<bool> * raw =
+	read_pointer(&node->_value.bool_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      value.bool_val = raw->getValue();
+      break;
+    }
+    case INT: {
+      SGRawValue<int> * raw =
+	read_pointer(&node->_value.int_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      value.long_val = raw->getValue();
+      break;
+    }
+    case LONG: {
+      SGRawValue<long> * raw =
+	read_pointer(&node->_value.long_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      value.long_val = raw->getValue();
+      break;
+    }
+    case FLOAT: {
+      SGRawValue<float> * raw =
+	read_pointer(&node->_value.float_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      value.double_val = raw->getValue();
+      break;
+    }
+    case DOUBLE: {
+      SGRawValue<double> * raw =
+	read_pointer(&node->_value.double_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      value.double_val = raw->getValue();
+      break;
+    }
+    case STRING:
+    case UNSPECIFIED: {
+      SGRawValue<const char *> * raw =
+	read_pointer(&node->_value.string_val, counter, sequence);
+      if (raw == 0)
+	return false;
+      const char * s = raw->getValue();
+      text = (s ? s : "");
+      break;
+    }
+    default:
+      break;
+    }
+    return true;
+  }
+
+  switch (type) {
+  case BOOL:
+    value.bool_val = load_field(node->_local_val.bool_val);
+    break;
+  case INT:
+    value.long_val = load_field(node->_local_val.int_val);
+    break;
+  case LONG:
+    value.long_val = load_field(node->_local_val.long_val);
+    break;
+  case FLOAT:
+    value.double_val = load_field(node->_local_val.float_val);
+    break;
+  case DOUBLE:
+    value.double_val = load_field(node->_local_val.double_val);
+    break;
+  case STRING:
+  case UNSPECIFIED: {
+				// A retired buffer is still there to
+				// copy; 0 only while it is cleared.
+    const char * s = read_pointer(&node->_local_val.string_val,
+				  tree->sequence, sequence);
+    if (s == 0)
+      return false;
+    text = s;
+    break;
+  }
+  default:
+    break;
+  }
+  return true;
+}
+
+void
+SGPropertyNode::read_children (vector<const SGPropertyNode *> &children) const
+{
+  _children.copy_to(children);
 }
 
 
@@ -315,10 +781,297 @@ find_node (SGPropertyNode * current,
 
 
 
+////////////////////////////////////////////////////////////////////////
+// Node pool.
+//
+// Loading a config allocates hundreds of small nodes one at a time;
+// carving them from chunks saves the per-allocation heap overhead
+// and keeps siblings close together.  Freed slots go back on the
+// free list for the next node, chunks are never returned.
+////////////////////////////////////////////////////////////////////////
+
+#define NODE_POOL_CHUNK 32
+
+union node_slot {
+  node_slot * next;
+  char node[sizeof(SGPropertyNode)];
+  double align;
+};
+
+static node_slot * node_free_list = 0;
+static pthread_mutex_t node_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void *
+SGPropertyNode::operator new (size_t size)
+{
+  if (size != sizeof(SGPropertyNode))
+    return ::operator new(size);
+
+  pthread_mutex_lock(&node_pool_mutex);
+  if (node_free_list == 0) {
+    node_slot * chunk =
+      (node_slot *)::operator new(NODE_POOL_CHUNK * sizeof(node_slot));
+				// Hand out slots in address order.
+    for (int i = NODE_POOL_CHUNK - 1; i >= 0; i--) {
+      chunk[i].next = node_free_list;
+      node_free_list = &chunk[i];
+    }
+  }
+  node_slot * slot = node_free_list;
+  node_free_list = slot->next;
+  pthread_mutex_unlock(&node_pool_mutex);
+  return slot;
+}
+
+void
+SGPropertyNode::operator delete (void * p, size_t size)
+{
+  if (p == 0)
+    return;
+  if (size != sizeof(SGPropertyNode)) {
+    ::operator delete(p);
+    return;
+  }
+
+  node_slot * slot = (node_slot *)p;
+  pthread_mutex_lock(&node_pool_mutex);
+  slot->next = node_free_list;
+  node_free_list = slot;
+  pthread_mutex_unlock(&node_pool_mutex);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////
 // Private methods from SGPropertyNode (may be inlined for speed).
 ////////////////////////////////////////////////////////////////////////
 
+SGPropertyNode::child_list::~child_list ()
+{
+  if (_block == 0)
+    return;
+  for (int i = 0; i < _block->size; i++)
+    if (!SGReferenced::put(_block->nodes[i]))
+      delete _block->nodes[i];
+  free(_block);
+}
+
+void
+SGPropertyNode::child_list::push_back (SGPropertyNode * node,
+				       tree_state * tree)
+{
+  int size = this->size();
+  SGReferenced::get(node);
+  if (_block != 0 && size < _block->capacity) {
+				// The node, then the size that
+				// shows it to readers.
+    _block->nodes[size] = node;
+    sg_store(&_block->size, size + 1, SG_RELEASE);
+    return;
+  }
+
+				// Readers may be in the old block, so
+				// grow into a new one.
+  int capacity = (size ? 2 * size : 2);
+  block * grown = (block *)malloc(sizeof(block)
+				  + (capacity - 1) * sizeof(SGPropertyNode *));
+  if (size > 0)
+    memcpy(grown->nodes, _block->nodes, size * sizeof(SGPropertyNode *));
+  grown->nodes[size] = node;
+  grown->size = size + 1;
+  grown->capacity = capacity;
+  block * old = _block;
+  sg_store(&_block, grown, SG_RELEASE);
+  if (old != 0) {
+    if (tree != 0)
+      tree->retire(old, free);
+    else
+      free(old);
+  }
+}
+
+SGPropertyNode_ptr
+SGPropertyNode::child_list::erase (int pos)
+{
+  SGPropertyNode_ptr node = _block->nodes[pos];
+  SGReferenced::put(node);
+  int size = _block->size - 1;
+				// One slot at a time, a reader may be
+				// copying them.
+  for (int i = pos; i < size; i++)
+    sg_store(&_block->nodes[i], _block->nodes[i + 1],
+		     SG_RELAXED);
+  sg_store(&_block->size, size, SG_RELEASE);
+  return node;
+}
+
+void
+SGPropertyNode::child_list::copy_to (vector<const SGPropertyNode *> &nodes)
+  const
+{
+  nodes.clear();
+  block * b = sg_load(&_block, SG_ACQUIRE);
+  if (b == 0)
+    return;
+  int size = sg_load(&b->size, SG_ACQUIRE);
+  nodes.reserve(size);
+  for (int i = 0; i < size; i++)
+    nodes.push_back(sg_load(&b->nodes[i], SG_RELAXED));
+}
+
+int
+SGPropertyNode::child_list::find (const char * atom, int index) const
+{
+  int nNodes = size();
+  for (int i = 0; i < nNodes; i++) {
+    SGPropertyNode * node = _block->nodes[i];
+    if (node->getName() == atom && node->getIndex() == index)
+      return i;
+  }
+  return -1;
+}
+
+SGPropertyNode::extras::extras ()
+  : path_cache(0),
+    tree(0)
+{
+}
+
+SGPropertyNode::extras::~extras ()
+{
+  delete path_cache;
+  delete tree;
+}
+
+SGPropertyNode::extras *
+SGPropertyNode::get_extras () const
+{
+				// Const getters on reader threads may
+				// get here too; the first to publish
+				// wins and the others drop theirs.
+  extras * x = _extras.load(SG_ACQUIRE);
+  if (x == 0) {
+    extras * fresh = new extras;
+    if (_extras.compare_exchange(x, fresh, SG_ACQ_REL))
+      x = fresh;
+    else
+      delete fresh;
+  }
+  return x;
+}
+
+/**
+ * Walk up to the root for get_tree().  Every write asks, so each
+ * node keeps the answer instead of walking up again.
+ */
+SGPropertyNode::tree_state *
+SGPropertyNode::find_tree () const
+{
+  const SGPropertyNode * root = this;
+  while (root->_parent != 0)
+    root = root->_parent;
+  extras * x = root->get_extras();
+  tree_state * tree = x->tree.load(SG_ACQUIRE);
+  if (tree == 0) {
+				// A reader thread may get here first.
+    tree_state * fresh = new tree_state;
+    if (x->tree.compare_exchange(tree, fresh,
+					SG_ACQ_REL))
+      tree = fresh;
+    else
+      delete fresh;
+  }
+  _tree.store(tree, SG_RELEASE);
+  return tree;
+}
+
+/**
+ * Drop the remembered tree of a subtree that is losing its root.
+ */
+void
+SGPropertyNode::forget_tree ()
+{
+  _tree.store(0, SG_RELAXED);
+  for (int i = 0; i < _children.size(); i++)
+    _children[i]->forget_tree();
+  extras * x = _extras.load(SG_ACQUIRE);
+  if (x) {
+    child_list &removed = x->removed_children;
+    for (int i = 0; i < removed.size(); i++)
+      removed[i]->forget_tree();
+  }
+}
+
+void
+SGPropertyNode::removal_stamp (unsigned int &tree,
+			       unsigned int &generation) const
+{
+  tree_state * state = get_tree();
+  tree = state->id;
+  generation = state->removals.load(SG_ACQUIRE);
+}
+
+SGPropertyNode *
+SGPropertyNode::find_child_node (const char * atom, int index) const
+{
+  if (_child_index)
+    return _child_index->get(atom, index);
+  int pos = _children.find(atom, index);
+  return (pos >= 0 ? _children[pos] : 0);
+}
+
+int
+SGPropertyNode::find_child_pos (const char * atom, int index) const
+{
+  if (_child_index) {
+    SGPropertyNode * node = _child_index->get(atom, index);
+    if (node == 0)
+      return -1;
+    int nNodes = _children.size();
+    for (int i = 0; i < nNodes; i++)
+      if (_children[i] == node)
+        return i;
+    return -1;
+  }
+  return _children.find(atom, index);
+}
+
+void
+SGPropertyNode::add_child (SGPropertyNode * node)
+{
+  structure_guard guard(this);
+
+				// Inherit our listener count, a
+				// revived child may carry a stale one.
+  int own = (node->_listeners ? node->_listeners->size() : 0);
+  int delta = _listened + own - node->_listened;
+  if (delta != 0)
+    node->adjust_listened(delta);
+
+  _children.push_back(node, guard.tree());
+  if (_child_index) {
+    _child_index->put(node);
+  } else if (_children.size() > CHILD_INDEX_THRESHOLD) {
+    _child_index = new child_index;
+    for (int i = 0; i < _children.size(); i++)
+      _child_index->put(_children[i]);
+  }
+}
+
+void
+SGPropertyNode::adjust_listened (int delta)
+{
+  _listened += delta;
+  for (int i = 0; i < _children.size(); i++)
+    _children[i]->adjust_listened(delta);
+  extras * x = _extras.load(SG_ACQUIRE);
+  if (x) {
+    child_list &removed = x->removed_children;
+    for (int i = 0; i < removed.size(); i++)
+      removed[i]->adjust_listened(delta);
+  }
+}
+
 inline bool
 SGPropertyNode::get_bool () const
 {
@@ -376,163 +1129,197 @@ SGPropertyNode::get_string () const
 inline bool
 SGPropertyNode::set_bool (bool val)
 {
-  if (_tied) {
-    if (_value.bool_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    _local_val.bool_val = val;
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
+  if (_tied)
+    result = _value.bool_val->setValue(val);
+  else
+    store_field(_local_val.bool_val, val);
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 inline bool
 SGPropertyNode::set_int (int val)
 {
-  if (_tied) {
-    if (_value.int_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    _local_val.int_val = val;
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
+  if (_tied)
+    result = _value.int_val->setValue(val);
+  else
+    store_field(_local_val.int_val, val);
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 inline bool
 SGPropertyNode::set_long (long val)
 {
-  if (_tied) {
-    if (_value.long_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    _local_val.long_val = val;
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
+  if (_tied)
+    result = _value.long_val->setValue(val);
+  else
+    store_field(_local_val.long_val, val);
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 inline bool
 SGPropertyNode::set_float (float val)
 {
-  if (_tied) {
-    if (_value.float_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    _local_val.float_val = val;
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
+  if (_tied)
+    result = _value.float_val->setValue(val);
+  else
+    store_field(_local_val.float_val, val);
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 inline bool
 SGPropertyNode::set_double (double val)
 {
-  if (_tied) {
-    if (_value.double_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    _local_val.double_val = val;
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
+  if (_tied)
+    result = _value.double_val->setValue(val);
+  else
+    store_field(_local_val.double_val, val);
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 inline bool
 SGPropertyNode::set_string (const char * val)
 {
+  bool result = true;
+  tree_state * tree = get_tree();
+  tree->value_begin();
   if (_tied) {
-    if (_value.string_val->setValue(val)) {
-      fireValueChanged();
-      return true;
-    } else {
-      return false;
-    }
+    result = _value.string_val->setValue(val);
   } else {
-    delete [] _local_val.string_val;
-    _local_val.string_val = copy_string(val);
+				// A reader may still be copying the
+				// old buffer.
+    char * old = _local_val.string_val;
+    sg_store(&_local_val.string_val, copy_string(val),
+		     SG_RELEASE);
+    if (old != 0)
+      tree->retire(old, release_string);
+  }
+  tree->value_end();
+  if (result) {
+    journal_write(this);
     fireValueChanged();
-    return true;
   }
+  return result;
 }
 
 void
 SGPropertyNode::clearValue ()
+{
+  structure_guard guard(this);
+  clear_value(guard.tree());
+}
+
+/**
+ * Hand a tie object to tree to delete later, or delete it now.
+ */
+template <class Tree, class T>
+static void
+drop_object (Tree * tree, T * object)
+{
+  if (tree != 0)
+    tree->retire(object, release_object<T>);
+  else
+    delete object;
+}
+
+void
+SGPropertyNode::clear_value (tree_state * tree)
 {
   switch (_type) {
   case NONE:
     break;
   case ALIAS:
-    _value.alias = 0;
+    store_field(_value.alias, 0);
     break;
   case BOOL:
     if (_tied) {
-      delete _value.bool_val;
-      _value.bool_val = 0;
+      drop_object(tree, _value.bool_val);
+      store_field(_value.bool_val, 0);
     }
-    _local_val.bool_val = SGRawValue<bool>::DefaultValue;
+    store_field(_local_val.bool_val, SGRawValue<bool>::DefaultValue);
     break;
   case INT:
     if (_tied) {
-      delete _value.int_val;
-      _value.int_val = 0;
+      drop_object(tree, _value.int_val);
+      store_field(_value.int_val, 0);
     }
-    _local_val.int_val = SGRawValue<int>::DefaultValue;
+    store_field(_local_val.int_val, SGRawValue<int>::DefaultValue);
     break;
   case LONG:
     if (_tied) {
-      delete _value.long_val;
-      _value.long_val = 0L;
+      drop_object(tree, _value.long_val);
+      store_field(_value.long_val, 0L);
     }
-    _local_val.long_val = SGRawValue<long>::DefaultValue;
+    store_field(_local_val.long_val, SGRawValue<long>::DefaultValue);
     break;
   case FLOAT:
     if (_tied) {
-      delete _value.float_val;
-      _value.float_val = 0;
+      drop_object(tree, _value.float_val);
+      store_field(_value.float_val, 0);
     }
-    _local_val.float_val = SGRawValue<float>::DefaultValue;
+    store_field(_local_val.float_val, SGRawValue<float>::DefaultValue);
     break;
   case DOUBLE:
     if (_tied) {
-      delete _value.double_val;
-      _value.double_val = 0;
+      drop_object(tree, _value.double_val);
+      store_field(_value.double_val, 0);
     }
-    _local_val.double_val = SGRawValue<double>::DefaultValue;
+    store_field(_local_val.double_val, SGRawValue<double>::DefaultValue);
     break;
   case STRING:
   case UNSPECIFIED:
     if (_tied) {
-      delete _value.string_val;
-      _value.string_val = 0;
+      drop_object(tree, _value.string_val);
+      store_field(_value.string_val, 0);
+    } else if (tree != 0 && _local_val.string_val != 0) {
+      tree->retire(_local_val.string_val, release_string);
     } else {
       delete [] _local_val.string_val;
     }
-    _local_val.string_val = 0;
+    store_field(_local_val.string_val, 0);
     break;
   }
-  _tied = false;
-  _type = NONE;
+  store_field(_tied, false);
+  store_field(_type, NONE);
 }
 
 
@@ -557,30 +1344,34 @@ SGPropertyNode::make_string () const
     {
       stringstream sstr;
       sstr << get_int();
-      _buffer = sstr.str();
-      return _buffer.c_str();
+      extras * x = get_extras();
+      x->buffer = sstr.str();
+      return x->buffer.c_str();
     }
   case LONG:
     {
       stringstream sstr;
       sstr << get_long();
-      _buffer = sstr.str();
-      return _buffer.c_str();
+      extras * x = get_extras();
+      x->buffer = sstr.str();
+      return x->buffer.c_str();
     }
   case FLOAT:
     {
       stringstream sstr;
       sstr << get_float();
-      _buffer = sstr.str();
-      return _buffer.c_str();
+      extras * x = get_extras();
+      x->buffer = sstr.str();
+      return x->buffer.c_str();
     }
   case DOUBLE:
     {
       stringstream sstr;
       sstr.precision( 10 );
       sstr << get_double();
-      _buffer = sstr.str();
-      return _buffer.c_str();
+      extras * x = get_extras();
+      x->buffer = sstr.str();
+      return x->buffer.c_str();
     }
   case STRING:
   case UNSPECIFIED:
@@ -637,11 +1428,16 @@ const int SGPropertyNode::LAST_USED_ATTRIBUTE = TRACE_WRITE;
  */
 SGPropertyNode::SGPropertyNode ()
   : _index(0),
+    _name(SGPropertyName::intern("")),
     _parent(0),
-    _path_cache(0),
+    _child_index(0),
+    _extras(0),
+    _tree(0),
     _type(NONE),
     _tied(false),
+    _journal_id(0),
     _attr(READ|WRITE),
+    _listened(0),
     _listeners(0)
 {
   _local_val.string_val = 0;
@@ -655,10 +1451,14 @@ SGPropertyNode::SGPropertyNode (const SGPropertyNode &node)
   : _index(node._index),
     _name(node._name),
     _parent(0),			// don't copy the parent
-    _path_cache(0),
+    _child_index(0),
+    _extras(0),
+    _tree(0),
     _type(node._type),
     _tied(node._tied),
+    _journal_id(0),
     _attr(node._attr),
+    _listened(0),
     _listeners(0)		// CHECK!!
 {
   _local_val.string_val = 0;
@@ -735,14 +1535,18 @@ SGPropertyNode::SGPropertyNode (const char * name,
 				int index,
 				SGPropertyNode * parent)
   : _index(index),
+    _name(SGPropertyName::intern(name)),
     _parent(parent),
-    _path_cache(0),
+    _child_index(0),
+    _extras(0),
+    _tree(0),
     _type(NONE),
     _tied(false),
+    _journal_id(0),
     _attr(READ|WRITE),
+    _listened(0),
     _listeners(0)
 {
-  _name = name;
   _local_val.string_val = 0;
 }
 
@@ -752,13 +1556,25 @@ SGPropertyNode::SGPropertyNode (const char * name,
  */
 SGPropertyNode::~SGPropertyNode ()
 {
-  // zero out all parent pointers, else they might be dangling
-  for (unsigned i = 0; i < _children.size(); ++i)
+  // zero out all parent pointers, else they might be dangling;
+  // children that outlive us become roots of their own trees
+  for (int i = 0; i < _children.size(); ++i) {
     _children[i]->_parent = 0;
-  for (unsigned i = 0; i < _removedChildren.size(); ++i)
-    _removedChildren[i]->_parent = 0;
-  delete _path_cache;
-  clearValue();
+    if (SGReferenced::shared(_children[i]))
+      _children[i]->forget_tree();
+  }
+  extras * x = _extras.load(SG_ACQUIRE);
+  if (x) {
+    child_list &removed = x->removed_children;
+    for (int i = 0; i < removed.size(); ++i) {
+      removed[i]->_parent = 0;
+      if (SGReferenced::shared(removed[i]))
+	removed[i]->forget_tree();
+    }
+    delete x;
+  }
+  delete _child_index;
+  clear_value(0);
   delete _listeners;
 }
 
@@ -771,9 +1587,10 @@ SGPropertyNode::alias (SGPropertyNode * target)
 {
   if (target == 0 || _type == ALIAS || _tied)
     return false;
+  structure_guard guard(this);
   clearValue();
-  _value.alias = target;
-  _type = ALIAS;
+  store_field(_value.alias, target);
+  store_field(_type, ALIAS);
   return true;
 }
 
@@ -796,8 +1613,9 @@ SGPropertyNode::unalias ()
 {
   if (_type != ALIAS)
     return false;
-  _type = NONE;
-  _value.alias = 0;
+  structure_guard guard(this);
+  store_field(_type, NONE);
+  store_field(_value.alias, 0);
   return true;
 }
 
@@ -851,22 +1669,30 @@ SGPropertyNode::getChild (int position) const
 SGPropertyNode *
 SGPropertyNode::getChild (const char * name, int index, bool create)
 {
-  int pos = find_child(name, index, _children);
-  if (pos >= 0) {
-    return _children[pos];
+				// A name that was never interned
+				// cannot belong to any child.
+  const char * atom = (create ? SGPropertyName::intern(name)
+		       : SGPropertyName::find(name));
+  if (atom == 0)
+    return 0;
+
+  SGPropertyNode * child = find_child_node(atom, index);
+  if (child != 0) {
+    return child;
   } else if (create) {
     SGPropertyNode_ptr node;
-    pos = find_child(name, index, _removedChildren);
-    if (pos >= 0) {
-      vector<SGPropertyNode_ptr>::iterator it = _removedChildren.begin();
-      it += pos;
-      node = _removedChildren[pos];
-      _removedChildren.erase(it);
-      node->setAttribute(REMOVED, false);
-    } else {
-      node = new SGPropertyNode(name, index, this);
+    {
+      structure_guard guard(this);
+      extras * x = _extras.load(SG_ACQUIRE);
+      int pos = (x ? x->removed_children.find(atom, index) : -1);
+      if (pos >= 0) {
+	node = x->removed_children.erase(pos);
+	node->setAttribute(REMOVED, false);
+      } else {
+	node = new SGPropertyNode(atom, index, this);
+      }
+      add_child(node);
     }
-    _children.push_back(node);
     fireChildAdded(node);
     return node;
   } else {
@@ -881,11 +1707,31 @@ SGPropertyNode::getChild (const char * name, int index, bool create)
 const SGPropertyNode *
 SGPropertyNode::getChild (const char * name, int index) const
 {
-  int pos = find_child(name, index, _children);
-  if (pos >= 0)
-    return _children[pos];
-  else
-    return 0;
+  const char * atom = SGPropertyName::find(name);
+  return (atom ? find_child_node(atom, index) : 0);
+}
+
+
+/**
+ * Get a non-const child by interned name and index.
+ */
+SGPropertyNode *
+SGPropertyNode::getChild (const SGPropertyName &name, int index, bool create)
+{
+  SGPropertyNode * child = find_child_node(name.c_str(), index);
+  if (child != 0 || !create)
+    return child;
+  return getChild(name.c_str(), index, true);
+}
+
+
+/**
+ * Get a const child by interned name and index.
+ */
+const SGPropertyNode *
+SGPropertyNode::getChild (const SGPropertyName &name, int index) const
+{
+  return find_child_node(name.c_str(), index);
 }
 
 
@@ -896,10 +1742,13 @@ vector<SGPropertyNode_ptr>
 SGPropertyNode::getChildren (const char * name) const
 {
   vector<SGPropertyNode_ptr> children;
-  int max = _children.size();
+  const char * atom = SGPropertyName::find(name);
+  if (atom == 0)
+    return children;
 
+  int max = _children.size();
   for (int i = 0; i < max; i++)
-    if (compare_strings(_children[i]->getName(), name))
+    if (_children[i]->getName() == atom)
       children.push_back(_children[i]);
 
   sort(children.begin(), children.end(), CompareIndices());
@@ -914,20 +1763,27 @@ SGPropertyNode_ptr
 SGPropertyNode::removeChild (int pos, bool keep)
 {
   SGPropertyNode_ptr node;
-  if (pos < 0 || pos >= (int)_children.size())
+  if (pos < 0 || pos >= _children.size())
     return node;
 
-  vector<SGPropertyNode_ptr>::iterator it = _children.begin();
-  it += pos;
-  node = _children[pos];
-  _children.erase(it);
-  if (keep) {
-    _removedChildren.push_back(node);
-  }
-  if (_path_cache)
-     _path_cache->erase(node->getName()); // EMH - TODO: Take "index" into account!
-  node->setAttribute(REMOVED, true);
-  node->clearValue();
+  {
+    structure_guard guard(this);
+    node = _children.erase(pos);
+    if (_child_index)
+      _child_index->erase(node);
+    if (keep) {
+      get_extras()->removed_children.push_back(node);
+    }
+				// Any path cache in the tree may point
+				// at this node or below it.
+    tree_state * tree = guard.tree();
+    tree->removals.fetch_add(1, SG_RELEASE);
+    node->setAttribute(REMOVED, true);
+    node->clear_value(tree);
+				// A snapshot may still be walking it.
+    SGReferenced::get(node);
+    tree->retire(node, release_node);
+  }
   fireChildRemoved(node);
   return node;
 }
@@ -940,7 +1796,8 @@ SGPropertyNode_ptr
 SGPropertyNode::removeChild (const char * name, int index, bool keep)
 {
   SGPropertyNode_ptr ret;
-  int pos = find_child(name, index, _children);
+  const char * atom = SGPropertyName::find(name);
+  int pos = (atom ? find_child_pos(atom, index) : -1);
   if (pos >= 0)
     ret = removeChild(pos, keep);
   return ret;
@@ -954,9 +1811,12 @@ vector<SGPropertyNode_ptr>
 SGPropertyNode::removeChildren (const char * name, bool keep)
 {
   vector<SGPropertyNode_ptr> children;
+  const char * atom = SGPropertyName::find(name);
+  if (atom == 0)
+    return children;
 
   for (int pos = _children.size() - 1; pos >= 0; pos--)
-    if (compare_strings(_children[pos]->getName(), name))
+    if (_children[pos]->getName() == atom)
       children.push_back(removeChild(pos, keep));
 
   sort(children.begin(), children.end(), CompareIndices());
@@ -967,13 +1827,14 @@ SGPropertyNode::removeChildren (const char * name, bool keep)
 const char *
 SGPropertyNode::getDisplayName (bool simplify) const
 {
-  _display_name = _name;
+  string &display_name = get_extras()->display_name;
+  display_name = _name;
   if (_index != 0 || !simplify) {
     stringstream sstr;
     sstr << '[' << _index << ']';
-    _display_name += sstr.str();
+    display_name += sstr.str();
   }
-  return _display_name.c_str();
+  return display_name.c_str();
 }
 
 
@@ -981,13 +1842,16 @@ const char *
 SGPropertyNode::getPath (bool simplify) const
 {
   // Calculate the complete path only once.
-  if (_parent != 0 && _path.empty()) {
-    _path = _parent->getPath(simplify);
-    _path += '/';
-    _path += getDisplayName(simplify);
+  if (_parent == 0)
+    return "";
+  string &path = get_extras()->path;
+  if (path.empty()) {
+    path = _parent->getPath(simplify);
+    path += '/';
+    path += getDisplayName(simplify);
   }
 
-  return _path.c_str();
+  return path.c_str();
 }
 
 SGPropertyNode::Type
@@ -1190,9 +2054,10 @@ SGPropertyNode::setBoolValue (bool value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _tied = false;
-    _type = BOOL;
+    store_field(_tied, false);
+    store_field(_type, BOOL);
   }
 
   switch (_type) {
@@ -1238,9 +2103,10 @@ SGPropertyNode::setIntValue (int value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _type = INT;
-    _local_val.int_val = 0;
+    store_field(_type, INT);
+    store_field(_local_val.int_val, 0);
   }
 
   switch (_type) {
@@ -1289,9 +2155,10 @@ SGPropertyNode::setLongValue (long value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _type = LONG;
-    _local_val.long_val = 0L;
+    store_field(_type, LONG);
+    store_field(_local_val.long_val, 0L);
   }
 
   switch (_type) {
@@ -1340,9 +2207,10 @@ SGPropertyNode::setFloatValue (float value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _type = FLOAT;
-    _local_val.float_val = 0;
+    store_field(_type, FLOAT);
+    store_field(_local_val.float_val, 0);
   }
 
   switch (_type) {
@@ -1391,9 +2259,10 @@ SGPropertyNode::setDoubleValue (double value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _local_val.double_val = value;
-    _type = DOUBLE;
+    store_field(_local_val.double_val, value);
+    store_field(_type, DOUBLE);
   }
 
   switch (_type) {
@@ -1442,8 +2311,9 @@ SGPropertyNode::setStringValue (const char * value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE || _type == UNSPECIFIED) {
+    structure_guard guard(this);
     clearValue();
-    _type = STRING;
+    store_field(_type, STRING);
   }
 
   switch (_type) {
@@ -1486,8 +2356,9 @@ SGPropertyNode::setUnspecifiedValue (const char * value)
   bool result = false;
   TEST_WRITE;
   if (_type == NONE) {
+    structure_guard guard(this);
     clearValue();
-    _type = UNSPECIFIED;
+    store_field(_type, UNSPECIFIED);
   }
 
   switch (_type) {
@@ -1535,14 +2406,18 @@ SGPropertyNode::tie (const SGRawValue<bool> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getBoolValue();
 
-  clearValue();
-  _type = BOOL;
-  _tied = true;
-  _value.bool_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, BOOL);
+    store_field(_tied, true);
+    store_field(_value.bool_val, rawValue.clone());
+  }
 
   if (useDefault)
     setBoolValue(old_val);
 
+  journal_tie(this);
   return true;
 }
 
@@ -1557,14 +2432,18 @@ SGPropertyNode::tie (const SGRawValue<int> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getIntValue();
 
-  clearValue();
-  _type = INT;
-  _tied = true;
-  _value.int_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, INT);
+    store_field(_tied, true);
+    store_field(_value.int_val, rawValue.clone());
+  }
 
   if (useDefault)
     setIntValue(old_val);
 
+  journal_tie(this);
   return true;
 }
 
@@ -1579,14 +2458,18 @@ SGPropertyNode::tie (const SGRawValue<long> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getLongValue();
 
-  clearValue();
-  _type = LONG;
-  _tied = true;
-  _value.long_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, LONG);
+    store_field(_tied, true);
+    store_field(_value.long_val, rawValue.clone());
+  }
 
   if (useDefault)
     setLongValue(old_val);
 
+  journal_tie(this);
   return true;
 }
 
@@ -1601,14 +2484,18 @@ SGPropertyNode::tie (const SGRawValue<float> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getFloatValue();
 
-  clearValue();
-  _type = FLOAT;
-  _tied = true;
-  _value.float_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, FLOAT);
+    store_field(_tied, true);
+    store_field(_value.float_val, rawValue.clone());
+  }
 
   if (useDefault)
     setFloatValue(old_val);
 
+  journal_tie(this);
   return true;
 }
 
@@ -1623,14 +2510,18 @@ SGPropertyNode::tie (const SGRawValue<double> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getDoubleValue();
 
-  clearValue();
-  _type = DOUBLE;
-  _tied = true;
-  _value.double_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, DOUBLE);
+    store_field(_tied, true);
+    store_field(_value.double_val, rawValue.clone());
+  }
 
   if (useDefault)
     setDoubleValue(old_val);
 
+  journal_tie(this);
   return true;
 
 }
@@ -1646,14 +2537,18 @@ SGPropertyNode::tie (const SGRawValue<const char *> &rawValue, bool useDefault)
   if (useDefault)
     old_val = getStringValue();
 
-  clearValue();
-  _type = STRING;
-  _tied = true;
-  _value.string_val = rawValue.clone();
+  {
+    structure_guard guard(this);
+    clearValue();
+    store_field(_type, STRING);
+    store_field(_tied, true);
+    store_field(_value.string_val, rawValue.clone());
+  }
 
   if (useDefault)
     setStringValue(old_val.c_str());
 
+  journal_tie(this);
   return true;
 }
 
@@ -1663,48 +2558,49 @@ SGPropertyNode::untie ()
   if (!_tied)
     return false;
 
+  structure_guard guard(this);
   switch (_type) {
   case BOOL: {
     bool val = getBoolValue();
     clearValue();
-    _type = BOOL;
-    _local_val.bool_val = val;
+    store_field(_type, BOOL);
+    store_field(_local_val.bool_val, val);
     break;
   }
   case INT: {
     int val = getIntValue();
     clearValue();
-    _type = INT;
-    _local_val.int_val = val;
+    store_field(_type, INT);
+    store_field(_local_val.int_val, val);
     break;
   }
   case LONG: {
     long val = getLongValue();
     clearValue();
-    _type = LONG;
-    _local_val.long_val = val;
+    store_field(_type, LONG);
+    store_field(_local_val.long_val, val);
     break;
   }
   case FLOAT: {
     float val = getFloatValue();
     clearValue();
-    _type = FLOAT;
-    _local_val.float_val = val;
+    store_field(_type, FLOAT);
+    store_field(_local_val.float_val, val);
     break;
   }
   case DOUBLE: {
     double val = getDoubleValue();
     clearValue();
-    _type = DOUBLE;
-    _local_val.double_val = val;
+    store_field(_type, DOUBLE);
+    store_field(_local_val.double_val, val);
     break;
   }
   case STRING:
   case UNSPECIFIED: {
     string val = getStringValue();
     clearValue();
-    _type = STRING;
-    _local_val.string_val = copy_string(val.c_str());
+    store_field(_type, STRING);
+    store_field(_local_val.string_val, copy_string(val.c_str()));
     break;
   }
   case NONE:
@@ -1712,7 +2608,7 @@ SGPropertyNode::untie ()
     break;
   }
 
-  _tied = false;
+  store_field(_tied, false);
   return true;
 }
 
@@ -1737,16 +2633,23 @@ SGPropertyNode::getRootNode () const
 SGPropertyNode *
 SGPropertyNode::getNode (const char * relative_path, bool create)
 {
-  if (_path_cache == 0)
-    _path_cache = new hash_table;
+  unsigned int tree, generation;
+  removal_stamp(tree, generation);
+  hash_table * &path_cache = get_extras()->path_cache;
+  if (path_cache != 0 && path_cache->is_stale(tree, generation)) {
+    delete path_cache;
+    path_cache = 0;
+  }
+  if (path_cache == 0)
+    path_cache = new hash_table(tree, generation);
 
-  SGPropertyNode * result = _path_cache->get(relative_path);
+  SGPropertyNode * result = path_cache->get(relative_path);
   if (result == 0) {
     vector<PathComponent> components;
     parse_path(relative_path, components);
     result = find_node(this, components, 0, create);
     if (result != 0)
-      _path_cache->put(relative_path, result);
+      path_cache->put(relative_path, result);
   }
 
   return result;
@@ -2045,6 +2948,7 @@ SGPropertyNode::addChangeListener (SGPropertyChangeListener * listener,
   if (_listeners == 0)
     _listeners = new vector<SGPropertyChangeListener*>;
   _listeners->push_back(listener);
+  adjust_listened(1);
   listener->register_property(this);
   if (initial)
     listener->valueChanged(this);
@@ -2057,6 +2961,7 @@ SGPropertyNode::removeChangeListener (SGPropertyChangeListener * listener)
     find(_listeners->begin(), _listeners->end(), listener);
   if (it != _listeners->end()) {
     _listeners->erase(it);
+    adjust_listened(-1);
     listener->unregister_property(this);
     if (_listeners->empty()) {
       vector<SGPropertyChangeListener*>* tmp = _listeners;
@@ -2069,61 +2974,290 @@ SGPropertyNode::removeChangeListener (SGPropertyChangeListener * listener)
 void
 SGPropertyNode::fireValueChanged ()
 {
+				// Nothing is listening here or
+				// anywhere above: the common case.
+  if (_listened == 0)
+    return;
   fireValueChanged(this);
 }
 
 void
 SGPropertyNode::fireChildAdded (SGPropertyNode * child)
 {
+  if (_listened == 0)
+    return;
   fireChildAdded(this, child);
 }
 
 void
 SGPropertyNode::fireChildRemoved (SGPropertyNode * child)
 {
+  if (_listened == 0)
+    return;
   fireChildRemoved(this, child);
 }
 
+				// _listened counts the listeners on a
+				// node and all of its ancestors, so
+				// each walk below stops at the first
+				// node with nothing left above it.
 void
 SGPropertyNode::fireValueChanged (SGPropertyNode * node)
 {
-  if (_listeners != 0) {
-    for (unsigned int i = 0; i < _listeners->size(); i++) {
-      (*_listeners)[i]->valueChanged(node);
+  for (SGPropertyNode * n = this; n != 0 && n->_listened > 0; n = n->_parent) {
+    if (n->_listeners == 0)
+      continue;
+    for (unsigned int i = 0; i < n->_listeners->size(); i++) {
+      SGPropertyChangeListener * listener = (*n->_listeners)[i];
+      if (listener->isBatched())
+	listener->queue_change(node);
+      else
+	listener->valueChanged(node);
     }
   }
-  if (_parent != 0)
-    _parent->fireValueChanged(node);
 }
 
 void
 SGPropertyNode::fireChildAdded (SGPropertyNode * parent,
 				SGPropertyNode * child)
 {
-  if (_listeners != 0) {
-    for (unsigned int i = 0; i < _listeners->size(); i++) {
-      (*_listeners)[i]->childAdded(parent, child);
-    }
+  for (SGPropertyNode * n = this; n != 0 && n->_listened > 0; n = n->_parent) {
+    if (n->_listeners == 0)
+      continue;
+    for (unsigned int i = 0; i < n->_listeners->size(); i++)
+      (*n->_listeners)[i]->childAdded(parent, child);
   }
-  if (_parent != 0)
-    _parent->fireChildAdded(parent, child);
 }
 
 void
 SGPropertyNode::fireChildRemoved (SGPropertyNode * parent,
 				  SGPropertyNode * child)
 {
-  if (_listeners != 0) {
-    for (unsigned int i = 0; i < _listeners->size(); i++) {
-      (*_listeners)[i]->childRemoved(parent, child);
+  for (SGPropertyNode * n = this; n != 0 && n->_listened > 0; n = n->_parent) {
+    if (n->_listeners == 0)
+      continue;
+    for (unsigned int i = 0; i < n->_listeners->size(); i++)
+      (*n->_listeners)[i]->childRemoved(parent, child);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Implementation of SGPropertyPath.
+////////////////////////////////////////////////////////////////////////
+
+SGPropertyPath::SGPropertyPath ()
+  : _start(0),
+    _node(0),
+    _tree(0),
+    _generation(0)
+{
+}
+
+SGPropertyPath::SGPropertyPath (const char * path)
+  : _start(0),
+    _node(0),
+    _tree(0),
+    _generation(0)
+{
+  set(path);
+}
+
+void
+SGPropertyPath::set (const char * path)
+{
+  vector<PathComponent> components;
+  parse_path(path, components);
+
+  _path = path;
+  _components.clear();
+  _start = 0;
+  _node = 0;
+  for (unsigned int i = 0; i < components.size(); i++) {
+    component c;
+    if (components[i].name == "") {
+      c.index = ROOT;
+    } else if (components[i].name == ".") {
+      continue;
+    } else if (components[i].name == "..") {
+      c.index = PARENT;
+    } else {
+      c.name = SGPropertyName(components[i].name);
+      c.index = components[i].index;
+    }
+    _components.push_back(c);
+  }
+}
+
+SGPropertyNode *
+SGPropertyPath::resolve (SGPropertyNode * start, bool create)
+{
+  unsigned int tree, generation;
+  start->removal_stamp(tree, generation);
+  if (_node != 0 && _start == start && _tree == tree
+      && _generation == generation)
+    return _node;
+
+  _start = start;
+  _tree = tree;
+  _generation = generation;
+  _node = walk(start, create);
+  return _node;
+}
+
+SGPropertyNode *
+SGPropertyPath::walk (SGPropertyNode * start, bool create) const
+{
+  SGPropertyNode * node = start;
+  for (unsigned int i = 0; i < _components.size() && node != 0; i++) {
+    const component &c = _components[i];
+    if (c.index == ROOT) {
+      node = node->getRootNode();
+    } else if (c.index == PARENT) {
+      node = node->getParent();
+      if (node == 0)
+	throw string("Attempt to move past root with '..'");
+    } else {
+      node = node->getChild(c.name, c.index, create);
     }
   }
-  if (_parent != 0)
-    _parent->fireChildRemoved(parent, child);
+  if (node != 0 && node->getAttribute(SGPropertyNode::REMOVED))
+    return 0;
+  return node;
 }
 
 
-
+
+////////////////////////////////////////////////////////////////////////
+// Interned property names.
+////////////////////////////////////////////////////////////////////////
+
+#define ATOM_TABLE_MIN_SLOTS 256
+#define ATOM_ARENA_CHUNK 1024
+
+/**
+ * The slot array and its mask are published together through one
+ * pointer so that find() needs no lock.  Outgrown tables are kept,
+ * since a reader may still be probing one.
+ */
+struct atom_table {
+  unsigned int mask;
+  const char * slots[1];
+};
+
+static atom_table * atoms = 0;	// published with a release store
+static unsigned int atom_count = 0;
+static pthread_mutex_t atom_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+				// Names are packed into chunks
+				// rather than allocated one by one.
+static char * atom_arena = 0;
+static unsigned int atom_arena_left = 0;
+
+static unsigned int
+atom_hashcode (const char * name)
+{
+  unsigned int hash = 2166136261u;
+  while (*name != 0) {
+    hash = (hash ^ (unsigned char)*name) * 16777619u;
+    name++;
+  }
+  return hash;
+}
+
+static const char *
+atom_copy (const char * name)
+{
+  unsigned int length = strlen(name) + 1;
+  if (length > ATOM_ARENA_CHUNK / 4)
+    return copy_string(name);
+  if (length > atom_arena_left) {
+    atom_arena = new char[ATOM_ARENA_CHUNK];
+    atom_arena_left = ATOM_ARENA_CHUNK;
+  }
+  char * copy = atom_arena;
+  memcpy(copy, name, length);
+  atom_arena += length;
+  atom_arena_left -= length;
+  return copy;
+}
+
+static void
+atom_insert (atom_table * table, const char * atom)
+{
+  unsigned int i = atom_hashcode(atom) & table->mask;
+  while (table->slots[i] != 0)
+    i = (i + 1) & table->mask;
+				// The name before the slot that finds it.
+  sg_store(&table->slots[i], atom, SG_RELEASE);
+}
+
+static void
+atom_grow ()
+{
+  atom_table * old_table = sg_load(&atoms, SG_RELAXED);
+  unsigned int old_length = (old_table ? old_table->mask + 1 : 0);
+  unsigned int length = (old_length ? 2 * old_length : ATOM_TABLE_MIN_SLOTS);
+
+  atom_table * table = (atom_table *)
+    new char[sizeof(atom_table) + (length - 1) * sizeof(const char *)];
+  table->mask = length - 1;
+  for (unsigned int i = 0; i < length; i++)
+    table->slots[i] = 0;
+  for (unsigned int i = 0; i < old_length; i++)
+    if (old_table->slots[i] != 0)
+      atom_insert(table, old_table->slots[i]);
+
+  sg_store(&atoms, table, SG_RELEASE);
+}
+
+const char *
+SGPropertyName::find (const char * name)
+{
+  atom_table * table = sg_load(&atoms, SG_ACQUIRE);
+  if (table == 0)
+    return 0;
+  unsigned int i = atom_hashcode(name) & table->mask;
+  const char * atom;
+  while ((atom = sg_load(&table->slots[i], SG_ACQUIRE)) != 0) {
+    if (!strcmp(atom, name))
+      return atom;
+    i = (i + 1) & table->mask;
+  }
+  return 0;
+}
+
+const char *
+SGPropertyName::intern (const char * name)
+{
+  const char * atom = find(name);
+  if (atom != 0)
+    return atom;
+
+  pthread_mutex_lock(&atom_mutex);
+  atom = find(name);
+  if (atom == 0) {
+				// Keep the load factor under one half.
+    atom_table * table = sg_load(&atoms, SG_RELAXED);
+    if (table == 0 || 2 * (atom_count + 1) > table->mask + 1)
+      atom_grow();
+    atom = atom_copy(name);
+    atom_insert(sg_load(&atoms, SG_RELAXED), atom);
+    atom_count++;
+  }
+  pthread_mutex_unlock(&atom_mutex);
+  return atom;
+}
+
+unsigned int
+SGPropertyName::count ()
+{
+  return atom_count;
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////
 // Simplified hash table for caching paths.
 ////////////////////////////////////////////////////////////////////////
@@ -2208,9 +3342,12 @@ SGPropertyNode::hash_table::bucket::erase (const char * key)
 }
 
 
-SGPropertyNode::hash_table::hash_table ()
+SGPropertyNode::hash_table::hash_table (unsigned int tree,
+					unsigned int generation)
   : _data_length(0),
-    _data(0)
+    _data(0),
+    _tree(tree),
+    _generation(generation)
 {
 }
 
@@ -2275,20 +3412,175 @@ SGPropertyNode::hash_table::hashcode (const char * key)
   return hash;
 }
 
+bool
+SGPropertyNode::hash_table::is_stale (unsigned int tree,
+				      unsigned int generation) const
+{
+  return _tree != tree || _generation != generation;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Open addressing (name, index) index over a node's children.
+////////////////////////////////////////////////////////////////////////
+
+#define CHILD_INDEX_MIN_SLOTS 32
+
+SGPropertyNode::child_index::child_index ()
+  : _count(0),
+    _mask(0),
+    _slots(0)
+{
+}
+
+SGPropertyNode::child_index::~child_index ()
+{
+				// The nodes belong to _children.
+  delete [] _slots;
+}
+
+unsigned int
+SGPropertyNode::child_index::hashcode (const char * atom, int index)
+{
+				// Names are interned, so the pointer
+				// identifies the name; its low bits
+				// are alignment.
+  unsigned int hash = (unsigned int)((uintptr_t)atom >> 3);
+  hash = (hash ^ ((unsigned int)index * 0x9e3779b1u)) * 0x85ebca6bu;
+  return hash ^ (hash >> 15);
+}
+
+SGPropertyNode *
+SGPropertyNode::child_index::get (const char * atom, int index) const
+{
+  if (_slots == 0)
+    return 0;
+  unsigned int hash = hashcode(atom, index);
+  for (unsigned int i = hash & _mask; _slots[i].node != 0; i = (i + 1) & _mask) {
+    SGPropertyNode * node = _slots[i].node;
+    if (_slots[i].hash == hash && node->getName() == atom
+        && node->getIndex() == index)
+      return node;
+  }
+  return 0;
+}
+
+void
+SGPropertyNode::child_index::put (SGPropertyNode * node)
+{
+				// Keep the load factor under one half.
+  if (2 * (_count + 1) > _mask + 1)
+    grow();
+  unsigned int hash = hashcode(node->getName(), node->getIndex());
+  unsigned int i = hash & _mask;
+  while (_slots[i].node != 0)
+    i = (i + 1) & _mask;
+  _slots[i].hash = hash;
+  _slots[i].node = node;
+  _count++;
+}
+
+void
+SGPropertyNode::child_index::erase (SGPropertyNode * node)
+{
+  if (_slots == 0)
+    return;
+  unsigned int hash = hashcode(node->getName(), node->getIndex());
+  unsigned int i = hash & _mask;
+  while (_slots[i].node != node) {
+    if (_slots[i].node == 0)
+      return;
+    i = (i + 1) & _mask;
+  }
+				// Shift later members of the probe
+				// run back so no tombstones are needed.
+  unsigned int j = i;
+  for (;;) {
+    _slots[i].node = 0;
+    unsigned int k;
+    do {
+      j = (j + 1) & _mask;
+      if (_slots[j].node == 0) {
+        _count--;
+        return;
+      }
+      k = _slots[j].hash & _mask;
+    } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+    _slots[i] = _slots[j];
+    i = j;
+  }
+}
+
+void
+SGPropertyNode::child_index::grow ()
+{
+  unsigned int old_length = (_slots ? _mask + 1 : 0);
+  unsigned int length = (old_length ? 2 * old_length : CHILD_INDEX_MIN_SLOTS);
+  slot * old_slots = _slots;
+
+  _slots = new slot[length];
+  _mask = length - 1;
+  for (unsigned int i = 0; i < length; i++)
+    _slots[i].node = 0;
+
+  for (unsigned int i = 0; i < old_length; i++) {
+    if (old_slots[i].node == 0)
+      continue;
+    unsigned int j = old_slots[i].hash & _mask;
+    while (_slots[j].node != 0)
+      j = (j + 1) & _mask;
+    _slots[j] = old_slots[i];
+  }
+  delete [] old_slots;
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////
 // Implementation of SGPropertyChangeListener.
 ////////////////////////////////////////////////////////////////////////
 
+				// Batched listeners with changes
+				// waiting for fireBatchedChanges().
+				// There is one list for the process,
+				// not one per tree, so batching is
+				// for the main loop's thread only:
+				// the first thread to use the list
+				// owns it.
+static vector<SGPropertyChangeListener *> pending_listeners;
+static pthread_t pending_thread;
+static bool pending_thread_known = false;
+
+static void
+check_pending_thread ()
+{
+  if (!pending_thread_known) {
+    pending_thread = pthread_self();
+    pending_thread_known = true;
+  }
+  assert(pthread_equal(pending_thread, pthread_self()));
+}
+
+SGPropertyChangeListener::SGPropertyChangeListener (bool batched)
+  : _batched(batched)
+{
+}
+
 SGPropertyChangeListener::~SGPropertyChangeListener ()
 {
-				// This will come back and remove
-				// the current item each time.  Is
-				// that OK?
-  vector<SGPropertyNode *>::iterator it;
-  for (it = _properties.begin(); it != _properties.end(); it++)
-    (*it)->removeChangeListener(this);
+				// removeChangeListener() comes back
+				// and erases the entry each time.
+  while (!_properties.empty())
+    _properties.back()->removeChangeListener(this);
+
+  if (!_pending.empty()) {
+    check_pending_thread();
+    vector<SGPropertyChangeListener *>::iterator it =
+      find(pending_listeners.begin(), pending_listeners.end(), this);
+    if (it != pending_listeners.end())
+      pending_listeners.erase(it);
+  }
 }
 
 void
@@ -2297,6 +3589,41 @@ SGPropertyChangeListener::valueChanged (SGPropertyNode * node)
   // NO-OP
 }
 
+void
+SGPropertyChangeListener::valuesChanged (const vector<SGPropertyNode *> &nodes)
+{
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    valueChanged(nodes[i]);
+}
+
+void
+SGPropertyChangeListener::queue_change (SGPropertyNode * node)
+{
+  check_pending_thread();
+  if (_pending.empty())
+    pending_listeners.push_back(this);
+  _pending.push_back(node);
+}
+
+void
+SGPropertyChangeListener::fireBatchedChanges ()
+{
+  check_pending_thread();
+  vector<SGPropertyChangeListener *> listeners;
+  listeners.swap(pending_listeners);
+
+  vector<SGPropertyNode *> nodes;
+  for (unsigned int i = 0; i < listeners.size(); i++) {
+    nodes.clear();
+    nodes.swap(listeners[i]->_pending);
+				// One entry per node however often
+				// it was written this frame.
+    sort(nodes.begin(), nodes.end());
+    nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+    listeners[i]->valuesChanged(nodes);
+  }
+}
+
 void
 SGPropertyChangeListener::childAdded (SGPropertyNode * node,
 				      SGPropertyNode * child)
@@ -45,6 +45,7 @@ SG_USING_STD(ostream);
 
 #include "util/SGReferenced.hxx"
 #include "util/SGSharedPtr.hxx"
+#include "util/sg_atomic.hxx"
 
 
 #ifdef NONE
@@ -453,6 +454,52 @@ private:
 };
 
 
+/**
+ * An interned property name.
+ *
+ * <p>Every distinct node name is stored once in a global table and
+ * nodes keep a pointer into it, so names compare by pointer.  Code
+ * that looks up the same child over and over can intern the name
+ * once and pass the SGPropertyName to getChild() to skip the string
+ * hashing.  The table is never shrunk.  Any thread may intern names:
+ * lookups take no lock, and additions are serialized.</p>
+ */
+class SGPropertyName
+{
+public:
+  SGPropertyName () : _atom(0) {}
+  SGPropertyName (const char * name) : _atom(intern(name)) {}
+  SGPropertyName (const string &name) : _atom(intern(name.c_str())) {}
+
+  const char * c_str () const { return _atom; }
+  bool operator== (const SGPropertyName &name) const {
+    return _atom == name._atom;
+  }
+  bool operator!= (const SGPropertyName &name) const {
+    return _atom != name._atom;
+  }
+
+  /**
+   * Return the interned copy of a name, adding it if needed.
+   */
+  static const char * intern (const char * name);
+
+  /**
+   * Return the interned copy of a name, or 0 if no node has ever
+   * used it.
+   */
+  static const char * find (const char * name);
+
+  /**
+   * The number of distinct names interned so far.
+   */
+  static unsigned int count ();
+
+private:
+  const char * _atom;
+};
+
+
 /**
  * The smart pointer that manage reference counting
  */
@@ -466,22 +513,48 @@ typedef SGSharedPtr<const SGPropertyNode> SGConstPropertyNode_ptr;
  *
  * <p>Any class that needs to listen for property changes must implement
  * this interface.</p>
+ *
+ * <p>A batched listener is not called on each write.  The nodes that
+ * changed are collected instead and handed to valuesChanged() once,
+ * without duplicates, when fireBatchedChanges() runs at the end of
+ * the frame.  Child added and removed events are always immediate.
+ * Nodes must stay alive until the batch is delivered.  The batch is
+ * kept for the whole process, so batched listeners, and the trees
+ * they watch, belong to one thread (the main loop's).</p>
  */
 class SGPropertyChangeListener
 {
 public:
+  SGPropertyChangeListener (bool batched = false);
   virtual ~SGPropertyChangeListener ();
   virtual void valueChanged (SGPropertyNode * node);
   virtual void childAdded (SGPropertyNode * parent, SGPropertyNode * child);
   virtual void childRemoved (SGPropertyNode * parent, SGPropertyNode * child);
 
+  /**
+   * Receive a frame's worth of changes; by default calls
+   * valueChanged() for each node.
+   */
+  virtual void valuesChanged (const vector<SGPropertyNode *> &nodes);
+
+  bool isBatched () const { return _batched; }
+
+  /**
+   * Deliver the changes queued for all batched listeners.
+   */
+  static void fireBatchedChanges ();
+
 protected:
   friend class SGPropertyNode;
   virtual void register_property (SGPropertyNode * node);
   virtual void unregister_property (SGPropertyNode * node);
 
 private:
+  void queue_change (SGPropertyNode * node);
+
+  bool _batched;
   vector<SGPropertyNode *> _properties;
+  vector<SGPropertyNode *> _pending;
 };
 
 
@@ -558,6 +631,14 @@ public:
   virtual ~SGPropertyNode ();
 
 
+  /**
+   * Heap nodes come from a pool of fixed-size slots rather than one
+   * allocation each.
+   */
+  static void * operator new (size_t size);
+  static void operator delete (void * p, size_t size);
+
+
 
   //
   // Basic properties.
@@ -572,7 +653,7 @@ public:
   /**
    * Get the node's simple (XML) name.
    */
-  const char * getName () const { return _name.c_str(); }
+  const char * getName () const { return _name; }
 
 
   /**
@@ -644,6 +725,20 @@ public:
   const SGPropertyNode * getChild (const char * name, int index = 0) const;
 
 
+  /**
+   * Get a child node by interned name and index.
+   */
+  SGPropertyNode * getChild (const SGPropertyName &name, int index = 0,
+			     bool create = false);
+
+
+  /**
+   * Get a const child node by interned name and index.
+   */
+  const SGPropertyNode * getChild (const SGPropertyName &name,
+				   int index = 0) const;
+
+
   /**
    * Get a vector of all children with the specified name.
    */
@@ -783,7 +878,8 @@ public:
    * Set a single mode attribute for the property node.
    */
   void setAttribute (Attribute attr, bool state) {
-    (state ? _attr |= attr : _attr &= ~attr);
+    int attrs = (state ? _attr | attr : _attr & ~attr);
+    sg_store(&_attr, attrs, SG_RELAXED);  // snapshots read it
   }
 
 
@@ -796,7 +892,7 @@ public:
   /**
    * Set all of the mode attributes for the property node.
    */
-  void setAttributes (int attr) { _attr = attr; }
+  void setAttributes (int attr) { sg_store(&_attr, attr, SG_RELAXED); }
   
 
   //
@@ -1136,6 +1232,16 @@ public:
   void clearValue ();
 
 
+  /**
+   * Bracket a group of writes to this node's tree, such as one
+   * frame's worth, so that a snapshot taken on another thread sees
+   * all of them or none of them.  Calls may nest.  Only the thread
+   * that writes the tree may call these.
+   */
+  void beginUpdate ();
+  void endUpdate ();
+
+
 protected:
 
   void fireValueChanged (SGPropertyNode * node);
@@ -1150,6 +1256,11 @@ protected:
 
 private:
 
+  class hash_table;
+  class child_index;
+  class structure_guard;
+  struct tree_state;
+
 				// Get the raw value
   bool get_bool () const;
   int get_int () const;
@@ -1185,22 +1296,152 @@ private:
   void trace_write () const;
 
 
-  class hash_table;
+  /**
+   * Clear the value.  Memory a snapshot reader may still be using
+   * is handed to tree to free later, or freed at once if tree is 0.
+   */
+  void clear_value (tree_state * tree);
+
+
+  /**
+   * Locate a child by interned name and index, through the child
+   * index when the node has one.
+   */
+  SGPropertyNode * find_child_node (const char * atom, int index) const;
+
+
+  /**
+   * Locate the position of a child by interned name and index.
+   */
+  int find_child_pos (const char * atom, int index) const;
+
+
+  /**
+   * Append a new child and keep the child index up to date.
+   */
+  void add_child (SGPropertyNode * node);
+
+
+  /**
+   * Add delta to the listener count of this node and everything
+   * below it.
+   */
+  void adjust_listened (int delta);
+
+
+				// Reader side of the write sequence,
+				// for snapshots (see tree_state).
+  friend class SGPropertySnapshot;
+  union value_copy {
+    bool bool_val;
+    long long_val;
+    double double_val;
+  };
+  static tree_state * read_lock (const SGPropertyNode * node, int &slot);
+  static void read_unlock (tree_state * tree, int slot);
+  static unsigned int read_begin (const tree_state * tree);
+  static bool read_retry (const tree_state * tree, unsigned int sequence);
+  static unsigned int structure_generation (const tree_state * tree);
+  const SGPropertyNode * read_target (const tree_state * tree,
+				      unsigned int sequence) const;
+  bool read_type (const tree_state * tree, unsigned int sequence,
+		  Type &type) const;
+  bool read_value (const tree_state * tree, unsigned int sequence,
+		   Type type, value_copy &value, string &text) const;
+  void read_children (vector<const SGPropertyNode *> &children) const;
+
+				// Node numbers for the write journal.
+  friend class SGPropertyJournal;
+
+				// Direct reads for typed handles.
+  template <class T> friend class SGTypedProperty;
+
+
+
+  /**
+   * Child nodes, each holding a reference, kept in one block with
+   * the count in front.  A leaf pays for a single pointer.
+   */
+  class child_list
+  {
+  public:
+    child_list () : _block(0) {}
+    ~child_list ();
+    int size () const { return (_block ? _block->size : 0); }
+    SGPropertyNode * operator[] (int i) const { return _block->nodes[i]; }
+				// A block that has to grow is handed
+				// to tree to free once no reader can
+				// be in it, or freed at once if 0.
+    void push_back (SGPropertyNode * node, tree_state * tree = 0);
+    SGPropertyNode_ptr erase (int pos);
+    int find (const char * atom, int index) const;
+				// Copy the list on a reader thread.
+    void copy_to (vector<const SGPropertyNode *> &nodes) const;
+  private:
+    child_list (const child_list &);
+    child_list &operator= (const child_list &);
+    struct block {
+      int size;
+      int capacity;
+      SGPropertyNode * nodes[1];
+    };
+    block * _block;
+  };
+
+
+  /**
+   * The parts of a node most never use, allocated on first need.
+   */
+  struct extras
+  {
+    extras ();
+    ~extras ();
+    child_list removed_children;
+    hash_table * path_cache;
+    SGAtomic<tree_state *> tree;  // on the root, see get_tree()
+    string display_name;
+    string path;
+    string buffer;
+  };
+
+  extras * get_extras () const;
+
+
+  /**
+   * The state of the tree this node belongs to, held by the root
+   * and remembered by each node that asks.
+   */
+  tree_state * get_tree () const {
+    tree_state * tree = _tree.load(SG_ACQUIRE);
+    return (tree != 0 ? tree : find_tree());
+  }
+  tree_state * find_tree () const;
+  void forget_tree ();
+
+
+  /**
+   * Which tree this node is in and how many removals it has seen;
+   * a path cache is good while both stay the same.
+   */
+  friend class SGPropertyPath;
+  void removal_stamp (unsigned int &tree, unsigned int &generation) const;
+
 
   int _index;
-  string _name;
-  mutable string _display_name;
+  const char * _name;           // interned, see SGPropertyName
   /// To avoid cyclic reference counting loops this shall not be a reference
   /// counted pointer
   SGPropertyNode * _parent;
-  vector<SGPropertyNode_ptr> _children;
-  vector<SGPropertyNode_ptr> _removedChildren;
-  mutable string _path;
-  mutable string _buffer;
-  hash_table * _path_cache;
+  child_list _children;
+  child_index * _child_index;
+  mutable SGAtomic<extras *> _extras;  // see get_extras()
+  mutable SGAtomic<tree_state *> _tree;  // see get_tree()
   Type _type;
   bool _tied;
+  unsigned int _journal_id;     // journal serial and node number,
+                                // see SGPropertyJournal
   int _attr;
+  int _listened;                // listeners on this node and its ancestors
 
 				// The right kind of pointer...
   union {
@@ -1245,7 +1486,7 @@ private:
       void set_value (SGPropertyNode * value);
     private:
       string _key;
-      SGSharedPtr<SGPropertyNode>  _value;
+      SGPropertyNode * _value;
     };
 
 
@@ -1265,20 +1506,122 @@ private:
 
     friend class bucket;
 
-    hash_table ();
+    hash_table (unsigned int tree, unsigned int generation);
     ~hash_table ();
     SGPropertyNode * get (const char * key);
     void put (const char * key, SGPropertyNode * value);
     void erase(const char * key);
 
+    /**
+     * True once a node has been removed from the tree since this
+     * table was created (see removal_stamp()); any cached path may
+     * then be stale.
+     */
+    bool is_stale (unsigned int tree, unsigned int generation) const;
+
   private:
     unsigned int hashcode (const char * key);
     unsigned int _data_length;
     bucket ** _data;
+    unsigned int _tree;
+    unsigned int _generation;
+  };
+
+
+  /**
+   * An open addressing (name, index) index over the children of a
+   * node, built once the node has more than a handful of children so
+   * that lookups cost the same regardless of fan-out.  The table
+   * does not own the nodes; _children keeps them alive.
+   */
+  class child_index {
+  public:
+
+    child_index ();
+    ~child_index ();
+    SGPropertyNode * get (const char * atom, int index) const;
+    void put (SGPropertyNode * node);
+    void erase (SGPropertyNode * node);
+
+    static unsigned int hashcode (const char * atom, int index);
+
+  private:
+    struct slot {
+      unsigned int hash;
+      SGPropertyNode * node;
+    };
+
+    void grow ();
+
+    unsigned int _count;
+    unsigned int _mask;
+    slot * _slots;
+  };
+
+};
+
+
+/**
+ * A property path parsed once and resolved against a start node.
+ *
+ * <p>The path is split into interned (name, index) components when
+ * it is set, and the node it resolves to is cached.  Later calls to
+ * resolve() return the cached node until any node is removed or
+ * destroyed, so a lookup at runtime costs one comparison and no
+ * allocation.  Paths that did not resolve are walked again on each
+ * call, which is still allocation free.</p>
+ *
+ * <pre>
+ * static SGPropertyPath target_alt("/autopilot/settings/target-altitude-ft");
+ * fgGetNode(target_alt, true)->setDoubleValue(alt);
+ * </pre>
+ */
+class SGPropertyPath
+{
+public:
+
+  SGPropertyPath ();
+  SGPropertyPath (const char * path);
+
+
+  /**
+   * Parse a new path; throws a string if the path is malformed.
+   */
+  void set (const char * path);
+
+
+  /**
+   * Get the path as it was given.
+   */
+  const char * getPath () const { return _path.c_str(); }
+
+
+  /**
+   * Find the node the path names relative to start, optionally
+   * creating it.
+   */
+  SGPropertyNode * resolve (SGPropertyNode * start, bool create = false);
+
+private:
+
+  struct component {
+    SGPropertyName name;
+    int index;                  // ROOT or PARENT for those components
   };
 
+  enum { ROOT = -1, PARENT = -2 };
+
+  SGPropertyNode * walk (SGPropertyNode * start, bool create) const;
+
+  string _path;
+  vector<component> _components;
+  SGPropertyNode * _start;
+  SGPropertyNode * _node;
+  unsigned int _tree;
+  unsigned int _generation;
 };
 
+
 // global property structure
 extern SGPropertyNode *props;
 
@@ -1293,6 +1636,11 @@ inline SGPropertyNode *fgGetNode (const char *path, int index, bool create = fal
   return props->getNode(path, index, create);
 }
 
+inline SGPropertyNode *fgGetNode (SGPropertyPath &path, bool create = false)
+{
+  return path.resolve(props, create);
+}
+
 #endif // __PROPS_HXX
 
 // end of props.hxx
@@ -0,0 +1,620 @@
+////////////////////////////////////////////////////////////////////////
+// Property tree lookup benchmark.
+//
+// Loads a config, autopilot and route file into one tree the way
+// ugear does at startup, reporting load time and heap bytes per node,
+// and times node lookups over it, then times
+// child lookups against a single node with growing fan-out, value
+// writes on deep trees with and without change listeners, and XML
+// against binary save and restore of the tree, and the cost of
+// journaling writes, replaying the journal to check it.  Last, a
+// writer thread updates a subtree frame by frame while reader threads
+// snapshot it, checking every snapshot for torn frames and timing
+// how much the readers cost the writer.
+//
+// usage: props_bench [config.xml [autopilot.xml [route.xml]]]
+////////////////////////////////////////////////////////////////////////
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <util/exception.hxx>
+
+#include "props.hxx"
+#include "props_binary.hxx"
+#include "props_io.hxx"
+#include "props_journal.hxx"
+#include "props_snapshot.hxx"
+
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+
+struct lookup_path {
+  string path;
+  SGPropertyPath handle;
+  vector<string> names;
+  vector<SGPropertyName> atoms;
+  vector<int> indices;
+};
+
+
+static double
+get_time ()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void
+load (const char * file, SGPropertyNode * node)
+{
+  try {
+    readProperties(file, node);
+    printf("loaded %s\n", file);
+  } catch (const sg_exception &exc) {
+    printf("cannot load %s: %s\n", file, exc.getMessage().c_str());
+  }
+}
+
+
+static int
+count_nodes (SGPropertyNode * node)
+{
+  int count = 1;
+  for (int i = 0; i < node->nChildren(); i++)
+    count += count_nodes(node->getChild(i));
+  return count;
+}
+
+
+// Record the (name, index) chain from the root for every node.
+static void
+collect (SGPropertyNode * node, vector<lookup_path> &paths)
+{
+  for (int i = 0; i < node->nChildren(); i++) {
+    SGPropertyNode * child = node->getChild(i);
+    lookup_path p;
+    p.path = child->getPath();
+    p.handle.set(p.path.c_str());
+    for (SGPropertyNode * n = child; n->getParent() != 0; n = n->getParent()) {
+      p.names.insert(p.names.begin(), n->getName());
+      p.atoms.insert(p.atoms.begin(), SGPropertyName(n->getName()));
+      p.indices.insert(p.indices.begin(), n->getIndex());
+    }
+    paths.push_back(p);
+    collect(child, paths);
+  }
+}
+
+
+static int
+walk (SGPropertyNode * root, const lookup_path &p)
+{
+  SGPropertyNode * node = root;
+  for (unsigned int i = 0; i < p.names.size() && node != 0; i++)
+    node = node->getChild(p.names[i].c_str(), p.indices[i]);
+  return node != 0;
+}
+
+
+static int
+walk_interned (SGPropertyNode * root, const lookup_path &p)
+{
+  SGPropertyNode * node = root;
+  for (unsigned int i = 0; i < p.atoms.size() && node != 0; i++)
+    node = node->getChild(p.atoms[i], p.indices[i]);
+  return node != 0;
+}
+
+
+static void
+bench_tree (SGPropertyNode * root)
+{
+  vector<lookup_path> paths;
+  collect(root, paths);
+
+  unsigned int components = 0;
+  unsigned int max_fanout = 0;
+  for (unsigned int i = 0; i < paths.size(); i++) {
+    components += paths[i].names.size();
+    SGPropertyNode * node = root->getNode(paths[i].path.c_str());
+    if ((unsigned int)node->nChildren() > max_fanout)
+      max_fanout = node->nChildren();
+  }
+  printf("tree: %u nodes, %u path components, widest node %u children\n",
+         (unsigned int)paths.size(), components, max_fanout);
+  printf("  %u distinct names\n", SGPropertyName::count());
+
+  const int reps = 200;
+  int found = 0;
+  double start = get_time();
+  for (int r = 0; r < reps; r++)
+    for (unsigned int i = 0; i < paths.size(); i++)
+      found += walk(root, paths[i]);
+  double elapsed = get_time() - start;
+  printf("  getChild walk:     %7.1f ns/component\n",
+         elapsed * 1e9 / ((double)reps * components));
+
+  start = get_time();
+  for (int r = 0; r < reps; r++)
+    for (unsigned int i = 0; i < paths.size(); i++)
+      found += walk_interned(root, paths[i]);
+  elapsed = get_time() - start;
+  printf("  interned walk:     %7.1f ns/component\n",
+         elapsed * 1e9 / ((double)reps * components));
+
+  start = get_time();
+  for (int r = 0; r < reps; r++)
+    for (unsigned int i = 0; i < paths.size(); i++)
+      found += (root->getNode(paths[i].path.c_str()) != 0);
+  elapsed = get_time() - start;
+  printf("  cached getNode:    %7.1f ns/path\n",
+         elapsed * 1e9 / ((double)reps * paths.size()));
+
+  start = get_time();
+  for (int r = 0; r < reps; r++)
+    for (unsigned int i = 0; i < paths.size(); i++)
+      found += (paths[i].handle.resolve(root) != 0);
+  elapsed = get_time() - start;
+  printf("  SGPropertyPath:    %7.1f ns/path\n",
+         elapsed * 1e9 / ((double)reps * paths.size()));
+
+  int expected = 4 * reps * (int)paths.size();
+  if (found != expected)
+    printf("  ERROR: %d of %d lookups failed\n", expected - found, expected);
+}
+
+
+static void
+bench_fanout (int count)
+{
+  SGPropertyNode root;
+  SGPropertyNode * parent = root.getNode("/route", true);
+  char name[32];
+
+  // route style: many indexed wpt children plus a few distinct names
+  for (int i = 0; i < count; i++)
+    parent->getChild("wpt", i, true);
+  for (int i = 0; i < count / 4; i++) {
+    snprintf(name, sizeof(name), "setting-%d", i);
+    parent->getChild(name, 0, true);
+  }
+
+  const int lookups = 1000000;
+  int found = 0;
+  double start = get_time();
+  for (int i = 0; i < lookups; i++)
+    found += (parent->getChild("wpt", i % count) != 0);
+  double elapsed = get_time() - start;
+
+  // remove and re-add the tail to exercise the index maintenance
+  for (int i = count / 2; i < count; i++)
+    parent->removeChild("wpt", i, false);
+  for (int i = count / 2; i < count; i++)
+    parent->getChild("wpt", i, true);
+  for (int i = 0; i < count; i++)
+    found -= (parent->getChild("wpt", i) != 0);
+
+  printf("  %5d children: %7.1f ns/lookup%s\n", parent->nChildren(),
+         elapsed * 1e9 / lookups,
+         found == lookups - count ? "" : "  ERROR: lookup mismatch");
+}
+
+
+class count_listener : public SGPropertyChangeListener {
+public:
+  count_listener (bool batched) :
+    SGPropertyChangeListener(batched), calls(0), changes(0) {}
+  virtual void valueChanged (SGPropertyNode * node) { calls++; changes++; }
+  virtual void valuesChanged (const vector<SGPropertyNode *> &nodes) {
+    calls++;
+    changes += nodes.size();
+  }
+  long calls;
+  long changes;
+};
+
+
+static double
+time_sets (SGPropertyNode * leaves[], int nleaves, int sets)
+{
+  const int per_frame = 50;
+  double start = get_time();
+  for (int i = 0; i < sets; i++) {
+    leaves[i % nleaves]->setDoubleValue(i);
+    if (i % per_frame == per_frame - 1)
+      SGPropertyChangeListener::fireBatchedChanges();
+  }
+  SGPropertyChangeListener::fireBatchedChanges();
+  return (get_time() - start) * 1e9 / sets;
+}
+
+
+static void
+bench_listeners (int depth)
+{
+  SGPropertyNode root;
+  string path;
+  for (int i = 0; i < depth - 1; i++)
+    path += "/level";
+  SGPropertyNode * parent = root.getNode(path.c_str(), true);
+  SGPropertyNode * leaves[10];
+  for (int i = 0; i < 10; i++)
+    leaves[i] = parent->getChild("value", i, true);
+  SGPropertyNode * other = root.getNode("/other/branch", true);
+
+  const int sets = 1000000;
+  double none = time_sets(leaves, 10, sets);
+
+  count_listener elsewhere(false);
+  other->addChangeListener(&elsewhere);
+  double unrelated = time_sets(leaves, 10, sets);
+  other->removeChangeListener(&elsewhere);
+
+  count_listener immediate(false);
+  root.addChangeListener(&immediate);
+  double at_root = time_sets(leaves, 10, sets);
+  root.removeChangeListener(&immediate);
+
+  count_listener batched(true);
+  root.addChangeListener(&batched);
+  double batch = time_sets(leaves, 10, sets);
+  root.removeChangeListener(&batched);
+
+  printf("  depth %2d: %6.1f none %6.1f unrelated %6.1f root %6.1f batched"
+         " ns/set (%ld calls for %ld changes)%s\n",
+         depth, none, unrelated, at_root, batch, batched.calls,
+         batched.changes,
+         elsewhere.calls == 0 && immediate.calls == sets ? ""
+         : "  ERROR: wrong listener calls");
+}
+
+
+static string
+to_xml (const SGPropertyNode * node)
+{
+  ostringstream out;
+  writeProperties(out, node, true);
+  return out.str();
+}
+
+
+static void
+bench_binary (SGPropertyNode * root)
+{
+  const int reps = 200;
+  string xml;
+  double start = get_time();
+  for (int r = 0; r < reps; r++) {
+    xml = to_xml(root);
+    SGPropertyNode copy;
+    readProperties(xml.data(), xml.size(), &copy);
+  }
+  double xml_us = (get_time() - start) * 1e6 / reps;
+
+  string bin;
+  start = get_time();
+  for (int r = 0; r < reps; r++) {
+    bin.clear();
+    writeBinaryProperties(bin, root);
+    SGPropertyNode copy;
+    readBinaryProperties(bin.data(), bin.size(), &copy);
+  }
+  double bin_us = (get_time() - start) * 1e6 / reps;
+
+  SGPropertyNode copy;
+  readBinaryProperties(bin.data(), bin.size(), &copy);
+  bool same = (to_xml(&copy) == xml);
+
+				// One value changes between two
+				// sends, then one node goes away.
+  SGPropertyNode * target = root->getNode("/autopilot/settings/target-altitude-ft", true);
+  target->setDoubleValue(target->getDoubleValue() + 100.0);
+  string delta;
+  start = get_time();
+  for (int r = 0; r < reps; r++) {
+    delta.clear();
+    writeBinaryProperties(delta, root, &copy);
+  }
+  double delta_us = (get_time() - start) * 1e6 / reps;
+  readBinaryProperties(delta.data(), delta.size(), &copy);
+  same = same && (to_xml(&copy) == to_xml(root));
+
+  root->getNode("/route")->removeChild("wpt", 0, false);
+  string removal;
+  writeBinaryProperties(removal, root, &copy);
+  readBinaryProperties(removal.data(), removal.size(), &copy);
+  same = same && (to_xml(&copy) == to_xml(root));
+
+  printf("  xml:    %6u bytes %8.1f us write+read\n",
+	 (unsigned int)xml.size(), xml_us);
+  printf("  binary: %6u bytes %8.1f us write+read\n",
+	 (unsigned int)bin.size(), bin_us);
+  printf("  delta:  %6u bytes %8.1f us write (one value),"
+	 " %u bytes (one removal)%s\n", (unsigned int)delta.size(), delta_us,
+	 (unsigned int)removal.size(), same ? "" : "  ERROR: copies differ");
+}
+
+
+static double
+time_frames (SGPropertyNode * leaves[], int nleaves, int frames,
+	     SGPropertyJournal * journal)
+{
+  double start = get_time();
+  for (int f = 1; f <= frames; f++) {
+    if (journal)
+      journal->frame(f * 0.02);
+    for (int i = 0; i < nleaves; i++)
+      leaves[i]->setDoubleValue(f * 100.0 + i);
+  }
+  return (get_time() - start) * 1e9 / (frames * nleaves);
+}
+
+
+static void
+bench_journal (SGPropertyNode * root)
+{
+  const char * file = "props_bench.jnl.gz";
+  const int nleaves = 100;
+  const int frames = 2000;
+  const int check_frame = 1234;
+
+  SGPropertyNode * internal = root->getNode("/autopilot/internal", true);
+  SGPropertyNode * leaves[nleaves];
+  for (int i = 0; i < nleaves; i++)
+    leaves[i] = internal->getChild("value", i, true);
+
+  double off = time_frames(leaves, nleaves, frames, 0);
+
+  SGPropertyJournal journal(frames * nleaves + frames + 16384);
+  double start = get_time();
+  journal.open(file, root);
+  double open_ms = (get_time() - start) * 1000.0;
+  double on = time_frames(leaves, nleaves, frames, &journal);
+  journal.close();
+
+				// Replay to a frame in the middle,
+				// then to the end.
+  SGPropertyJournalReader reader;
+  SGPropertyNode_ptr copy = new SGPropertyNode;
+  reader.open(file);
+  while (reader.getFrame() < (unsigned int)check_frame && reader.next(copy))
+    ;
+  bool same = true;
+  for (int i = 0; i < nleaves; i++)
+    same = same && copy->getNode("/autopilot/internal")->getChild("value", i)
+      ->getDoubleValue() == check_frame * 100.0 + i;
+  start = get_time();
+  while (reader.next(copy))
+    ;
+  double replay_ms = (get_time() - start) * 1000.0;
+  same = same && reader.getFrame() == (unsigned int)frames
+    && to_xml(copy) == to_xml(root);
+
+  FILE * fp = fopen(file, "rb");
+  long bytes = 0;
+  if (fp) {
+    fseek(fp, 0, SEEK_END);
+    bytes = ftell(fp);
+    fclose(fp);
+  }
+  remove(file);
+
+  printf("  %6.1f ns/set off %6.1f ns/set journaled, %lu recorded"
+	 " %lu dropped\n", off, on, journal.getRecorded(),
+	 journal.getDropped());
+  printf("  open %.2f ms, %ld bytes on disk (%.1f per write),"
+	 " replay %.2f ms%s\n", open_ms, bytes,
+	 (double)bytes / (frames * nleaves), replay_ms,
+	 same ? "" : "  ERROR: replay differs");
+}
+
+
+#define STRESS_VALUES 16
+#define STRESS_FRAMES 200000
+#define MAX_READERS 4
+
+struct stress_writer {
+  SGPropertyNode * root;
+  SGAtomic<bool> done;
+  double ns_per_set;
+};
+
+struct stress_reader {
+  stress_writer * writer;
+  long snapshots;
+  long retries;
+  long failed;
+  long torn;
+};
+
+
+static double
+get_thread_time ()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+// Each frame sets value[i] = frame + i and the frame counter as one
+// update; every 64th frame also rewrites the label string and adds
+// or removes a child, so readers race structural changes too.
+static void *
+stress_write (void * arg)
+{
+  stress_writer * w = (stress_writer *)arg;
+  SGPropertyNode * values[STRESS_VALUES];
+  for (int i = 0; i < STRESS_VALUES; i++)
+    values[i] = w->root->getChild("value", i, true);
+  SGPropertyNode * frame_node = w->root->getChild("frame", 0, true);
+  SGPropertyNode * label = w->root->getChild("label", 0, true);
+  char buf[32];
+
+  double start = get_thread_time();
+  for (long frame = 1; frame <= STRESS_FRAMES; frame++) {
+    w->root->beginUpdate();
+    for (int i = 0; i < STRESS_VALUES; i++)
+      values[i]->setDoubleValue(frame + i);
+    frame_node->setLongValue(frame);
+    if (frame % 64 == 0) {
+      snprintf(buf, sizeof(buf), "frame-%ld", frame);
+      label->setStringValue(buf);
+      if (frame % 128 == 0)
+	w->root->getChild("scratch", 0, true)->setIntValue(1);
+      else
+	w->root->removeChild("scratch", 0, false);
+    }
+    w->root->endUpdate();
+  }
+  w->ns_per_set = (get_thread_time() - start) * 1e9
+    / ((double)STRESS_FRAMES * (STRESS_VALUES + 1));
+  w->done = true;
+  return 0;
+}
+
+
+static bool
+consistent (const SGPropertySnapshot &snap)
+{
+  long frame = snap.getLongValue("frame");
+  if (frame == 0)
+    return true;		// writer has not started yet
+  char buf[32];
+  for (int i = 0; i < STRESS_VALUES; i++) {
+    snprintf(buf, sizeof(buf), "value[%d]", i);
+    if (snap.getDoubleValue(buf) != frame + i)
+      return false;
+  }
+				// Label and scratch change every
+				// 64 frames and lag the counter.
+  long labelled = frame - frame % 64;
+  if (labelled > 0) {
+    snprintf(buf, sizeof(buf), "frame-%ld", labelled);
+    if (strcmp(snap.getStringValue("label"), buf) != 0)
+      return false;
+    bool scratch = (snap.find("scratch") >= 0);
+    if (scratch != (labelled % 128 == 0))
+      return false;
+  }
+  return true;
+}
+
+
+static void *
+stress_read (void * arg)
+{
+  stress_reader * r = (stress_reader *)arg;
+  SGPropertySnapshot snap;
+  while (!r->writer->done) {
+    if (!snap.take(r->writer->root, 100)) {
+      r->failed++;
+      continue;
+    }
+    r->snapshots++;
+    r->retries += snap.getRetries();
+    if (!consistent(snap))
+      r->torn++;
+  }
+  return 0;
+}
+
+
+static bool
+bench_snapshots (int nreaders)
+{
+  SGPropertyNode root;
+  stress_writer w;
+  w.root = root.getNode("/stress", true);
+  w.done = false;
+  w.root->getChild("frame", 0, true)->setLongValue(0);
+
+  stress_reader readers[MAX_READERS];
+  pthread_t threads[MAX_READERS];
+  for (int i = 0; i < nreaders; i++) {
+    readers[i].writer = &w;
+    readers[i].snapshots = readers[i].retries = 0;
+    readers[i].failed = readers[i].torn = 0;
+    pthread_create(&threads[i], 0, stress_read, &readers[i]);
+  }
+  pthread_t writer;
+  pthread_create(&writer, 0, stress_write, &w);
+  pthread_join(writer, 0);
+
+  long snapshots = 0, retries = 0, failed = 0, torn = 0;
+  for (int i = 0; i < nreaders; i++) {
+    pthread_join(threads[i], 0);
+    snapshots += readers[i].snapshots;
+    retries += readers[i].retries;
+    failed += readers[i].failed;
+    torn += readers[i].torn;
+  }
+
+  printf("  %d readers: %6.1f writer ns/set, %ld snapshots, %.2f retries"
+	 " each, %ld given up%s\n", nreaders, w.ns_per_set, snapshots,
+	 snapshots ? (double)retries / snapshots : 0.0, failed,
+	 torn ? "  ERROR: torn snapshots" : "");
+  return torn == 0;
+}
+
+
+int
+main (int argc, char ** argv)
+{
+  const char * config = argc > 1 ? argv[1] : "../../data/config-gumstix.xml";
+  const char * autopilot =
+    argc > 2 ? argv[2] : "../../data/autopilots/Rascal110-combined.xml";
+  const char * route = argc > 3 ? argv[3] : "../../data/routes/SPRC-bowtie.xml";
+
+  struct mallinfo heap_before = mallinfo();
+  double start = get_time();
+  props = new SGPropertyNode;
+  load(config, props);
+  load(autopilot, fgGetNode("/autopilot/new-config", true));
+  load(route, fgGetNode("/route[0]", true));
+  double elapsed = get_time() - start;
+  struct mallinfo heap_after = mallinfo();
+
+  int nodes = count_nodes(props);
+  printf("load: %d nodes in %.2f ms, %.1f heap bytes per node"
+	 " (%u in the node itself)\n", nodes, elapsed * 1000.0,
+	 (double)(heap_after.uordblks - heap_before.uordblks) / nodes,
+	 (unsigned int)sizeof(SGPropertyNode));
+
+  bench_tree(props);
+
+  printf("fan-out:\n");
+  for (int count = 4; count <= 4096; count *= 4)
+    bench_fanout(count);
+
+  printf("value writes:\n");
+  for (int depth = 2; depth <= 32; depth *= 2)
+    bench_listeners(depth);
+
+  printf("save and restore:\n");
+  bench_binary(props);
+
+  printf("journal:\n");
+  bench_journal(props);
+
+  printf("snapshots:\n");
+  bool ok = bench_snapshots(0);
+  for (int nreaders = 1; nreaders <= MAX_READERS; nreaders *= 2)
+    ok = bench_snapshots(nreaders) && ok;
+
+  return ok ? 0 : 1;
+}
+
+// end of props_bench.cxx
@@ -0,0 +1,537 @@
+// props_binary.cxx - compact binary encoding of property subtrees.
+//
+// A message is the magic "SGPB" and a version byte followed by the
+// start node's record:
+//
+//   record   = tag [name index] [attributes] [value] {record} END
+//   tag      = type (low 4 bits) | VALUE | ATTRIBUTES | REMOVE
+//   name     = number of a name already sent, or 0 then the new name
+//
+// The start node's record has no name or index, and a REMOVE record
+// has nothing after its index.  Integers are unsigned LEB128 (signed
+// ones zigzag encoded first), floats and doubles little-endian IEEE,
+// strings a length then the bytes.
+//
+// $Id$
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include <util/exception.hxx>
+
+#include "props_binary.hxx"
+
+using std::map;
+using std::vector;
+
+
+#define BINARY_MAGIC "SGPB"
+#define BINARY_VERSION 1
+
+#define TAG_TYPE_MASK 0x0f
+#define TAG_VALUE 0x10
+#define TAG_ATTRIBUTES 0x20
+#define TAG_REMOVE 0x40
+#define TAG_END 0x80
+
+#define MAX_DEPTH 128
+
+				// Every new name in a message is
+				// interned for good, so a bad file
+				// must not be able to add many.
+#define MAX_NAME_LENGTH 128
+#define MAX_NAMES 4096
+
+
+				// Old ARM FPA doubles keep their two
+				// words in big-endian order.
+#if defined(__arm__) && !defined(__VFP_FP__)
+#define DOUBLE_WORDS_SWAPPED 1
+#else
+#define DOUBLE_WORDS_SWAPPED 0
+#endif
+
+static bool
+little_endian ()
+{
+  unsigned int one = 1;
+  return *(unsigned char *)&one == 1;
+}
+
+static void
+to_little_endian (unsigned char * bytes, int size)
+{
+  if (DOUBLE_WORDS_SWAPPED && size == 8) {
+    for (int i = 0; i < 4; i++) {
+      unsigned char c = bytes[i];
+      bytes[i] = bytes[i + 4];
+      bytes[i + 4] = c;
+    }
+  }
+  if (!little_endian()) {
+    for (int i = 0; i < size / 2; i++) {
+      unsigned char c = bytes[i];
+      bytes[i] = bytes[size - 1 - i];
+      bytes[size - 1 - i] = c;
+    }
+  }
+}
+
+
+/**
+ * Compare the values of two nodes, types included.
+ */
+static bool
+same_value (const SGPropertyNode * a, const SGPropertyNode * b)
+{
+  SGPropertyNode::Type type = a->getType();
+  if (type != b->getType())
+    return false;
+
+  switch (type) {
+  case SGPropertyNode::BOOL:
+    return a->getBoolValue() == b->getBoolValue();
+  case SGPropertyNode::INT:
+    return a->getIntValue() == b->getIntValue();
+  case SGPropertyNode::LONG:
+    return a->getLongValue() == b->getLongValue();
+  case SGPropertyNode::FLOAT:
+    return a->getFloatValue() == b->getFloatValue();
+  case SGPropertyNode::DOUBLE:
+    return a->getDoubleValue() == b->getDoubleValue();
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    return !strcmp(a->getStringValue(), b->getStringValue());
+  default:
+    return true;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Encoding.
+////////////////////////////////////////////////////////////////////////
+
+class BinaryWriter
+{
+public:
+  BinaryWriter (string &out) : _out(out) {}
+
+  bool write_node (const SGPropertyNode * node, const SGPropertyNode * ref,
+		   bool delta, bool root);
+
+private:
+  void put_byte (int c) { _out += (char)c; }
+  void put_varint (unsigned long value);
+  void put_signed (long value);
+  void put_fixed (const void * value, int size);
+  void put_name (const char * atom);
+  void put_value (const SGPropertyNode * node);
+
+  string &_out;
+  vector<const char *> _names;
+  map<const char *, int> _name_ids;
+};
+
+void
+BinaryWriter::put_varint (unsigned long value)
+{
+  while (value >= 0x80) {
+    put_byte((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  put_byte(value);
+}
+
+void
+BinaryWriter::put_signed (long value)
+{
+  unsigned long sign = (unsigned long)(value >> (8 * sizeof(long) - 1));
+  put_varint(((unsigned long)value << 1) ^ sign);
+}
+
+void
+BinaryWriter::put_fixed (const void * value, int size)
+{
+  unsigned char bytes[8];
+  memcpy(bytes, value, size);
+  to_little_endian(bytes, size);
+  _out.append((const char *)bytes, size);
+}
+
+void
+BinaryWriter::put_name (const char * atom)
+{
+  map<const char *, int>::const_iterator it = _name_ids.find(atom);
+  if (it != _name_ids.end()) {
+    put_varint(it->second);
+  } else {
+    _names.push_back(atom);
+    _name_ids[atom] = _names.size();
+    put_varint(0);
+    int length = strlen(atom);
+    put_varint(length);
+    _out.append(atom, length);
+  }
+}
+
+void
+BinaryWriter::put_value (const SGPropertyNode * node)
+{
+  switch (node->getType()) {
+  case SGPropertyNode::BOOL:
+    put_byte(node->getBoolValue() ? 1 : 0);
+    break;
+  case SGPropertyNode::INT:
+    put_signed(node->getIntValue());
+    break;
+  case SGPropertyNode::LONG:
+    put_signed(node->getLongValue());
+    break;
+  case SGPropertyNode::FLOAT: {
+    float value = node->getFloatValue();
+    put_fixed(&value, 4);
+    break;
+  }
+  case SGPropertyNode::DOUBLE: {
+    double value = node->getDoubleValue();
+    put_fixed(&value, 8);
+    break;
+  }
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED: {
+    const char * value = node->getStringValue();
+    int length = strlen(value);
+    put_varint(length);
+    _out.append(value, length);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/**
+ * Write a node and its children.  In a delta, a subtree with nothing
+ * new is taken back out again and false returned.
+ */
+bool
+BinaryWriter::write_node (const SGPropertyNode * node,
+			  const SGPropertyNode * ref, bool delta, bool root)
+{
+  string::size_type mark = _out.size();
+  unsigned int names_mark = _names.size();
+
+  SGPropertyNode::Type type = node->getType();
+  int attr = node->getAttributes() & ~SGPropertyNode::REMOVED;
+  int ref_attr = SGPropertyNode::READ|SGPropertyNode::WRITE;
+  if (delta && ref)
+    ref_attr = ref->getAttributes() & ~SGPropertyNode::REMOVED;
+
+  bool value;
+  if (delta && ref)
+    value = !same_value(node, ref);
+  else
+    value = (type != SGPropertyNode::NONE);
+  bool attributes = (attr != ref_attr);
+
+  int tag = type & TAG_TYPE_MASK;
+  if (value)
+    tag |= TAG_VALUE;
+  if (attributes)
+    tag |= TAG_ATTRIBUTES;
+  put_byte(tag);
+  if (!root) {
+    put_name(node->getName());
+    put_varint(node->getIndex());
+  }
+  if (attributes)
+    put_varint(attr);
+  if (value)
+    put_value(node);
+
+  bool changed = (value || attributes || ref == 0);
+  int nChildren = node->nChildren();
+  for (int i = 0; i < nChildren; i++) {
+    const SGPropertyNode * child = node->getChild(i);
+    const SGPropertyNode * ref_child =
+      (ref ? ref->getChild(child->getName(), child->getIndex()) : 0);
+    if (write_node(child, ref_child, delta, false))
+      changed = true;
+  }
+
+  if (delta && ref) {
+    int nRefChildren = ref->nChildren();
+    for (int i = 0; i < nRefChildren; i++) {
+      const SGPropertyNode * ref_child = ref->getChild(i);
+      if (node->getChild(ref_child->getName(), ref_child->getIndex()) == 0) {
+	put_byte(TAG_REMOVE);
+	put_name(ref_child->getName());
+	put_varint(ref_child->getIndex());
+	changed = true;
+      }
+    }
+  }
+  put_byte(TAG_END);
+
+  if (delta && !changed && !root) {
+    _out.resize(mark);
+    while (_names.size() > names_mark) {
+      _name_ids.erase(_names.back());
+      _names.pop_back();
+    }
+    return false;
+  }
+  return true;
+}
+
+
+void
+writeBinaryProperties (string &out, const SGPropertyNode * start_node,
+		       const SGPropertyNode * reference)
+{
+  out += BINARY_MAGIC;
+  out += (char)BINARY_VERSION;
+  BinaryWriter writer(out);
+  writer.write_node(start_node, reference, reference != 0, true);
+}
+
+
+void
+writeBinaryProperties (const string &file, const SGPropertyNode * start_node)
+{
+  string out;
+  writeBinaryProperties(out, start_node);
+
+  FILE * fp = fopen(file.c_str(), "wb");
+  if (fp == 0)
+    throw sg_io_exception("Cannot open file", sg_location(file));
+  bool ok = (fwrite(out.data(), 1, out.size(), fp) == out.size());
+  if (fclose(fp) != 0 || !ok)
+    throw sg_io_exception("Cannot write file", sg_location(file));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Decoding.
+////////////////////////////////////////////////////////////////////////
+
+class BinaryReader
+{
+public:
+  BinaryReader (const char * buf, int size)
+    : _start((const unsigned char *)buf),
+      _p((const unsigned char *)buf),
+      _end((const unsigned char *)buf + size)
+  {}
+
+  void read_header ();
+  void read_node (SGPropertyNode * node, int tag, int depth);
+  int get_byte ();
+  int used () const { return _p - _start; }
+
+private:
+  unsigned long get_varint ();
+  long get_signed ();
+  void get_fixed (void * value, int size);
+  void get_string (string &value);
+  const char * get_name ();
+  void get_value (SGPropertyNode * node, int type);
+  void fail (const char * message);
+
+  const unsigned char * _start;
+  const unsigned char * _p;
+  const unsigned char * _end;
+  vector<const char *> _names;
+};
+
+void
+BinaryReader::fail (const char * message)
+{
+  throw sg_io_exception(message, "SimGear Binary Property Reader");
+}
+
+int
+BinaryReader::get_byte ()
+{
+  if (_p >= _end)
+    fail("Truncated binary property message");
+  return *_p++;
+}
+
+unsigned long
+BinaryReader::get_varint ()
+{
+  unsigned long value = 0;
+  for (unsigned int shift = 0; shift < 8 * sizeof(long); shift += 7) {
+    int c = get_byte();
+    value |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return value;
+  }
+  fail("Bad number in binary property message");
+  return 0;
+}
+
+long
+BinaryReader::get_signed ()
+{
+  unsigned long value = get_varint();
+  return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+void
+BinaryReader::get_fixed (void * value, int size)
+{
+  if (_end - _p < size)
+    fail("Truncated binary property message");
+  unsigned char bytes[8];
+  memcpy(bytes, _p, size);
+  _p += size;
+  to_little_endian(bytes, size);
+  memcpy(value, bytes, size);
+}
+
+void
+BinaryReader::get_string (string &value)
+{
+  unsigned long length = get_varint();
+  if ((unsigned long)(_end - _p) < length)
+    fail("Truncated binary property message");
+  value.assign((const char *)_p, length);
+  _p += length;
+}
+
+const char *
+BinaryReader::get_name ()
+{
+  unsigned long id = get_varint();
+  if (id == 0) {
+    if (_names.size() >= MAX_NAMES)
+      fail("Too many names in binary property message");
+    unsigned long length = get_varint();
+    if (length == 0 || length > MAX_NAME_LENGTH)
+      fail("Bad name length in binary property message");
+    if ((unsigned long)(_end - _p) < length)
+      fail("Truncated binary property message");
+    string name((const char *)_p, length);
+    _p += length;
+    if (name.find('\0') != string::npos)
+      fail("Bad name in binary property message");
+    _names.push_back(SGPropertyName::intern(name.c_str()));
+    return _names.back();
+  }
+  if (id > _names.size())
+    fail("Bad name in binary property message");
+  return _names[id - 1];
+}
+
+void
+BinaryReader::get_value (SGPropertyNode * node, int type)
+{
+  switch (type) {
+  case SGPropertyNode::NONE:
+    node->clearValue();
+    break;
+  case SGPropertyNode::BOOL:
+    node->setBoolValue(get_byte() != 0);
+    break;
+  case SGPropertyNode::INT:
+    node->setIntValue(get_signed());
+    break;
+  case SGPropertyNode::LONG:
+    node->setLongValue(get_signed());
+    break;
+  case SGPropertyNode::FLOAT: {
+    float value;
+    get_fixed(&value, 4);
+    node->setFloatValue(value);
+    break;
+  }
+  case SGPropertyNode::DOUBLE: {
+    double value;
+    get_fixed(&value, 8);
+    node->setDoubleValue(value);
+    break;
+  }
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED: {
+    string value;
+    get_string(value);
+    if (type == SGPropertyNode::STRING)
+      node->setStringValue(value.c_str());
+    else
+      node->setUnspecifiedValue(value.c_str());
+    break;
+  }
+  default:
+    fail("Bad type in binary property message");
+  }
+}
+
+void
+BinaryReader::read_header ()
+{
+  if (_end - _p < 5 || memcmp(_p, BINARY_MAGIC, 4))
+    fail("Not a binary property message");
+  _p += 4;
+  if (get_byte() != BINARY_VERSION)
+    fail("Unsupported binary property version");
+}
+
+void
+BinaryReader::read_node (SGPropertyNode * node, int tag, int depth)
+{
+  if (depth > MAX_DEPTH)
+    fail("Binary property message nested too deeply");
+
+  if (tag & TAG_ATTRIBUTES)
+    node->setAttributes(get_varint());
+  if (tag & TAG_VALUE)
+    get_value(node, tag & TAG_TYPE_MASK);
+
+  for (;;) {
+    int child_tag = get_byte();
+    if (child_tag == TAG_END)
+      break;
+    const char * name = get_name();
+    int index = get_varint();
+    if (child_tag & TAG_REMOVE)
+      node->removeChild(name, index, false);
+    else
+      read_node(node->getChild(name, index, true), child_tag, depth + 1);
+  }
+}
+
+
+int
+readBinaryProperties (const char * buf, int size, SGPropertyNode * start_node)
+{
+  BinaryReader reader(buf, size);
+  reader.read_header();
+  reader.read_node(start_node, reader.get_byte(), 0);
+  return reader.used();
+}
+
+
+void
+readBinaryProperties (const string &file, SGPropertyNode * start_node)
+{
+  FILE * fp = fopen(file.c_str(), "rb");
+  if (fp == 0)
+    throw sg_io_exception("Cannot open file", sg_location(file));
+  string buf;
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    buf.append(chunk, n);
+  fclose(fp);
+  readBinaryProperties(buf.data(), buf.size(), start_node);
+}
+
+// end of props_binary.cxx
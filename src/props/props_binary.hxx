@@ -0,0 +1,61 @@
+/**
+ * \file props_binary.hxx
+ * Compact binary encoding of property subtrees.
+ *
+ * $Id$
+ */
+
+#ifndef __PROPS_BINARY_HXX
+#define __PROPS_BINARY_HXX
+
+#include "props/props.hxx"
+
+#include <string>
+
+using std::string;
+
+
+/**
+ * Encode a subtree, appending the message to out.
+ *
+ * <p>A message carries each node's name, index, type, attributes and
+ * value.  Names are sent once and then referred to by number;
+ * numbers are variable-length and fixed-size values little-endian,
+ * so messages move between the ARM board and the ground as is.
+ * Aliases are written as plain nodes, as copyProperties() does.</p>
+ *
+ * <p>Given a reference tree, usually the receiver's copy rebuilt from
+ * the previous message, only the differences are encoded: changed
+ * values, new nodes, and removals of nodes the reference has but
+ * start_node lacks.  An unchanged subtree costs nothing.</p>
+ */
+void writeBinaryProperties (string &out, const SGPropertyNode * start_node,
+			    const SGPropertyNode * reference = 0);
+
+
+/**
+ * Decode a message from writeBinaryProperties() into start_node.
+ * Nodes are created and values set as needed; a full message merges
+ * into what is there, a delta also removes nodes.  Returns the bytes
+ * used, throws sg_io_exception if the message is malformed.
+ */
+int readBinaryProperties (const char * buf, int size,
+			  SGPropertyNode * start_node);
+
+
+/**
+ * Write a subtree to a binary file.
+ */
+void writeBinaryProperties (const string &file,
+			    const SGPropertyNode * start_node);
+
+
+/**
+ * Read a binary file into a subtree.
+ */
+void readBinaryProperties (const string &file, SGPropertyNode * start_node);
+
+
+#endif // __PROPS_BINARY_HXX
+
+// end of props_binary.hxx
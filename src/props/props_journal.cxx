@@ -0,0 +1,699 @@
+// props_journal.cxx - recording of every property write.
+//
+// A journal is a gzip file of 16-byte records, the first a header
+// ("SGPJ" and a version byte).  Each other record is
+//
+//   bytes 0-3   frame number
+//   bytes 4-5   node number
+//   byte  6     kind: a node type for a value, or DEFINE, FRAME, LOST
+//   bytes 8-15  value
+//
+// all little-endian.  A DEFINE gives the path of a node number, a
+// FRAME the time of a new frame, a LOST the count of records dropped
+// before it.  Strings and paths store their length as the value and
+// continue in as many raw 16-byte records as the bytes need.
+//
+// $Id$
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <util/exception.hxx>
+
+#include "props_journal.hxx"
+
+
+#define JOURNAL_MAGIC "SGPJ"
+#define JOURNAL_VERSION 1
+
+#define KIND_DEFINE 16
+#define KIND_FRAME 17
+#define KIND_LOST 18
+
+#define ID_NONE 0		// not numbered yet
+#define ID_IGNORED 0xffff	// outside the journaled tree, or out of numbers
+#define ID_BITS 16		// the rest of _journal_id is the serial
+
+#define FLUSH_SLEEP_US 20000	// journal thread poll period
+#define FLUSH_IDLE 50		// polls before a partial block is written
+
+
+				// Old ARM FPA doubles keep their two
+				// words in big-endian order.
+#if defined(__arm__) && !defined(__VFP_FP__)
+#define DOUBLE_WORDS_SWAPPED 1
+#else
+#define DOUBLE_WORDS_SWAPPED 0
+#endif
+
+static bool
+little_endian ()
+{
+  unsigned int one = 1;
+  return *(unsigned char *)&one == 1;
+}
+
+				// Swapping is its own inverse, so this
+				// converts both ways.
+static void
+swap_little_endian (unsigned char * bytes, int size)
+{
+  if (DOUBLE_WORDS_SWAPPED && size == 8) {
+    for (int i = 0; i < 4; i++) {
+      unsigned char c = bytes[i];
+      bytes[i] = bytes[i + 4];
+      bytes[i + 4] = c;
+    }
+  }
+  if (!little_endian()) {
+    for (int i = 0; i < size / 2; i++) {
+      unsigned char c = bytes[i];
+      bytes[i] = bytes[size - 1 - i];
+      bytes[size - 1 - i] = c;
+    }
+  }
+}
+
+static void
+put_integer (unsigned char * bytes, unsigned long long value, int size)
+{
+  for (int i = 0; i < size; i++) {
+    bytes[i] = (unsigned char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+static unsigned long long
+get_integer (const unsigned char * bytes, int size)
+{
+  unsigned long long value = 0;
+  for (int i = size - 1; i >= 0; i--)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+
+static int
+data_records (int size)
+{
+  return (size + 15) / 16;
+}
+
+				// Node numbers kept in the nodes belong
+				// to the journal with the same serial.
+static unsigned int last_serial = 0;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Recording.
+////////////////////////////////////////////////////////////////////////
+
+SGPropertyJournal * SGPropertyJournal::active = 0;
+
+SGPropertyJournal::SGPropertyJournal (int ring_size)
+  : _root(0),
+    _file(0),
+    _running(false),
+    _waiting(false),
+    _head(0),
+    _tail(0),
+    _next(0),
+    _tail_seen(0),
+    _serial(0),
+    _next_id(1),
+    _frame(0),
+    _recorded(0),
+    _dropped(0),
+    _lost(0)
+{
+  unsigned int size = 64;
+  while (size < (unsigned int)ring_size)
+    size <<= 1;
+  _mask = size - 1;
+  _ring = new unsigned char[size * RECORD_SIZE];
+				// Touch every page now rather than
+				// fault them in during flight.
+  memset(_ring, 0, size * RECORD_SIZE);
+}
+
+SGPropertyJournal::~SGPropertyJournal ()
+{
+  close();
+  delete [] _ring;
+}
+
+void
+SGPropertyJournal::open (const string &file, SGPropertyNode * root)
+{
+  close();
+  if (active != 0)
+    active->close();
+
+  _file = gzopen(file.c_str(), "wb");
+  if (_file == 0)
+    throw sg_io_exception("Cannot open file", sg_location(file));
+
+  unsigned char header[RECORD_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, JOURNAL_MAGIC, 4);
+  header[4] = JOURNAL_VERSION;
+  if (gzwrite(_file, header, sizeof(header)) != (int)sizeof(header)) {
+    gzclose(_file);
+    _file = 0;
+    throw sg_io_exception("Cannot write file", sg_location(file));
+  }
+
+  _root = root;
+  _head = 0;
+  _tail = 0;
+  _next = _tail_seen = 0;
+				// A new serial renumbers every node, so
+				// each journal defines its own paths.
+  last_serial = (last_serial + 1) & ((1 << ID_BITS) - 1);
+  if (last_serial == 0)
+    last_serial = 1;
+  _serial = last_serial;
+  _next_id = 1;
+  _tied.clear();
+  _frame = 0;
+  _recorded = _dropped = _lost = 0;
+  _running = true;
+  pthread_create(&_thread, 0, run, this);
+
+				// The starting state may not fit the
+				// ring, so wait for the journal thread
+				// rather than drop any of it.
+  _waiting = true;
+  record_tree(root);
+  _waiting = false;
+  active = this;
+}
+
+void
+SGPropertyJournal::close ()
+{
+  if (_file == 0)
+    return;
+  if (active == this)
+    active = 0;
+  _running = false;
+  pthread_join(_thread, 0);
+  gzclose(_file);
+  _file = 0;
+  _tied.clear();
+}
+
+void
+SGPropertyJournal::frame (double time)
+{
+  if (_file == 0)
+    return;
+  sample();
+  _frame++;
+  if (!reserve(1))
+    return;
+  unsigned char value[8];
+  memcpy(value, &time, 8);
+  swap_little_endian(value, 8);
+  put(KIND_FRAME, 0, value);
+  publish();
+}
+
+void
+SGPropertyJournal::record (const SGPropertyNode * node)
+{
+  if (number(node) == ID_IGNORED)
+    return;
+
+  unsigned char value[8];
+  const char * string_val;
+  int string_len;
+  int type = encode(node, value, string_val, string_len);
+  if (type >= 0)
+    write(node, type, value, string_val, string_len);
+}
+
+void
+SGPropertyJournal::track (const SGPropertyNode * node)
+{
+  if (_file == 0)
+    return;
+  for (unsigned int i = 0; i < _tied.size(); i++)
+    if (_tied[i].node.ptr() == node)
+      return;
+
+  tied_node tied;
+  const char * string_val;
+  int string_len;
+  tied.type = encode(node, tied.value, string_val, string_len);
+  if (tied.type < 0)
+    return;
+  write(node, tied.type, tied.value, string_val, string_len);
+  if (number(node) == ID_IGNORED)
+    return;
+  tied.node = (SGPropertyNode *)node;
+  if (string_val != 0)
+    tied.text.assign(string_val, string_len);
+  _tied.push_back(tied);
+}
+
+/**
+ * Journal the tied nodes whose values changed since they were last
+ * journaled, and forget those no longer tied.
+ */
+void
+SGPropertyJournal::sample ()
+{
+  unsigned int i = 0;
+  while (i < _tied.size()) {
+    tied_node &tied = _tied[i];
+    if (!tied.node->isTied()) {
+      _tied[i] = _tied.back();
+      _tied.pop_back();
+      continue;
+    }
+    i++;
+
+    unsigned char value[8];
+    const char * string_val;
+    int string_len;
+    int type = encode(tied.node, value, string_val, string_len);
+    if (type < 0)
+      continue;
+    if (type == tied.type && memcmp(value, tied.value, 8) == 0
+	&& (string_val == 0
+	    || tied.text.compare(0, string::npos, string_val, string_len) == 0))
+      continue;
+
+    write(tied.node, type, value, string_val, string_len);
+    tied.type = type;
+    memcpy(tied.value, value, 8);
+    if (string_val != 0)
+      tied.text.assign(string_val, string_len);
+  }
+}
+
+/**
+ * Put the value of a node in the 8 value bytes of a record; strings
+ * put their length there and return the bytes to follow.  Returns
+ * the type to journal, or -1 for a node without a value.
+ */
+int
+SGPropertyJournal::encode (const SGPropertyNode * node,
+			   unsigned char value[8],
+			   const char * &string_val, int &string_len)
+{
+  SGPropertyNode::Type type = node->getType();
+  memset(value, 0, 8);
+  string_val = 0;
+  string_len = 0;
+
+  switch (type) {
+  case SGPropertyNode::BOOL:
+    value[0] = node->getBoolValue() ? 1 : 0;
+    break;
+  case SGPropertyNode::INT:
+  case SGPropertyNode::LONG:
+    put_integer(value, (long long)node->getLongValue(), 8);
+    break;
+  case SGPropertyNode::FLOAT:
+    {
+      float f = node->getFloatValue();
+      memcpy(value, &f, 4);
+      swap_little_endian(value, 4);
+    }
+    break;
+  case SGPropertyNode::DOUBLE:
+    {
+      double d = node->getDoubleValue();
+      memcpy(value, &d, 8);
+      swap_little_endian(value, 8);
+    }
+    break;
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    string_val = node->getStringValue();
+    string_len = strlen(string_val);
+    put_integer(value, string_len, 8);
+    break;
+  default:
+    return -1;
+  }
+  return type;
+}
+
+/**
+ * The number of a node in this journal, or ID_NONE if it has none
+ * yet; numbers from earlier journals do not count.
+ */
+unsigned int
+SGPropertyJournal::number (const SGPropertyNode * node) const
+{
+  unsigned int id = node->_journal_id;
+  if ((id >> ID_BITS) != _serial)
+    return ID_NONE;
+  return id & ((1 << ID_BITS) - 1);
+}
+
+/**
+ * Journal a value, numbering the node first if it has no number.
+ */
+void
+SGPropertyJournal::write (const SGPropertyNode * node, int type,
+			  const unsigned char value[8],
+			  const char * string_val, int string_len)
+{
+  unsigned int id = number(node);
+  if (id == ID_NONE)
+    id = define(node);
+  if (id == ID_NONE || id == ID_IGNORED)
+    return;
+
+  if (!reserve(1 + data_records(string_len)))
+    return;
+  put(type, id, value);
+  put_bytes(string_val, string_len);
+  publish();
+  _recorded++;
+}
+
+/**
+ * Number a node on its first write and journal its path.  If the
+ * path does not fit, the node stays unnumbered and the next write
+ * tries again.  Returns the number, ID_NONE or ID_IGNORED.
+ */
+unsigned int
+SGPropertyJournal::define (const SGPropertyNode * node)
+{
+  SGPropertyNode * mutable_node = (SGPropertyNode *)node;
+
+				// Build the path from the parents; only
+				// nodes of the journaled tree count.
+  string path;
+  const SGPropertyNode * top = node;
+  while (top->getParent() != 0) {
+    string component = "/";
+    component += top->getName();
+    if (top->getIndex() != 0) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "[%d]", top->getIndex());
+      component += buf;
+    }
+    path.insert(0, component);
+    top = top->getParent();
+  }
+  if (top != _root || _next_id >= ID_IGNORED) {
+    mutable_node->_journal_id = (_serial << ID_BITS) | ID_IGNORED;
+    return ID_IGNORED;
+  }
+  if (path.empty())
+    path = "/";
+
+  int path_len = path.size();
+  if (!reserve(1 + data_records(path_len)))
+    return ID_NONE;
+  unsigned char value[8];
+  put_integer(value, path_len, 8);
+  put(KIND_DEFINE, _next_id, value);
+  put_bytes(path.data(), path_len);
+  publish();
+  mutable_node->_journal_id = (_serial << ID_BITS) | _next_id;
+  return _next_id++;
+}
+
+void
+SGPropertyJournal::record_tree (const SGPropertyNode * node)
+{
+  SGPropertyNode::Type type = node->getType();
+  if (node->isTied())
+    track(node);
+  else if (type != SGPropertyNode::NONE && type != SGPropertyNode::ALIAS)
+    record(node);
+  for (int i = 0; i < node->nChildren(); i++)
+    record_tree(node->getChild(i));
+}
+
+/**
+ * Make room for count records after any pending LOST record, or
+ * count the write as dropped.
+ */
+bool
+SGPropertyJournal::reserve (int count)
+{
+  unsigned int size = _mask + 1;
+  int needed = count + (_lost > 0 ? 1 : 0);
+  while (_next + needed - _tail_seen > size) {
+				// Only look at the journal thread's
+				// tail when the ring seems full.
+    _tail_seen = _tail.load(SG_ACQUIRE);
+    if (_next + needed - _tail_seen <= size)
+      break;
+    if (!_waiting) {
+      _dropped++;
+      _lost++;
+      return false;
+    }
+    usleep(1000);
+  }
+
+  if (_lost > 0) {
+    unsigned char value[8];
+    put_integer(value, _lost, 8);
+    put(KIND_LOST, 0, value);
+    _lost = 0;
+  }
+  return true;
+}
+
+void
+SGPropertyJournal::put (int kind, unsigned int id, const unsigned char value[8])
+{
+  unsigned char * record = _ring + (_next & _mask) * RECORD_SIZE;
+  put_integer(record, _frame, 4);
+  put_integer(record + 4, id, 2);
+  record[6] = kind;
+  record[7] = 0;
+  memcpy(record + 8, value, 8);
+  _next++;
+}
+
+void
+SGPropertyJournal::put_bytes (const char * bytes, int size)
+{
+  while (size > 0) {
+    unsigned char * record = _ring + (_next & _mask) * RECORD_SIZE;
+    int n = (size < RECORD_SIZE ? size : RECORD_SIZE);
+    memcpy(record, bytes, n);
+    memset(record + n, 0, RECORD_SIZE - n);
+    bytes += n;
+    size -= n;
+    _next++;
+  }
+}
+
+/**
+ * Hand the records put so far to the journal thread.
+ */
+void
+SGPropertyJournal::publish ()
+{
+  _head.store(_next, SG_RELEASE);
+}
+
+/**
+ * Compress what the ring holds; runs on the journal thread.  A sync
+ * flush after each block keeps all but the last block readable if
+ * the board resets.
+ */
+void
+SGPropertyJournal::flush ()
+{
+  unsigned int head = _head.load(SG_ACQUIRE);
+  unsigned int tail = _tail.load(SG_RELAXED);
+  if (head == tail)
+    return;
+
+  while (tail != head) {
+    unsigned int start = tail & _mask;
+    unsigned int count = head - tail;
+    if (start + count > _mask + 1)
+      count = _mask + 1 - start;
+    gzwrite(_file, _ring + start * RECORD_SIZE, count * RECORD_SIZE);
+    tail += count;
+  }
+  gzflush(_file, Z_SYNC_FLUSH);
+
+  _tail.store(tail, SG_RELEASE);
+}
+
+void *
+SGPropertyJournal::run (void * arg)
+{
+  SGPropertyJournal * journal = (SGPropertyJournal *)arg;
+  unsigned int block = (journal->_mask + 1) / 4;
+  int idle = 0;
+  while (journal->_running) {
+    unsigned int pending = journal->_head.load() - journal->_tail.load();
+    if (pending >= block || (pending > 0 && idle >= FLUSH_IDLE)) {
+      journal->flush();
+      idle = 0;
+    } else {
+      usleep(FLUSH_SLEEP_US);
+      idle++;
+    }
+  }
+  journal->flush();
+  return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Replay.
+////////////////////////////////////////////////////////////////////////
+
+SGPropertyJournalReader::SGPropertyJournalReader ()
+  : _file(0),
+    _pending(false),
+    _frame(0),
+    _time(0.0),
+    _lost(0)
+{
+}
+
+SGPropertyJournalReader::~SGPropertyJournalReader ()
+{
+  if (_file != 0)
+    gzclose(_file);
+}
+
+void
+SGPropertyJournalReader::open (const string &file)
+{
+  if (_file != 0)
+    gzclose(_file);
+  _name = file;
+  _pending = false;
+  _frame = 0;
+  _time = 0.0;
+  _lost = 0;
+  _nodes.clear();
+
+  _file = gzopen(file.c_str(), "rb");
+  if (_file == 0)
+    throw sg_io_exception("Cannot open file", sg_location(file));
+  unsigned char header[16];
+  if (!read_record(header) || memcmp(header, JOURNAL_MAGIC, 4) != 0)
+    throw sg_io_exception("Not a property journal", sg_location(file));
+  if (header[4] != JOURNAL_VERSION)
+    throw sg_io_exception("Unknown property journal version",
+			  sg_location(file));
+}
+
+/**
+ * Read one record.  A journal cut short by a reset ends at its last
+ * whole record.
+ */
+bool
+SGPropertyJournalReader::read_record (unsigned char record[16])
+{
+  return (_file != 0 && gzread(_file, record, 16) == 16);
+}
+
+string
+SGPropertyJournalReader::read_bytes (int size)
+{
+  string bytes;
+  unsigned char record[16];
+  while (size > 0) {
+    if (!read_record(record))
+      throw sg_io_exception("Truncated property journal", sg_location(_name));
+    int n = (size < 16 ? size : 16);
+    bytes.append((const char *)record, n);
+    size -= n;
+  }
+  return bytes;
+}
+
+bool
+SGPropertyJournalReader::next (SGPropertyNode * root)
+{
+  unsigned char record[16];
+  bool started = false;
+
+  if (_pending) {
+    _frame = get_integer(_ahead, 4);
+    memcpy(&_time, _ahead + 8, 8);
+    swap_little_endian((unsigned char *)&_time, 8);
+    _pending = false;
+    started = true;
+  }
+
+  while (read_record(record)) {
+    unsigned int id = get_integer(record + 4, 2);
+    int kind = record[6];
+    const unsigned char * value = record + 8;
+
+    if (kind == KIND_FRAME) {
+      memcpy(_ahead, record, 16);
+      _pending = true;
+      return true;
+    } else if (kind == KIND_LOST) {
+      _lost += get_integer(value, 8);
+      continue;
+    } else if (kind == KIND_DEFINE) {
+      string path = read_bytes(get_integer(value, 8));
+      if (id >= _nodes.size())
+	_nodes.resize(id + 1);
+      _nodes[id] = root->getNode(path.c_str(), true);
+      continue;
+    }
+
+    if (id >= _nodes.size() || _nodes[id] == 0)
+      throw sg_io_exception("Undefined node in property journal",
+			    sg_location(_name));
+    SGPropertyNode * node = _nodes[id];
+    started = true;
+
+    switch (kind) {
+    case SGPropertyNode::BOOL:
+      node->setBoolValue(value[0] != 0);
+      break;
+    case SGPropertyNode::INT:
+      node->setIntValue((int)(long long)get_integer(value, 8));
+      break;
+    case SGPropertyNode::LONG:
+      node->setLongValue((long)(long long)get_integer(value, 8));
+      break;
+    case SGPropertyNode::FLOAT:
+      {
+	float f;
+	memcpy(&f, value, 4);
+	swap_little_endian((unsigned char *)&f, 4);
+	node->setFloatValue(f);
+      }
+      break;
+    case SGPropertyNode::DOUBLE:
+      {
+	double d;
+	memcpy(&d, value, 8);
+	swap_little_endian((unsigned char *)&d, 8);
+	node->setDoubleValue(d);
+      }
+      break;
+    case SGPropertyNode::STRING:
+      node->setStringValue(read_bytes(get_integer(value, 8)).c_str());
+      break;
+    case SGPropertyNode::UNSPECIFIED:
+      node->setUnspecifiedValue(read_bytes(get_integer(value, 8)).c_str());
+      break;
+    default:
+      throw sg_io_exception("Bad record in property journal",
+			    sg_location(_name));
+    }
+  }
+  return started;
+}
+
+// end of props_journal.cxx
@@ -0,0 +1,238 @@
+/**
+ * \file props_journal.hxx
+ * Recording of every property write, for replay after a flight.
+ *
+ * $Id$
+ */
+
+#ifndef __PROPS_JOURNAL_HXX
+#define __PROPS_JOURNAL_HXX
+
+#include "props/props.hxx"
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+/**
+ * A compressed file of every value written to a property tree.
+ *
+ * <p>While a journal is open, each successful set*Value() call adds a
+ * fixed-size record (node number, type, value, frame) to a ring
+ * allocated up front.  A thread of the journal's own empties the ring
+ * into a gzip file in blocks, so the writing thread never waits on
+ * the disk or the compressor; if the ring fills anyway, records are
+ * dropped and a count of them is journaled when there is room again.
+ * Opening a journal records the whole tree first, so a replay starts
+ * from the same state.</p>
+ *
+ * <p>Nodes are numbered on their first journaled write, and the
+ * number is kept in the node along with the journal's serial, so the
+ * path is written once per node and journal rather than once per
+ * write.  Tied nodes can change without a set*Value() call, so
+ * frame() also samples each of them and journals those that changed.
+ * Like SGPropertySnapshot, this assumes one thread writes the tree.
+ * Removals of nodes are not seen.</p>
+ *
+ * <pre>
+ * SGPropertyJournal journal;
+ * journal.open("props.jnl.gz", props);
+ * while (flying) {
+ *   journal.frame(get_Time());
+ *   ...
+ * }
+ * journal.close();
+ * </pre>
+ */
+class SGPropertyJournal
+{
+public:
+
+  /**
+   * The open journal, if any; props.cxx records writes through it.
+   */
+  static SGPropertyJournal * active;
+
+
+  /**
+   * Create a journal whose ring holds ring_size records (rounded up
+   * to a power of two).
+   */
+  SGPropertyJournal (int ring_size = 16384);
+
+  ~SGPropertyJournal ();
+
+
+  /**
+   * Start journaling the tree whose root is root to file.  Only one
+   * journal can be open at a time, and it should always be given the
+   * same tree.  Throws sg_io_exception if the file cannot be created.
+   */
+  void open (const string &file, SGPropertyNode * root);
+
+
+  /**
+   * Write out what is left in the ring and close the file.
+   */
+  void close ();
+
+
+  /**
+   * Start a new frame at time (seconds).  Writes until the next
+   * frame() belong to it.
+   */
+  void frame (double time);
+
+
+  /**
+   * Record the current value of a node.  Called by props.cxx after
+   * every successful write.
+   */
+  void record (const SGPropertyNode * node);
+
+
+  /**
+   * Record the current value of a tied node and sample it at every
+   * frame.  Called by props.cxx when a node is tied.
+   */
+  void track (const SGPropertyNode * node);
+
+
+  /**
+   * Records journaled and dropped since open().
+   */
+  unsigned long getRecorded () const { return _recorded; }
+  unsigned long getDropped () const { return _dropped; }
+
+
+  /**
+   * Records waiting in the ring for the journal thread.
+   */
+  int getPending () const { return _head.load() - _tail.load(); }
+
+private:
+
+  enum {
+    RECORD_SIZE = 16
+  };
+
+  struct tied_node {
+    SGPropertyNode_ptr node;
+    int type;
+    unsigned char value[8];	// as last journaled
+    string text;
+  };
+
+  static int encode (const SGPropertyNode * node, unsigned char value[8],
+		     const char * &string_val, int &string_len);
+  unsigned int number (const SGPropertyNode * node) const;
+  unsigned int define (const SGPropertyNode * node);
+  void write (const SGPropertyNode * node, int type,
+	      const unsigned char value[8],
+	      const char * string_val, int string_len);
+  void sample ();
+  void record_tree (const SGPropertyNode * node);
+  bool reserve (int count);
+  void put (int kind, unsigned int id, const unsigned char value[8]);
+  void put_bytes (const char * bytes, int size);
+  void publish ();
+  void flush ();
+
+  static void * run (void * journal);
+
+  SGPropertyNode * _root;
+  gzFile _file;
+  pthread_t _thread;
+  SGAtomic<bool> _running;
+  bool _waiting;		// block instead of dropping, in open()
+
+  unsigned char * _ring;
+  unsigned int _mask;
+  SGAtomic<unsigned int> _head;	// written by the recording thread
+  SGAtomic<unsigned int> _tail;	// written by the journal thread
+  unsigned int _next;		// head of records not yet published
+  unsigned int _tail_seen;	// _tail when last read
+
+  unsigned int _serial;		// kept in the nodes this journal numbers
+  unsigned int _next_id;
+  vector<tied_node> _tied;
+
+  unsigned int _frame;
+  unsigned long _recorded;
+  unsigned long _dropped;
+  unsigned long _lost;		// dropped since the last LOST record
+};
+
+
+/**
+ * Reads back a file written by SGPropertyJournal, one frame at a time.
+ *
+ * <pre>
+ * SGPropertyJournalReader reader;
+ * reader.open("props.jnl.gz");
+ * SGPropertyNode_ptr tree = new SGPropertyNode;
+ * while (reader.getTime() < 120.0 && reader.next(tree))
+ *   ;
+ * </pre>
+ */
+class SGPropertyJournalReader
+{
+public:
+
+  SGPropertyJournalReader ();
+  ~SGPropertyJournalReader ();
+
+
+  /**
+   * Open a journal.  Throws sg_io_exception if the file cannot be
+   * read or is not a journal.
+   */
+  void open (const string &file);
+
+
+  /**
+   * Apply the records of the next frame to root, creating nodes as
+   * needed.  The records before the first frame hold the state at
+   * open().  Returns false at the end of the journal; throws
+   * sg_io_exception if the file is damaged.
+   */
+  bool next (SGPropertyNode * root);
+
+
+  /**
+   * The frame last applied and its time; 0 before the first.
+   */
+  unsigned int getFrame () const { return _frame; }
+  double getTime () const { return _time; }
+
+
+  /**
+   * Records the recorder reported dropped so far.
+   */
+  unsigned long getLost () const { return _lost; }
+
+private:
+
+  bool read_record (unsigned char record[16]);
+  string read_bytes (int size);
+
+  gzFile _file;
+  string _name;
+  bool _pending;		// a frame record was read ahead
+  unsigned char _ahead[16];
+  unsigned int _frame;
+  double _time;
+  unsigned long _lost;
+  vector<SGPropertyNode_ptr> _nodes;
+};
+
+
+#endif // __PROPS_JOURNAL_HXX
+
+// end of props_journal.hxx
@@ -0,0 +1,292 @@
+// props_snapshot.cxx - consistent copies of a property subtree.
+//
+// $Id$
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "props_snapshot.hxx"
+
+using std::sort;
+
+
+/**
+ * Orders entry positions by the path of the entry.
+ */
+class path_order
+{
+public:
+  path_order (const vector<string> &paths) : _paths(paths) {}
+  bool operator() (int a, int b) const { return _paths[a] < _paths[b]; }
+private:
+  const vector<string> &_paths;
+};
+
+
+SGPropertySnapshot::SGPropertySnapshot ()
+  : _root(0),
+    _generation(0),
+    _sequence(0),
+    _retries(0)
+{
+}
+
+
+/**
+ * Record a node and everything below it.  Returns false as soon as
+ * a write gets in the way.
+ */
+bool
+SGPropertySnapshot::collect (const SGPropertyNode::tree_state * tree,
+			     unsigned int sequence,
+			     const SGPropertyNode * node, const string &path)
+{
+  entry e;
+  e.node = node;
+  e.path = path;
+  if (!node->read_type(tree, sequence, e.type))
+    return false;
+  e.value.double_val = 0.0;
+  _entries.push_back(e);
+
+  vector<const SGPropertyNode *> children;
+  node->read_children(children);
+  if (SGPropertyNode::read_retry(tree, sequence))
+    return false;
+  for (unsigned int i = 0; i < children.size(); i++) {
+    const SGPropertyNode * child = children[i];
+    string child_path = path;
+    if (!child_path.empty())
+      child_path += '/';
+    child_path += child->getName();
+    if (child->getIndex() != 0) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "[%d]", child->getIndex());
+      child_path += buf;
+    }
+    if (!collect(tree, sequence, child, child_path))
+      return false;
+  }
+  return true;
+}
+
+
+/**
+ * Read every value once.  Returns false if a value could not be
+ * read as it was listed; the caller checks for later writes.
+ */
+bool
+SGPropertySnapshot::copy_values (const SGPropertyNode::tree_state * tree,
+				 unsigned int sequence)
+{
+  for (unsigned int i = 0; i < _entries.size(); i++) {
+    entry &e = _entries[i];
+    if (!e.node->read_value(tree, sequence, e.type, e.value, e.string_val))
+      return false;
+  }
+  return true;
+}
+
+
+bool
+SGPropertySnapshot::take (const SGPropertyNode * node, int max_tries)
+{
+  _retries = 0;
+  bool relisted = false;
+  int slot;
+  SGPropertyNode::tree_state * tree = SGPropertyNode::read_lock(node, slot);
+  while (_retries < max_tries) {
+    unsigned int sequence = SGPropertyNode::read_begin(tree);
+    if (!(sequence & 1)) {
+				// Relist the nodes if the tree changed
+				// shape since last time.
+      unsigned int generation = SGPropertyNode::structure_generation(tree);
+      bool listed = true;
+      if (node != _root || generation != _generation || _entries.empty()) {
+	_entries.clear();
+	_root = 0;
+	listed = collect(tree, sequence, node, "");
+	if (listed) {
+	  _root = node;
+	  _generation = generation;
+	  relisted = true;
+	} else {
+	  _entries.clear();
+	}
+      }
+      if (listed && copy_values(tree, sequence)
+	  && !SGPropertyNode::read_retry(tree, sequence)) {
+	SGPropertyNode::read_unlock(tree, slot);
+	if (relisted) {
+	  vector<string> paths;
+	  _by_path.resize(_entries.size());
+	  for (unsigned int i = 0; i < _entries.size(); i++) {
+	    paths.push_back(_entries[i].path);
+	    _by_path[i] = i;
+	  }
+	  sort(_by_path.begin(), _by_path.end(), path_order(paths));
+	}
+	_sequence = sequence;
+	return true;
+      }
+    }
+
+				// Let the writer finish its update;
+				// leaving lets it free what it retired.
+    _retries++;
+    SGPropertyNode::read_unlock(tree, slot);
+    sched_yield();
+    tree = SGPropertyNode::read_lock(node, slot);
+  }
+  SGPropertyNode::read_unlock(tree, slot);
+  return false;
+}
+
+
+int
+SGPropertySnapshot::find (const char * relative_path) const
+{
+				// Stored paths leave out [0].
+  string path = relative_path;
+  for (string::size_type pos = path.find("[0]"); pos != string::npos;
+       pos = path.find("[0]", pos))
+    path.erase(pos, 3);
+  if (!path.empty() && path[0] == '/')
+    path.erase(0, 1);
+
+  int lo = 0;
+  int hi = _by_path.size();
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = _entries[_by_path[mid]].path.compare(path);
+    if (cmp == 0)
+      return _by_path[mid];
+    else if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+
+bool
+SGPropertySnapshot::getBoolValue (int i) const
+{
+  const entry &e = _entries[i];
+  switch (e.type) {
+  case SGPropertyNode::BOOL:
+    return e.value.bool_val;
+  case SGPropertyNode::INT:
+  case SGPropertyNode::LONG:
+    return e.value.long_val != 0L;
+  case SGPropertyNode::FLOAT:
+  case SGPropertyNode::DOUBLE:
+    return e.value.double_val != 0.0;
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    return (e.string_val == "true" || atoi(e.string_val.c_str())) ? true : false;
+  default:
+    return false;
+  }
+}
+
+
+long
+SGPropertySnapshot::getLongValue (int i) const
+{
+  const entry &e = _entries[i];
+  switch (e.type) {
+  case SGPropertyNode::BOOL:
+    return e.value.bool_val ? 1L : 0L;
+  case SGPropertyNode::INT:
+  case SGPropertyNode::LONG:
+    return e.value.long_val;
+  case SGPropertyNode::FLOAT:
+  case SGPropertyNode::DOUBLE:
+    return long(e.value.double_val);
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    return strtol(e.string_val.c_str(), 0, 0);
+  default:
+    return 0L;
+  }
+}
+
+
+double
+SGPropertySnapshot::getDoubleValue (int i) const
+{
+  const entry &e = _entries[i];
+  switch (e.type) {
+  case SGPropertyNode::BOOL:
+    return e.value.bool_val ? 1.0 : 0.0;
+  case SGPropertyNode::INT:
+  case SGPropertyNode::LONG:
+    return double(e.value.long_val);
+  case SGPropertyNode::FLOAT:
+  case SGPropertyNode::DOUBLE:
+    return e.value.double_val;
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    return strtod(e.string_val.c_str(), 0);
+  default:
+    return 0.0;
+  }
+}
+
+
+const char *
+SGPropertySnapshot::getStringValue (int i) const
+{
+  const entry &e = _entries[i];
+  switch (e.type) {
+  case SGPropertyNode::STRING:
+  case SGPropertyNode::UNSPECIFIED:
+    return e.string_val.c_str();
+  default:
+    return "";
+  }
+}
+
+
+bool
+SGPropertySnapshot::getBoolValue (const char * relative_path,
+				  bool defaultValue) const
+{
+  int i = find(relative_path);
+  return (i < 0 ? defaultValue : getBoolValue(i));
+}
+
+
+long
+SGPropertySnapshot::getLongValue (const char * relative_path,
+				  long defaultValue) const
+{
+  int i = find(relative_path);
+  return (i < 0 ? defaultValue : getLongValue(i));
+}
+
+
+double
+SGPropertySnapshot::getDoubleValue (const char * relative_path,
+				    double defaultValue) const
+{
+  int i = find(relative_path);
+  return (i < 0 ? defaultValue : getDoubleValue(i));
+}
+
+
+const char *
+SGPropertySnapshot::getStringValue (const char * relative_path,
+				    const char * defaultValue) const
+{
+  int i = find(relative_path);
+  return (i < 0 ? defaultValue : getStringValue(i));
+}
+
+// end of props_snapshot.cxx
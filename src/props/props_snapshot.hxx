@@ -0,0 +1,139 @@
+/**
+ * \file props_snapshot.hxx
+ * Consistent copies of a property subtree for reader threads.
+ *
+ * $Id$
+ */
+
+#ifndef __PROPS_SNAPSHOT_HXX
+#define __PROPS_SNAPSHOT_HXX
+
+#include "props/props.hxx"
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+/**
+ * A private copy of the values in a property subtree, taken from a
+ * thread other than the one that writes the tree.
+ *
+ * <p>The writer never waits for a snapshot.  take() copies the values
+ * and starts over if a write landed in the middle, so the copy always
+ * matches one instant of the writer's timeline; writes grouped with
+ * SGPropertyNode::beginUpdate() and endUpdate() are seen all together
+ * or not at all.  Nothing is locked: while take() runs, the writer
+ * only holds on to what it removes or replaces (nodes, strings, tie
+ * objects) instead of freeing it, and frees it at a later write.</p>
+ *
+ * <p>Tied values are read through their getters on the reader's
+ * thread, so they are only as consistent as the variables behind
+ * them.  Once taken, a snapshot touches nothing in the tree; the
+ * list of nodes is reused for the next take() unless the structure
+ * changed.</p>
+ *
+ * <pre>
+ * SGPropertySnapshot snap;
+ * if (snap.take(fgGetNode("/position")))
+ *   log(snap.getDoubleValue("altitude-ft"), snap.getDoubleValue("latitude-deg"));
+ * </pre>
+ */
+class SGPropertySnapshot
+{
+public:
+
+  SGPropertySnapshot ();
+
+
+  /**
+   * Copy the subtree under node.  Returns false if the writer kept
+   * interfering for max_tries attempts, and the copy is not to be used.
+   */
+  bool take (const SGPropertyNode * node, int max_tries = 1000);
+
+
+  /**
+   * Number of nodes copied, the root included.
+   */
+  int size () const { return _entries.size(); }
+
+
+  /**
+   * Path of a copied node relative to the snapshot root ("" for the
+   * root itself).
+   */
+  const char * getPath (int i) const { return _entries[i].path.c_str(); }
+
+
+  /**
+   * Type of a copied node; aliases report the type of their target.
+   */
+  SGPropertyNode::Type getType (int i) const { return _entries[i].type; }
+
+
+  /**
+   * Position of a node by relative path, or -1.
+   */
+  int find (const char * relative_path) const;
+
+
+  /**
+   * Copied values, converted as SGPropertyNode would convert them;
+   * only string nodes have a string value.
+   */
+  bool getBoolValue (int i) const;
+  long getLongValue (int i) const;
+  double getDoubleValue (int i) const;
+  const char * getStringValue (int i) const;
+
+  bool getBoolValue (const char * relative_path, bool defaultValue = false) const;
+  long getLongValue (const char * relative_path, long defaultValue = 0L) const;
+  double getDoubleValue (const char * relative_path,
+			 double defaultValue = 0.0) const;
+  const char * getStringValue (const char * relative_path,
+			       const char * defaultValue = "") const;
+
+
+  /**
+   * The writer's update sequence the copy matches.  Snapshots with
+   * the same sequence hold the same values.
+   */
+  unsigned int getSequence () const { return _sequence; }
+
+
+  /**
+   * Attempts the last take() discarded because of concurrent writes.
+   */
+  int getRetries () const { return _retries; }
+
+private:
+
+  struct entry {
+    const SGPropertyNode * node;
+    string path;
+    SGPropertyNode::Type type;
+    SGPropertyNode::value_copy value;
+    string string_val;
+  };
+
+  bool collect (const SGPropertyNode::tree_state * tree,
+		unsigned int sequence,
+		const SGPropertyNode * node, const string &path);
+  bool copy_values (const SGPropertyNode::tree_state * tree,
+		    unsigned int sequence);
+
+  const SGPropertyNode * _root;
+  unsigned int _generation;
+  unsigned int _sequence;
+  int _retries;
+  vector<entry> _entries;
+  vector<int> _by_path;		// entry positions sorted by path
+};
+
+
+#endif // __PROPS_SNAPSHOT_HXX
+
+// end of props_snapshot.hxx
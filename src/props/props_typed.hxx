@@ -0,0 +1,160 @@
+/**
+ * \file props_typed.hxx
+ * Typed property keys and handles.
+ *
+ * $Id$
+ */
+
+#ifndef __PROPS_TYPED_HXX
+#define __PROPS_TYPED_HXX
+
+#include "props/props.hxx"
+
+
+/**
+ * The path and value type of a property, known at compile time.
+ *
+ * <p>Keys are constants, normally declared once in a schema rather
+ * than spelled out where the property is used, so a misspelled key
+ * is a build error instead of a new, unused node.  The type is part
+ * of the key: binding a double handle to a bool key does not
+ * compile.</p>
+ *
+ * <pre>
+ * static const SGPropertyKey<double> TARGET_ALTITUDE_FT =
+ *   { "/autopilot/settings/target-altitude-ft" };
+ * </pre>
+ */
+template <class T>
+struct SGPropertyKey
+{
+  const char * path;
+};
+
+
+/**
+ * A node bound once to a typed key, with typed access to its value.
+ *
+ * <p>get() reads the node's own storage directly when the node holds
+ * an untied value of the handle's type with the default attributes,
+ * which is the usual case once the property has been written; anything
+ * else goes through the normal getter.  set() always goes through the
+ * normal setter, so listeners, snapshots and the write journal still
+ * see every change.  The handle holds a reference to its node.</p>
+ *
+ * <pre>
+ * static SGTypedProperty<double> target_alt;
+ * target_alt.bind(TARGET_ALTITUDE_FT);
+ * target_alt.set(target_alt.get() + 100.0);
+ * </pre>
+ */
+template <class T>
+class SGTypedProperty
+{
+public:
+
+  SGTypedProperty () {}
+
+
+  /**
+   * Resolve the key against the global root, creating the node.
+   */
+  void bind (const SGPropertyKey<T> &key) { _node = fgGetNode(key.path, true); }
+
+
+  /**
+   * Resolve the key against another root, creating the node.
+   */
+  void bind (SGPropertyNode * root, const SGPropertyKey<T> &key) {
+    _node = root->getNode(key.path, true);
+  }
+
+
+  /**
+   * Test whether bind() has been called.
+   */
+  bool isBound () const { return _node.ptr() != 0; }
+
+
+  /**
+   * The bound node, for anything the handle does not cover.
+   */
+  SGPropertyNode * node () const { return _node; }
+
+
+  /**
+   * Get and set the value.
+   */
+  T get () const;
+  bool set (T value);
+
+
+  /**
+   * Tie the bound node to an outside value.
+   */
+  bool tie (const SGRawValue<T> &rawValue, bool useDefault = true) {
+    return _node->tie(rawValue, useDefault);
+  }
+
+private:
+
+  SGPropertyNode_ptr _node;
+};
+
+
+				// The fast path mirrors the shortcut
+				// in SGPropertyNode's own getters.
+#define SG_TYPED_PROPERTY(T, TYPE, member, Name)			\
+template <> inline T							\
+SGTypedProperty<T>::get () const					\
+{									\
+  if (_node->_attr == (SGPropertyNode::READ|SGPropertyNode::WRITE)	\
+      && _node->_type == SGPropertyNode::TYPE && !_node->_tied)		\
+    return _node->_local_val.member;					\
+  return _node->get##Name##Value();					\
+}									\
+									\
+template <> inline bool							\
+SGTypedProperty<T>::set (T value)					\
+{									\
+  return _node->set##Name##Value(value);				\
+}
+
+SG_TYPED_PROPERTY(bool, BOOL, bool_val, Bool)
+SG_TYPED_PROPERTY(int, INT, int_val, Int)
+SG_TYPED_PROPERTY(long, LONG, long_val, Long)
+SG_TYPED_PROPERTY(float, FLOAT, float_val, Float)
+SG_TYPED_PROPERTY(double, DOUBLE, double_val, Double)
+
+#undef SG_TYPED_PROPERTY
+
+template <> inline const char *
+SGTypedProperty<const char *>::get () const
+{
+  return _node->getStringValue();
+}
+
+template <> inline bool
+SGTypedProperty<const char *>::set (const char * value)
+{
+  return _node->setStringValue(value);
+}
+
+
+
+/**
+ * Tie the node a key names, under the global root, to an outside
+ * value of the key's type.
+ */
+template <class T>
+inline bool
+fgTie (const SGPropertyKey<T> &key, const SGRawValue<T> &rawValue,
+       bool useDefault = true)
+{
+  return fgGetNode(key.path, true)->tie(rawValue, useDefault);
+}
+
+
+#endif // __PROPS_TYPED_HXX
+
+// end of props_typed.hxx
@@ -21,6 +21,8 @@
 #ifndef SGReferenced_HXX
 #define SGReferenced_HXX
 
+#include "sg_atomic.hxx"
+
 /// Base class for all reference counted SimGear objects
 /// Classes derived from this one are meant to be managed with
 /// the SGSharedPtr class.
@@ -37,17 +39,19 @@ public:
   SGReferenced& operator=(const SGReferenced&)
   { return *this; }
 
+  /// Counts are atomic so that references may be taken and dropped
+  /// on more than one thread.
   static unsigned get(const SGReferenced* ref)
-  { if (ref) return ++(ref->_refcount); else return ~0u; }
+  { if (ref) return ref->_refcount.fetch_add(1u) + 1u; else return ~0u; }
   static unsigned put(const SGReferenced* ref)
-  { if (ref) return --(ref->_refcount); else return ~0u; }
+  { if (ref) return ref->_refcount.fetch_sub(1u) - 1u; else return ~0u; }
   static unsigned count(const SGReferenced* ref)
-  { if (ref) return ref->_refcount; else return ~0u; }
+  { if (ref) return ref->_refcount.load(SG_RELAXED); else return ~0u; }
   static bool shared(const SGReferenced* ref)
-  { if (ref) return 1u < ref->_refcount; else return false; }
+  { if (ref) return 1u < ref->_refcount.load(SG_RELAXED); else return false; }
 
 private:
-  mutable unsigned _refcount;
+  mutable SGAtomic<unsigned> _refcount;
 };
 
 #endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+
+#include "latency.h"
+
+
+static const char *stage_names[LAT_NUM_STAGES] = {
+  "serial", "decode", "ahrs", "control", "servo"
+};
+
+
+mylatency::mylatency() {
+  reset();
+}
+
+mylatency::~mylatency() {
+}
+
+void mylatency::reset() {
+  memset( stamp, 0, sizeof(stamp) );
+  memset( valid, 0, sizeof(valid) );
+  memset( hist, 0, sizeof(hist) );
+}
+
+void mylatency::mark( latency_stage stage ) {
+  double now = get_Time();
+
+  if ( stage == LAT_SERIAL ) {
+    // start of a new frame
+    memset( valid, 0, sizeof(valid) );
+  } else if ( !valid[LAT_SERIAL] ) {
+    return;
+  }
+
+  stamp[stage] = now;
+  valid[stage] = true;
+
+  if ( stage != LAT_SERVO ) {
+    return;
+  }
+
+  // frame complete, bin each stage relative to serial receipt
+  int i;
+  for ( i = LAT_DECODE; i < LAT_NUM_STAGES; ++i ) {
+    if ( !valid[i] ) {
+      continue;
+    }
+    double dt = stamp[i] - stamp[LAT_SERIAL];
+    histogram &h = hist[i];
+    h.count++;
+    h.total += dt;
+    if ( dt > h.max ) {
+      h.max = dt;
+    }
+    int bin = (int)(dt * 1000000.0 / LATENCY_BIN_USEC);
+    if ( bin < 0 ) {
+      bin = 0;
+    } else if ( bin > LATENCY_BINS ) {
+      bin = LATENCY_BINS;
+    }
+    h.bins[bin]++;
+  }
+  valid[LAT_SERIAL] = false;
+}
+
+// upper edge of the bin holding the p'th fraction of samples
+double mylatency::percentile( const histogram &h, double p ) const {
+  int target = (int)(p * h.count + 0.5);
+  int sum = 0;
+  int i;
+  for ( i = 0; i <= LATENCY_BINS; ++i ) {
+    sum += h.bins[i];
+    if ( sum >= target ) {
+      break;
+    }
+  }
+  if ( i >= LATENCY_BINS ) {
+    return h.max;
+  }
+  return (i + 1) * LATENCY_BIN_USEC / 1000000.0;
+}
+
+void mylatency::stats( const char *header ) {
+  int i;
+  for ( i = LAT_DECODE; i < LAT_NUM_STAGES; ++i ) {
+    const histogram &h = hist[i];
+    if ( h.count == 0 ) {
+      continue;
+    }
+    printf("%s %-7s: avg = %.4f  p50 = %.4f  p99 = %.4f  max = %.4f  count = %d\n",
+	   header, stage_names[i], h.total / (double)h.count,
+	   percentile( h, 0.50 ), percentile( h, 0.99 ), h.max, h.count );
+  }
+}
+
+
+// global latency tracker for the sensor to servo path
+mylatency servo_latency;
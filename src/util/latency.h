@@ -0,0 +1,55 @@
+#ifndef _UGEAR_LATENCY_H
+#define _UGEAR_LATENCY_H
+
+
+// Sensor to servo latency tracking.  Each frame is stamped at the
+// stages below; when the servo command goes out the elapsed time
+// since serial receipt of every stage is added to a histogram.
+// Frames that don't end in a servo write are discarded.
+
+enum latency_stage {
+    LAT_SERIAL = 0,             // sensor packet fully received
+    LAT_DECODE,                 // packet decoded
+    LAT_AHRS,                   // attitude estimate done
+    LAT_CONTROL,                // autopilot and mixing done
+    LAT_SERVO,                  // servo command written
+    LAT_NUM_STAGES
+};
+
+#define LATENCY_BIN_USEC   100  // histogram resolution
+#define LATENCY_BINS       400  // 40ms of range, plus an overflow bin
+
+
+class mylatency {
+
+ private:
+
+  struct histogram {
+    int count;
+    double total;
+    double max;
+    int bins[LATENCY_BINS + 1];
+  };
+
+  double stamp[LAT_NUM_STAGES];
+  bool valid[LAT_NUM_STAGES];
+  histogram hist[LAT_NUM_STAGES];
+
+  double percentile( const histogram &h, double p ) const;
+
+ public:
+
+  mylatency();
+  ~mylatency();
+
+  void mark( latency_stage stage );
+  void reset();
+  void stats( const char *header );
+};
+
+
+// global latency tracker for the sensor to servo path
+extern mylatency servo_latency;
+
+
+#endif // _UGEAR_LATENCY_H
@@ -0,0 +1,197 @@
+/**
+ * \file sg_atomic.hxx
+ * The atomic operations the threads share memory through.
+ *
+ * Every access one thread makes to a value another thread changes
+ * goes through these, so the code stays C++98 and has one place to
+ * port.  GCC 4.7 and later (and clang) have the __atomic builtins,
+ * which take the memory order; GCC 4.1 to 4.6 only have the __sync
+ * builtins, so there every order is a full barrier.
+ *
+ * sg_load() and friends work on plain fields (of any type of 1, 2, 4
+ * or 8 bytes), for structures that must stay aggregates or that are
+ * shared with C; SGAtomic wraps a value that is only ever accessed
+ * atomically.
+ */
+
+#ifndef _SG_ATOMIC_HXX
+#define _SG_ATOMIC_HXX
+
+
+#if defined(__ATOMIC_RELAXED)
+
+#define SG_RELAXED __ATOMIC_RELAXED
+#define SG_ACQUIRE __ATOMIC_ACQUIRE
+#define SG_RELEASE __ATOMIC_RELEASE
+#define SG_ACQ_REL __ATOMIC_ACQ_REL
+#define SG_SEQ_CST __ATOMIC_SEQ_CST
+
+template <class T>
+inline T
+sg_load (const T * p, int order = SG_SEQ_CST)
+{
+  T value;
+  __atomic_load(p, &value, order);
+  return value;
+}
+
+template <class T>
+inline void
+sg_store (T * p, T value, int order = SG_SEQ_CST)
+{
+  __atomic_store(p, &value, order);
+}
+
+template <class T>
+inline T
+sg_exchange (T * p, T value, int order = SG_SEQ_CST)
+{
+  T old;
+  __atomic_exchange(p, &value, &old, order);
+  return old;
+}
+
+/**
+ * Replace *p with desired if it holds expected, else load it into
+ * expected.  Returns true if *p was replaced.
+ */
+template <class T>
+inline bool
+sg_compare_exchange (T * p, T &expected, T desired, int order = SG_SEQ_CST)
+{
+				// A failure only loads, so it takes
+				// the acquire part of the order.
+  int failure = (order == SG_ACQ_REL ? SG_ACQUIRE
+		 : order == SG_RELEASE ? SG_RELAXED : order);
+  return __atomic_compare_exchange(p, &expected, &desired, false,
+				   order, failure);
+}
+
+template <class T>
+inline T
+sg_fetch_add (T * p, T value, int order = SG_SEQ_CST)
+{
+  return __atomic_fetch_add(p, value, order);
+}
+
+template <class T>
+inline T
+sg_fetch_sub (T * p, T value, int order = SG_SEQ_CST)
+{
+  return __atomic_fetch_sub(p, value, order);
+}
+
+inline void
+sg_fence (int order = SG_SEQ_CST)
+{
+  __atomic_thread_fence(order);
+}
+
+#elif defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+
+#define SG_RELAXED 0
+#define SG_ACQUIRE 2
+#define SG_RELEASE 3
+#define SG_ACQ_REL 4
+#define SG_SEQ_CST 5
+
+template <class T>
+inline T
+sg_load (const T * p, int = SG_SEQ_CST)
+{
+  T value = *(const volatile T *)p;
+  __sync_synchronize();
+  return value;
+}
+
+template <class T>
+inline void
+sg_store (T * p, T value, int = SG_SEQ_CST)
+{
+  __sync_synchronize();
+  *(volatile T *)p = value;
+  __sync_synchronize();
+}
+
+template <class T>
+inline bool
+sg_compare_exchange (T * p, T &expected, T desired, int = SG_SEQ_CST)
+{
+  T old = __sync_val_compare_and_swap(p, expected, desired);
+  if (old == expected)
+    return true;
+  expected = old;
+  return false;
+}
+
+template <class T>
+inline T
+sg_exchange (T * p, T value, int = SG_SEQ_CST)
+{
+  T old = sg_load(p);
+  while (!sg_compare_exchange(p, old, value))
+    ;
+  return old;
+}
+
+template <class T>
+inline T
+sg_fetch_add (T * p, T value, int = SG_SEQ_CST)
+{
+  return __sync_fetch_and_add(p, value);
+}
+
+template <class T>
+inline T
+sg_fetch_sub (T * p, T value, int = SG_SEQ_CST)
+{
+  return __sync_fetch_and_sub(p, value);
+}
+
+inline void
+sg_fence (int = SG_SEQ_CST)
+{
+  __sync_synchronize();
+}
+
+#else
+#error "sg_atomic.hxx needs GCC 4.1 or later for its atomic builtins"
+#endif
+
+
+/**
+ * A value shared between threads.  Not copyable: copy the value.
+ */
+template <class T>
+class SGAtomic
+{
+public:
+
+  SGAtomic (T value = T()) : _value(value) {}
+
+  T load (int order = SG_SEQ_CST) const { return sg_load(&_value, order); }
+  void store (T value, int order = SG_SEQ_CST)
+  { sg_store(&_value, value, order); }
+
+  T exchange (T value, int order = SG_SEQ_CST)
+  { return sg_exchange(&_value, value, order); }
+  bool compare_exchange (T &expected, T desired, int order = SG_SEQ_CST)
+  { return sg_compare_exchange(&_value, expected, desired, order); }
+  T fetch_add (T value, int order = SG_SEQ_CST)
+  { return sg_fetch_add(&_value, value, order); }
+  T fetch_sub (T value, int order = SG_SEQ_CST)
+  { return sg_fetch_sub(&_value, value, order); }
+
+  operator T () const { return load(); }
+  SGAtomic & operator= (T value) { store(value); return *this; }
+
+private:
+
+  SGAtomic (const SGAtomic &);
+  SGAtomic & operator= (const SGAtomic &);
+
+  T _value;
+};
+
+
+#endif // _SG_ATOMIC_HXX